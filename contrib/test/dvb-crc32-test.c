@@ -0,0 +1,185 @@
+/*
+ *  dvb-crc32-test: check and measure the speed of libdvbv5's dvb_crc32()
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  dvb_crc32() is first checked against known test vectors, then against
+ *  a bit at a time implementation, for every length up to a few kilobytes,
+ *  at every alignment, and with random initial values. Then, the speed of
+ *  dvb_crc32() is compared to the classic byte at a time table loop, for
+ *  a few buffer sizes.
+ *
+ *  Setting LIBDVBV5_NO_SIMD in the environment checks and benchmarks the
+ *  table based code only.
+ *
+ *  To execute:
+ *             ./dvb-crc32-test [seconds]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libdvbv5/crc32.h>
+
+#define POLY		0x04c11db7
+#define MAX_LEN		4096
+
+static uint32_t crc32_bitwise(const uint8_t *data, size_t len, uint32_t crc)
+{
+	int i;
+
+	while (len--) {
+		crc ^= (uint32_t)*data++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^ ((crc & 0x80000000) ? POLY : 0);
+	}
+	return crc;
+}
+
+static uint32_t bytetab[256];
+
+static uint32_t crc32_bytewise(const uint8_t *data, size_t len, uint32_t crc)
+{
+	while (len--)
+		crc = (crc << 8) ^ bytetab[((crc >> 24) ^ *data++) & 0xff];
+	return crc;
+}
+
+static const struct {
+	const char *data;
+	uint32_t crc;
+} vectors[] = {
+	{ "", 0xffffffff },
+	{ "a", 0xe66c6494 },
+	{ "123456789", 0x0376e6e7 },
+	{ "The quick brown fox jumps over the lazy dog", 0xba62119e },
+	{ "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+	  0x73d5566f },
+};
+
+static int check(uint8_t *buf)
+{
+	unsigned i, len, off, errors = 0;
+	uint32_t init, crc, ref;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		len = strlen(vectors[i].data);
+		memcpy(buf, vectors[i].data, len);
+		crc = dvb_crc32(buf, len, 0xffffffff);
+		ref = crc32_bitwise(buf, len, 0xffffffff);
+		if (crc != vectors[i].crc || ref != vectors[i].crc) {
+			fprintf(stderr, "vector %u: got 0x%08x, expected 0x%08x\n",
+				i, crc, vectors[i].crc);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < MAX_LEN + 64; i++)
+		buf[i] = rand();
+
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len <= MAX_LEN; len++) {
+			init = off ? (uint32_t)rand() << 1 ^ rand() : 0xffffffff;
+			crc = dvb_crc32(buf + off, len, init);
+			ref = crc32_bitwise(buf + off, len, init);
+			if (crc != ref) {
+				if (errors++ < 10)
+					fprintf(stderr,
+						"len %u, offset %u, init 0x%08x: got 0x%08x, expected 0x%08x\n",
+						len, off, init, crc, ref);
+			}
+		}
+	}
+
+	/* A section, with its crc appended, always gives a zero crc */
+	for (len = 4; len <= MAX_LEN; len += 61) {
+		crc = dvb_crc32(buf, len - 4, 0xffffffff);
+		buf[len - 4] = crc >> 24;
+		buf[len - 3] = crc >> 16;
+		buf[len - 2] = crc >> 8;
+		buf[len - 1] = crc;
+		if (dvb_crc32(buf, len, 0xffffffff)) {
+			fprintf(stderr, "len %u: crc of a valid section isn't zero\n",
+				len);
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench(uint8_t *buf, size_t len, double seconds, int bytewise)
+{
+	volatile uint32_t sink = 0;
+	unsigned long n = 0, i;
+	double start = now(), elapsed;
+
+	do {
+		for (i = 0; i < 1000; i++) {
+			if (bytewise)
+				sink ^= crc32_bytewise(buf, len, 0xffffffff);
+			else
+				sink ^= dvb_crc32(buf, len, 0xffffffff);
+		}
+		n += i;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	return (double)n * len / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 16, 188, 1024, 4096, 65536 };
+	double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+	uint8_t *buf;
+	unsigned i;
+	int errors;
+
+	for (i = 0; i < 256; i++)
+		bytetab[i] = crc32_bitwise((uint8_t[]){ i }, 1, 0);
+
+	buf = malloc(65536 + 64);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+
+	errors = check(buf);
+	printf("check: %s\n", errors ? "FAILED" : "ok");
+	if (errors) {
+		free(buf);
+		return 1;
+	}
+
+	for (i = 0; i < 65536; i++)
+		buf[i] = rand();
+
+	printf("%8s %14s %14s\n", "size", "bytewise MB/s", "dvb_crc32 MB/s");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		printf("%8zu %14.1f %14.1f\n", sizes[i],
+		       bench(buf, sizes[i], seconds, 1),
+		       bench(buf, sizes[i], seconds, 0));
+
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,399 @@
+/*
+ *  dvb-eit-bench: measure the cost of parsing EIT tables with libdvbv5
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  The EIT sections are either extracted from a recorded transport stream,
+ *  with the software demux, or synthesized: a day of schedule for a few
+ *  services, with short and extended event descriptors. All sections are
+ *  then parsed several times with dvb_table_eit_init(), freeing the tables
+ *  either one by one, with dvb_table_eit_free(), or all at once, with a
+ *  table arena. Then, the sections are fed to an EPG cache, which only
+ *  parses them the first time. The time and the number of allocations per
+ *  round are reported for each case. The allocations are counted on glibc
+ *  systems only.
+ *
+ *  To execute:
+ *             ./dvb-eit-bench [-r rounds] [file.ts]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-sw-demux.h>
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-table-arena.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/eit.h>
+
+#ifdef __GLIBC__
+/* Count the allocations, by wrapping the allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+
+void *malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#else
+static unsigned long alloc_count;
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+#define EIT_PID			0x12
+#define SYNTH_SERVICES		64
+#define SYNTH_EVENTS		48	/* a day of 30 minutes events */
+#define SYNTH_EVENTS_PER_SECTION	8
+
+struct section {
+	uint8_t *data;
+	size_t len;
+};
+
+static struct section *sections;
+static unsigned num_sections;
+
+static void add_section(const uint8_t *data, size_t len)
+{
+	struct section *s;
+
+	s = realloc(sections, (num_sections + 1) * sizeof(*s));
+	if (!s)
+		return;
+	sections = s;
+	s += num_sections;
+	s->data = malloc(len);
+	if (!s->data)
+		return;
+	memcpy(s->data, data, len);
+	s->len = len;
+	num_sections++;
+}
+
+static void eit_cb(void *priv, const struct dvb_sw_demux_data *data,
+		   unsigned num)
+{
+	unsigned i;
+
+	for (i = 0; i < num; i++) {
+		uint8_t tid = data[i].data[0];
+
+		if (tid >= DVB_TABLE_EIT && tid <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f)
+			add_section(data[i].data, data[i].len);
+	}
+}
+
+static int read_ts(struct dvb_v5_fe_parms *parms, const char *fname)
+{
+	struct dvb_sw_demux *dmx;
+	ssize_t ret;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror(fname);
+		return -1;
+	}
+	dmx = dvb_sw_demux_alloc(parms);
+	if (!dmx || !dvb_sw_demux_add_section_filter(dmx, EIT_PID, 0, 0,
+						     eit_cb, NULL)) {
+		fprintf(stderr, "can't create the demux\n");
+		close(fd);
+		return -1;
+	}
+	do {
+		ret = dvb_sw_demux_read(dmx, fd);
+	} while (ret > 0);
+	dvb_sw_demux_free(dmx);
+	close(fd);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static uint8_t *put_text(uint8_t *p, const char *text)
+{
+	*p = strlen(text);
+	memcpy(p + 1, text, *p);
+	return p + 1 + *p;
+}
+
+static uint8_t *put_event(uint8_t *p, unsigned svc, unsigned event)
+{
+	uint8_t *desc;
+	char name[64];
+	unsigned len;
+
+	p[0] = event >> 8;
+	p[1] = event;
+	/* MJD 59000, 30 minutes events, as BCD */
+	p[2] = 59000 >> 8;
+	p[3] = 59000 & 0xff;
+	p[4] = ((event / 2) / 10) << 4 | (event / 2) % 10;
+	p[5] = (event & 1) ? 0x30 : 0x00;
+	p[6] = 0x00;
+	p[7] = 0x00;
+	p[8] = 0x30;
+	p[9] = 0x00;
+	desc = p + 12;
+
+	/* short event descriptor */
+	snprintf(name, sizeof(name), "Programme %u of service %u", event, svc);
+	desc[0] = 0x4d;
+	memcpy(desc + 2, "eng", 3);
+	len = put_text(put_text(desc + 5, name),
+		       "What is on, long enough to look like a real schedule.") - desc;
+	desc[1] = len - 2;
+	desc += len;
+
+	/* extended event descriptor, without items */
+	desc[0] = 0x4e;
+	desc[2] = 0x00;
+	memcpy(desc + 3, "eng", 3);
+	desc[6] = 0;
+	len = put_text(desc + 7, "More about the programme, its cast and director.") - desc;
+	desc[1] = len - 2;
+	desc += len;
+
+	/* content and parental rating descriptors */
+	memcpy(desc, "\x54\x02\x10\x00\x55\x04GBR\x08", 10);
+	desc += 10;
+
+	len = desc - (p + 12);
+	p[10] = 0xf0 | len >> 8;
+	p[11] = len;
+
+	return desc;
+}
+
+static void synth_sections(void)
+{
+	unsigned svc, section, last_section, event, len;
+	uint8_t buf[4096], *p;
+	uint32_t crc;
+
+	last_section = (SYNTH_EVENTS - 1) / SYNTH_EVENTS_PER_SECTION;
+	for (svc = 0; svc < SYNTH_SERVICES; svc++) {
+		for (section = 0; section <= last_section; section++) {
+			p = buf + 14;
+			for (event = section * SYNTH_EVENTS_PER_SECTION;
+			     event < (section + 1) * SYNTH_EVENTS_PER_SECTION &&
+			     event < SYNTH_EVENTS; event++)
+				p = put_event(p, svc, event);
+
+			len = p - buf + 4;
+			buf[0] = DVB_TABLE_EIT_SCHEDULE;
+			buf[1] = 0xf0 | (len - 3) >> 8;
+			buf[2] = len - 3;
+			buf[3] = (0x100 + svc) >> 8;
+			buf[4] = 0x100 + svc;
+			buf[5] = 0xc1;
+			buf[6] = section;
+			buf[7] = last_section;
+			buf[8] = 0x00;	/* transport stream ID */
+			buf[9] = 0x01;
+			buf[10] = 0x20;	/* original network ID */
+			buf[11] = 0x33;
+			buf[12] = last_section;
+			buf[13] = DVB_TABLE_EIT_SCHEDULE;
+			crc = dvb_crc32(buf, len - 4, 0xFFFFFFFF);
+			p[0] = crc >> 24;
+			p[1] = crc >> 16;
+			p[2] = crc >> 8;
+			p[3] = crc;
+			add_section(buf, len);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long parse_all(struct dvb_v5_fe_parms *parms,
+			       struct dvb_table_eit **tables)
+{
+	unsigned long events = 0;
+	unsigned i;
+
+	for (i = 0; i < num_sections; i++) {
+		tables[i] = NULL;
+		/* Just like dvb_read_sections(), the CRC isn't passed */
+		if (dvb_table_eit_init(parms, sections[i].data,
+				       sections[i].len - DVB_CRC_SIZE,
+				       &tables[i]) < 0)
+			continue;
+		dvb_eit_event_foreach(event, tables[i])
+			events++;
+	}
+	return events;
+}
+
+static void bench(struct dvb_v5_fe_parms *parms, struct dvb_table_eit **tables,
+		  unsigned rounds, int use_arena)
+{
+	struct dvb_table_arena *arena = NULL;
+	unsigned long allocs, events = 0;
+	double start, elapsed;
+	unsigned r, i;
+
+	if (use_arena) {
+		arena = dvb_table_arena_alloc(0);
+		if (!arena) {
+			fprintf(stderr, "can't allocate the arena\n");
+			return;
+		}
+	}
+
+	allocs = alloc_count;
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		if (arena)
+			dvb_table_arena_set(parms, arena);
+		events = parse_all(parms, tables);
+		if (arena) {
+			dvb_table_arena_set(parms, NULL);
+			dvb_table_arena_reset(arena);
+		} else {
+			for (i = 0; i < num_sections; i++)
+				if (tables[i])
+					dvb_table_eit_free(tables[i]);
+		}
+	}
+	elapsed = now() - start;
+	allocs = alloc_count - allocs;
+
+	printf("%-10s %8lu events %10.3f ms/round", use_arena ? "arena" : "malloc",
+	       events, elapsed * 1000 / rounds);
+	if (HAVE_ALLOC_COUNT)
+		printf(" %10lu allocs/round", allocs / rounds);
+	printf("\n");
+
+	dvb_table_arena_free(arena);
+}
+
+static void bench_epg(struct dvb_v5_fe_parms *parms, unsigned rounds)
+{
+	unsigned long allocs, parsed = 0;
+	struct dvb_epg *epg;
+	double start, elapsed;
+	unsigned r, i;
+
+	epg = dvb_epg_alloc(parms, NULL);
+	if (!epg) {
+		fprintf(stderr, "can't allocate the EPG cache\n");
+		return;
+	}
+
+	/* The first round fills the cache, the others find it up to date */
+	for (i = 0; i < num_sections; i++)
+		dvb_epg_add_section(epg, sections[i].data, sections[i].len);
+
+	allocs = alloc_count;
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < num_sections; i++)
+			if (dvb_epg_add_section(epg, sections[i].data,
+						sections[i].len) > 0)
+				parsed++;
+	}
+	elapsed = now() - start;
+	allocs = alloc_count - allocs;
+
+	printf("%-10s %8lu parsed %10.3f ms/round", "epg cache",
+	       parsed / rounds, elapsed * 1000 / rounds);
+	if (HAVE_ALLOC_COUNT)
+		printf(" %10lu allocs/round", allocs / rounds);
+	printf("\n");
+
+	dvb_epg_free(epg);
+}
+
+int main(int argc, char **argv)
+{
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_table_eit **tables;
+	unsigned rounds = 20, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r rounds] [file.ts]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!rounds)
+		rounds = 1;
+
+	parms = dvb_fe_dummy();
+	if (!parms)
+		return 1;
+
+	if (optind < argc) {
+		if (read_ts(parms, argv[optind]) < 0)
+			return 1;
+	} else {
+		synth_sections();
+	}
+	if (!num_sections) {
+		fprintf(stderr, "no EIT sections found\n");
+		return 1;
+	}
+
+	tables = calloc(num_sections, sizeof(*tables));
+	if (!tables)
+		return 1;
+
+	printf("%u EIT sections, %u rounds\n", num_sections, rounds);
+	bench(parms, tables, rounds, 0);
+	bench(parms, tables, rounds, 1);
+	bench_epg(parms, rounds);
+
+	for (i = 0; i < num_sections; i++)
+		free(sections[i].data);
+	free(sections);
+	free(tables);
+	dvb_fe_close(parms);
+
+	return 0;
+}
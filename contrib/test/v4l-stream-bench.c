@@ -0,0 +1,317 @@
+/*
+ *  v4l-stream-bench: measure the speed of the v4l-stream run-length encoder
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  No device is needed, frames are generated with the test pattern
+ *  generator for a few pixel formats and patterns. Each frame is run-length
+ *  encoded with rle_compress(), as v4l2-ctl --stream-to-host does, and
+ *  decoded again with rle_decompress(). The throughput of both is reported
+ *  next to the one of a copy of the original word by word encoder and
+ *  decoder, and the encoded frames are checked to be identical to the ones
+ *  of the original encoder, so that the wire format is known to be kept.
+ *
+ *  To execute:
+ *             ./v4l-stream-bench [-r rounds] [-s WxH]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "v4l-stream.h"
+#include "v4l2-tpg.h"
+
+static const struct {
+	__u32 fourcc;
+	const char *name;
+} formats[] = {
+	{ V4L2_PIX_FMT_YUYV, "YUYV" },
+	{ V4L2_PIX_FMT_RGB24, "RGB3" },
+	{ V4L2_PIX_FMT_NV12, "NV12" },
+};
+
+static const enum tpg_pattern patterns[] = {
+	TPG_PAT_75_COLORBAR,
+	TPG_PAT_100_COLORSQUARES,
+	TPG_PAT_BLACK,
+	TPG_PAT_CHECKERS_16X16,
+	TPG_PAT_CHECKERS_1X1,
+	TPG_PAT_GRAY_RAMP,
+	TPG_PAT_NOISE,
+};
+
+/* The word by word encoder and decoder, as they were before using SIMD */
+static unsigned ref_rle_compress(__u8 *b, unsigned size, unsigned bpl)
+{
+	__u32 magic_x = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_X_RLE);
+	__u32 magic_y = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_Y_RLE);
+	__u32 magic_r = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_RPLC);
+	__u32 *p = (__u32 *)b;
+	__u32 *dst = p;
+	unsigned i;
+
+	if (((unsigned long)b & 3) || (size & 3))
+		return size;
+
+	if (bpl & 3)
+		bpl = 0;
+	if (bpl == 0)
+		magic_y = magic_x;
+
+	for (i = 0; i < size; i += 4, p++) {
+		unsigned n, max;
+
+		if (bpl && i % bpl == 0) {
+			unsigned l = 0;
+
+			while (i + (l + 2) * bpl <= size &&
+			       !memcmp(p, p + (l + 1) * (bpl / 4), bpl))
+				l++;
+			if (l) {
+				*dst++ = magic_y;
+				*dst++ = htonl(l);
+				i += l * bpl - 4;
+				p += (l * bpl / 4) - 1;
+				continue;
+			}
+		}
+		if (*p == magic_x || *p == magic_y) {
+			*dst++ = magic_r;
+			continue;
+		}
+		max = bpl ? bpl * (i / bpl + 1) : size;
+		if (i >= max - 16) {
+			*dst++ = *p;
+			continue;
+		}
+		if (*p != p[1] || *p != p[2] || *p != p[3]) {
+			*dst++ = *p;
+			continue;
+		}
+		n = 4;
+
+		while (i + n * 4 < max && *p == p[n])
+			n++;
+		*dst++ = magic_x;
+		*dst++ = p[1];
+		*dst++ = htonl(n);
+		p += n - 1;
+		i += n * 4 - 4;
+	}
+	return (__u8 *)dst - b;
+}
+
+static void ref_rle_decompress(__u8 *b, unsigned size, unsigned rle_size,
+			       unsigned bpl)
+{
+	__u32 magic_x = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_X_RLE);
+	__u32 magic_y = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_Y_RLE);
+	unsigned offset = size - rle_size;
+	__u32 *dst = (__u32 *)b;
+	__u32 *p = (__u32 *)(b + offset);
+	__u32 *next_line = NULL;
+	unsigned l = 0;
+	unsigned i;
+
+	if (size == rle_size)
+		return;
+
+	if (bpl & 3)
+		bpl = 0;
+	if (bpl == 0)
+		magic_y = magic_x;
+
+	for (i = 0; i < rle_size; i += 4, p++) {
+		__u32 v = *p;
+		__u32 n = 1;
+
+		if (bpl && v == magic_y) {
+			l = ntohl(*++p);
+			i += 4;
+			next_line = dst + bpl / 4;
+			continue;
+		}
+		if (v == magic_x) {
+			v = *++p;
+			n = ntohl(*++p);
+			i += 8;
+		}
+
+		while (n--)
+			*dst++ = v;
+
+		if (dst == next_line) {
+			while (l--) {
+				memcpy(dst, dst - bpl / 4, bpl);
+				dst += bpl / 4;
+			}
+			next_line = NULL;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct timing {
+	double enc, dec;
+	unsigned rle_size;
+};
+
+/*
+ * Encode and decode the frame in work for the given number of rounds, after
+ * a first untimed one, returning -1 if the decoded frame differs from the
+ * original one.
+ */
+static int run(const __u8 *frame, __u8 *work, unsigned size, unsigned bpl,
+	       unsigned rounds, int ref, struct timing *t)
+{
+	unsigned r;
+
+	t->enc = t->dec = 0;
+	for (r = 0; r <= rounds; r++) {
+		double start, enc;
+
+		memcpy(work, frame, size);
+		start = now();
+		t->rle_size = ref ? ref_rle_compress(work, size, bpl) :
+				    rle_compress(work, size, bpl);
+		enc = now() - start;
+
+		memmove(work + size - t->rle_size, work, t->rle_size);
+		start = now();
+		if (ref)
+			ref_rle_decompress(work, size, t->rle_size, bpl);
+		else
+			rle_decompress(work, size, t->rle_size, bpl);
+		if (r) {
+			t->enc += enc;
+			t->dec += now() - start;
+		}
+		if (memcmp(work, frame, size))
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned width = 1920, height = 1080;
+	unsigned rounds = 20;
+	struct tpg_data tpg;
+	int errors = 0;
+	unsigned f, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &width, &height) == 2 &&
+			    width >= 16 && height >= 16 &&
+			    !(width & 1) && !(height & 1))
+				break;
+			/* fall through */
+		default:
+			fprintf(stderr, "usage: %s [-r rounds] [-s WxH]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!rounds)
+		rounds = 1;
+
+	tpg_init(&tpg, width, height);
+	if (tpg_alloc(&tpg, width)) {
+		fprintf(stderr, "can't allocate the test pattern generator\n");
+		return 1;
+	}
+
+	printf("%ux%u, %u rounds, MB/s of raw frame data\n", width, height, rounds);
+	printf("%-6s %-24s %7s %10s %10s %10s %10s\n", "format", "pattern",
+	       "ratio", "enc", "enc (ref)", "dec", "dec (ref)");
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		unsigned bpl, size, rle_bpl;
+		__u8 *frame, *work, *ref_work;
+
+		if (!tpg_s_fourcc(&tpg, formats[f].fourcc))
+			continue;
+		tpg_reset_source(&tpg, width, height, V4L2_FIELD_NONE);
+		tpg_s_colorspace(&tpg, V4L2_COLORSPACE_REC709);
+		bpl = width * tpg.twopixelsize[0] / 2;
+		tpg_s_bytesperline(&tpg, 0, bpl);
+		size = tpg_calc_line_width(&tpg, 0, bpl) * height;
+		rle_bpl = rle_calc_bpl(bpl, formats[f].fourcc);
+
+		frame = malloc(size);
+		work = malloc(size);
+		ref_work = malloc(size);
+		if (!frame || !work || !ref_work) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+			struct timing t, ref;
+			double mb = (double)size * rounds / 1e6;
+
+			tpg_s_pattern(&tpg, patterns[i]);
+			tpg_fillbuffer(&tpg, 0, 0, frame);
+
+			if (run(frame, work, size, rle_bpl, rounds, 0, &t) ||
+			    run(frame, ref_work, size, rle_bpl, rounds, 1, &ref)) {
+				printf("%-6s %-24s decoded frame differs\n",
+				       formats[f].name, tpg_pattern_strings[patterns[i]]);
+				errors++;
+				continue;
+			}
+
+			/* Compare the wire format with the one of the reference */
+			memcpy(work, frame, size);
+			memcpy(ref_work, frame, size);
+			if (rle_compress(work, size, rle_bpl) !=
+			    ref_rle_compress(ref_work, size, rle_bpl) ||
+			    memcmp(work, ref_work, t.rle_size)) {
+				printf("%-6s %-24s encoded frame differs\n",
+				       formats[f].name, tpg_pattern_strings[patterns[i]]);
+				errors++;
+				continue;
+			}
+
+			printf("%-6s %-24s %6.1f%% %10.0f %10.0f",
+			       formats[f].name, tpg_pattern_strings[patterns[i]],
+			       100.0 * t.rle_size / size, mb / t.enc, mb / ref.enc);
+			/* Frames which can't be shrunk are sent as they are */
+			if (t.rle_size == size)
+				printf(" %10s %10s\n", "-", "-");
+			else
+				printf(" %10.0f %10.0f\n", mb / t.dec, mb / ref.dec);
+		}
+		free(frame);
+		free(work);
+		free(ref_work);
+	}
+	tpg_free(&tpg);
+	return errors ? 1 : 0;
+}
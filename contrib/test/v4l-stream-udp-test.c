@@ -0,0 +1,407 @@
+/*
+ *  v4l-stream-udp-test: check the UDP transport of the v4l-stream protocol
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  Only the loopback interface is used. A sender streams synthetic FWHT
+ *  frames to a receiver through a relay, which drops some of the datagrams,
+ *  and passes the reports of the receiver back to the sender. The frames
+ *  must arrive intact, P-frames must only be passed on after the frame
+ *  they depend on, and the receiver must get an I-frame soon after a loss,
+ *  by requesting it. Then, two receivers join a multicast group on the
+ *  loopback interface, one of them late, and must both get the format and
+ *  the frames.
+ *
+ *  To execute:
+ *             ./v4l-stream-udp-test
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "v4l-stream.h"
+
+#define GOP_SIZE	30
+#define MCAST_GROUP	"239.255.83.62"
+
+struct relay {
+	int fd;
+	struct sockaddr_in addr;
+	struct sockaddr_in sender;
+	struct sockaddr_in receiver;
+	bool has_sender;
+	unsigned count;
+	unsigned drop_from, drop_to;
+};
+
+struct check {
+	const char *name;
+	int last;
+	unsigned frames;
+	unsigned i_frames;
+	unsigned has_fmt;
+	int errors;
+};
+
+static unsigned frame_size(unsigned n)
+{
+	/* From a single datagram to a few hundred */
+	return 200 + (n * 7919) % 300000;
+}
+
+static __u8 frame_byte(unsigned n, unsigned i)
+{
+	return n * 31 + i * 7 + (i >> 8);
+}
+
+/* A FRAME_VIDEO_FWHT packet, in the layout written by v4l2-ctl */
+static unsigned make_frame(__u8 *p, unsigned n, bool i_frame)
+{
+	struct fwht_cframe_hdr hdr = {};
+	unsigned data_size = sizeof(hdr) + 4 + frame_size(n);
+	__u32 w[8];
+	unsigned i;
+
+	w[0] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_FWHT);
+	w[1] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(1) + data_size);
+	w[2] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
+	w[3] = htonl(V4L2_FIELD_NONE);
+	w[4] = 0;
+	w[5] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
+	w[6] = htonl(data_size);
+	w[7] = htonl(data_size);
+	memcpy(p, w, sizeof(w));
+	hdr.magic1 = FWHT_MAGIC1;
+	hdr.magic2 = FWHT_MAGIC2;
+	hdr.flags = htonl(i_frame ? V4L2_FWHT_FL_I_FRAME : 0);
+	hdr.size = htonl(frame_size(n));
+	memcpy(p + sizeof(w), &hdr, sizeof(hdr));
+	w[0] = htonl(n);
+	memcpy(p + sizeof(w) + sizeof(hdr), w, 4);
+	p += sizeof(w) + sizeof(hdr) + 4;
+	for (i = 0; i < frame_size(n); i++)
+		p[i] = frame_byte(n, i);
+	return 8 * 4 + data_size;
+}
+
+static unsigned make_fmt(__u8 *p)
+{
+	__u32 w[2 + 13 + 3] = {
+		V4L_STREAM_PACKET_FMT_VIDEO,
+		V4L_STREAM_PACKET_FMT_VIDEO_SIZE(1),
+		V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT,
+		1, V4L2_PIX_FMT_YUYV, 640, 480, V4L2_FIELD_NONE,
+		V4L2_COLORSPACE_SRGB, 0, 0, 0, 0, 1, 1,
+		V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE, 640 * 480 * 2, 640 * 2,
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(w) / sizeof(w[0]); i++)
+		w[i] = htonl(w[i]);
+	memcpy(p, w, sizeof(w));
+	return sizeof(w);
+}
+
+/* Checks a packet passed on by a receiver */
+static void check_packet(struct check *c, const __u8 *p, unsigned size)
+{
+	struct fwht_cframe_hdr hdr;
+	__u32 w[9];
+	unsigned n, i;
+	bool i_frame;
+
+	memcpy(w, p, 4);
+	if (ntohl(w[0]) == V4L_STREAM_PACKET_FMT_VIDEO) {
+		c->has_fmt++;
+		return;
+	}
+	if (!c->has_fmt) {
+		fprintf(stderr, "%s: frame before the format\n", c->name);
+		c->errors++;
+	}
+	if (size < sizeof(w) + sizeof(hdr)) {
+		fprintf(stderr, "%s: short packet\n", c->name);
+		c->errors++;
+		return;
+	}
+	memcpy(&hdr, p + 8 * 4, sizeof(hdr));
+	memcpy(w, p + 8 * 4 + sizeof(hdr), 4);
+	n = ntohl(w[0]);
+	i_frame = ntohl(hdr.flags) & V4L2_FWHT_FL_I_FRAME;
+	if (size != 8 * 4 + sizeof(hdr) + 4 + frame_size(n)) {
+		fprintf(stderr, "%s: frame %u: wrong size %u\n", c->name, n, size);
+		c->errors++;
+		return;
+	}
+	p += 8 * 4 + sizeof(hdr) + 4;
+	for (i = 0; i < frame_size(n); i++) {
+		if (p[i] != frame_byte(n, i)) {
+			fprintf(stderr, "%s: frame %u: corrupt at %u\n", c->name, n, i);
+			c->errors++;
+			return;
+		}
+	}
+	if (!i_frame && (int)n != c->last + 1) {
+		fprintf(stderr, "%s: P-frame %u passed on after frame %d\n",
+			c->name, n, c->last);
+		c->errors++;
+	}
+	c->last = n;
+	c->frames++;
+	c->i_frames += i_frame;
+}
+
+/* Reads what arrived for a receiver, waiting at most timeout ms */
+static void receive(struct udp_stream *rx, struct check *c, int timeout)
+{
+	struct pollfd pfd = { rx->fd, POLLIN, 0 };
+
+	while (poll(&pfd, 1, timeout) > 0) {
+		int size = udp_stream_recv(rx);
+
+		if (size < 0) {
+			fprintf(stderr, "%s: %s\n", c->name, strerror(errno));
+			c->errors++;
+			return;
+		}
+		if (size)
+			check_packet(c, rx->buf, size);
+	}
+}
+
+static int relay_open(struct relay *r)
+{
+	socklen_t len = sizeof(r->addr);
+	int buf_size = 4 << 20;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (r->fd < 0)
+		return -1;
+	setsockopt(r->fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+	r->addr.sin_family = AF_INET;
+	r->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(r->fd, (struct sockaddr *)&r->addr, sizeof(r->addr)) ||
+	    getsockname(r->fd, (struct sockaddr *)&r->addr, &len))
+		return -1;
+	return 0;
+}
+
+/*
+ * Passes the datagrams of the sender on to the receiver, but for the
+ * dropped ones, and the reports of the receiver back to the sender.
+ */
+static void relay_forward(struct relay *r, struct udp_stream *rx,
+			  struct check *c)
+{
+	struct pollfd pfd[2] = {
+		{ r->fd, POLLIN, 0 },
+		{ rx->fd, POLLIN, 0 },
+	};
+	static __u8 buf[V4L_STREAM_UDP_MAX_MTU];
+
+	while (poll(pfd, 2, 20) > 0) {
+		if (pfd[0].revents) {
+			struct sockaddr_in from;
+			socklen_t len = sizeof(from);
+			ssize_t ret;
+
+			ret = recvfrom(r->fd, buf, sizeof(buf), 0,
+				       (struct sockaddr *)&from, &len);
+			if (ret < 0)
+				continue;
+			if (from.sin_port == r->receiver.sin_port) {
+				if (r->has_sender)
+					sendto(r->fd, buf, ret, 0,
+					       (struct sockaddr *)&r->sender,
+					       sizeof(r->sender));
+				continue;
+			}
+			r->sender = from;
+			r->has_sender = true;
+			r->count++;
+			if (r->count >= r->drop_from && r->count < r->drop_to)
+				continue;
+			sendto(r->fd, buf, ret, 0, (struct sockaddr *)&r->receiver,
+			       sizeof(r->receiver));
+		}
+		if (pfd[1].revents)
+			receive(rx, c, 0);
+	}
+}
+
+static int test_loss(void)
+{
+	struct check c = { "loss", -1 };
+	struct udp_stream tx, rx;
+	struct relay r;
+	socklen_t len = sizeof(r.receiver);
+	__u8 *p = malloc(512 * 1024);
+	unsigned loss_frame = 0, recovered = 0;
+	unsigned n;
+
+	if (!p || relay_open(&r) ||
+	    udp_stream_open(&rx, "127.0.0.1", 0, NULL, 0, false) ||
+	    getsockname(rx.fd, (struct sockaddr *)&r.receiver, &len) ||
+	    udp_stream_open(&tx, "127.0.0.1", ntohs(r.addr.sin_port), NULL, 0, true)) {
+		fprintf(stderr, "loss: can't open the sockets: %s\n", strerror(errno));
+		return 1;
+	}
+
+	udp_stream_send_fmt(&tx, p, make_fmt(p));
+	for (n = 0; n < 2 * GOP_SIZE; n++) {
+		bool i_frame = n % GOP_SIZE == 0 ||
+			       udp_stream_i_frame_requested(&tx);
+		struct iovec iov[3];
+		unsigned size = make_frame(p, n, i_frame);
+
+		/* Lose a datagram in the middle of frame 5, then all of frame 9 */
+		if (n == 5) {
+			r.drop_from = r.count + 3;
+			r.drop_to = r.drop_from + 1;
+			loss_frame = n;
+		} else if (n == 9) {
+			r.drop_from = r.count + 1;
+			r.drop_to = ~0U;
+		} else if (n == 10) {
+			r.drop_to = r.count + 1;
+		}
+		if (loss_frame && !recovered && i_frame && n > loss_frame)
+			recovered = n;
+
+		/* Split the packet as v4l2-ctl does: headers, data */
+		iov[0].iov_base = p;
+		iov[0].iov_len = 8 * 4;
+		iov[1].iov_base = p + 8 * 4;
+		iov[1].iov_len = (size - 8 * 4) / 2;
+		iov[2].iov_base = p + 8 * 4 + iov[1].iov_len;
+		iov[2].iov_len = size - 8 * 4 - iov[1].iov_len;
+		if (udp_stream_send(&tx, iov, 3)) {
+			fprintf(stderr, "loss: send: %s\n", strerror(errno));
+			return 1;
+		}
+		relay_forward(&r, &rx, &c);
+		/* About 25 fps, so that the receiver can make requests */
+		usleep(40000);
+	}
+
+	printf("loss: %u frames, %u I-frames passed on; %u datagrams, %u lost, "
+	       "%u packets dropped, %u I-frame requests\n",
+	       c.frames, c.i_frames, rx.datagrams, rx.lost, rx.dropped,
+	       tx.i_frame_reqs);
+	if (!rx.lost || !rx.dropped) {
+		fprintf(stderr, "loss: the losses were not seen\n");
+		c.errors++;
+	}
+	if (!recovered || recovered >= GOP_SIZE) {
+		fprintf(stderr, "loss: no I-frame was requested\n");
+		c.errors++;
+	}
+	if (c.last != 2 * GOP_SIZE - 1) {
+		fprintf(stderr, "loss: the last frame is %d\n", c.last);
+		c.errors++;
+	}
+	if (tx.num_peers != 1 || tx.peers[0].lost != rx.lost) {
+		fprintf(stderr, "loss: the sender did not get the statistics\n");
+		c.errors++;
+	}
+	udp_stream_close(&tx);
+	udp_stream_close(&rx);
+	close(r.fd);
+	free(p);
+	return c.errors;
+}
+
+static int test_multicast(void)
+{
+	struct check c[2] = { { "multicast 1", -1 }, { "multicast 2", -1 } };
+	struct udp_stream tx, rx[2];
+	__u8 *p = malloc(512 * 1024);
+	unsigned port, n, i;
+	socklen_t len;
+	struct sockaddr_in addr;
+	int errors = 0;
+
+	if (!p || udp_stream_open(&rx[0], MCAST_GROUP, 0, "127.0.0.1", 0, false)) {
+		printf("multicast: skipped, can't join %s on the loopback interface: %s\n",
+		       MCAST_GROUP, strerror(errno));
+		free(p);
+		return 0;
+	}
+	len = sizeof(addr);
+	getsockname(rx[0].fd, (struct sockaddr *)&addr, &len);
+	port = ntohs(addr.sin_port);
+	if (udp_stream_open(&tx, MCAST_GROUP, port, "127.0.0.1", 0, true)) {
+		fprintf(stderr, "multicast: can't open the sender: %s\n", strerror(errno));
+		return 1;
+	}
+
+	udp_stream_send_fmt(&tx, p, make_fmt(p));
+	for (n = 0; n < GOP_SIZE; n++) {
+		bool i_frame = n == 0 || udp_stream_i_frame_requested(&tx);
+		struct iovec iov = { p, make_frame(p, n, i_frame) };
+
+		/* The second receiver joins late, in the middle of the GOP */
+		if (n == 10 && udp_stream_open(&rx[1], MCAST_GROUP, port,
+					       "127.0.0.1", 0, false)) {
+			fprintf(stderr, "multicast: can't open the second receiver: %s\n",
+				strerror(errno));
+			return 1;
+		}
+		if (udp_stream_send(&tx, &iov, 1)) {
+			fprintf(stderr, "multicast: send: %s\n", strerror(errno));
+			return 1;
+		}
+		for (i = 0; i < (n >= 10 ? 2 : 1); i++)
+			receive(&rx[i], &c[i], 20);
+		usleep(40000);
+	}
+
+	for (i = 0; i < 2; i++) {
+		printf("%s: %u frames, %u I-frames passed on; %u datagrams, %u lost, "
+		       "%u packets dropped, %u format and %u I-frame requests\n",
+		       c[i].name, c[i].frames, c[i].i_frames, rx[i].datagrams,
+		       rx[i].lost, rx[i].dropped, rx[i].fmt_reqs, rx[i].i_frame_reqs);
+		errors += c[i].errors;
+		if (!c[i].has_fmt || c[i].last != GOP_SIZE - 1) {
+			fprintf(stderr, "%s: got the format %u times, the last frame is %d\n",
+				c[i].name, c[i].has_fmt, c[i].last);
+			errors++;
+		}
+		udp_stream_close(&rx[i]);
+	}
+	/* The late receiver can't wait for the next GOP */
+	if (c[1].frames < GOP_SIZE - 15) {
+		fprintf(stderr, "multicast 2: only %u frames\n", c[1].frames);
+		errors++;
+	}
+	udp_stream_close(&tx);
+	free(p);
+	return errors;
+}
+
+int main(void)
+{
+	int errors;
+
+	errors = test_loss();
+	errors += test_multicast();
+	printf("check: %s\n", errors ? "FAILED" : "ok");
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,589 @@
+/*
+ *  v4lconvert-bench: measure the speed of libv4lconvert's conversions
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  No device is needed, synthetic frames of every source format libv4lconvert
+ *  knows about are converted through v4lconvert_convert() to each of the
+ *  destination formats, at several resolutions. For each conversion the
+ *  time per frame, the throughput and the memory allocated is reported,
+ *  either as a table or as JSON, so that optimizations can be checked for
+ *  regressions. Frames of the compressed formats for which no synthetic
+ *  frame can be made (all except jpeg) are filled with noise, these are
+ *  reported with the error of the decoder if it rejects them. The memory
+ *  allocated is counted on glibc systems only.
+ *
+ *  Setting LIBV4LCONVERT_NO_SIMD in the environment benchmarks the plain C
+ *  converters.
+ *
+ *  To execute:
+ *             ./v4lconvert-bench [--json] [--threads n] [--size WxH]...
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+#define HAVE_JPEG_MEM_DEST 1
+#endif
+#endif
+#include <libv4lconvert.h>
+#include <libv4l-plugin.h>
+
+#ifdef __GLIBC__
+/* Count the bytes allocated by libv4lconvert, by wrapping the allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t alloc_bytes;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&alloc_bytes, nmemb * size, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#define ALLOC_BYTES() __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED)
+#else
+#define HAVE_ALLOC_COUNT 0
+#define ALLOC_BYTES() 0
+#endif
+
+enum frame_type {
+	FRAME_RAW,	/* bpp bits per pixel, lines of bytesperline bytes */
+	FRAME_PLANAR,	/* bpp bits per pixel, bytesperline is the width */
+	FRAME_JPEG,	/* a jpeg file */
+	FRAME_NOISE,	/* some compressed format, no real frame */
+};
+
+/* All source formats of supported_src_pixfmts in libv4lconvert.c */
+static const struct {
+	unsigned int fmt;
+	int bpp;
+	enum frame_type type;
+} src_fmts[] = {
+	{ V4L2_PIX_FMT_RGB24,		24, FRAME_RAW },
+	{ V4L2_PIX_FMT_BGR24,		24, FRAME_RAW },
+	{ V4L2_PIX_FMT_YUV420,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_YVU420,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_RGB565,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_BGR32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_RGB32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_XBGR32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_XRGB32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_ABGR32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_ARGB32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_YUYV,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_YVYU,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_UYVY,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_NV16,		16, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_NV61,		16, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_SPCA501,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_SPCA505,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_SPCA508,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_KONICA420,	12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_M420,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_HM12,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_NV12,		12, FRAME_PLANAR },
+	{ V4L2_PIX_FMT_CPIA1,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_MJPEG,		 0, FRAME_JPEG },
+	{ V4L2_PIX_FMT_JPEG,		 0, FRAME_JPEG },
+	{ V4L2_PIX_FMT_PJPG,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_JPGL,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_OV511,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_OV518,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_SBGGR8,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGBRG8,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGRBG8,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_SRGGB8,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_STV0680,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_SBGGR10P,	10, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGBRG10P,	10, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGRBG10P,	10, FRAME_RAW },
+	{ V4L2_PIX_FMT_SRGGB10P,	10, FRAME_RAW },
+	{ V4L2_PIX_FMT_SBGGR10,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGBRG10,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGRBG10,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SRGGB10,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SBGGR16,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGBRG16,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SGRBG16,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SRGGB16,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_SPCA561,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_SN9C10X,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_SN9C2028,	 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_PAC207,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_MR97310A,	 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_JL2005BCD,	 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_SQ905C,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_SE401,		 0, FRAME_NOISE },
+	{ V4L2_PIX_FMT_GREY,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_Y4,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_Y6,		 8, FRAME_RAW },
+	{ V4L2_PIX_FMT_Y10BPACK,	10, FRAME_RAW },
+	{ V4L2_PIX_FMT_Y16,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_Y16_BE,		16, FRAME_RAW },
+	{ V4L2_PIX_FMT_HSV32,		32, FRAME_RAW },
+	{ V4L2_PIX_FMT_HSV24,		24, FRAME_RAW },
+};
+
+static const unsigned int dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+};
+
+#define MAX_SIZES 16
+
+static int sizes[MAX_SIZES][2] = {
+	{ 320, 240 },
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+static int no_sizes = 4;
+
+static unsigned int src_pixfmt;
+
+/* A fake capture device, which only knows about src_pixfmt */
+static int fake_ioctl(void *dev_ops_priv, int fd, unsigned long int cmd,
+		      void *arg)
+{
+	switch (cmd) {
+	case VIDIOC_ENUM_FMT: {
+		struct v4l2_fmtdesc *fmt = arg;
+
+		if (fmt->index)
+			break;
+		fmt->pixelformat = src_pixfmt;
+		return 0;
+	}
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "fake");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE;
+		return 0;
+	}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops fake_dev_ops = {
+	.ioctl = fake_ioctl,
+};
+
+struct result {
+	unsigned int src;
+	unsigned int dst;
+	int width;
+	int height;
+	int frames;
+	double ns_per_frame;
+	double mpix_per_s;
+	size_t alloc_bytes;		/* allocated by the first conversion */
+	size_t alloc_bytes_per_frame;	/* allocated by the other ones */
+	char error[256];
+};
+
+static const char *fourcc(unsigned int fmt, char *s)
+{
+	s[0] = fmt & 0x7f;
+	s[1] = (fmt >> 8) & 0x7f;
+	s[2] = (fmt >> 16) & 0x7f;
+	s[3] = (fmt >> 24) & 0x7f;
+	s[4] = 0;
+	if (fmt & (1U << 31))
+		strcat(s, "-BE");
+	return s;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A smooth gradient with some noise, so that the demosaicing and the
+   jpeg encoder see something resembling a picture */
+static void fill_frame(unsigned char *buf, int size, int stride)
+{
+	unsigned int seed = 0x5eed;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (i % stride) / 4 + i / stride / 4 + ((seed >> 16) & 0x1f);
+	}
+}
+
+#ifdef HAVE_JPEG_MEM_DEST
+/* Encode a 4:2:2 jpeg, as uvc cameras produce them */
+static int make_jpeg(unsigned char **buf, unsigned long *size,
+		int width, int height)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *rgb, *line;
+	int y;
+
+	rgb = malloc(width * height * 3);
+	if (!rgb)
+		return -1;
+	fill_frame(rgb, width * height * 3, width * 3);
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	*buf = NULL;
+	*size = 0;
+	jpeg_mem_dest(&cinfo, buf, size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 1;
+	jpeg_start_compress(&cinfo, TRUE);
+	for (y = 0; y < height; y++) {
+		line = rgb + y * width * 3;
+		jpeg_write_scanlines(&cinfo, &line, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(rgb);
+	return 0;
+}
+#endif
+
+/* Create the source frame for src_fmts[f], returns its size, or -1 */
+static int make_frame(int f, struct v4l2_format *fmt, unsigned char **buf)
+{
+	int width = fmt->fmt.pix.width, height = fmt->fmt.pix.height;
+	int size;
+
+	switch (src_fmts[f].type) {
+	case FRAME_RAW:
+		fmt->fmt.pix.bytesperline = (width * src_fmts[f].bpp + 7) / 8;
+		size = fmt->fmt.pix.bytesperline * height;
+		break;
+	case FRAME_PLANAR:
+		fmt->fmt.pix.bytesperline = width;
+		size = width * height * src_fmts[f].bpp / 8;
+		break;
+	case FRAME_JPEG:
+#ifdef HAVE_JPEG_MEM_DEST
+	{
+		unsigned long jpeg_size;
+
+		if (make_jpeg(buf, &jpeg_size, width, height))
+			return -1;
+		fmt->fmt.pix.bytesperline = 0;
+		fmt->fmt.pix.sizeimage = jpeg_size;
+		return jpeg_size;
+	}
+#endif
+		/* fall through, without libjpeg jpeg frames are noise too */
+	case FRAME_NOISE:
+	default:
+		fmt->fmt.pix.bytesperline = 0;
+		size = width * height * 3 / 2;
+		break;
+	}
+
+	*buf = malloc(size);
+	if (!*buf)
+		return -1;
+	fill_frame(*buf, size, fmt->fmt.pix.bytesperline ?
+		   fmt->fmt.pix.bytesperline : width);
+	fmt->fmt.pix.sizeimage = size;
+	return size;
+}
+
+static void bench_one(struct v4lconvert_data *data, int f,
+		unsigned int dst_pixfmt, int width, int height,
+		int min_ms, struct result *res)
+{
+	struct v4l2_format src_fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4l2_format dst_fmt;
+	unsigned char *src = NULL, *dst;
+	int src_size, dst_size, ret;
+	uint64_t start, elapsed;
+	size_t allocated;
+
+	memset(res, 0, sizeof(*res));
+	res->src = src_fmts[f].fmt;
+	res->dst = dst_pixfmt;
+	res->width = width;
+	res->height = height;
+
+	src_fmt.fmt.pix.width = width;
+	src_fmt.fmt.pix.height = height;
+	src_fmt.fmt.pix.pixelformat = src_fmts[f].fmt;
+	src_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	dst_fmt = src_fmt;
+	dst_fmt.fmt.pix.pixelformat = dst_pixfmt;
+	dst_size = width * height * 3;
+
+	src_size = make_frame(f, &src_fmt, &src);
+	dst = malloc(dst_size);
+	if (src_size < 0 || !dst) {
+		strcpy(res->error, "out of memory");
+		goto leave;
+	}
+
+	allocated = ALLOC_BYTES();
+	ret = v4lconvert_convert(data, &src_fmt, &dst_fmt, src, src_size,
+				 dst, dst_size);
+	if (ret < 0) {
+		snprintf(res->error, sizeof(res->error), "%s",
+			 v4lconvert_get_error_message(data));
+		res->error[strcspn(res->error, "\n")] = 0;
+		if (!res->error[0])
+			strcpy(res->error, strerror(errno));
+		goto leave;
+	}
+	res->alloc_bytes = ALLOC_BYTES() - allocated;
+
+	allocated = ALLOC_BYTES();
+	start = now_ns();
+	do {
+		v4lconvert_convert(data, &src_fmt, &dst_fmt, src, src_size,
+				   dst, dst_size);
+		res->frames++;
+		elapsed = now_ns() - start;
+	} while (elapsed < (uint64_t)min_ms * 1000000);
+
+	res->alloc_bytes_per_frame = (ALLOC_BYTES() - allocated) / res->frames;
+	res->ns_per_frame = (double)elapsed / res->frames;
+	res->mpix_per_s = width * height * 1000.0 / res->ns_per_frame;
+
+leave:
+	free(src);
+	free(dst);
+}
+
+static void print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void print_result(const struct result *res, int json, int first)
+{
+	char s1[8], s2[8];
+
+	fourcc(res->src, s1);
+	fourcc(res->dst, s2);
+
+	if (!json) {
+		if (res->error[0])
+			printf("%-8s -> %-4s %4dx%-4d  error: %s\n", s1, s2,
+			       res->width, res->height, res->error);
+		else
+			printf("%-8s -> %-4s %4dx%-4d %12.0f ns %9.2f MPix/s %10zu bytes %6zu bytes/frame\n",
+			       s1, s2, res->width, res->height,
+			       res->ns_per_frame, res->mpix_per_s,
+			       res->alloc_bytes, res->alloc_bytes_per_frame);
+		return;
+	}
+
+	printf("%s\n    { \"src\": \"%s\", \"dst\": \"%s\", \"width\": %d, \"height\": %d, ",
+	       first ? "" : ",", s1, s2, res->width, res->height);
+	if (res->error[0]) {
+		printf("\"error\": ");
+		print_json_string(res->error);
+		printf(" }");
+		return;
+	}
+	printf("\"frames\": %d, \"ns_per_frame\": %.0f, \"mpix_per_s\": %.3f",
+	       res->frames, res->ns_per_frame, res->mpix_per_s);
+	if (HAVE_ALLOC_COUNT)
+		printf(", \"alloc_bytes\": %zu, \"alloc_bytes_per_frame\": %zu",
+		       res->alloc_bytes, res->alloc_bytes_per_frame);
+	printf(" }");
+}
+
+static void usage(FILE *fp, const char *prog)
+{
+	fprintf(fp,
+		"Usage: %s [options]\n\n"
+		"Options:\n"
+		"-f | --src fourcc    Only benchmark this source format\n"
+		"-d | --dst fourcc    Only benchmark this destination format\n"
+		"-s | --size WxH      Resolution to benchmark, may be given %d times,\n"
+		"                     stick to sizes cameras produce, as some decoders\n"
+		"                     cannot handle others\n"
+		"-t | --threads n     Number of conversion threads [1]\n"
+		"-m | --min-time ms   Minimum time to spend on each conversion [200]\n"
+		"-j | --json          Output JSON\n"
+		"-h | --help          Print this message\n",
+		prog, MAX_SIZES);
+}
+
+static const char short_options[] = "f:d:s:t:m:jh";
+
+static const struct option long_options[] = {
+	{ "src",      required_argument, NULL, 'f' },
+	{ "dst",      required_argument, NULL, 'd' },
+	{ "size",     required_argument, NULL, 's' },
+	{ "threads",  required_argument, NULL, 't' },
+	{ "min-time", required_argument, NULL, 'm' },
+	{ "json",     no_argument,       NULL, 'j' },
+	{ "help",     no_argument,       NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+static int fourcc_matches(const char *arg, unsigned int fmt)
+{
+	char s[8];
+
+	return !arg || !strcasecmp(arg, fourcc(fmt, s));
+}
+
+int main(int argc, char **argv)
+{
+	const char *src_arg = NULL, *dst_arg = NULL;
+	int threads = 1, min_ms = 200, json = 0, user_sizes = 0;
+	int f, d, s, first = 1, failed = 0;
+	struct result res;
+
+	for (;;) {
+		int c = getopt_long(argc, argv, short_options, long_options,
+				    NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'f':
+			src_arg = optarg;
+			break;
+		case 'd':
+			dst_arg = optarg;
+			break;
+		case 's':
+			if (user_sizes == MAX_SIZES ||
+			    sscanf(optarg, "%dx%d", &sizes[user_sizes][0],
+				   &sizes[user_sizes][1]) != 2 ||
+			    sizes[user_sizes][0] <= 0 ||
+			    sizes[user_sizes][1] <= 0) {
+				usage(stderr, argv[0]);
+				return 1;
+			}
+			no_sizes = ++user_sizes;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'm':
+			min_ms = atoi(optarg);
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	/* The ov511 / ov518 decompression helpers are not installed when
+	   running from the build tree, don't die writing to their pipe */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (json)
+		printf("{\n  \"simd\": %s,\n  \"threads\": %d,\n  \"results\": [",
+		       getenv("LIBV4LCONVERT_NO_SIMD") ? "false" : "true",
+		       threads);
+
+	for (f = 0; f < sizeof(src_fmts) / sizeof(src_fmts[0]); f++) {
+		struct v4lconvert_data *data;
+
+		if (!fourcc_matches(src_arg, src_fmts[f].fmt))
+			continue;
+
+		src_pixfmt = src_fmts[f].fmt;
+		data = v4lconvert_create_with_dev_ops(-1, NULL, &fake_dev_ops);
+		if (!data) {
+			fprintf(stderr, "could not create converter\n");
+			return 1;
+		}
+		if (v4lconvert_set_threads(data, threads)) {
+			fprintf(stderr, "could not set threads to %d\n", threads);
+			return 1;
+		}
+
+		for (d = 0; d < sizeof(dst_fmts) / sizeof(dst_fmts[0]); d++) {
+			if (!fourcc_matches(dst_arg, dst_fmts[d]))
+				continue;
+			for (s = 0; s < no_sizes; s++) {
+				bench_one(data, f, dst_fmts[d], sizes[s][0],
+					  sizes[s][1], min_ms, &res);
+				print_result(&res, json, first);
+				first = 0;
+				if (res.error[0])
+					failed++;
+			}
+		}
+
+		v4lconvert_destroy(data);
+	}
+
+	if (json)
+		printf("\n  ]\n}\n");
+	else
+		printf("%d conversions failed\n", failed);
+
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ *  v4lconvert-simd-test: check the SIMD rgb / yuv converters and bayer
+ *  demosaicing of libv4lconvert against the plain C ones.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  No device is needed, random frames are converted twice through
+ *  v4lconvert_convert(), once by a converter created with
+ *  LIBV4LCONVERT_NO_SIMD set and once by a converter using whatever the CPU
+ *  supports, and the results are compared byte for byte.
+ *
+ *  To execute:
+ *             ./v4lconvert-simd-test [iterations]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libv4lconvert.h>
+#include <libv4l-plugin.h>
+
+static unsigned int src_pixfmt;
+
+/* A fake capture device, which only knows about src_pixfmt */
+static int fake_ioctl(void *dev_ops_priv, int fd, unsigned long int cmd,
+		      void *arg)
+{
+	switch (cmd) {
+	case VIDIOC_ENUM_FMT: {
+		struct v4l2_fmtdesc *fmt = arg;
+
+		if (fmt->index)
+			break;
+		fmt->pixelformat = src_pixfmt;
+		return 0;
+	}
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "fake");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE;
+		return 0;
+	}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops fake_dev_ops = {
+	.ioctl = fake_ioctl,
+};
+
+static const struct {
+	unsigned int fmt;
+	int bpp;
+	int packed;	/* bytesperline is honored, test with padding */
+} src_fmts[] = {
+	{ V4L2_PIX_FMT_YUYV,	16, 1 },
+	{ V4L2_PIX_FMT_YVYU,	16, 1 },
+	{ V4L2_PIX_FMT_UYVY,	16, 1 },
+	{ V4L2_PIX_FMT_NV12,	12, 0 },
+	{ V4L2_PIX_FMT_YUV420,	12, 0 },
+	{ V4L2_PIX_FMT_YVU420,	12, 0 },
+	{ V4L2_PIX_FMT_RGB24,	24, 1 },
+	{ V4L2_PIX_FMT_BGR24,	24, 1 },
+	{ V4L2_PIX_FMT_RGB32,	32, 1 },
+	{ V4L2_PIX_FMT_BGR32,	32, 1 },
+	{ V4L2_PIX_FMT_SBGGR8,	 8, 1 },
+	{ V4L2_PIX_FMT_SGBRG8,	 8, 1 },
+	{ V4L2_PIX_FMT_SGRBG8,	 8, 1 },
+	{ V4L2_PIX_FMT_SRGGB8,	 8, 1 },
+	{ V4L2_PIX_FMT_SGRBG10,	16, 0 },
+	{ V4L2_PIX_FMT_SRGGB16,	16, 0 },
+};
+
+static const unsigned int dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+};
+
+static const int sizes[][2] = {
+	{ 16, 2 },
+	{ 34, 4 },
+	{ 176, 144 },
+	{ 322, 242 },
+	{ 640, 480 },
+	{ 1282, 722 },
+};
+
+static void fourcc(unsigned int fmt, char *s)
+{
+	s[0] = fmt & 0xff;
+	s[1] = (fmt >> 8) & 0xff;
+	s[2] = (fmt >> 16) & 0xff;
+	s[3] = (fmt >> 24) & 0xff;
+	s[4] = 0;
+}
+
+static int test_one(struct v4lconvert_data *ref, struct v4lconvert_data *simd,
+		    int f, unsigned int dst_pixfmt, int width, int height)
+{
+	struct v4l2_format src_fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4l2_format dst_fmt;
+	unsigned char *src, *dst_ref, *dst_simd;
+	int i, src_size, dst_size, res_ref, res_simd, ret = 0;
+	char s1[5], s2[5];
+
+	src_fmt.fmt.pix.width = width;
+	src_fmt.fmt.pix.height = height;
+	src_fmt.fmt.pix.pixelformat = src_fmts[f].fmt;
+	src_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (src_fmts[f].packed) {
+		src_fmt.fmt.pix.bytesperline = width * src_fmts[f].bpp / 8 + 32;
+		src_size = src_fmt.fmt.pix.bytesperline * height;
+	} else {
+		src_fmt.fmt.pix.bytesperline = width;
+		src_size = width * height * src_fmts[f].bpp / 8;
+	}
+	src_fmt.fmt.pix.sizeimage = src_size;
+	dst_fmt = src_fmt;
+	dst_fmt.fmt.pix.pixelformat = dst_pixfmt;
+	dst_size = width * height * 3;
+
+	src = malloc(src_size);
+	dst_ref = malloc(dst_size);
+	dst_simd = malloc(dst_size);
+	if (!src || !dst_ref || !dst_simd) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < src_size; i++)
+		src[i] = rand();
+	memset(dst_ref, 0x55, dst_size);
+	memset(dst_simd, 0xaa, dst_size);
+
+	res_ref = v4lconvert_convert(ref, &src_fmt, &dst_fmt, src, src_size,
+				     dst_ref, dst_size);
+	res_simd = v4lconvert_convert(simd, &src_fmt, &dst_fmt, src, src_size,
+				      dst_simd, dst_size);
+
+	fourcc(src_fmts[f].fmt, s1);
+	fourcc(dst_pixfmt, s2);
+	if (res_ref < 0 || res_ref != res_simd) {
+		printf("%s -> %s %dx%d: conversion failed (%d / %d): %s\n",
+		       s1, s2, width, height, res_ref, res_simd,
+		       v4lconvert_get_error_message(simd));
+		ret = 1;
+	} else {
+		for (i = 0; i < res_ref; i++)
+			if (dst_ref[i] != dst_simd[i])
+				break;
+		if (i < res_ref) {
+			printf("%s -> %s %dx%d: mismatch at offset %d: %d != %d\n",
+			       s1, s2, width, height, i, dst_ref[i], dst_simd[i]);
+			ret = 1;
+		}
+	}
+
+	free(src);
+	free(dst_ref);
+	free(dst_simd);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 1;
+	int f, d, s, n, failed = 0, tests = 0;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	srand(0x5eed);
+
+	for (f = 0; f < sizeof(src_fmts) / sizeof(src_fmts[0]); f++) {
+		struct v4lconvert_data *ref, *simd;
+
+		src_pixfmt = src_fmts[f].fmt;
+		setenv("LIBV4LCONVERT_NO_SIMD", "1", 1);
+		ref = v4lconvert_create_with_dev_ops(-1, NULL, &fake_dev_ops);
+		unsetenv("LIBV4LCONVERT_NO_SIMD");
+		simd = v4lconvert_create_with_dev_ops(-1, NULL, &fake_dev_ops);
+		if (!ref || !simd) {
+			fprintf(stderr, "could not create converters\n");
+			return 1;
+		}
+
+		for (d = 0; d < sizeof(dst_fmts) / sizeof(dst_fmts[0]); d++)
+			for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+				for (n = 0; n < iterations; n++) {
+					failed += test_one(ref, simd, f, dst_fmts[d],
+							   sizes[s][0], sizes[s][1]);
+					tests++;
+				}
+
+		v4lconvert_destroy(ref);
+		v4lconvert_destroy(simd);
+	}
+
+	printf("%d of %d conversions identical\n", tests - failed, tests);
+	return failed ? 1 : 0;
+}
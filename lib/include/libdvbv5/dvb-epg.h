@@ -0,0 +1,242 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/**
+ * @file dvb-epg.h
+ * @ingroup dvb_table
+ * @brief Provides an incremental cache for the EIT (EPG) sections.
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * The EIT schedule is broadcasted in a carousel: the same sections are
+ * repeated all the time, and only change when their version number is
+ * incremented. The EPG cache keeps the last version of every EIT section,
+ * keyed by original network ID, transport stream ID, service ID, table ID
+ * and section number. A section whose version and CRC are already known is
+ * dropped before being parsed, so, once the cache is filled, reading the
+ * carousel again costs just a lookup per section.
+ *
+ * When a section changes, the events added, changed or removed are
+ * reported to a callback. The cache can be stored at a file, mapped in
+ * memory: this way, it is kept between two runs of an EPG grabber, and
+ * only the events changed meanwhile are reported.
+ *
+ * The EPG cache isn't thread safe.
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_EPG_H
+#define _DVB_EPG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-sw-demux.h>
+#include <libdvbv5/eit.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct dvb_epg
+ * @ingroup dvb_table
+ * @brief Opaque EPG cache handler
+ */
+struct dvb_epg;
+
+/**
+ * @struct dvb_epg_key
+ * @ingroup dvb_table
+ * @brief Identifies an EIT section at the EPG cache
+ *
+ * @param network_id	original network ID
+ * @param transport_id	transport stream ID
+ * @param service_id	service ID
+ * @param table_id	table ID (0x4e to 0x6f)
+ * @param section	section number
+ */
+struct dvb_epg_key {
+	uint16_t network_id;
+	uint16_t transport_id;
+	uint16_t service_id;
+	uint8_t table_id;
+	uint8_t section;
+};
+
+/**
+ * @enum dvb_epg_change
+ * @ingroup dvb_table
+ * @brief Kind of change reported for an EIT event
+ *
+ * @var DVB_EPG_EVENT_ADDED
+ *	@brief The event is new
+ * @var DVB_EPG_EVENT_CHANGED
+ *	@brief The event was already known, but its contents changed
+ * @var DVB_EPG_EVENT_REMOVED
+ *	@brief The event is no longer broadcasted
+ */
+enum dvb_epg_change {
+	DVB_EPG_EVENT_ADDED,
+	DVB_EPG_EVENT_CHANGED,
+	DVB_EPG_EVENT_REMOVED,
+};
+
+/**
+ * @brief Callback called for each event changed at the EPG cache
+ * @ingroup dvb_table
+ *
+ * @param priv		Private data passed to dvb_epg_set_callback()
+ * @param key		EIT section where the event is
+ * @param change	What happened to the event
+ * @param event		The event. For removed events, its last contents
+ *
+ * @details The event is only valid until the callback returns.
+ */
+typedef void (*dvb_epg_cb)(void *priv, const struct dvb_epg_key *key,
+			   enum dvb_epg_change change,
+			   const struct dvb_table_eit_event *event);
+
+/**
+ * @brief Allocates an EPG cache
+ * @ingroup dvb_table
+ *
+ * @param parms	Pointer to struct dvb_v5_fe_parms, used for logging and
+ *		for parsing the sections
+ * @param fname	File where the cache is stored, or NULL to keep it in
+ *		memory only
+ *
+ * @details If the file exists, the sections stored there are loaded.
+ *	Otherwise, it is created. The file is in the byte order of the
+ *	machine, and it is mapped in memory, so its changes are written
+ *	by the Kernel as they happen.
+ *
+ * @return Returns an EPG cache on success, NULL otherwise.
+ */
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms,
+			      const char *fname);
+
+/**
+ * @brief Frees an EPG cache, unmapping its file, if any
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ */
+void dvb_epg_free(struct dvb_epg *epg);
+
+/**
+ * @brief Sets the callback called for the events changed
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ * @param cb	Callback, or NULL to disable it
+ * @param priv	Private data passed to the callback
+ */
+void dvb_epg_set_callback(struct dvb_epg *epg, dvb_epg_cb cb, void *priv);
+
+/**
+ * @brief Adds an EIT section to the EPG cache
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ * @param buf	Section, including its header and its CRC
+ * @param len	Length of the section
+ *
+ * @details The CRC of the section should have been already checked, as
+ *	done by the Kernel demux with DMX_CHECK_CRC, or by the software
+ *	demux. Sections that aren't from an EIT table, or that aren't
+ *	applicable yet, are ignored.
+ *
+ *	When the section changed, the other sections of the same table with
+ *	a number after its last_section_number are removed from the cache.
+ *
+ * @return Returns 1 if the section changed, 0 if it was already known
+ *	or ignored, or a negative value on errors.
+ */
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Software demux callback feeding the EPG cache
+ * @ingroup dvb_table
+ *
+ * @param priv	The EPG cache
+ * @param data	Sections, as given by the software demux
+ * @param num	Number of sections
+ *
+ * @details To be used with dvb_sw_demux_add_section_filter(), for the
+ *	DVB_TABLE_EIT_PID program ID.
+ */
+void dvb_epg_sw_demux_cb(void *priv, const struct dvb_sw_demux_data *data,
+			 unsigned num);
+
+/**
+ * @brief Reads EIT sections from a demux into the EPG cache
+ * @ingroup dvb_table
+ *
+ * @param epg		EPG cache
+ * @param dmx_fd	File descriptor of the demux device
+ * @param timeout	Time to read the carousel, in seconds
+ *
+ * @details Sections are read from the DVB_TABLE_EIT_PID program ID until
+ *	the timeout expires, or the abort flag of struct dvb_v5_fe_parms
+ *	is set.
+ *
+ * @return Returns the number of changed sections, or a negative value on
+ *	errors.
+ */
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, unsigned timeout);
+
+/**
+ * @brief Parses a section stored at the EPG cache
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ * @param key	Section to parse
+ * @param table	Pointer where the parsed table is returned. It should be
+ *		freed with dvb_table_eit_free().
+ *
+ * @return Returns 0 on success, -ENOENT if the section isn't at the cache,
+ *	or another negative value on errors.
+ */
+int dvb_epg_get_section(struct dvb_epg *epg, const struct dvb_epg_key *key,
+			struct dvb_table_eit **table);
+
+/**
+ * @brief Reports all the events at the EPG cache as added
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ *
+ * @details Useful to rebuild a guide from a cache loaded from a file,
+ *	as the sections there are not reported again, unless they change.
+ *
+ * @return Returns the number of sections reported, or a negative value
+ *	on errors.
+ */
+int dvb_epg_replay(struct dvb_epg *epg);
+
+/**
+ * @brief Writes the EPG cache file to the disk
+ * @ingroup dvb_table
+ *
+ * @param epg	EPG cache
+ *
+ * @return Returns 0 on success, a negative errno value otherwise.
+ */
+int dvb_epg_sync(struct dvb_epg *epg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -43,6 +43,7 @@ extern "C" {
 #endif
 
 struct dvb_entry;
+struct dvb_sw_demux;
 
 /**
  * @struct dvb_v5_descriptors_program
@@ -226,6 +227,26 @@ int dvb_read_sections(struct dvb_v5_fe_parms *parms, int dmx_fd,
 			     struct dvb_table_filter *sect,
 			     unsigned timeout);
 
+/**
+ * @brief read MPEG-TS tables using the software demux
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms
+ * @param dmx		software demux, allocated with dvb_sw_demux_alloc()
+ * @param fd		file descriptor with the TS packets: a DVR device
+ *			carrying the full transport stream, a TS file, ...
+ * @param sect		section filter pointer
+ * @param timeout	limit, in seconds, to read a MPEG-TS table. Ignored
+ *			when fd is a file: the table is searched up to its end
+ *
+ * This is a variant of dvb_read_sections() that filters the section from
+ * fd with the software demux, instead of using the Kernel demux.
+ */
+int dvb_sw_demux_read_sections(struct dvb_v5_fe_parms *parms,
+			       struct dvb_sw_demux *dmx, int fd,
+			       struct dvb_table_filter *sect,
+			       unsigned timeout);
+
 /**
  * @brief allocates a struct dvb_v5_descriptors
  * @ingroup frontend_scan
@@ -270,6 +291,34 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *parms, int
 					  unsigned other_nit,
 					  unsigned timeout_multiply);
 
+/**
+ * @brief Scans a DVB stream using the software demux, looking for the
+ *			 tables needed to identify the programs inside a MPEG-TS
+ * @ingroup frontend_scan
+ *
+ * @param parms			pointer to struct dvb_v5_fe_parms
+ * @param dmx			software demux, allocated with
+ *				dvb_sw_demux_alloc()
+ * @param fd			file descriptor with the TS packets: a DVR
+ *				device carrying the full transport stream,
+ *				a TS file, ...
+ * @param delivery_system	delivery system to be scanned
+ * @param other_nit		use alternate table IDs for NIT and other tables
+ * @param timeout_multiply	improves the timeout for each table reception
+ * 				by using a value that will multiply the wait
+ *				time. Ignored when fd is a file.
+ *
+ * This is a variant of dvb_get_ts_tables() that reads all tables from a
+ * single stream, with the software demux, instead of using the Kernel
+ * demux. So, it can also parse the tables of a recorded TS file.
+ */
+struct dvb_v5_descriptors *dvb_sw_demux_get_ts_tables(struct dvb_v5_fe_parms *parms,
+						      struct dvb_sw_demux *dmx,
+						      int fd,
+						      uint32_t delivery_system,
+						      unsigned other_nit,
+						      unsigned timeout_multiply);
+
 /**
  * @brief frees a struct dvb_v5_descriptors
  * @ingroup frontend_scan
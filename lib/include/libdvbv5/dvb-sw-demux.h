@@ -0,0 +1,184 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/**
+ * @file dvb-sw-demux.h
+ * @ingroup demux
+ * @brief Provides a software demultiplexer for MPEG Transport Streams.
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * The software demux filters sections and PES packets from a stream of
+ * TS packets, without using the demux of the Kernel. This way, tables and
+ * elementary streams can be extracted from a DVR device, carrying the
+ * full transport stream, from a recorded file, or from any other source
+ * of TS packets, like the data read with dvb_dev_read() from a remote
+ * device.
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_SW_DEMUX_H
+#define _DVB_SW_DEMUX_H
+
+#include <stdint.h>
+#include <unistd.h> /* ssize_t */
+
+#include <libdvbv5/dvb-fe.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct dvb_sw_demux
+ * @ingroup demux
+ * @brief Opaque software demux handler
+ */
+struct dvb_sw_demux;
+
+/**
+ * @struct dvb_sw_demux_filter
+ * @ingroup demux
+ * @brief Opaque handler for a filter of the software demux
+ */
+struct dvb_sw_demux_filter;
+
+/**
+ * @struct dvb_sw_demux_data
+ * @ingroup demux
+ * @brief A section or PES packet extracted by the software demux
+ *
+ * @param pid	Program ID the data came from
+ * @param data	Pointer to the section or PES packet, including its header
+ * @param len	Length of the data, in bytes
+ */
+struct dvb_sw_demux_data {
+	uint16_t pid;
+	const uint8_t *data;
+	size_t len;
+};
+
+/**
+ * @brief Callback called with the data extracted by a filter
+ * @ingroup demux
+ *
+ * @param priv	Private data passed when the filter was added
+ * @param data	Array with the sections or PES packets extracted
+ * @param num	Number of entries at the data array
+ *
+ * @details Data is dispatched in batches: all sections or PES packets
+ *	completed in a row for the same filter by a call to
+ *	dvb_sw_demux_feed() are passed at once. The data is only valid until
+ *	the callback returns. Filters can be added or removed from inside
+ *	the callback, but dvb_sw_demux_feed() can't be called from there.
+ */
+typedef void (*dvb_sw_demux_cb)(void *priv,
+				const struct dvb_sw_demux_data *data,
+				unsigned num);
+
+/**
+ * @brief Allocates a software demux
+ * @ingroup demux
+ *
+ * @param parms	Pointer to struct dvb_v5_fe_parms, used for logging
+ *
+ * @return Returns a software demux on success, NULL otherwise.
+ */
+struct dvb_sw_demux *dvb_sw_demux_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief Frees a software demux and all its filters
+ * @ingroup demux
+ *
+ * @param dmx	Software demux
+ */
+void dvb_sw_demux_free(struct dvb_sw_demux *dmx);
+
+/**
+ * @brief Adds a section filter to a software demux
+ * @ingroup demux
+ *
+ * @param dmx	Software demux
+ * @param pid	Program ID to filter
+ * @param tid	Table ID to filter
+ * @param mask	Mask for the table ID. Use 0 to get all tables on the PID
+ * @param cb	Callback called with the sections
+ * @param priv	Private data passed to the callback
+ *
+ * @details Sections with a section syntax indicator and an invalid CRC are
+ *	discarded, just like DMX_CHECK_CRC does for the Kernel demux.
+ *
+ * @return Returns a filter handler on success, NULL otherwise.
+ */
+struct dvb_sw_demux_filter *
+dvb_sw_demux_add_section_filter(struct dvb_sw_demux *dmx, uint16_t pid,
+				uint8_t tid, uint8_t mask,
+				dvb_sw_demux_cb cb, void *priv);
+
+/**
+ * @brief Adds a PES filter to a software demux
+ * @ingroup demux
+ *
+ * @param dmx	Software demux
+ * @param pid	Program ID to filter
+ * @param cb	Callback called with the PES packets
+ * @param priv	Private data passed to the callback
+ *
+ * @return Returns a filter handler on success, NULL otherwise.
+ */
+struct dvb_sw_demux_filter *
+dvb_sw_demux_add_pes_filter(struct dvb_sw_demux *dmx, uint16_t pid,
+			    dvb_sw_demux_cb cb, void *priv);
+
+/**
+ * @brief Removes a filter from a software demux
+ * @ingroup demux
+ *
+ * @param dmx		Software demux
+ * @param filter	Filter to remove
+ */
+void dvb_sw_demux_remove_filter(struct dvb_sw_demux *dmx,
+				struct dvb_sw_demux_filter *filter);
+
+/**
+ * @brief Feeds TS packets to a software demux
+ * @ingroup demux
+ *
+ * @param dmx	Software demux
+ * @param buf	Buffer with the TS packets
+ * @param len	Length of the buffer
+ *
+ * @details The buffer doesn't need to start or end at a packet boundary:
+ *	the demux looks for the sync byte, and keeps incomplete packets
+ *	for the next call. The filter callbacks are called before this
+ *	function returns.
+ */
+void dvb_sw_demux_feed(struct dvb_sw_demux *dmx, const uint8_t *buf,
+		       size_t len);
+
+/**
+ * @brief Reads TS packets from a file descriptor and feeds a software demux
+ * @ingroup demux
+ *
+ * @param dmx	Software demux
+ * @param fd	File descriptor of a DVR device, a TS file, a pipe, ...
+ *
+ * @return Returns the number of bytes read, 0 at the end of the file, or
+ *	a negative errno value on errors.
+ */
+ssize_t dvb_sw_demux_read(struct dvb_sw_demux *dmx, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/**
+ * @file dvb-table-arena.h
+ * @ingroup dvb_table
+ * @brief Provides an arena allocator for the parsed MPEG-TS tables.
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * Parsing a table allocates one object per table entry (EIT event, PMT
+ * stream, ...) and per descriptor, each one released, one at a time, by
+ * the table free function. For tables that are parsed all the time, like
+ * the EIT schedule, it is cheaper to allocate all those objects from an
+ * arena, and release them all at once.
+ *
+ * While an arena is set with dvb_table_arena_set(), the tables parsed
+ * with the same struct dvb_v5_fe_parms are allocated from it. Such tables
+ * are freed by dvb_table_arena_reset() or dvb_table_arena_free(): passing
+ * them to dvb_table_*_free(), dvb_desc_free() or
+ * dvb_scan_free_handler_table() is harmless, as those leave the memory of
+ * an arena alone.
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_TABLE_ARENA_H
+#define _DVB_TABLE_ARENA_H
+
+#include <stddef.h>
+
+#include <libdvbv5/dvb-fe.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct dvb_table_arena
+ * @ingroup dvb_table
+ * @brief Opaque arena handler
+ */
+struct dvb_table_arena;
+
+/**
+ * @brief Allocates an arena for the parsed tables
+ * @ingroup dvb_table
+ *
+ * @param chunk_size	Size of each memory block allocated by the arena.
+ *			If zero, a default of 64 KiB is used.
+ *
+ * @return Returns an arena on success, NULL otherwise.
+ */
+struct dvb_table_arena *dvb_table_arena_alloc(size_t chunk_size);
+
+/**
+ * @brief Frees all tables parsed into the arena, keeping its memory
+ * @ingroup dvb_table
+ *
+ * @param arena	Arena to reset
+ */
+void dvb_table_arena_reset(struct dvb_table_arena *arena);
+
+/**
+ * @brief Frees all tables parsed into the arena, and the arena itself
+ * @ingroup dvb_table
+ *
+ * @param arena	Arena to free
+ */
+void dvb_table_arena_free(struct dvb_table_arena *arena);
+
+/**
+ * @brief Sets the arena used by the table parsers
+ * @ingroup dvb_table
+ *
+ * @param parms	Pointer to struct dvb_v5_fe_parms, as passed to the parsers
+ * @param arena	Arena to use, or NULL to go back to the normal allocator
+ *
+ * @return Returns the arena used before.
+ */
+struct dvb_table_arena *dvb_table_arena_set(struct dvb_v5_fe_parms *parms,
+					    struct dvb_table_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
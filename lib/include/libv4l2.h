@@ -100,6 +100,12 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Convert frames ahead in a background thread when emulating read() using
+   streaming mode, so that the next frame gets dequeued and converted while
+   the app is still busy with the previous one. v4l2_read() then only copies
+   out an already converted frame. This can also be enabled by setting the
+   LIBV4L2_READ_AHEAD environment variable. */
+#define V4L2_ENABLE_READ_AHEAD 0x04
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
@@ -56,6 +56,7 @@
 #include <libdvbv5/desc_ca.h>
 #include <libdvbv5/desc_ca_identifier.h>
 #include <libdvbv5/desc_extension.h>
+#include "dvb-table-arena-priv.h"
 
 static void dvb_desc_init(uint8_t type, uint8_t length, struct dvb_desc *desc)
 {
@@ -186,7 +187,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			return -2;
 		}
 
-		current = calloc(1, size);
+		current = dvb_table_calloc(parms, 1, size);
 		if (!current) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -198,9 +199,13 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			if (parms->verbose)
 				dvb_hexdump(parms, "content: ", ptr, desc_len);
 
-			free(current);
+			dvb_table_free(current);
 			return -4;
 		}
+		if (dvb_table_arena_add_desc(parms, current) < 0) {
+			dvb_logerr("%s: out of memory", __func__);
+			return -3;
+		}
 		if (!*head_desc)
 			*head_desc = current;
 		if (last)
@@ -229,6 +234,9 @@ void dvb_desc_free(struct dvb_desc **list)
 	while (desc) {
 		struct dvb_desc *tmp = desc;
 		desc = desc->next;
+		/* The arena frees the descriptors it owns on reset */
+		if (dvb_table_arena_owns(tmp))
+			continue;
 		if (dvb_descriptors[tmp->type].free)
 			dvb_descriptors[tmp->type].free(tmp);
 		free(tmp);
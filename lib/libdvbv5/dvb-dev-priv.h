@@ -98,4 +98,28 @@ void dvb_dev_free_devices(struct dvb_device_priv *dvb);
 /* From dvb-dev-local.c */
 void dvb_dev_local_init(struct dvb_device_priv *dvb);
 
+/*
+ * dvbv5-daemon protocol extensions, negotiated by passing a bitmask of
+ * the features the client wants to "daemon_get_version". The daemon
+ * answers with the subset it supports.
+ */
+#define REMOTE_FEAT_DATA_CHANNEL	(1 << 0)
+
+/*
+ * With REMOTE_FEAT_DATA_CHANNEL, the client opens one extra connection
+ * per demux/DVR descriptor and sends a "dev_attach_data" command on it,
+ * with the uid and the token that the "dev_open" reply had after the
+ * uid. The token is a string of REMOTE_TOKEN_LEN hex digits, that proves
+ * the connection belongs to the client that opened the descriptor.
+ * After replying, the daemon only writes read() results there, each one
+ * as this header, in big endian, followed by retval bytes of data when
+ * retval is positive. A negative retval is an error code.
+ */
+#define REMOTE_TOKEN_LEN		32
+
+struct dvb_remote_data_hdr {
+	int32_t uid;
+	int32_t retval;
+};
+
 #endif
@@ -28,6 +28,7 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <libudev.h>
 #include <stdarg.h>
@@ -38,6 +39,7 @@
 #include <unistd.h>
 #include <resolv.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
 #include "dvb-fe-priv.h"
@@ -66,7 +68,26 @@ const char *daemon_version = "dvbv5-daemon version " V4L_UTILS_VERSION;
  * Internal data structures
  */
 
-#define RINGBUF_SIZE (REMOTE_BUF_SIZE * 32)
+/*
+ * Size of the per-descriptor ring buffer, used until the application
+ * calls dvb_dev_set_bufsize(). Both get rounded up to a power of two.
+ * The minimum size should fit at least two "data_read" messages.
+ */
+#define RINGBUF_SIZE		(REMOTE_BUF_SIZE * 32)
+#define RINGBUF_MIN_SIZE	(1 << 15)
+
+/*
+ * Single producer/single consumer ring: receive_data() is the only
+ * writer and the application thread calling dvb_dev_read() is the only
+ * reader. head and tail are free-running counters; the writer owns head
+ * and the reader owns tail, so no lock is needed on the data path.
+ * A reader that finds the ring empty sets "waiting" and sleeps on the
+ * eventfd, which the writer kicks only when someone is waiting.
+ */
+struct ringbuf_data {
+	size_t size;
+	char buf[];
+};
 
 struct ringbuffer {
 	/* Should be the first member of struct */
@@ -74,9 +95,19 @@ struct ringbuffer {
 
 	/* ringbuffer handling */
 	int rc;
-	ssize_t read, write;
-	char buf[RINGBUF_SIZE];
-	pthread_mutex_t lock;
+	struct ringbuf_data *data;
+	size_t head, tail;
+
+	/* Set by dvb_remote_set_bufsize(), applied by the writer when empty */
+	struct ringbuf_data *new_data;
+
+	int wake_fd;
+	int waiting;
+
+	/* Binary data channel, if negotiated with the daemon */
+	int data_fd;
+	pthread_t data_id;
+	char data_token[REMOTE_TOKEN_LEN + 1];
 };
 
 #define CMD_SIZE	80
@@ -99,6 +130,7 @@ struct dvb_dev_remote_priv {
 	struct sockaddr_in addr;
 
 	int seq, disconnected;
+	int features;
 
 	dvb_dev_change_t notify_dev_change;
 
@@ -520,8 +552,44 @@ static ssize_t scan_data(struct dvb_v5_fe_parms_priv *parms, char *buf,
 	return p - buf;
 }
 
-static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
+static struct ringbuf_data *alloc_ringbuf_data(size_t size)
+{
+	struct ringbuf_data *data;
+	size_t ring_size = RINGBUF_MIN_SIZE;
+
+	/* The ring size should be a power of two */
+	while (ring_size < size)
+		ring_size <<= 1;
+
+	data = malloc(sizeof(*data) + ring_size);
+	if (data)
+		data->size = ring_size;
+
+	return data;
+}
+
+static void wake_ringbuffer(struct ringbuffer *ringbuf)
+{
+	uint64_t val = 1;
+
+	if (__atomic_exchange_n(&ringbuf->waiting, 0, __ATOMIC_SEQ_CST)) {
+		if (write(ringbuf->wake_fd, &val, sizeof(val)) < 0)
+			return;
+	}
+}
+
+static void error_ringbuffer(struct dvb_open_descriptor *open_dev, int rc)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+
+	__atomic_store_n(&ringbuf->rc, rc, __ATOMIC_RELEASE);
+	wake_ringbuffer(ringbuf);
+}
+
+static void dvb_dev_remote_disconnect(struct dvb_device_priv *dvb)
 {
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
 	struct queued_msg *msg;
 
 	priv->disconnected = 1;
@@ -530,6 +598,11 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 		msg->retval = -ENODEV;
 		pthread_cond_signal(&msg->cond);
 	}
+
+	/* Wake up anyone blocked at dvb_dev_read() */
+	for (cur = dvb->open_list.next; cur; cur = cur->next)
+		wake_ringbuffer((struct ringbuffer *)cur);
+
 	/* Close the socket */
 	if (priv->fd > 0) {
 		close(priv->fd);
@@ -537,70 +610,158 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 	}
 }
 
+/*
+ * Returns the ring data where the writer can store size bytes at head,
+ * or NULL if they don't fit.
+ */
+static struct ringbuf_data *room_ringbuffer(struct ringbuffer *ringbuf,
+					    size_t size)
+{
+	struct ringbuf_data *data;
+	size_t head = ringbuf->head, tail;
+
+	tail = __atomic_load_n(&ringbuf->tail, __ATOMIC_ACQUIRE);
+
+	/*
+	 * Switch to a buffer allocated by dvb_remote_set_bufsize() only
+	 * when the reader has consumed everything, as it may still be
+	 * copying from the old one otherwise.
+	 */
+	if (head == tail &&
+	    __atomic_load_n(&ringbuf->new_data, __ATOMIC_RELAXED)) {
+		data = __atomic_exchange_n(&ringbuf->new_data, NULL,
+					   __ATOMIC_ACQUIRE);
+		if (data) {
+			free(ringbuf->data);
+			ringbuf->data = data;
+		}
+	}
+	data = ringbuf->data;
+
+	/* Drop the data on overflows, as the kernel does for a DVR */
+	if (data->size - (head - tail) < size) {
+		error_ringbuffer(&ringbuf->open_dev, -EOVERFLOW);
+		return NULL;
+	}
+
+	return data;
+}
+
+static void commit_ringbuffer(struct ringbuffer *ringbuf, size_t size)
+{
+	__atomic_store_n(&ringbuf->head, ringbuf->head + size,
+			 __ATOMIC_SEQ_CST);
+	wake_ringbuffer(ringbuf);
+}
+
 static void write_ringbuffer(struct dvb_open_descriptor *open_dev,
 			    ssize_t size, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t len = size, split;
+	struct ringbuf_data *data;
+	size_t pos, split;
 
-	pthread_mutex_lock(&ringbuf->lock);
+	data = room_ringbuffer(ringbuf, size);
+	if (!data)
+		return;
 
-	split = (ringbuf->write + size > RINGBUF_SIZE) ?
-		 RINGBUF_SIZE - ringbuf->write : 0;
+	pos = ringbuf->head & (data->size - 1);
+	split = data->size - pos;
+	if (split > (size_t)size)
+		split = size;
 
-	if (split > 0) {
-		memcpy(&ringbuf->buf[ringbuf->write], buf, split);
-		buf += split;
-		len -= split;
-		ringbuf->write = 0;
+	memcpy(&data->buf[pos], buf, split);
+	memcpy(data->buf, buf + split, size - split);
+
+	commit_ringbuffer(ringbuf, size);
+}
+
+/* Same as write_ringbuffer(), but receiving the data from a socket */
+static int recv_ringbuffer(struct dvb_open_descriptor *open_dev,
+			   int fd, size_t size)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	struct ringbuf_data *data;
+	char discard[REMOTE_BUF_SIZE];
+	size_t pos, split;
+
+	data = room_ringbuffer(ringbuf, size);
+	if (!data) {
+		if (recv(fd, discard, size, MSG_WAITALL) != (ssize_t)size)
+			return -1;
+		return 0;
 	}
 
-	memcpy(&ringbuf->buf[ringbuf->write], buf, len);
-	ringbuf->write = (ringbuf->write + len) % RINGBUF_SIZE;
+	pos = ringbuf->head & (data->size - 1);
+	split = data->size - pos;
+	if (split > size)
+		split = size;
 
-	/* Detect buffer overflows */
-	if ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < size)
-		ringbuf->rc = -EOVERFLOW;
+	if (recv(fd, &data->buf[pos], split, MSG_WAITALL) != (ssize_t)split)
+		return -1;
+	if (split < size &&
+	    recv(fd, data->buf, size - split, MSG_WAITALL) != (ssize_t)(size - split))
+		return -1;
 
-	pthread_mutex_unlock(&ringbuf->lock);
+	commit_ringbuffer(ringbuf, size);
+
+	return 0;
 }
 
-static void read_ringbuffer(struct dvb_open_descriptor *open_dev,
-			    size_t *len, char *buf)
+static ssize_t read_ringbuffer(struct dvb_open_descriptor *open_dev,
+			       size_t len, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t size, split;
-
-	/* Sets the read size */
-	if (*len > REMOTE_BUF_SIZE)
-		*len = REMOTE_BUF_SIZE;
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	struct ringbuf_data *data;
+	size_t tail = ringbuf->tail, head, pos, split;
+	uint64_t val;
+	int rc;
 
 	/* Wait for data to arrive */
-	pthread_mutex_lock(&ringbuf->lock);
-	while ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < *len) {
-		pthread_mutex_unlock(&ringbuf->lock);
-		usleep(1);
-		pthread_mutex_lock(&ringbuf->lock);
+	for (;;) {
+		head = __atomic_load_n(&ringbuf->head, __ATOMIC_ACQUIRE);
+		if (head != tail)
+			break;
+
+		rc = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_ACQUIRE);
+		if (rc)
+			return rc;
+		if (priv->disconnected)
+			return -ENODEV;
+
+		/*
+		 * Re-check after announcing that we're going to sleep,
+		 * in order to not miss a wakeup from the writer.
+		 */
+		__atomic_store_n(&ringbuf->waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ringbuf->head, __ATOMIC_SEQ_CST) != tail ||
+		    __atomic_load_n(&ringbuf->rc, __ATOMIC_SEQ_CST) ||
+		    priv->disconnected) {
+			__atomic_store_n(&ringbuf->waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (read(ringbuf->wake_fd, &val, sizeof(val)) < 0 &&
+		    errno != EINTR)
+			return -errno;
 	}
 
-	size = *len;
+	/* Return whatever is there, up to len bytes */
+	if (len > head - tail)
+		len = head - tail;
 
-	*len = 0;
-	split = (ringbuf->read + size > RINGBUF_SIZE) ? RINGBUF_SIZE - ringbuf->read : 0;
-	if (split > 0) {
+	data = ringbuf->data;
+	pos = tail & (data->size - 1);
+	split = data->size - pos;
+	if (split > len)
+		split = len;
 
-		memcpy(buf, &ringbuf->buf[ringbuf->read], split);
-		buf += split;
-		size -= split;
-		*len += split;
-		ringbuf->read = 0;
-	}
-	memcpy(buf, &ringbuf->buf[ringbuf->read], size);
-	*len += size;
+	memcpy(buf, &data->buf[pos], split);
+	memcpy(buf + split, data->buf, len - split);
 
-	ringbuf->read = (ringbuf->read + size) % RINGBUF_SIZE;
+	__atomic_store_n(&ringbuf->tail, tail + len, __ATOMIC_RELEASE);
 
-	pthread_mutex_unlock(&ringbuf->lock);
+	return len;
 }
 
 static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
@@ -649,7 +810,7 @@ static void *receive_data(void *privdata)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
 		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
@@ -660,7 +821,7 @@ static void *receive_data(void *privdata)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
 
@@ -717,11 +878,9 @@ static void *receive_data(void *privdata)
 				found = 0;
 				for (cur = dvb->open_list.next; cur; cur = cur->next) {
 					if (cur->fd == uid) {
-						struct ringbuffer *ringbuf = (struct ringbuffer *)cur;
-
 						found = 1;
 						if (retval < 0) {
-							ringbuf->rc = retval;
+							error_ringbuffer(cur, retval);
 							continue;
 						}
 						write_ringbuffer(cur, args_size, args);
@@ -777,6 +936,50 @@ static void *receive_data(void *privdata)
 	} while (1);
 }
 
+/*
+ * Receives the data for a single demux/DVR from its data channel,
+ * storing it directly at the descriptor's ringbuffer.
+ */
+static void *receive_stream(void *privdata)
+{
+	struct ringbuffer *ringbuf = privdata;
+	struct dvb_open_descriptor *open_dev = &ringbuf->open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_remote_data_hdr hdr;
+	int32_t retval;
+
+	do {
+		if (recv(ringbuf->data_fd, &hdr, sizeof(hdr),
+			 MSG_WAITALL) != sizeof(hdr))
+			break;
+
+		if ((int32_t)be32toh(hdr.uid) != open_dev->fd) {
+			dvb_logerr("received data for unknown ID %d",
+				   (int32_t)be32toh(hdr.uid));
+			break;
+		}
+
+		retval = be32toh(hdr.retval);
+		if (retval < 0) {
+			error_ringbuffer(open_dev, retval);
+			continue;
+		}
+		if (retval > REMOTE_BUF_SIZE) {
+			dvb_logerr("data packet too big: %d", retval);
+			break;
+		}
+		if (retval && recv_ringbuffer(open_dev, ringbuf->data_fd,
+					      retval) < 0)
+			break;
+	} while (1);
+
+	/* Either closed or the daemon went away */
+	error_ringbuffer(open_dev, -ENODEV);
+
+	return NULL;
+}
+
 /*
  * Function handlers
  */
@@ -791,7 +994,8 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 	if (priv->disconnected)
 		return -ENODEV;
 
-	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "-");
+	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "%i",
+		       REMOTE_FEAT_DATA_CHANNEL);
 	if (!msg)
 		return -1;
 
@@ -810,6 +1014,11 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 		goto error;
 	}
 
+	/* Protocol extensions accepted by the daemon, if any */
+	if (msg->args_size - ret >= 4)
+		scan_data(parms, msg->args + ret, msg->args_size - ret, "%i",
+			  &priv->features);
+
 	if (strcmp(version, daemon_version)) {
 		dvb_logerr("Wrong version. Expecting '%s', received '%s'",
 			daemon_version, version);
@@ -1036,6 +1245,78 @@ error:
 
 int dvb_remote_fe_get_parms(struct dvb_v5_fe_parms *par);
 
+static int dvb_remote_close(struct dvb_open_descriptor *open_dev);
+
+/*
+ * Opens a dedicated connection for the data of a demux/DVR, in order to
+ * not delay the control messages when the stream is saturating the link.
+ */
+static int dvb_remote_attach_data(struct dvb_open_descriptor *open_dev)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	char buf[REMOTE_BUF_SIZE], cmd[CMD_SIZE];
+	int fd, ret, seq, retval, bufsize;
+	ssize_t size;
+	int32_t i32;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		dvb_perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&priv->addr, sizeof(priv->addr))) {
+		dvb_perror("connect");
+		goto error;
+	}
+
+	bufsize = RINGBUF_SIZE;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		       (void *)&bufsize, (int)sizeof(bufsize)))
+		dvb_perror("can't set buffer size");
+
+	size = prepare_data(parms, buf + 4, sizeof(buf) - 4, "%i%s%i%s",
+			    0, "dev_attach_data", open_dev->fd,
+			    ringbuf->data_token);
+	if (size < 0)
+		goto error;
+	i32 = htobe32(size);
+	memcpy(buf, &i32, 4);
+	if (write(fd, buf, size + 4) != size + 4) {
+		dvb_perror("write");
+		goto error;
+	}
+
+	/* Wait for the reply, before any data gets there */
+	if (recv(fd, &i32, 4, MSG_WAITALL) != 4)
+		goto error;
+	size = be32toh(i32);
+	if (size > (ssize_t)sizeof(buf) ||
+	    recv(fd, buf, size, MSG_WAITALL) != size)
+		goto error;
+	ret = scan_data(parms, buf, size, "%i%s%i", &seq, cmd, &retval);
+	if (ret < 0 || strcmp(cmd, "dev_attach_data") || retval < 0) {
+		dvb_logerr("can't attach a data channel to #%d", open_dev->fd);
+		goto error;
+	}
+
+	ringbuf->data_fd = fd;
+	ret = pthread_create(&ringbuf->data_id, NULL, receive_stream, ringbuf);
+	if (ret) {
+		dvb_perror("pthread_create");
+		ringbuf->data_fd = -1;
+		goto error;
+	}
+
+	return 0;
+
+error:
+	close(fd);
+	return -1;
+}
+
 static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 						   const char *sysname,
 						   int flags)
@@ -1045,7 +1326,7 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	struct dvb_open_descriptor *open_dev, *cur;
 	struct ringbuffer *ringbuf;
 	struct queued_msg *msg;
-	int ret;
+	int ret, remote_flags = 0;
 
 	if (priv->disconnected)
 		return NULL;
@@ -1057,12 +1338,25 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	}
 	open_dev = &ringbuf->open_dev;
 
-	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i", sysname, flags);
-	if (!msg) {
-		free(ringbuf);
-		return NULL;
+	/* Initialize ringbuffer data*/
+	ringbuf->data = alloc_ringbuf_data(RINGBUF_SIZE);
+	ringbuf->wake_fd = eventfd(0, EFD_CLOEXEC);
+	ringbuf->data_fd = -1;
+	if (!ringbuf->data || ringbuf->wake_fd < 0) {
+		dvb_perror("Can't create ringbuffer");
+		goto err_ringbuf;
 	}
 
+	/* Tell the daemon to wait for a data channel before reading */
+	if ((priv->features & REMOTE_FEAT_DATA_CHANNEL) &&
+	    (strstr(sysname, "dvr") || strstr(sysname, "demux")))
+		remote_flags = REMOTE_FEAT_DATA_CHANNEL;
+
+	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i%i", sysname, flags,
+		       remote_flags);
+	if (!msg)
+		goto err_ringbuf;
+
 	ret = pthread_cond_wait(&msg->cond, &msg->lock);
 	if (ret < 0) {
 		dvb_logerr("error waiting for %s response", msg->cmd);
@@ -1072,14 +1366,23 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	if (msg->retval < 0)
 		goto error;
 
+	/*
+	 * The daemon only accepts a data channel that knows the token.
+	 * Without it, attaching the channel fails, closing the device.
+	 */
+	if (remote_flags & REMOTE_FEAT_DATA_CHANNEL) {
+		char token[REMOTE_BUF_SIZE];
+
+		if (scan_data(parms, msg->args, msg->args_size, "%s", token) >= 0 &&
+		    strlen(token) == REMOTE_TOKEN_LEN)
+			strcpy(ringbuf->data_token, token);
+	}
+
 	/* Add the fd to the open descriptor's list */
 	open_dev->fd = msg->retval;
 	open_dev->dev = NULL;
 	open_dev->dvb = dvb;
 
-	/* Initialize ringbuffer data*/
-	pthread_mutex_init(&ringbuf->lock, NULL);
-
 	cur = &dvb->open_list;
 	while (cur->next)
 		cur = cur->next;
@@ -1089,6 +1392,12 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	if (strstr(sysname, "frontend"))
 		dvb_remote_fe_get_parms(dvb->d.fe_parms);
 
+	if ((remote_flags & REMOTE_FEAT_DATA_CHANNEL) &&
+	    dvb_remote_attach_data(open_dev) < 0) {
+		dvb_remote_close(open_dev);
+		return NULL;
+	}
+
 	return open_dev;
 
 error:
@@ -1096,6 +1405,10 @@ error:
 	pthread_mutex_unlock(&msg->lock);
 
 	free_msg(dvb, msg);
+err_ringbuf:
+	if (ringbuf->wake_fd >= 0)
+		close(ringbuf->wake_fd);
+	free(ringbuf->data);
 	free(ringbuf);
 	return NULL;
 }
@@ -1135,7 +1448,14 @@ error:
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
 			cur->next = open_dev->next;
-			pthread_mutex_destroy(&ringbuffer->lock);
+			if (ringbuffer->data_fd >= 0) {
+				shutdown(ringbuffer->data_fd, SHUT_RDWR);
+				pthread_join(ringbuffer->data_id, NULL);
+				close(ringbuffer->data_fd);
+			}
+			close(ringbuffer->wake_fd);
+			free(ringbuffer->new_data);
+			free(ringbuffer->data);
 			free(ringbuffer);
 			goto ret;
 		}
@@ -1209,6 +1529,21 @@ static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 
 	ret = msg->retval;
 
+	/* Resize the local ringbuffer to match the remote buffer */
+	if (!ret && bufsize > 0) {
+		struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+		struct ringbuf_data *data;
+
+		data = alloc_ringbuf_data(bufsize);
+		if (!data) {
+			dvb_perror("Can't resize ringbuffer");
+			goto error;
+		}
+		data = __atomic_exchange_n(&ringbuf->new_data, data,
+					   __ATOMIC_RELEASE);
+		free(data);
+	}
+
 error:
 	msg->seq = 0; /* Avoids any risk of a recursive call */
 	pthread_mutex_unlock(&msg->lock);
@@ -1228,15 +1563,11 @@ static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
-	if (ringbuf->rc) {
-		ret = ringbuf->rc;
-		ringbuf->rc = 0;
+	ret = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_ACQUIRE);
+	if (ret)
 		return ret;
-	}
-
-	read_ringbuffer(open_dev, &count, buf);
 
-	return count;
+	return read_ringbuffer(open_dev, count, buf);
 }
 
 static int dvb_remote_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
@@ -1680,7 +2011,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	pthread_cancel(priv->recv_id);
 
 	/* Cancel any pending messages */
-	dvb_dev_remote_disconnect(priv);
+	dvb_dev_remote_disconnect(dvb);
 
 	/* Give some time any pending message to be handled */
 	do {
@@ -0,0 +1,652 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * Incremental cache of EIT sections, as defined at ETSI EN 300 468.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/descriptors.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+#define EPG_MAGIC		"DVBEPG01"
+#define EPG_MIN_RECORDS		256
+
+/* Section header, up to the last_table_id, plus the CRC */
+#define EIT_HEADER_SIZE		14
+#define EIT_MIN_SECTION		(EIT_HEADER_SIZE + DVB_CRC_SIZE)
+#define EIT_EVENT_SIZE		12
+#define EIT_MAX_EVENTS		((DVB_MAX_PAYLOAD_PACKET_SIZE - EIT_MIN_SECTION) / \
+				 EIT_EVENT_SIZE)
+
+/*
+ * The cache, either at a mapped file or at the heap, is a header followed
+ * by an array of fixed size records, one per section. Records are never
+ * removed: a section dropped from a table just gets a zero length, and
+ * its record is reused if the section comes back.
+ */
+struct epg_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t num_records;
+	uint32_t max_records;
+	uint32_t reserved[11];
+};
+
+struct epg_record {
+	struct dvb_epg_key key;
+	uint8_t version;
+	uint8_t reserved;
+	uint16_t len;		/* 0 if the section was removed */
+	uint32_t crc;
+	uint8_t data[DVB_MAX_PAYLOAD_PACKET_SIZE];
+};
+
+/* Raw contents of an event, used to tell if it changed */
+struct epg_event_ref {
+	uint16_t id;
+	uint16_t len;
+	const uint8_t *p;
+};
+
+struct dvb_epg {
+	struct dvb_v5_fe_parms_priv *parms;
+	int fd;				/* -1 if not stored at a file */
+	struct epg_header *hdr;
+	size_t map_size;
+
+	/* Open addressing hash: record index + 1, or 0 if empty */
+	uint32_t *hash;
+	unsigned hash_bits;
+
+	dvb_epg_cb cb;
+	void *priv;
+
+	struct epg_event_ref old_ev[EIT_MAX_EVENTS];
+	struct epg_event_ref new_ev[EIT_MAX_EVENTS];
+};
+
+static inline struct epg_record *epg_records(struct dvb_epg *epg)
+{
+	return (struct epg_record *)(epg->hdr + 1);
+}
+
+static inline size_t epg_size(unsigned records)
+{
+	return sizeof(struct epg_header) +
+	       (size_t)records * sizeof(struct epg_record);
+}
+
+static unsigned epg_hash(const struct dvb_epg_key *key, unsigned bits)
+{
+	uint64_t h;
+
+	h = (uint64_t)key->network_id << 48 | (uint64_t)key->transport_id << 32 |
+	    (uint64_t)key->service_id << 16 | key->table_id << 8 | key->section;
+	h *= 0x9e3779b97f4a7c15ULL;
+
+	return h >> (64 - bits);
+}
+
+static int epg_key_equal(const struct dvb_epg_key *a,
+			 const struct dvb_epg_key *b)
+{
+	return a->network_id == b->network_id &&
+	       a->transport_id == b->transport_id &&
+	       a->service_id == b->service_id &&
+	       a->table_id == b->table_id &&
+	       a->section == b->section;
+}
+
+static struct epg_record *epg_lookup(struct dvb_epg *epg,
+				     const struct dvb_epg_key *key)
+{
+	unsigned mask = (1U << epg->hash_bits) - 1;
+	unsigned i = epg_hash(key, epg->hash_bits);
+	struct epg_record *rec;
+
+	for (; epg->hash[i]; i = (i + 1) & mask) {
+		rec = &epg_records(epg)[epg->hash[i] - 1];
+		if (epg_key_equal(&rec->key, key))
+			return rec;
+	}
+	return NULL;
+}
+
+static void epg_hash_add(struct dvb_epg *epg, uint32_t idx)
+{
+	unsigned mask = (1U << epg->hash_bits) - 1;
+	unsigned i = epg_hash(&epg_records(epg)[idx].key, epg->hash_bits);
+
+	while (epg->hash[i])
+		i = (i + 1) & mask;
+	epg->hash[i] = idx + 1;
+}
+
+/* Keeps the hash at most half full */
+static int epg_hash_resize(struct dvb_epg *epg, unsigned records)
+{
+	unsigned bits = 8;
+	uint32_t i;
+
+	while ((1U << bits) < 2 * records)
+		bits++;
+	if (epg->hash && bits <= epg->hash_bits)
+		return 0;
+
+	free(epg->hash);
+	epg->hash = calloc(1U << bits, sizeof(*epg->hash));
+	if (!epg->hash)
+		return -ENOMEM;
+	epg->hash_bits = bits;
+
+	for (i = 0; i < epg->hdr->num_records; i++)
+		epg_hash_add(epg, i);
+
+	return 0;
+}
+
+static int epg_grow(struct dvb_epg *epg)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	unsigned max = epg->hdr->max_records;
+	size_t size;
+	void *p;
+	int ret;
+
+	max = max ? max * 2 : EPG_MIN_RECORDS;
+	size = epg_size(max);
+
+	if (epg->fd >= 0) {
+		if (ftruncate(epg->fd, size) < 0) {
+			ret = -errno;
+			dvb_perror(_("EPG cache: can't grow the file"));
+			return ret;
+		}
+		p = mremap(epg->hdr, epg->map_size, size, MREMAP_MAYMOVE);
+		if (p == MAP_FAILED) {
+			ret = -errno;
+			dvb_perror(_("EPG cache: can't map the file"));
+			return ret;
+		}
+	} else {
+		p = realloc(epg->hdr, size);
+		if (!p) {
+			dvb_logerr(_("EPG cache: out of memory"));
+			return -ENOMEM;
+		}
+	}
+	epg->hdr = p;
+	epg->map_size = size;
+	epg->hdr->max_records = max;
+
+	return 0;
+}
+
+static struct epg_record *epg_insert(struct dvb_epg *epg,
+				     const struct dvb_epg_key *key)
+{
+	struct epg_record *rec;
+	uint32_t idx = epg->hdr->num_records;
+
+	if (idx == epg->hdr->max_records && epg_grow(epg) < 0)
+		return NULL;
+	if (epg_hash_resize(epg, idx + 1) < 0)
+		return NULL;
+
+	rec = &epg_records(epg)[idx];
+	memset(rec, 0, offsetof(struct epg_record, data));
+	rec->key = *key;
+	epg->hdr->num_records++;
+	epg_hash_add(epg, idx);
+
+	return rec;
+}
+
+static int epg_map_file(struct dvb_epg *epg, const char *fname)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct epg_header *hdr;
+	struct stat st;
+	int ret;
+
+	epg->fd = open(fname, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (epg->fd < 0) {
+		ret = -errno;
+		dvb_perror(fname);
+		return ret;
+	}
+	if (fstat(epg->fd, &st) < 0) {
+		ret = -errno;
+		dvb_perror(fname);
+		return ret;
+	}
+	if (!st.st_size) {
+		if (ftruncate(epg->fd, sizeof(*hdr)) < 0) {
+			ret = -errno;
+			dvb_perror(fname);
+			return ret;
+		}
+		st.st_size = sizeof(*hdr);
+	} else if ((size_t)st.st_size < sizeof(*hdr)) {
+		goto invalid;
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   epg->fd, 0);
+	if (hdr == MAP_FAILED) {
+		ret = -errno;
+		dvb_perror(fname);
+		return ret;
+	}
+	epg->hdr = hdr;
+	epg->map_size = st.st_size;
+
+	if (st.st_size == sizeof(*hdr) && !hdr->magic[0]) {
+		memcpy(hdr->magic, EPG_MAGIC, sizeof(hdr->magic));
+		hdr->record_size = sizeof(struct epg_record);
+		return 0;
+	}
+
+	if (memcmp(hdr->magic, EPG_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->record_size != sizeof(struct epg_record) ||
+	    hdr->num_records > hdr->max_records ||
+	    epg_size(hdr->max_records) > (size_t)st.st_size)
+		goto invalid;
+
+	return 0;
+
+invalid:
+	dvb_logerr(_("%s: not an EPG cache file"), fname);
+	return -EINVAL;
+}
+
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *p, const char *fname)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_epg *epg;
+
+	epg = calloc(1, sizeof(*epg));
+	if (!epg) {
+		dvb_logerr(_("EPG cache: out of memory"));
+		return NULL;
+	}
+	epg->parms = parms;
+	epg->fd = -1;
+
+	if (fname) {
+		if (epg_map_file(epg, fname) < 0)
+			goto err;
+	} else {
+		epg->hdr = calloc(1, sizeof(*epg->hdr));
+		if (!epg->hdr)
+			goto err;
+		memcpy(epg->hdr->magic, EPG_MAGIC, sizeof(epg->hdr->magic));
+		epg->hdr->record_size = sizeof(struct epg_record);
+		epg->map_size = sizeof(*epg->hdr);
+	}
+
+	if (epg_hash_resize(epg, epg->hdr->num_records) < 0)
+		goto err;
+
+	if (parms->p.verbose && epg->hdr->num_records)
+		dvb_log(_("EPG cache: %u sections loaded from %s"),
+			epg->hdr->num_records, fname);
+
+	return epg;
+
+err:
+	dvb_epg_free(epg);
+	return NULL;
+}
+
+void dvb_epg_free(struct dvb_epg *epg)
+{
+	if (!epg)
+		return;
+
+	if (epg->fd >= 0) {
+		if (epg->hdr)
+			munmap(epg->hdr, epg->map_size);
+		close(epg->fd);
+	} else {
+		free(epg->hdr);
+	}
+	free(epg->hash);
+	free(epg);
+}
+
+void dvb_epg_set_callback(struct dvb_epg *epg, dvb_epg_cb cb, void *priv)
+{
+	epg->cb = cb;
+	epg->priv = priv;
+}
+
+static int epg_parse(struct dvb_epg *epg, const uint8_t *buf, size_t len,
+		     struct dvb_table_eit **eit)
+{
+	ssize_t ret;
+
+	*eit = NULL;
+	ret = dvb_table_eit_init(&epg->parms->p, buf, len - DVB_CRC_SIZE, eit);
+	if (ret < 0) {
+		if (*eit)
+			dvb_table_eit_free(*eit);
+		*eit = NULL;
+		return ret;
+	}
+	return 0;
+}
+
+static unsigned epg_split_events(const uint8_t *buf, size_t len,
+				 struct epg_event_ref *ev)
+{
+	const uint8_t *p = buf + EIT_HEADER_SIZE;
+	const uint8_t *end = buf + len - DVB_CRC_SIZE;
+	unsigned n = 0, size;
+
+	while (p + EIT_EVENT_SIZE <= end && n < EIT_MAX_EVENTS) {
+		size = EIT_EVENT_SIZE + (((p[10] & 0x0f) << 8) | p[11]);
+		if (p + size > end)
+			size = end - p;
+		ev[n].id = p[0] << 8 | p[1];
+		ev[n].len = size;
+		ev[n].p = p;
+		n++;
+		p += size;
+	}
+	return n;
+}
+
+static const struct epg_event_ref *
+epg_find_event(const struct epg_event_ref *ev, unsigned num, uint16_t id)
+{
+	unsigned i;
+
+	for (i = 0; i < num; i++)
+		if (ev[i].id == id)
+			return &ev[i];
+	return NULL;
+}
+
+/*
+ * Compares the raw events of the old and the new version of a section,
+ * reporting the ones that differ. The old section is only parsed if some
+ * of its events were removed.
+ */
+static void epg_report(struct dvb_epg *epg, const struct dvb_epg_key *key,
+		       const struct epg_record *rec,
+		       const uint8_t *buf, size_t len,
+		       struct dvb_table_eit *eit)
+{
+	const struct epg_event_ref *o, *n;
+	struct dvb_table_eit *old_eit;
+	unsigned num_old = 0, num_new = 0, i;
+	int removed = 0;
+
+	if (rec->len)
+		num_old = epg_split_events(rec->data, rec->len, epg->old_ev);
+	if (buf)
+		num_new = epg_split_events(buf, len, epg->new_ev);
+
+	dvb_eit_event_foreach(event, eit) {
+		n = epg_find_event(epg->new_ev, num_new, event->event_id);
+		o = epg_find_event(epg->old_ev, num_old, event->event_id);
+		if (!o)
+			epg->cb(epg->priv, key, DVB_EPG_EVENT_ADDED, event);
+		else if (!n || n->len != o->len || memcmp(n->p, o->p, n->len))
+			epg->cb(epg->priv, key, DVB_EPG_EVENT_CHANGED, event);
+	}
+
+	for (i = 0; i < num_old && !removed; i++)
+		if (!epg_find_event(epg->new_ev, num_new, epg->old_ev[i].id))
+			removed = 1;
+	if (!removed || epg_parse(epg, rec->data, rec->len, &old_eit) < 0)
+		return;
+
+	dvb_eit_event_foreach(event, old_eit) {
+		if (!epg_find_event(epg->new_ev, num_new, event->event_id))
+			epg->cb(epg->priv, key, DVB_EPG_EVENT_REMOVED, event);
+	}
+	if (old_eit)
+		dvb_table_eit_free(old_eit);
+}
+
+/*
+ * A new version of a table may have less sections than the previous one:
+ * drop the sections past its last_section_number.
+ */
+static void epg_trim_table(struct dvb_epg *epg, struct dvb_epg_key key,
+			   uint8_t version, uint8_t last_section)
+{
+	struct epg_record *rec;
+	unsigned section;
+
+	for (section = last_section + 1; section < 256; section++) {
+		key.section = section;
+		rec = epg_lookup(epg, &key);
+		if (!rec || !rec->len || rec->version == version)
+			continue;
+		if (epg->cb)
+			epg_report(epg, &key, rec, NULL, 0, NULL);
+		rec->len = 0;
+	}
+}
+
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf, size_t len)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_table_eit *eit;
+	struct dvb_epg_key key;
+	struct epg_record *rec;
+	uint8_t version;
+	uint32_t crc;
+	size_t size;
+	int ret;
+
+	if (!len || buf[0] < DVB_TABLE_EIT ||
+	    buf[0] > DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f)
+		return 0;
+
+	size = 3 + (((buf[1] & 0x0f) << 8) | buf[2]);
+	if (len < EIT_MIN_SECTION || size < EIT_MIN_SECTION || size > len ||
+	    size > DVB_MAX_PAYLOAD_PACKET_SIZE) {
+		dvb_logerr(_("%s: invalid EIT section"), __func__);
+		return -EINVAL;
+	}
+	len = size;
+
+	/* current_next_indicator: not applicable yet */
+	if (!(buf[5] & 0x01))
+		return 0;
+
+	version = (buf[5] >> 1) & 0x1f;
+	crc = (uint32_t)buf[len - 4] << 24 | buf[len - 3] << 16 |
+	      buf[len - 2] << 8 | buf[len - 1];
+
+	key.table_id = buf[0];
+	key.service_id = buf[3] << 8 | buf[4];
+	key.section = buf[6];
+	key.transport_id = buf[8] << 8 | buf[9];
+	key.network_id = buf[10] << 8 | buf[11];
+
+	rec = epg_lookup(epg, &key);
+	if (rec && rec->len && rec->version == version && rec->crc == crc)
+		return 0;
+
+	ret = epg_parse(epg, buf, len, &eit);
+	if (ret < 0)
+		return ret;
+
+	if (!rec) {
+		rec = epg_insert(epg, &key);
+		if (!rec) {
+			dvb_table_eit_free(eit);
+			return -ENOMEM;
+		}
+	}
+
+	if (epg->cb)
+		epg_report(epg, &key, rec, buf, len, eit);
+	dvb_table_eit_free(eit);
+
+	memcpy(rec->data, buf, len);
+	rec->len = len;
+	rec->version = version;
+	rec->crc = crc;
+
+	epg_trim_table(epg, key, version, buf[7]);
+
+	return 1;
+}
+
+void dvb_epg_sw_demux_cb(void *priv, const struct dvb_sw_demux_data *data,
+			 unsigned num)
+{
+	struct dvb_epg *epg = priv;
+	unsigned i;
+
+	for (i = 0; i < num; i++)
+		dvb_epg_add_section(epg, data[i].data, data[i].len);
+}
+
+static uint64_t epg_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int dvb_epg_read(struct dvb_epg *epg, int dmx_fd, unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	/* Table IDs 0x40 to 0x7f: the EIT ones are picked later */
+	unsigned char tid = 0x40, mask = 0xc0;
+	struct pollfd pfd = { .fd = dmx_fd, .events = POLLIN };
+	uint64_t deadline, now;
+	uint8_t *buf;
+	ssize_t len;
+	int ret, changed = 0;
+
+	buf = malloc(DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -ENOMEM;
+	}
+
+	if (dvb_set_section_filter(dmx_fd, DVB_TABLE_EIT_PID, 1, &tid, &mask,
+				   NULL, DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		free(buf);
+		dvb_dmx_stop(dmx_fd);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: reading the EIT for %u seconds"), __func__,
+			timeout);
+
+	deadline = epg_time_ms() + timeout * 1000ULL;
+	while (!parms->p.abort) {
+		now = epg_time_ms();
+		if (now >= deadline)
+			break;
+		ret = poll(&pfd, 1, deadline - now);
+		if (ret < 0 && errno != EINTR) {
+			changed = -errno;
+			dvb_perror(_("EPG cache: poll error"));
+			break;
+		}
+		if (ret <= 0)
+			continue;
+
+		len = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+		if (len < 0) {
+			if (errno == EOVERFLOW || errno == EINTR ||
+			    errno == EAGAIN)
+				continue;
+			changed = -errno;
+			dvb_perror(_("EPG cache: read error"));
+			break;
+		}
+		if (!len)
+			break;
+
+		if (dvb_epg_add_section(epg, buf, len) > 0)
+			changed++;
+	}
+
+	dvb_dmx_stop(dmx_fd);
+	free(buf);
+
+	return changed;
+}
+
+int dvb_epg_get_section(struct dvb_epg *epg, const struct dvb_epg_key *key,
+			struct dvb_table_eit **table)
+{
+	struct epg_record *rec;
+
+	*table = NULL;
+	rec = epg_lookup(epg, key);
+	if (!rec || !rec->len)
+		return -ENOENT;
+
+	return epg_parse(epg, rec->data, rec->len, table);
+}
+
+int dvb_epg_replay(struct dvb_epg *epg)
+{
+	struct dvb_table_eit *eit;
+	struct epg_record *rec;
+	uint32_t i;
+	int num = 0;
+
+	if (!epg->cb)
+		return 0;
+
+	for (i = 0; i < epg->hdr->num_records; i++) {
+		rec = &epg_records(epg)[i];
+		if (!rec->len || epg_parse(epg, rec->data, rec->len, &eit) < 0)
+			continue;
+		dvb_eit_event_foreach(event, eit)
+			epg->cb(epg->priv, &rec->key, DVB_EPG_EVENT_ADDED, event);
+		dvb_table_eit_free(eit);
+		num++;
+	}
+
+	return num;
+}
+
+int dvb_epg_sync(struct dvb_epg *epg)
+{
+	if (epg->fd < 0)
+		return 0;
+	if (msync(epg->hdr, epg->map_size, MS_SYNC) < 0)
+		return -errno;
+	return 0;
+}
@@ -78,6 +78,12 @@ struct dvb_v5_fe_parms_priv {
 
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
+
+	/* Allocator for the parsed tables, see dvb_table_arena_set() */
+	struct dvb_table_arena		*arena;
+
+	/* iconv descriptors opened by the string parser */
+	struct dvb_iconv_cache		*iconv_cache;
 };
 
 /* Functions used internally by dvb-dev.c. Aren't part of the API */
@@ -22,6 +22,7 @@
 #include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/countries.h>
 #include <libdvbv5/dvb-v5-std.h>
+#include <parse_string.h>
 
 #include <inttypes.h>
 #include <math.h>
@@ -85,6 +86,7 @@ void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms)
 	if (parms->fname)
 		free(parms->fname);
 
+	dvb_iconv_cache_free(&parms->p);
 	free(parms);
 }
 
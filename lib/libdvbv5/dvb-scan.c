@@ -27,9 +27,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -46,6 +48,7 @@
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-sw-demux.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/header.h>
 #include <libdvbv5/pat.h>
@@ -447,26 +450,623 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler)
 	free(dvb_scan_handler);
 }
 
-struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
-					     int dmx_fd,
-					     uint32_t delivery_system,
-					     unsigned other_nit,
-					     unsigned timeout_multiply)
+/*
+ * Concurrent table acquisition
+ *
+ * Instead of waiting for each table at a time, open one section filter
+ * per table, by re-opening the demux device, and wait for all of them
+ * at the same time. PMT filters are added as soon as the PAT arrives.
+ * This way, the time spent on a transponder is the time needed by its
+ * slowest table, instead of the sum of all of them.
+ *
+ * The same logic is used to read the tables from a software demux, fed
+ * by a single DVR device or TS file.
+ */
+
+/* Maximum number of section filters opened at the same time */
+#define DVB_SCAN_MAX_FILTERS	32
+
+enum dvb_table_req_status {
+	DVB_REQ_DONE = 0,
+	DVB_REQ_QUEUED,
+	DVB_REQ_ACTIVE,
+	/* negative values mean errors */
+};
+
+struct dvb_table_scan;
+
+struct dvb_table_req {
+	struct dvb_table_scan *scan;
+	struct dvb_table_filter sect;
+	struct dvb_sw_demux_filter *filter;
+	unsigned timeout;
+	uint64_t deadline;
+	int fd;
+	int status;
+	int handled;
+	int program;		/* index at the program array, for PMTs */
+};
+
+struct dvb_table_scan {
+	struct dvb_v5_fe_parms_priv *parms;
+	struct dvb_v5_descriptors *handler;
+
+	/* Demux fd, or the source of the TS packets for the software demux */
+	int fd;
+	char dmx_path[32];
+	struct dvb_sw_demux *sw;
+	int offline;		/* reading from a file: no timeouts */
+
+	struct dvb_table_req **reqs;
+	int num_reqs, num_active;
+
+	/* Indexes of the requests that others depend on */
+	int pat, vct, sdt;
+
+	unsigned pmt_timeout;
+	int other_nit;
+	uint8_t *buf;
+};
+
+static uint64_t dvb_time_ms(void)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
-	int rc;
-	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
-	int atsc_filter = 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void dvb_table_scan_init(struct dvb_table_scan *scan,
+				struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_v5_descriptors *handler,
+				int fd, struct dvb_sw_demux *sw)
+{
+	struct stat st;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->parms = parms;
+	scan->handler = handler;
+	scan->fd = fd;
+	scan->sw = sw;
+	scan->pat = -1;
+	scan->vct = -1;
+	scan->sdt = -1;
+
+	if (sw && !fstat(fd, &st) && S_ISREG(st.st_mode))
+		scan->offline = 1;
+}
+
+static int dvb_table_req_add(struct dvb_table_scan *scan,
+			     unsigned char tid, uint16_t pid, void **table,
+			     unsigned timeout, int program)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	struct dvb_table_req **reqs, *req;
+
+	reqs = realloc(scan->reqs, (scan->num_reqs + 1) * sizeof(*reqs));
+	if (!reqs)
+		goto oom;
+	scan->reqs = reqs;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		goto oom;
+
+	req->scan = scan;
+	req->sect.tid = tid;
+	req->sect.pid = pid;
+	req->sect.ts_id = -1;
+	req->sect.table = table;
+	req->timeout = timeout;
+	req->fd = -1;
+	req->status = DVB_REQ_QUEUED;
+	req->program = program;
+
+	reqs[scan->num_reqs] = req;
+	return scan->num_reqs++;
+oom:
+	dvb_logerr(_("%s: out of memory"), __func__);
+	return -1;
+}
+
+static void dvb_table_req_stop(struct dvb_table_scan *scan,
+			       struct dvb_table_req *req, int status)
+{
+	if (req->status == DVB_REQ_ACTIVE) {
+		if (req->filter) {
+			dvb_sw_demux_remove_filter(scan->sw, req->filter);
+			req->filter = NULL;
+		} else {
+			dvb_dmx_stop(req->fd);
+			close(req->fd);
+			req->fd = -1;
+		}
+		dvb_table_filter_free(&req->sect);
+		scan->num_active--;
+	}
+	req->status = status;
+}
+
+static void dvb_table_scan_free(struct dvb_table_scan *scan)
+{
+	int i;
+
+	for (i = 0; i < scan->num_reqs; i++) {
+		dvb_table_req_stop(scan, scan->reqs[i], scan->reqs[i]->status);
+		free(scan->reqs[i]);
+	}
+	free(scan->reqs);
+	free(scan->buf);
+}
+
+static void dvb_table_req_parse(struct dvb_table_req *req,
+				const uint8_t *buf, ssize_t buf_length)
+{
+	struct dvb_table_scan *scan = req->scan;
+	int ret;
+
+	ret = dvb_parse_section(scan->parms, &req->sect, buf, buf_length);
+	if (!ret) {
+		/* Like dvb_read_sections(), timeout is per section */
+		req->deadline = dvb_time_ms() + req->timeout * 1000;
+		return;
+	}
+	dvb_table_req_stop(scan, req, ret > 0 ? DVB_REQ_DONE : ret);
+}
+
+static void dvb_table_req_sw_cb(void *priv,
+				const struct dvb_sw_demux_data *data,
+				unsigned num)
+{
+	struct dvb_table_req *req = priv;
+	unsigned i;
+
+	for (i = 0; i < num && req->status == DVB_REQ_ACTIVE; i++)
+		dvb_table_req_parse(req, data[i].data, data[i].len);
+}
+
+static int dvb_table_req_start(struct dvb_table_scan *scan,
+			       struct dvb_table_req *req)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	uint8_t mask = 0xff;
+	int fd = -1, ret;
+
+	if (!scan->sw) {
+		fd = open(scan->dmx_path, O_RDWR);
+		if (fd < 0)
+			return -errno;
+	}
+
+	ret = dvb_parse_section_alloc(parms, &req->sect);
+	if (ret < 0)
+		goto err;
+
+	if (scan->sw) {
+		req->filter = dvb_sw_demux_add_section_filter(scan->sw,
+							      req->sect.pid,
+							      req->sect.tid,
+							      mask,
+							      dvb_table_req_sw_cb,
+							      req);
+		if (!req->filter) {
+			ret = -ENOMEM;
+			goto err_free;
+		}
+	} else if (dvb_set_section_filter(fd, req->sect.pid, 1,
+					  &req->sect.tid, &mask, NULL,
+					  DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		ret = -errno;
+		goto err_free;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, req->sect.tid, req->sect.pid);
+
+	req->fd = fd;
+	req->deadline = dvb_time_ms() + req->timeout * 1000;
+	req->status = DVB_REQ_ACTIVE;
+	scan->num_active++;
+
+	return 0;
+
+err_free:
+	dvb_table_filter_free(&req->sect);
+err:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+static void dvb_table_req_read(struct dvb_table_scan *scan,
+			       struct dvb_table_req *req)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	ssize_t buf_length;
+	int ret;
+
+	buf_length = read(req->fd, scan->buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (buf_length < 0 && (errno == EOVERFLOW || errno == EAGAIN ||
+			       errno == EINTR))
+		return;
+
+	if (!buf_length) {
+		dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+		ret = -1;
+	} else if (buf_length < 0) {
+		dvb_perror(_("dvb_read_section: read error"));
+		ret = -2;
+	} else if (dvb_crc32(scan->buf, buf_length, 0xFFFFFFFF) != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		ret = -3;
+	} else {
+		dvb_table_req_parse(req, scan->buf, buf_length);
+		return;
+	}
+
+	dvb_table_req_stop(scan, req, ret);
+}
+
+/* Returns -1 if the scan can't continue */
+static int dvb_table_req_done(struct dvb_table_scan *scan, int idx)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	struct dvb_v5_descriptors *handler = scan->handler;
+	struct dvb_table_req *req = scan->reqs[idx];
+	int ok = req->status == DVB_REQ_DONE;
 	unsigned num_pmt = 0;
 
-	struct dvb_v5_descriptors *dvb_scan_handler;
+	/* Just reading a table, not the ones for the transport stream */
+	if (!handler)
+		return 0;
 
-	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
-	if (!dvb_scan_handler)
-		return NULL;
+	if (idx == scan->pat) {
+		if (!ok) {
+			dvb_logerr(_("error while waiting for PAT table"));
+			return -1;
+		}
+		if (parms->p.verbose)
+			dvb_table_pat_print(&parms->p, handler->pat);
 
-	if (!timeout_multiply)
-		timeout_multiply = 1;
+		handler->program = calloc(handler->pat->programs,
+					  sizeof(*handler->program));
+		if (!handler->program && handler->pat->programs) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return -1;
+		}
+
+		dvb_pat_program_foreach(program, handler->pat) {
+			handler->program[num_pmt].pat_pgm = program;
+
+			if (!program->service_id) {
+				if (parms->p.verbose)
+					dvb_log(_("Program #%d is network PID: 0x%04x"),
+						num_pmt, program->pid);
+				num_pmt++;
+				continue;
+			}
+			if (parms->p.verbose)
+				dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
+					num_pmt, program->pid, program->service_id);
+			if (dvb_table_req_add(scan, DVB_TABLE_PMT, program->pid,
+					      (void **)&handler->program[num_pmt].pmt,
+					      scan->pmt_timeout, num_pmt) < 0)
+				return -1;
+			num_pmt++;
+		}
+		handler->num_program = num_pmt;
+		return 0;
+	}
+
+	if (idx == scan->vct) {
+		if (!ok) {
+			dvb_logerr(_("error while waiting for VCT table"));
+			return 0;
+		}
+		if (parms->p.verbose)
+			atsc_table_vct_print(&parms->p, handler->vct);
+
+		/* The SDT is only needed when there's no VCT */
+		if (scan->sdt >= 0 && !scan->other_nit &&
+		    scan->reqs[scan->sdt]->status > DVB_REQ_DONE) {
+			dvb_table_req_stop(scan, scan->reqs[scan->sdt],
+					   -ECANCELED);
+			scan->sdt = -1;
+		}
+		return 0;
+	}
+
+	switch (req->sect.tid) {
+	case DVB_TABLE_PMT:
+		if (!ok) {
+			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
+				   handler->program[req->program].pat_pgm->service_id);
+			if (handler->program[req->program].pmt)
+				dvb_table_pmt_free(handler->program[req->program].pmt);
+			handler->program[req->program].pmt = NULL;
+		} else if (parms->p.verbose) {
+			dvb_table_pmt_print(&parms->p,
+					    handler->program[req->program].pmt);
+		}
+		break;
+	case DVB_TABLE_NIT:
+	case DVB_TABLE_NIT2:
+		if (!ok)
+			dvb_logerr(_("error while reading the NIT table"));
+		else if (parms->p.verbose)
+			dvb_table_nit_print(&parms->p, *req->sect.table);
+		break;
+	case DVB_TABLE_SDT:
+	case DVB_TABLE_SDT2:
+		if (req->status == -ECANCELED)
+			break;
+		if (!ok)
+			dvb_logerr(_("error while reading the SDT table"));
+		else if (parms->p.verbose)
+			dvb_table_sdt_print(&parms->p, *req->sect.table);
+		break;
+	}
+
+	return 0;
+}
+
+/* Handles the requests that finished. Returns -1 if the scan should stop */
+static int dvb_table_scan_finish(struct dvb_table_scan *scan)
+{
+	struct dvb_table_req *req;
+	int i;
+
+	for (i = 0; i < scan->num_reqs; i++) {
+		req = scan->reqs[i];
+		if (req->status > DVB_REQ_DONE || req->handled)
+			continue;
+		req->handled = 1;
+		if (dvb_table_req_done(scan, i) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void dvb_table_scan_stop_all(struct dvb_table_scan *scan, int status)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	int i;
+
+	for (i = 0; i < scan->num_reqs; i++) {
+		if (scan->reqs[i]->status != DVB_REQ_ACTIVE)
+			continue;
+		if (status == -1)
+			dvb_logerr(_("%s: no data read on section filter"),
+				   __func__);
+		dvb_table_req_stop(scan, scan->reqs[i], status);
+	}
+}
+
+static int dvb_table_scan_queued(struct dvb_table_scan *scan)
+{
+	int i;
+
+	for (i = 0; i < scan->num_reqs; i++)
+		if (scan->reqs[i]->status == DVB_REQ_QUEUED)
+			return 1;
+	return 0;
+}
+
+/* Waits for all requests. Returns -1 if the scan can't continue */
+static int dvb_table_scan_run(struct dvb_table_scan *scan)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	struct dvb_table_req *req;
+	struct pollfd fds[DVB_SCAN_MAX_FILTERS];
+	int idx[DVB_SCAN_MAX_FILTERS];
+	uint64_t now, deadline;
+	ssize_t size;
+	int i, n, ret;
+
+	while (!parms->p.abort) {
+		/* Start as many filters as possible */
+		for (i = 0; i < scan->num_reqs; i++) {
+			req = scan->reqs[i];
+			if (req->status != DVB_REQ_QUEUED)
+				continue;
+			if (scan->num_active == DVB_SCAN_MAX_FILTERS)
+				break;
+
+			ret = dvb_table_req_start(scan, req);
+			if (ret < 0) {
+				/* Likely out of filters. Retry later */
+				if (scan->num_active)
+					break;
+				dvb_table_req_stop(scan, req, ret);
+			}
+		}
+		if (dvb_table_scan_finish(scan) < 0)
+			return -1;
+		if (!scan->num_active) {
+			if (dvb_table_scan_queued(scan))
+				continue;
+			break;
+		}
+
+		now = dvb_time_ms();
+		deadline = UINT64_MAX;
+		for (i = 0, n = 0; i < scan->num_reqs; i++) {
+			req = scan->reqs[i];
+			if (req->status != DVB_REQ_ACTIVE)
+				continue;
+			if (!scan->sw) {
+				fds[n].fd = req->fd;
+				fds[n].events = POLLIN | POLLPRI;
+				fds[n].revents = 0;
+				idx[n++] = i;
+			}
+			if (req->deadline < deadline)
+				deadline = req->deadline;
+		}
+		if (scan->sw) {
+			fds[0].fd = scan->fd;
+			fds[0].events = POLLIN | POLLPRI;
+			fds[0].revents = 0;
+			n = 1;
+		}
+
+		ret = poll(fds, n, deadline > now ? deadline - now : 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			dvb_perror("poll");
+			return -1;
+		}
+
+		if (scan->sw) {
+			size = fds[0].revents ? dvb_sw_demux_read(scan->sw,
+								  scan->fd) : 1;
+			if (!size) {
+				/* End of the stream: no more sections */
+				dvb_table_scan_stop_all(scan, -1);
+			} else if (size < 0 && size != -EOVERFLOW &&
+				   size != -EAGAIN && size != -EINTR) {
+				errno = -size;
+				dvb_perror(_("dvb_read_section: read error"));
+				dvb_table_scan_stop_all(scan, -2);
+			}
+		} else {
+			for (i = 0; i < n; i++) {
+				req = scan->reqs[idx[i]];
+				if (fds[i].revents &&
+				    req->status == DVB_REQ_ACTIVE)
+					dvb_table_req_read(scan, req);
+			}
+		}
+
+		now = dvb_time_ms();
+		for (i = 0; i < scan->num_reqs && !scan->offline; i++) {
+			req = scan->reqs[i];
+			if (req->status != DVB_REQ_ACTIVE || now < req->deadline)
+				continue;
+			dvb_logerr(_("%s: no data read on section filter"),
+				   __func__);
+			dvb_table_req_stop(scan, req, -1);
+		}
+
+		if (dvb_table_scan_finish(scan) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 0 on success, -1 if the PAT couldn't be read and 1 if the
+ * demux can't be opened more than once, in order to let the caller
+ * read one table at a time.
+ */
+static int dvb_get_ts_tables_concurrent(struct dvb_table_scan *scan,
+					int atsc_filter, unsigned other_nit,
+					unsigned pat_pmt_time, unsigned vct_time,
+					unsigned sdt_time, unsigned nit_time)
+{
+	struct dvb_v5_fe_parms_priv *parms = scan->parms;
+	struct dvb_v5_descriptors *handler = scan->handler;
+	struct dvb_table_nit *nit_other = NULL;
+	struct dvb_table_sdt *sdt_other = NULL;
+	struct stat st;
+	int rc;
+
+	if (!scan->sw) {
+		if (fstat(scan->fd, &st) < 0 || !S_ISCHR(st.st_mode))
+			return 1;
+		snprintf(scan->dmx_path, sizeof(scan->dmx_path),
+			 "/proc/self/fd/%d", scan->fd);
+
+		scan->buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+		if (!scan->buf) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return 1;
+		}
+	}
+	scan->pmt_timeout = pat_pmt_time;
+	scan->other_nit = other_nit;
+
+	/* Nothing depends on those, except for the PMTs, that need the PAT */
+	scan->pat = dvb_table_req_add(scan, DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+				      (void **)&handler->pat, pat_pmt_time, -1);
+	if (atsc_filter)
+		scan->vct = dvb_table_req_add(scan, atsc_filter,
+					      ATSC_TABLE_VCT_PID,
+					      (void **)&handler->vct,
+					      vct_time, -1);
+	dvb_table_req_add(scan, DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
+			  (void **)&handler->nit, nit_time, -1);
+	scan->sdt = dvb_table_req_add(scan, DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+				      (void **)&handler->sdt, sdt_time, -1);
+	if (other_nit) {
+		if (parms->p.verbose)
+			dvb_log(_("Parsing other NIT/SDT"));
+		dvb_table_req_add(scan, DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
+				  (void **)&nit_other, nit_time, -1);
+		dvb_table_req_add(scan, DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
+				  (void **)&sdt_other, sdt_time, -1);
+	}
+	if (scan->pat < 0 || scan->sdt < 0) {
+		rc = -1;
+		goto ret;
+	}
+
+	/* If the demux can't be re-opened, the caller should do it serially */
+	if (dvb_table_req_start(scan, scan->reqs[scan->pat]) < 0) {
+		if (scan->sw) {
+			rc = -1;
+			goto ret;
+		}
+		if (parms->p.verbose)
+			dvb_log(_("Can't open %s. Reading one table at a time"),
+				scan->dmx_path);
+		rc = 1;
+		goto ret;
+	}
+
+	rc = dvb_table_scan_run(scan);
+	if (rc < 0)
+		goto ret;
+
+	if (handler->vct && !other_nit && handler->sdt) {
+		dvb_table_sdt_free(handler->sdt);
+		handler->sdt = NULL;
+	}
+
+	/*
+	 * Just like when reading one table at a time, the other NIT/SDT
+	 * tables replace the ones for the current transport stream.
+	 */
+	if (other_nit) {
+		if (handler->nit)
+			dvb_table_nit_free(handler->nit);
+		handler->nit = nit_other;
+		nit_other = NULL;
+		if (handler->sdt)
+			dvb_table_sdt_free(handler->sdt);
+		handler->sdt = sdt_other;
+		sdt_other = NULL;
+	}
+
+ret:
+	dvb_table_scan_stop_all(scan, -ECANCELED);
+	if (nit_other)
+		dvb_table_nit_free(nit_other);
+	if (sdt_other)
+		dvb_table_sdt_free(sdt_other);
+
+	return rc;
+}
+
+static void dvb_get_table_timeouts(uint32_t delivery_system, int *atsc_filter,
+				   unsigned *pat_pmt_time, unsigned *sdt_time,
+				   unsigned *nit_time, unsigned *vct_time)
+{
+	*atsc_filter = 0;
+	*vct_time = 0;
 
 	/* Get standard timeouts for each table */
 	switch(delivery_system) {
@@ -475,41 +1075,149 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		case SYS_DVBS:
 		case SYS_DVBS2:
 		case SYS_TURBO:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 10;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 10;
 			break;
 		case SYS_DVBT:
 		case SYS_DVBT2:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 12;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 12;
 			break;
 		case SYS_ISDBT:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 12;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 12;
 			break;
 		case SYS_ATSC:
-			atsc_filter = ATSC_TABLE_TVCT;
-			pat_pmt_time = 2;
-			vct_time = 2;
-			sdt_time = 5;
-			nit_time = 5;
+			*atsc_filter = ATSC_TABLE_TVCT;
+			*pat_pmt_time = 2;
+			*vct_time = 2;
+			*sdt_time = 5;
+			*nit_time = 5;
 			break;
 		case SYS_DVBC_ANNEX_B:
-			atsc_filter = ATSC_TABLE_CVCT;
-			pat_pmt_time = 2;
-			vct_time = 2;
-			sdt_time = 5;
-			nit_time = 5;
+			*atsc_filter = ATSC_TABLE_CVCT;
+			*pat_pmt_time = 2;
+			*vct_time = 2;
+			*sdt_time = 5;
+			*nit_time = 5;
 			break;
 		default:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 10;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 10;
 			break;
 	};
+}
+
+int dvb_sw_demux_read_sections(struct dvb_v5_fe_parms *__p,
+			       struct dvb_sw_demux *dmx, int fd,
+			       struct dvb_table_filter *sect,
+			       unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	struct dvb_table_scan scan;
+	int idx, ret;
+
+	dvb_table_scan_init(&scan, parms, NULL, fd, dmx);
+
+	idx = dvb_table_req_add(&scan, sect->tid, sect->pid, sect->table,
+				timeout, -1);
+	if (idx < 0) {
+		dvb_table_scan_free(&scan);
+		return -1;
+	}
+	scan.reqs[idx]->sect.ts_id = sect->ts_id;
+
+	ret = dvb_table_scan_run(&scan);
+	if (!ret && scan.reqs[idx]->status < 0)
+		ret = scan.reqs[idx]->status;
+
+	dvb_table_scan_free(&scan);
+
+	return ret;
+}
+
+struct dvb_v5_descriptors *dvb_sw_demux_get_ts_tables(struct dvb_v5_fe_parms *__p,
+						      struct dvb_sw_demux *dmx,
+						      int fd,
+						      uint32_t delivery_system,
+						      unsigned other_nit,
+						      unsigned timeout_multiply)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
+	struct dvb_v5_descriptors *dvb_scan_handler;
+	struct dvb_table_scan scan;
+	int atsc_filter, rc;
+
+	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
+	if (!dvb_scan_handler)
+		return NULL;
+
+	if (!timeout_multiply)
+		timeout_multiply = 1;
+
+	dvb_get_table_timeouts(delivery_system, &atsc_filter, &pat_pmt_time,
+			       &sdt_time, &nit_time, &vct_time);
+
+	dvb_table_scan_init(&scan, parms, dvb_scan_handler, fd, dmx);
+	rc = dvb_get_ts_tables_concurrent(&scan, atsc_filter, other_nit,
+					  pat_pmt_time * timeout_multiply,
+					  vct_time * timeout_multiply,
+					  sdt_time * timeout_multiply,
+					  nit_time * timeout_multiply);
+	dvb_table_scan_free(&scan);
+
+	if (rc < 0 && !parms->p.abort) {
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		return NULL;
+	}
+
+	return dvb_scan_handler;
+}
+
+struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
+					     int dmx_fd,
+					     uint32_t delivery_system,
+					     unsigned other_nit,
+					     unsigned timeout_multiply)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	int rc;
+	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
+	int atsc_filter;
+	unsigned num_pmt = 0;
+	struct dvb_table_scan scan;
+
+	struct dvb_v5_descriptors *dvb_scan_handler;
+
+	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
+	if (!dvb_scan_handler)
+		return NULL;
+
+	if (!timeout_multiply)
+		timeout_multiply = 1;
+
+	dvb_get_table_timeouts(delivery_system, &atsc_filter, &pat_pmt_time,
+			       &sdt_time, &nit_time, &vct_time);
+
+	/* Read all tables at the same time, if the demux allows it */
+	dvb_table_scan_init(&scan, parms, dvb_scan_handler, dmx_fd, NULL);
+	rc = dvb_get_ts_tables_concurrent(&scan, atsc_filter, other_nit,
+					  pat_pmt_time * timeout_multiply,
+					  vct_time * timeout_multiply,
+					  sdt_time * timeout_multiply,
+					  nit_time * timeout_multiply);
+	dvb_table_scan_free(&scan);
+	if (parms->p.abort || !rc)
+		return dvb_scan_handler;
+	if (rc < 0) {
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		return NULL;
+	}
 
 	/* PAT table */
 	rc = dvb_read_section(&parms->p, dmx_fd,
@@ -0,0 +1,612 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * Software demultiplexer for MPEG Transport Streams, as defined at
+ * ISO/IEC 13818-1.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-sw-demux.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/mpeg_ts.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+#define SW_DMX_NUM_PIDS		8192
+#define SW_DMX_MAX_SECTION	4096
+#define SW_DMX_MAX_PES		(4 * 1024 * 1024)
+#define SW_DMX_READ_SIZE	(DVB_MPEG_TS_PACKET_SIZE * 348)
+
+enum sw_dmx_type {
+	SW_DMX_SECTION,
+	SW_DMX_PES,
+};
+
+struct dvb_sw_demux_filter {
+	struct dvb_sw_demux_filter *next;
+	uint16_t pid;
+	enum sw_dmx_type type;
+	uint8_t tid, mask;
+	dvb_sw_demux_cb cb;
+	void *priv;
+	int removed;
+};
+
+/* Reassembly state of a PID */
+struct sw_dmx_pid {
+	struct dvb_sw_demux_filter *filters;
+	enum sw_dmx_type type;
+	int cc;			/* last continuity counter, -1 if unknown */
+	int synced;		/* the start of a section/PES was seen */
+	uint8_t *buf;
+	size_t len, size;
+	size_t need;		/* full length of the unit, 0 if unknown */
+};
+
+/* A section or PES packet waiting to be dispatched */
+struct sw_dmx_pending {
+	struct dvb_sw_demux_filter *filter;
+	uint16_t pid;
+	size_t off, len;
+};
+
+struct dvb_sw_demux {
+	struct dvb_v5_fe_parms_priv *parms;
+	struct sw_dmx_pid *pids[SW_DMX_NUM_PIDS];
+
+	/* An incomplete packet, from the end of the last buffer */
+	uint8_t pkt[DVB_MPEG_TS_PACKET_SIZE];
+	size_t pkt_len;
+
+	/* Data completed by the current dvb_sw_demux_feed() call */
+	struct sw_dmx_pending *pending;
+	unsigned num_pending, max_pending;
+	uint8_t *batch;
+	size_t batch_len, batch_size;
+	struct dvb_sw_demux_data *units;
+	unsigned max_units;
+
+	int dispatching, removed;
+	uint8_t *rbuf;
+};
+
+struct dvb_sw_demux *dvb_sw_demux_alloc(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_sw_demux *dmx;
+
+	dmx = calloc(1, sizeof(*dmx));
+	if (!dmx)
+		return NULL;
+	dmx->parms = (void *)p;
+
+	return dmx;
+}
+
+static void sw_dmx_free_pid(struct dvb_sw_demux *dmx, uint16_t pid)
+{
+	struct sw_dmx_pid *sp = dmx->pids[pid];
+	struct dvb_sw_demux_filter *f, *next;
+
+	if (!sp)
+		return;
+	for (f = sp->filters; f; f = next) {
+		next = f->next;
+		free(f);
+	}
+	free(sp->buf);
+	free(sp);
+	dmx->pids[pid] = NULL;
+}
+
+void dvb_sw_demux_free(struct dvb_sw_demux *dmx)
+{
+	int pid;
+
+	if (!dmx)
+		return;
+	for (pid = 0; pid < SW_DMX_NUM_PIDS; pid++)
+		sw_dmx_free_pid(dmx, pid);
+	free(dmx->pending);
+	free(dmx->batch);
+	free(dmx->units);
+	free(dmx->rbuf);
+	free(dmx);
+}
+
+static struct dvb_sw_demux_filter *
+sw_dmx_add_filter(struct dvb_sw_demux *dmx, uint16_t pid,
+		  enum sw_dmx_type type, dvb_sw_demux_cb cb, void *priv)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	struct dvb_sw_demux_filter *f, **tail;
+	struct sw_dmx_pid *sp;
+
+	if (pid >= SW_DMX_NUM_PIDS || !cb)
+		return NULL;
+
+	sp = dmx->pids[pid];
+	if (sp && sp->filters && sp->type != type) {
+		dvb_logerr(_("%s: PID 0x%04x can't have both section and PES filters"),
+			   __func__, pid);
+		return NULL;
+	}
+	if (!sp) {
+		sp = calloc(1, sizeof(*sp));
+		if (!sp)
+			goto oom;
+		sp->cc = -1;
+		dmx->pids[pid] = sp;
+	}
+	if (!sp->filters) {
+		sp->type = type;
+		sp->cc = -1;
+		sp->synced = 0;
+		sp->len = 0;
+	}
+	if (type == SW_DMX_SECTION && sp->size < SW_DMX_MAX_SECTION) {
+		uint8_t *buf = realloc(sp->buf, SW_DMX_MAX_SECTION);
+
+		if (!buf)
+			goto oom;
+		sp->buf = buf;
+		sp->size = SW_DMX_MAX_SECTION;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		goto oom;
+	f->pid = pid;
+	f->type = type;
+	f->cb = cb;
+	f->priv = priv;
+
+	/* Keep the filters in the order they were added */
+	for (tail = &sp->filters; *tail; tail = &(*tail)->next);
+	*tail = f;
+
+	return f;
+oom:
+	dvb_logerr(_("%s: out of memory"), __func__);
+	return NULL;
+}
+
+struct dvb_sw_demux_filter *
+dvb_sw_demux_add_section_filter(struct dvb_sw_demux *dmx, uint16_t pid,
+				uint8_t tid, uint8_t mask,
+				dvb_sw_demux_cb cb, void *priv)
+{
+	struct dvb_sw_demux_filter *f;
+
+	f = sw_dmx_add_filter(dmx, pid, SW_DMX_SECTION, cb, priv);
+	if (f) {
+		f->tid = tid;
+		f->mask = mask;
+	}
+	return f;
+}
+
+struct dvb_sw_demux_filter *
+dvb_sw_demux_add_pes_filter(struct dvb_sw_demux *dmx, uint16_t pid,
+			    dvb_sw_demux_cb cb, void *priv)
+{
+	return sw_dmx_add_filter(dmx, pid, SW_DMX_PES, cb, priv);
+}
+
+/* Frees the filters removed while dispatching */
+static void sw_dmx_gc(struct dvb_sw_demux *dmx, uint16_t pid)
+{
+	struct sw_dmx_pid *sp = dmx->pids[pid];
+	struct dvb_sw_demux_filter **p, *f;
+
+	if (!sp)
+		return;
+
+	for (p = &sp->filters; *p;) {
+		f = *p;
+		if (f->removed) {
+			*p = f->next;
+			free(f);
+		} else {
+			p = &f->next;
+		}
+	}
+	if (!sp->filters)
+		sw_dmx_free_pid(dmx, pid);
+}
+
+void dvb_sw_demux_remove_filter(struct dvb_sw_demux *dmx,
+				struct dvb_sw_demux_filter *filter)
+{
+	if (!filter)
+		return;
+
+	filter->removed = 1;
+	if (dmx->dispatching)
+		dmx->removed = 1;
+	else
+		sw_dmx_gc(dmx, filter->pid);
+}
+
+static void sw_dmx_queue(struct dvb_sw_demux *dmx,
+			 struct dvb_sw_demux_filter *f, uint16_t pid,
+			 const uint8_t *data, size_t len)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	struct sw_dmx_pending *p;
+
+	if (dmx->num_pending == dmx->max_pending) {
+		unsigned max = dmx->max_pending ? dmx->max_pending * 2 : 64;
+
+		p = realloc(dmx->pending, max * sizeof(*p));
+		if (!p)
+			goto oom;
+		dmx->pending = p;
+		dmx->max_pending = max;
+	}
+	if (dmx->batch_len + len > dmx->batch_size) {
+		size_t size = dmx->batch_size ? dmx->batch_size : 65536;
+		uint8_t *batch;
+
+		while (size < dmx->batch_len + len)
+			size *= 2;
+		batch = realloc(dmx->batch, size);
+		if (!batch)
+			goto oom;
+		dmx->batch = batch;
+		dmx->batch_size = size;
+	}
+
+	/* Pointers are only taken at dispatch time, as batch can move */
+	memcpy(dmx->batch + dmx->batch_len, data, len);
+	p = &dmx->pending[dmx->num_pending++];
+	p->filter = f;
+	p->pid = pid;
+	p->off = dmx->batch_len;
+	p->len = len;
+	dmx->batch_len += len;
+	return;
+oom:
+	dvb_logerr(_("%s: out of memory"), __func__);
+}
+
+static void sw_dmx_dispatch(struct dvb_sw_demux *dmx)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	struct dvb_sw_demux_filter *f;
+	unsigned i, j, n;
+
+	if (!dmx->num_pending)
+		return;
+
+	if (dmx->max_units < dmx->num_pending) {
+		struct dvb_sw_demux_data *units;
+
+		units = realloc(dmx->units, dmx->num_pending * sizeof(*units));
+		if (!units) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			goto ret;
+		}
+		dmx->units = units;
+		dmx->max_units = dmx->num_pending;
+	}
+
+	dmx->dispatching = 1;
+	for (i = 0; i < dmx->num_pending; i = j) {
+		f = dmx->pending[i].filter;
+
+		/* Group the data completed in a row for the same filter */
+		for (j = i, n = 0; j < dmx->num_pending &&
+				   dmx->pending[j].filter == f; j++, n++) {
+			dmx->units[n].pid = dmx->pending[j].pid;
+			dmx->units[n].data = dmx->batch + dmx->pending[j].off;
+			dmx->units[n].len = dmx->pending[j].len;
+		}
+		if (!f->removed)
+			f->cb(f->priv, dmx->units, n);
+	}
+	dmx->dispatching = 0;
+
+	if (dmx->removed) {
+		for (i = 0; i < SW_DMX_NUM_PIDS; i++)
+			if (dmx->pids[i])
+				sw_dmx_gc(dmx, i);
+		dmx->removed = 0;
+	}
+ret:
+	dmx->num_pending = 0;
+	dmx->batch_len = 0;
+}
+
+static void sw_dmx_section_done(struct dvb_sw_demux *dmx, uint16_t pid,
+				struct sw_dmx_pid *sp)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+	struct dvb_sw_demux_filter *f;
+
+	/* Only sections with the syntax indicator have a CRC */
+	if ((sp->buf[1] & 0x80) && dvb_crc32(sp->buf, sp->len, 0xFFFFFFFF)) {
+		if (parms->p.verbose > 1)
+			dvb_logdbg(_("%s: PID 0x%04x: crc error on table 0x%02x"),
+				   __func__, pid, sp->buf[0]);
+		return;
+	}
+
+	for (f = sp->filters; f; f = f->next) {
+		if (f->removed || ((sp->buf[0] ^ f->tid) & f->mask))
+			continue;
+		sw_dmx_queue(dmx, f, pid, sp->buf, sp->len);
+	}
+}
+
+/* Adds payload to the section being assembled. Returns the bytes used */
+static size_t sw_dmx_section_add(struct dvb_sw_demux *dmx, uint16_t pid,
+				 struct sw_dmx_pid *sp,
+				 const uint8_t *p, size_t n)
+{
+	size_t used = 0, count;
+
+	while (used < n && sp->synced) {
+		/* Stuffing: no other sections start at this packet */
+		if (!sp->len && p[used] == 0xff) {
+			sp->synced = 0;
+			return n;
+		}
+
+		if (sp->len < 3) {
+			count = 3 - sp->len;
+			if (count > n - used)
+				count = n - used;
+			memcpy(sp->buf + sp->len, p + used, count);
+			sp->len += count;
+			used += count;
+			if (sp->len < 3)
+				break;
+			sp->need = 3 + (((sp->buf[1] & 0x0f) << 8) | sp->buf[2]);
+			if (sp->need > SW_DMX_MAX_SECTION) {
+				sp->synced = 0;
+				sp->len = 0;
+				break;
+			}
+		}
+
+		count = sp->need - sp->len;
+		if (count > n - used)
+			count = n - used;
+		memcpy(sp->buf + sp->len, p + used, count);
+		sp->len += count;
+		used += count;
+
+		if (sp->len == sp->need) {
+			sw_dmx_section_done(dmx, pid, sp);
+			sp->len = 0;
+		}
+	}
+	return used;
+}
+
+static void sw_dmx_section(struct dvb_sw_demux *dmx, uint16_t pid,
+			   struct sw_dmx_pid *sp, const uint8_t *p, size_t n,
+			   int pusi)
+{
+	size_t ptr;
+
+	if (pusi) {
+		ptr = p[0];
+		p++;
+		n--;
+		if (ptr > n) {
+			sp->synced = 0;
+			sp->len = 0;
+			return;
+		}
+
+		/* The bytes before the pointer finish the previous section */
+		if (sp->synced && sp->len)
+			sw_dmx_section_add(dmx, pid, sp, p, ptr);
+		p += ptr;
+		n -= ptr;
+		sp->synced = 1;
+		sp->len = 0;
+	}
+	sw_dmx_section_add(dmx, pid, sp, p, n);
+}
+
+static void sw_dmx_pes_done(struct dvb_sw_demux *dmx, uint16_t pid,
+			    struct sw_dmx_pid *sp)
+{
+	struct dvb_sw_demux_filter *f;
+
+	for (f = sp->filters; f; f = f->next)
+		if (!f->removed)
+			sw_dmx_queue(dmx, f, pid, sp->buf, sp->len);
+	sp->len = 0;
+}
+
+static void sw_dmx_pes(struct dvb_sw_demux *dmx, uint16_t pid,
+		       struct sw_dmx_pid *sp, const uint8_t *p, size_t n,
+		       int pusi)
+{
+	struct dvb_v5_fe_parms_priv *parms = dmx->parms;
+
+	if (pusi) {
+		/* PES packets without length end when the next one starts */
+		if (sp->synced && sp->len && !sp->need)
+			sw_dmx_pes_done(dmx, pid, sp);
+		sp->synced = 1;
+		sp->len = 0;
+		sp->need = 0;
+	}
+	if (!sp->synced)
+		return;
+
+	if (sp->len + n > sp->size) {
+		size_t size = sp->size ? sp->size : 65536;
+		uint8_t *buf;
+
+		while (size < sp->len + n)
+			size *= 2;
+		if (size > SW_DMX_MAX_PES) {
+			dvb_logerr(_("%s: PID 0x%04x: PES packet too big"),
+				   __func__, pid);
+			sp->synced = 0;
+			sp->len = 0;
+			return;
+		}
+		buf = realloc(sp->buf, size);
+		if (!buf) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			sp->synced = 0;
+			sp->len = 0;
+			return;
+		}
+		sp->buf = buf;
+		sp->size = size;
+	}
+	memcpy(sp->buf + sp->len, p, n);
+	sp->len += n;
+
+	if (!sp->need && sp->len >= 6) {
+		size_t pes_len = (sp->buf[4] << 8) | sp->buf[5];
+
+		if (pes_len)
+			sp->need = pes_len + 6;
+	}
+	if (sp->need && sp->len >= sp->need) {
+		sp->len = sp->need;
+		sw_dmx_pes_done(dmx, pid, sp);
+		sp->synced = 0;
+	}
+}
+
+static void sw_dmx_packet(struct dvb_sw_demux *dmx, const uint8_t *pkt)
+{
+	struct sw_dmx_pid *sp;
+	unsigned pid, afc, cc, off = 4;
+	int pusi, discontinuity = 0;
+
+	/* Transport error indicator */
+	if (pkt[1] & 0x80)
+		return;
+
+	pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+	sp = dmx->pids[pid];
+	if (!sp || !sp->filters)
+		return;
+
+	pusi = pkt[1] & 0x40;
+	afc = (pkt[3] >> 4) & 0x03;
+	cc = pkt[3] & 0x0f;
+
+	if (afc & 0x02) {
+		if (pkt[4] > DVB_MPEG_TS_PACKET_SIZE - 5)
+			return;
+		if (pkt[4])
+			discontinuity = pkt[5] & 0x80;
+		off += 1 + pkt[4];
+	}
+	/* No payload */
+	if (!(afc & 0x01) || off >= DVB_MPEG_TS_PACKET_SIZE)
+		return;
+
+	if (sp->cc >= 0 && !discontinuity) {
+		/* Duplicated packet */
+		if (cc == (unsigned)sp->cc)
+			return;
+		/* Lost packets: drop what was being assembled */
+		if (cc != ((sp->cc + 1) & 0x0f)) {
+			sp->synced = 0;
+			sp->len = 0;
+		}
+	}
+	sp->cc = cc;
+
+	if (sp->type == SW_DMX_SECTION)
+		sw_dmx_section(dmx, pid, sp, pkt + off,
+			       DVB_MPEG_TS_PACKET_SIZE - off, pusi);
+	else
+		sw_dmx_pes(dmx, pid, sp, pkt + off,
+			   DVB_MPEG_TS_PACKET_SIZE - off, pusi);
+}
+
+void dvb_sw_demux_feed(struct dvb_sw_demux *dmx, const uint8_t *buf,
+		       size_t len)
+{
+	const uint8_t *p;
+	size_t count;
+
+	while (len) {
+		/* Complete the packet left from the last call */
+		if (dmx->pkt_len) {
+			count = DVB_MPEG_TS_PACKET_SIZE - dmx->pkt_len;
+			if (count > len)
+				count = len;
+			memcpy(dmx->pkt + dmx->pkt_len, buf, count);
+			dmx->pkt_len += count;
+			buf += count;
+			len -= count;
+			if (dmx->pkt_len < DVB_MPEG_TS_PACKET_SIZE)
+				break;
+			sw_dmx_packet(dmx, dmx->pkt);
+			dmx->pkt_len = 0;
+			continue;
+		}
+
+		if (buf[0] != DVB_MPEG_TS) {
+			p = memchr(buf, DVB_MPEG_TS, len);
+			if (!p)
+				break;
+			len -= p - buf;
+			buf = p;
+			continue;
+		}
+
+		if (len < DVB_MPEG_TS_PACKET_SIZE) {
+			memcpy(dmx->pkt, buf, len);
+			dmx->pkt_len = len;
+			break;
+		}
+
+		sw_dmx_packet(dmx, buf);
+		buf += DVB_MPEG_TS_PACKET_SIZE;
+		len -= DVB_MPEG_TS_PACKET_SIZE;
+	}
+
+	sw_dmx_dispatch(dmx);
+}
+
+ssize_t dvb_sw_demux_read(struct dvb_sw_demux *dmx, int fd)
+{
+	ssize_t ret;
+
+	if (!dmx->rbuf) {
+		dmx->rbuf = malloc(SW_DMX_READ_SIZE);
+		if (!dmx->rbuf)
+			return -ENOMEM;
+	}
+
+	ret = read(fd, dmx->rbuf, SW_DMX_READ_SIZE);
+	if (ret < 0)
+		return -errno;
+
+	dvb_sw_demux_feed(dmx, dmx->rbuf, ret);
+
+	return ret;
+}
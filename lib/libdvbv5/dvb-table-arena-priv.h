@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#ifndef _DVB_TABLE_ARENA_PRIV_H
+#define _DVB_TABLE_ARENA_PRIV_H
+
+#include <libdvbv5/dvb-table-arena.h>
+#include <libdvbv5/descriptors.h>
+
+/*
+ * Allocators for the table parsers: they use the arena set at parms, if
+ * any, or malloc()/calloc() otherwise.
+ */
+void *dvb_table_malloc(struct dvb_v5_fe_parms *parms, size_t size);
+void *dvb_table_calloc(struct dvb_v5_fe_parms *parms, size_t nmemb,
+		       size_t size);
+
+/* Returns true if ptr points into the memory of an arena */
+int dvb_table_arena_owns(const void *ptr);
+
+/*
+ * Frees memory from dvb_table_malloc(), unless it came from an arena. The
+ * table free functions use it, so that they leave arena tables alone.
+ */
+void dvb_table_free(void *ptr);
+
+/*
+ * Registers a descriptor whose free() callback should be called when the
+ * arena is reset, as its contents were allocated with malloc().
+ */
+int dvb_table_arena_add_desc(struct dvb_v5_fe_parms *parms,
+			     struct dvb_desc *desc);
+
+#endif
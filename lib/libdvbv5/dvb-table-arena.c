@@ -0,0 +1,270 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#include "dvb-fe-priv.h"
+#include "dvb-table-arena-priv.h"
+
+#define ARENA_CHUNK_SIZE	65536
+#define ARENA_ALIGN		16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size, used;
+	/* Keep the data aligned, as tables have 64-bit fields */
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/* Descriptors with contents allocated outside the arena */
+struct arena_desc {
+	struct dvb_desc *desc;
+	struct arena_desc *next;
+};
+
+struct dvb_table_arena {
+	size_t chunk_size;
+	struct arena_chunk *chunks;	/* the current one is the first */
+	struct arena_chunk *free_chunks;
+	struct arena_desc *descs;
+	struct dvb_table_arena *next;
+};
+
+/*
+ * All the arenas alive, so that the table free functions can tell whether
+ * some memory belongs to one of them. The lock protects this list and the
+ * chunk lists of the arenas.
+ */
+static struct dvb_table_arena *arenas;
+static int num_arenas;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void arenas_lock_get(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&arenas_lock);
+#endif
+}
+
+static void arenas_lock_put(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&arenas_lock);
+#endif
+}
+
+struct dvb_table_arena *dvb_table_arena_alloc(size_t chunk_size)
+{
+	struct dvb_table_arena *arena;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return NULL;
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+
+	arenas_lock_get();
+	arena->next = arenas;
+	arenas = arena;
+	__atomic_store_n(&num_arenas, num_arenas + 1, __ATOMIC_RELEASE);
+	arenas_lock_put();
+
+	return arena;
+}
+
+static void *arena_alloc(struct dvb_table_arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	size_t chunk_size;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->used + size > chunk->size) {
+		arenas_lock_get();
+		/* Reuse the memory kept by dvb_table_arena_reset() */
+		chunk = arena->free_chunks;
+		if (chunk && size <= chunk->size) {
+			arena->free_chunks = chunk->next;
+		} else {
+			chunk_size = arena->chunk_size;
+			if (size > chunk_size)
+				chunk_size = size;
+			chunk = malloc(sizeof(*chunk) + chunk_size);
+			if (!chunk) {
+				arenas_lock_put();
+				return NULL;
+			}
+			chunk->size = chunk_size;
+		}
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arenas_lock_put();
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+static void arena_free_chunks(struct arena_chunk *chunk)
+{
+	struct arena_chunk *next;
+
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+void dvb_table_arena_reset(struct dvb_table_arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+	struct arena_desc *d;
+
+	if (!arena)
+		return;
+
+	for (d = arena->descs; d; d = d->next)
+		dvb_descriptors[d->desc->type].free(d->desc);
+	arena->descs = NULL;
+
+	arenas_lock_get();
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		chunk->next = arena->free_chunks;
+		arena->free_chunks = chunk;
+	}
+	arena->chunks = NULL;
+	arenas_lock_put();
+}
+
+void dvb_table_arena_free(struct dvb_table_arena *arena)
+{
+	struct dvb_table_arena **a;
+
+	if (!arena)
+		return;
+
+	dvb_table_arena_reset(arena);
+
+	arenas_lock_get();
+	for (a = &arenas; *a; a = &(*a)->next) {
+		if (*a == arena) {
+			*a = arena->next;
+			break;
+		}
+	}
+	__atomic_store_n(&num_arenas, num_arenas - 1, __ATOMIC_RELEASE);
+	arenas_lock_put();
+
+	arena_free_chunks(arena->free_chunks);
+	free(arena);
+}
+
+struct dvb_table_arena *dvb_table_arena_set(struct dvb_v5_fe_parms *p,
+					    struct dvb_table_arena *arena)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_table_arena *old = parms->arena;
+
+	parms->arena = arena;
+
+	return old;
+}
+
+void *dvb_table_malloc(struct dvb_v5_fe_parms *p, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	if (!parms || !parms->arena)
+		return malloc(size);
+
+	return arena_alloc(parms->arena, size);
+}
+
+void *dvb_table_calloc(struct dvb_v5_fe_parms *p, size_t nmemb, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	void *ptr;
+
+	if (!parms || !parms->arena)
+		return calloc(nmemb, size);
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+	ptr = arena_alloc(parms->arena, nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+static int chunks_own(struct arena_chunk *chunk, const char *ptr)
+{
+	for (; chunk; chunk = chunk->next)
+		if (ptr >= chunk->data && ptr < chunk->data + chunk->size)
+			return 1;
+	return 0;
+}
+
+int dvb_table_arena_owns(const void *ptr)
+{
+	struct dvb_table_arena *arena;
+	int owns = 0;
+
+	/* Don't take the lock when no arena is used at all */
+	if (!ptr || !__atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE))
+		return 0;
+
+	arenas_lock_get();
+	for (arena = arenas; arena && !owns; arena = arena->next)
+		owns = chunks_own(arena->chunks, ptr) ||
+		       chunks_own(arena->free_chunks, ptr);
+	arenas_lock_put();
+
+	return owns;
+}
+
+void dvb_table_free(void *ptr)
+{
+	/* Memory from an arena is only released all at once */
+	if (!dvb_table_arena_owns(ptr))
+		free(ptr);
+}
+
+int dvb_table_arena_add_desc(struct dvb_v5_fe_parms *p, struct dvb_desc *desc)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct arena_desc *d;
+
+	if (!parms || !parms->arena || !dvb_descriptors[desc->type].free)
+		return 0;
+
+	d = arena_alloc(parms->arena, sizeof(*d));
+	if (!d)
+		return -1;
+	d->desc = desc;
+	d->next = parms->arena->descs;
+	parms->arena->descs = d;
+
+	return 0;
+}
@@ -28,12 +28,31 @@
 #include <string.h>
 #include <strings.h> /* strcasecmp */
 
+#include "dvb-fe-priv.h"
 #include <parse_string.h>
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-fe.h>
 
 #define CS_OPTIONS "//TRANSLIT"
 
+/*
+ * Opening an iconv descriptor is expensive, and the tables use just a few
+ * charsets: keep the last ones used by each frontend.
+ */
+#define ICONV_CACHE_SIZE 8
+
+struct dvb_iconv_entry {
+	char *from, *to;
+	int ascii;		/* both charsets are a superset of ASCII */
+	int opened;		/* iconv_open() was already tried */
+	iconv_t cd;
+};
+
+struct dvb_iconv_cache {
+	struct dvb_iconv_entry entry[ICONV_CACHE_SIZE];
+	unsigned next;		/* entry to replace when the cache is full */
+};
+
 struct charset_conv {
 	unsigned len;
 	unsigned char  data[3];
@@ -299,30 +318,136 @@ static struct charset_conv en300468_latin_00_to_utf8[256] = {
 	[0xff] = { 2, {0xc2, 0xad, } },
 };
 
-void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
+static int charset_is_ascii(const char *charset)
+{
+	return !strncasecmp(charset, "ISO-8859", 8) ||
+	       !strcasecmp(charset, "UTF-8") ||
+	       !strcasecmp(charset, "ISO-10646/UTF-8") ||
+	       !strcasecmp(charset, "US-ASCII");
+}
+
+/* Checks for 7-bit data, a word at a time */
+static int is_ascii(const unsigned char *s, size_t len)
+{
+	const uint64_t mask = 0x8080808080808080ULL;
+	uint64_t acc = 0, w;
+	size_t i;
+
+	for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, s + i, sizeof(w));
+		acc |= w;
+	}
+	for (; i < len; i++)
+		acc |= s[i];
+
+	return !(acc & mask);
+}
+
+static void dvb_iconv_entry_free(struct dvb_iconv_entry *e)
+{
+	if (e->opened && e->cd != (iconv_t)(-1))
+		iconv_close(e->cd);
+	free(e->from);
+	free(e->to);
+	memset(e, 0, sizeof(*e));
+}
+
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms *__p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	unsigned i;
+
+	if (!parms->iconv_cache)
+		return;
+	for (i = 0; i < ICONV_CACHE_SIZE; i++)
+		dvb_iconv_entry_free(&parms->iconv_cache->entry[i]);
+	free(parms->iconv_cache);
+	parms->iconv_cache = NULL;
+}
+
+static struct dvb_iconv_entry *dvb_iconv_get(struct dvb_v5_fe_parms_priv *parms,
+					     const char *from, const char *to)
+{
+	struct dvb_iconv_cache *cache = parms->iconv_cache;
+	struct dvb_iconv_entry *e;
+	unsigned i;
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return NULL;
+		parms->iconv_cache = cache;
+	}
+
+	for (i = 0; i < ICONV_CACHE_SIZE; i++) {
+		e = &cache->entry[i];
+		if (!e->from)
+			break;
+		if (!strcmp(e->from, from) && !strcmp(e->to, to))
+			return e;
+	}
+
+	if (i == ICONV_CACHE_SIZE) {
+		i = cache->next;
+		cache->next = (i + 1) % ICONV_CACHE_SIZE;
+	}
+	e = &cache->entry[i];
+	dvb_iconv_entry_free(e);
+
+	e->from = strdup(from);
+	e->to = strdup(to);
+	if (!e->from || !e->to) {
+		dvb_iconv_entry_free(e);
+		return NULL;
+	}
+	e->ascii = charset_is_ascii(from) && charset_is_ascii(to);
+
+	return e;
+}
+
+void dvb_iconv_to_charset(struct dvb_v5_fe_parms *__p,
 			  char *dest,
 			  size_t destlen,
 			  const unsigned char *src,
 			  size_t len,
 			  char *input_charset, char *output_charset)
 {
-	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	struct dvb_iconv_entry *e;
 	char *p = dest;
 
-	strcpy(out_cs, output_charset);
-	strcat(out_cs, CS_OPTIONS);
+	e = dvb_iconv_get(parms, input_charset, output_charset);
 
-	iconv_t cd = iconv_open(out_cs, input_charset);
-	if (cd == (iconv_t)(-1)) {
+	/* 7-bit text is the same on all ASCII based charsets */
+	if (e && e->ascii && len <= destlen && is_ascii(src, len)) {
+		memcpy(p, src, len);
+		p[len] = '\0';
+		return;
+	}
+
+	if (e && !e->opened) {
+		char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+
+		strcpy(out_cs, output_charset);
+		strcat(out_cs, CS_OPTIONS);
+
+		e->cd = iconv_open(out_cs, input_charset);
+		e->opened = 1;
+		if (e->cd == (iconv_t)(-1)) {
+			dvb_logerr("Conversion from %s to %s not supported\n",
+					input_charset, output_charset);
+			if (!strcasecmp(input_charset, "ARIB-STD-B24"))
+				dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
+		}
+	}
+
+	if (!e || e->cd == (iconv_t)(-1)) {
 		memcpy(p, src, len);
 		p[len] = '\0';
-		dvb_logerr("Conversion from %s to %s not supported\n",
-				input_charset, output_charset);
-		if (!strcasecmp(input_charset, "ARIB-STD-B24"))
-			dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
 	} else {
-		iconv(cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
-		iconv_close(cd);
+		/* Start from the initial shift state */
+		iconv(e->cd, NULL, NULL, NULL, NULL);
+		iconv(e->cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
 		*p = '\0';
 	}
 }
@@ -332,11 +457,11 @@ static void charset_conversion(struct dvb_v5_fe_parms *parms, char **dest, const
 {
 	size_t destlen = len * 3;
 	int need_conversion = 1;
+	unsigned char *tmp = NULL;
 
 	/* Special handler for ISO-6937 */
 	if (!strcasecmp(input_charset, "ISO-6937")) {
 		char *p = *dest;
-		unsigned char *tmp;
 		unsigned char *p1, *p2;
 
 		/* Convert charset to UTF-8 using Code table 00 - Latin */
@@ -361,10 +486,13 @@ static void charset_conversion(struct dvb_v5_fe_parms *parms, char **dest, const
 	}
 
 	/* Convert from original charset to the desired one */
-	if (need_conversion)
+	if (need_conversion) {
 		dvb_iconv_to_charset(parms, *dest, destlen, s, len,
 				     input_charset,
 				     parms->output_charset);
+		/* The ISO-6937 to UTF-8 buffer, if any */
+		free(tmp);
+	}
 }
 
 void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
@@ -373,6 +501,9 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	size_t destlen, i, len2 = 0;
 	char *p, *p2, *type = parms->default_charset;
 	unsigned char *tmp1 = NULL, *tmp2 = NULL;
+	/* DVB strings are up to 255 bytes long: avoid mallocs for them */
+	unsigned char stack1[256] __attribute__((aligned(8)));
+	unsigned char stack2[256] __attribute__((aligned(8)));
 	const unsigned char *s;
 	int emphasis = 0;
 
@@ -443,7 +574,6 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	 */
 	destlen = len * 3;
 	*dest = malloc(destlen + 1);
-	*emph = malloc(destlen + 1);
 
 	/* Remove special chars */
 	if (!strncasecmp(type, "ISO-8859", 8) || !strcasecmp(type, "ISO-6937") || !strcasecmp(type, "ISO-10646/UTF-8")) {
@@ -451,8 +581,13 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		 * Handles the ISO/IEC 10646 1-byte control codes
 		 * (EN 300 468 v1.11.1 Table A.1)
 		 */
-		tmp1 = malloc(len + 2);
-		tmp2 = malloc(len + 2);
+		if (len + 2 <= sizeof(stack1)) {
+			tmp1 = stack1;
+			tmp2 = stack2;
+		} else {
+			tmp1 = malloc(len + 2);
+			tmp2 = malloc(len + 2);
+		}
 		p = (char *)tmp1;
 		p2 = (char *)tmp2;
 		s = src;
@@ -482,8 +617,13 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		uint16_t *out_code;
 		uint16_t *out_emph;
 
-		tmp1 = malloc(len + 2);
-		tmp2 = malloc(len + 2);
+		if (len + 2 <= sizeof(stack1)) {
+			tmp1 = stack1;
+			tmp2 = stack2;
+		} else {
+			tmp1 = malloc(len + 2);
+			tmp2 = malloc(len + 2);
+		}
 		out_code = (void *)tmp1;
 		out_emph = (void *)tmp2;
 
@@ -522,21 +662,15 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	if (*dest)
 		*dest = realloc(*dest, strlen(*dest) + 1);
 
-	if (!len2) {
-		if (tmp2) {
-			free (tmp2);
-			tmp2 = NULL;
-		}
-		free (*emph);
-		*emph = NULL;
-	} else {
+	if (len2) {
+		*emph = malloc(len2 * 3 + 1);
 		charset_conversion(parms, emph, tmp2, len2, type);
 		*emph = realloc(*emph, strlen(*emph) + 1);
 	}
 
-	if (tmp1)
+	if (tmp1 != stack1) {
 		free(tmp1);
-	if (tmp2)
 		free(tmp2);
+	}
 }
 
@@ -20,6 +20,7 @@
 #include <libdvbv5/cat.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-table-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -47,7 +48,7 @@ ssize_t dvb_table_cat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_cat), 1);
+		*table = dvb_table_calloc(parms, 1, sizeof(struct dvb_table_cat));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -91,7 +92,7 @@ ssize_t dvb_table_cat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 void dvb_table_cat_free(struct dvb_table_cat *cat)
 {
 	dvb_desc_free((struct dvb_desc **) &cat->descriptor);
-	free(cat);
+	dvb_table_free(cat);
 }
 
 void dvb_table_cat_print(struct dvb_v5_fe_parms *parms, struct dvb_table_cat *cat)
@@ -20,6 +20,7 @@
 #include <libdvbv5/eit.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-table-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -51,7 +52,7 @@ ssize_t dvb_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_eit), 1);
+		*table = dvb_table_calloc(parms, 1, sizeof(struct dvb_table_eit));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -75,7 +76,7 @@ ssize_t dvb_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_eit_event *event;
 
-		event = malloc(sizeof(struct dvb_table_eit_event));
+		event = dvb_table_malloc(parms, sizeof(struct dvb_table_eit_event));
 		if (!event) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -4;
@@ -126,9 +127,9 @@ void dvb_table_eit_free(struct dvb_table_eit *eit)
 		dvb_desc_free((struct dvb_desc **) &event->descriptor);
 		struct dvb_table_eit_event *tmp = event;
 		event = event->next;
-		free(tmp);
+		dvb_table_free(tmp);
 	}
-	free(eit);
+	dvb_table_free(eit);
 }
 
 void dvb_table_eit_print(struct dvb_v5_fe_parms *parms, struct dvb_table_eit *eit)
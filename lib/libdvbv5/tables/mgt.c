@@ -20,6 +20,7 @@
 #include <libdvbv5/mgt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-table-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -49,7 +50,7 @@ ssize_t atsc_table_mgt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct atsc_table_mgt), 1);
+		*table = dvb_table_calloc(parms, 1, sizeof(struct atsc_table_mgt));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -79,7 +80,7 @@ ssize_t atsc_table_mgt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 				   endbuf - p, size);
 			return -4;
 		}
-		table = (struct atsc_table_mgt_table *) malloc(sizeof(struct atsc_table_mgt_table));
+		table = dvb_table_malloc(parms, sizeof(struct atsc_table_mgt_table));
 		if (!table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -127,9 +128,9 @@ void atsc_table_mgt_free(struct atsc_table_mgt *mgt)
 
 		dvb_desc_free((struct dvb_desc **) &table->descriptor);
 		table = table->next;
-		free(tmp);
+		dvb_table_free(tmp);
 	}
-	free(mgt);
+	dvb_table_free(mgt);
 }
 
 void atsc_table_mgt_print(struct dvb_v5_fe_parms *parms, struct atsc_table_mgt *mgt)
@@ -21,6 +21,7 @@
 #include <libdvbv5/sdt.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-table-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_sdt), 1);
+		*table = dvb_table_calloc(parms, 1, sizeof(struct dvb_table_sdt));
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -78,7 +79,7 @@ ssize_t dvb_table_sdt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_sdt_service *service;
 
-		service = malloc(sizeof(struct dvb_table_sdt_service));
+		service = dvb_table_malloc(parms, sizeof(struct dvb_table_sdt_service));
 		if (!service) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -124,9 +125,9 @@ void dvb_table_sdt_free(struct dvb_table_sdt *sdt)
 		dvb_desc_free((struct dvb_desc **) &service->descriptor);
 		struct dvb_table_sdt_service *tmp = service;
 		service = service->next;
-		free(tmp);
+		dvb_table_free(tmp);
 	}
-	free(sdt);
+	dvb_table_free(sdt);
 }
 
 void dvb_table_sdt_print(struct dvb_v5_fe_parms *parms, struct dvb_table_sdt *sdt)
@@ -20,7 +20,9 @@
 #define __LIBV4L2_PRIV_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include <libv4lconvert.h> /* includes videodev2.h for us */
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
@@ -33,6 +35,10 @@
 #define V4L2_DEFAULT_NREADBUFFERS 4
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
+/* Number of converted frames the read ahead thread keeps */
+#define V4L2_READ_AHEAD_FRAMES 3
+/* read() does not return frames which are older than this (in seconds) */
+#define V4L2_MAX_FRAME_AGE 5
 
 #define V4L2_LOG_ERR(...) 			\
 	do { 					\
@@ -71,6 +77,22 @@
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+/* A frame converted ahead by the read thread */
+struct v4l2_read_frame {
+	unsigned char *data;
+	int size;
+	int state; /* V4L2_FRAME_FREE, _CONVERTING, _READY or _READING */
+	uint64_t time; /* capture time, CLOCK_MONOTONIC in ns */
+};
+
+/* A USERPTR or DMABUF buffer of the app, which we convert into directly */
+struct v4l2_app_buf {
+	unsigned char *start; /* for DMABUF buffers this is our mapping */
+	size_t length;
+	int fd;
+	ino_t ino;
+};
+
 struct v4l2_dev_info {
 	int fd;
 	int flags;
@@ -104,7 +126,20 @@ struct v4l2_dev_info {
 	void *plugin_library;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
-	int has_dmabuf_memory;
+	/* Memory type of the app's buffers, and of the driver's. These only
+	   differ when converting into the app's USERPTR or DMABUF buffers, in
+	   which case the driver captures into mmap buffers */
+	unsigned int memory;
+	unsigned int driver_memory;
+	struct v4l2_app_buf app_bufs[V4L2_MAX_NO_FRAMES];
+	/* read ahead thread, see v4l2_read_thread() */
+	pthread_t read_thread;
+	pthread_cond_t read_cond;
+	int read_thread_active;
+	int read_thread_stop;
+	int read_thread_error;
+	int read_frame_size;
+	struct v4l2_read_frame read_frames[V4L2_READ_AHEAD_FRAMES];
 };
 
 /* From v4l2-plugin.c */
@@ -65,11 +65,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <linux/dma-buf.h>
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
@@ -86,9 +89,21 @@
 #define V4L2_STREAM_TOUCHED		0x1000
 #define V4L2_USE_READ_FOR_READ		0x2000
 #define V4L2_SUPPORTS_TIMEPERFRAME	0x4000
+#define V4L2_READ_THREAD		0x8000
+
+/* States of the frames converted ahead by the read thread */
+enum {
+	V4L2_FRAME_FREE,
+	V4L2_FRAME_CONVERTING,
+	V4L2_FRAME_READY,
+	V4L2_FRAME_READING,
+};
 
 #define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
 
+/* Size of the fd -> device lookup table, larger fds get searched for */
+#define V4L2_FD_TABLE_SIZE		65536
+
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
@@ -102,6 +117,18 @@ static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
 };
 static int devices_used;
 
+/* Under LD_PRELOAD every ioctl / read / mmap / close of the process goes
+   through v4l2_get_index(), so it looks up the device by fd in this table,
+   without taking any locks. An entry holds the index in devices + 1, and is
+   only set once the device is fully initialized. */
+static unsigned char fd_table[V4L2_FD_TABLE_SIZE];
+
+static void v4l2_set_fd_table(int fd, int value)
+{
+	if ((unsigned int)fd < V4L2_FD_TABLE_SIZE)
+		__atomic_store_n(&fd_table[fd], value, __ATOMIC_RELEASE);
+}
+
 static int v4l2_ensure_convert_mmap_buf(int index)
 {
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
@@ -313,6 +340,128 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 	return 0;
 }
 
+/* Remember the USERPTR or DMABUF buffer the app queues, so that the frame
+   captured in the matching driver buffer can be converted into it */
+static int v4l2_set_app_buffer(int index, struct v4l2_buffer *buf)
+{
+	struct v4l2_app_buf *app;
+	size_t length = buf->length;
+	struct stat st;
+	off_t size;
+
+	if (buf->index >= devices[index].no_frames) {
+		errno = EINVAL;
+		return -1;
+	}
+	app = &devices[index].app_bufs[buf->index];
+
+	if (devices[index].memory == V4L2_MEMORY_USERPTR) {
+		if (!buf->m.userptr ||
+		    length < devices[index].dest_fmt.fmt.pix.sizeimage) {
+			errno = EINVAL;
+			return -1;
+		}
+		app->start = (unsigned char *)buf->m.userptr;
+		app->length = length;
+		return 0;
+	}
+
+	/* DMABUF, apps normally cycle through the same set of dmabufs, so only
+	   map a buffer when it is a different one than last time */
+	if (fstat(buf->m.fd, &st))
+		return -1;
+	if (app->start && app->fd == buf->m.fd && app->ino == st.st_ino)
+		return 0;
+
+	if (!length) {
+		size = lseek(buf->m.fd, 0, SEEK_END);
+		if (size < 0)
+			return -1;
+		length = size;
+	}
+	if (length < devices[index].dest_fmt.fmt.pix.sizeimage) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (app->start)
+		SYS_MUNMAP(app->start, app->length);
+	app->start = (void *)SYS_MMAP(NULL, length, PROT_READ | PROT_WRITE,
+				      MAP_SHARED, buf->m.fd, 0);
+	if (app->start == MAP_FAILED) {
+		int saved_err = errno;
+
+		V4L2_PERROR("mmapping dmabuf %d", buf->m.fd);
+		app->start = NULL;
+		errno = saved_err;
+		return -1;
+	}
+	app->length = length;
+	app->fd = buf->m.fd;
+	app->ino = st.st_ino;
+
+	return 0;
+}
+
+static void v4l2_release_app_buffers(int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
+		struct v4l2_app_buf *app = &devices[index].app_bufs[i];
+
+		if (devices[index].memory == V4L2_MEMORY_DMABUF && app->start)
+			SYS_MUNMAP(app->start, app->length);
+		app->start = NULL;
+		app->length = 0;
+		app->fd = -1;
+	}
+}
+
+/* Convert the frame in driver buffer buf->index into dest, or when dest is
+   NULL, into the buffer with the same index as seen by the app */
+static int v4l2_convert(int index, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size)
+{
+	struct v4l2_app_buf *app = &devices[index].app_bufs[buf->index];
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE,
+	};
+	int result, saved_err, dmabuf = 0;
+
+	if (!dest && devices[index].memory == V4L2_MEMORY_MMAP) {
+		dest = devices[index].convert_mmap_buf +
+			buf->index * devices[index].convert_mmap_frame_size;
+	} else if (!dest) {
+		if (!app->start) {
+			V4L2_LOG_ERR("no app buffer for buf %u\n", buf->index);
+			errno = EINVAL;
+			return -1;
+		}
+		dest = app->start;
+		dest_size = app->length;
+		dmabuf = devices[index].memory == V4L2_MEMORY_DMABUF;
+	}
+
+	/* Let the exporter of the dmabuf take care of cache coherency */
+	if (dmabuf)
+		SYS_IOCTL(app->fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	result = v4lconvert_convert(devices[index].convert,
+			&devices[index].src_fmt, &devices[index].dest_fmt,
+			devices[index].frame_pointers[buf->index],
+			buf->bytesused, dest, dest_size);
+
+	if (dmabuf) {
+		saved_err = errno;
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+		SYS_IOCTL(app->fd, DMA_BUF_IOCTL_SYNC, &sync);
+		errno = saved_err;
+	}
+
+	return result;
+}
+
 static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		unsigned char *dest, int dest_size)
 {
@@ -348,12 +497,14 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			return -1;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
-				dest_size);
+		/* The read thread converts without holding the lock, so that
+		   v4l2_read() can take a frame meanwhile. Nothing else touches
+		   the stream while it runs, see v4l2_stop_read_thread(). */
+		if (devices[index].flags & V4L2_READ_THREAD)
+			pthread_mutex_unlock(&devices[index].stream_lock);
+		result = v4l2_convert(index, buf, dest, dest_size);
+		if (devices[index].flags & V4L2_READ_THREAD)
+			pthread_mutex_lock(&devices[index].stream_lock);
 
 		if (devices[index].first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
@@ -402,6 +553,230 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 	return result;
 }
 
+static uint64_t v4l2_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The capture time of a frame, when the driver does not use monotonic
+   timestamps the best we can do is the time it was dequeued */
+static uint64_t v4l2_frame_time(struct v4l2_buffer *buf)
+{
+	if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return v4l2_now();
+
+	return buf->timestamp.tv_sec * 1000000000ULL +
+	       buf->timestamp.tv_usec * 1000ULL;
+}
+
+static int v4l2_frame_too_old(uint64_t time, uint64_t now)
+{
+	return now > time &&
+	       now - time > V4L2_MAX_FRAME_AGE * 1000000000ULL;
+}
+
+/* A free frame to convert into, or when there is none the oldest
+   converted frame, which gets dropped */
+static struct v4l2_read_frame *v4l2_get_read_frame(int index)
+{
+	struct v4l2_read_frame *frame = NULL;
+	int i;
+
+	for (i = 0; i < V4L2_READ_AHEAD_FRAMES; i++) {
+		struct v4l2_read_frame *f = &devices[index].read_frames[i];
+
+		if (f->state == V4L2_FRAME_FREE)
+			return f;
+		if (f->state == V4L2_FRAME_READY &&
+		    (!frame || f->time < frame->time))
+			frame = f;
+	}
+
+	if (frame)
+		V4L2_LOG("read thread: app not keeping up, dropping frame\n");
+	return frame;
+}
+
+/*
+ * In read() mode using streaming under the hood this thread dequeues and
+ * converts frames ahead of time, so that converting a frame does not delay
+ * dequeuing the next one, and v4l2_read() only has to copy out a ready
+ * frame. It runs with stream_lock held, except when waiting for a frame and
+ * when converting.
+ */
+static void *v4l2_read_thread(void *arg)
+{
+	int index = (intptr_t)arg;
+	struct pollfd pfd = { .fd = devices[index].fd, .events = POLLIN };
+	struct v4l2_read_frame *frame;
+	struct v4l2_buffer buf;
+	int result;
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	while (!devices[index].read_thread_stop) {
+		/* Wait for a frame with a timeout, so that we get stopped
+		   even if the device stops producing frames */
+		pthread_mutex_unlock(&devices[index].stream_lock);
+		result = poll(&pfd, 1, 100);
+		pthread_mutex_lock(&devices[index].stream_lock);
+		if (result <= 0 || devices[index].read_thread_stop)
+			continue;
+
+		frame = v4l2_get_read_frame(index);
+		if (!frame) {
+			/* All frames are being read by the app */
+			pthread_cond_wait(&devices[index].read_cond,
+					  &devices[index].stream_lock);
+			continue;
+		}
+		frame->state = V4L2_FRAME_CONVERTING;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		result = v4l2_dequeue_and_convert(index, &buf, frame->data,
+						  devices[index].read_frame_size);
+		if (result < 0) {
+			frame->state = V4L2_FRAME_FREE;
+			if (errno == EAGAIN)
+				continue;
+			devices[index].read_thread_error = errno;
+			break;
+		}
+		v4l2_queue_read_buffer(index, buf.index);
+
+		frame->size = result;
+		frame->time = v4l2_frame_time(&buf);
+		frame->state = V4L2_FRAME_READY;
+		pthread_cond_broadcast(&devices[index].read_cond);
+	}
+
+	devices[index].read_thread_active = 0;
+	pthread_cond_broadcast(&devices[index].read_cond);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return NULL;
+}
+
+static int v4l2_start_read_thread(int index)
+{
+	int i, result, size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	unsigned char *data;
+
+	if (devices[index].read_frame_size != size) {
+		data = realloc(devices[index].read_frames[0].data,
+			       size * V4L2_READ_AHEAD_FRAMES);
+		if (!data)
+			return -1;
+
+		for (i = 0; i < V4L2_READ_AHEAD_FRAMES; i++) {
+			devices[index].read_frames[i].data = data + i * size;
+			devices[index].read_frames[i].state = V4L2_FRAME_FREE;
+		}
+		devices[index].read_frame_size = size;
+	}
+
+	devices[index].read_thread_stop = 0;
+	devices[index].read_thread_error = 0;
+	devices[index].read_thread_active = 1;
+	result = pthread_create(&devices[index].read_thread, NULL,
+				v4l2_read_thread, (void *)(intptr_t)index);
+	if (result) {
+		devices[index].read_thread_active = 0;
+		errno = result;
+		return -1;
+	}
+	devices[index].flags |= V4L2_READ_THREAD;
+
+	return 0;
+}
+
+/* Called with stream_lock held, before anything about the stream changes */
+static void v4l2_stop_read_thread(int index)
+{
+	int i;
+
+	if (!(devices[index].flags & V4L2_READ_THREAD))
+		return;
+
+	devices[index].read_thread_stop = 1;
+	pthread_cond_broadcast(&devices[index].read_cond);
+	while (devices[index].read_thread_active)
+		pthread_cond_wait(&devices[index].read_cond,
+				  &devices[index].stream_lock);
+	pthread_join(devices[index].read_thread, NULL);
+	devices[index].flags &= ~V4L2_READ_THREAD;
+
+	/* These may have been converted with settings which are changing */
+	for (i = 0; i < V4L2_READ_AHEAD_FRAMES; i++)
+		if (devices[index].read_frames[i].state == V4L2_FRAME_READY)
+			devices[index].read_frames[i].state = V4L2_FRAME_FREE;
+}
+
+/* read() using the read thread, returns the oldest converted frame which is
+   not too old */
+static int v4l2_read_ahead(int index, unsigned char *dest, size_t n)
+{
+	struct v4l2_read_frame *frame;
+	uint64_t now;
+	int i, size;
+
+	if (!(devices[index].flags & V4L2_READ_THREAD) &&
+	    v4l2_start_read_thread(index))
+		return -1;
+
+	for (;;) {
+		frame = NULL;
+		now = v4l2_now();
+		for (i = 0; i < V4L2_READ_AHEAD_FRAMES; i++) {
+			struct v4l2_read_frame *f = &devices[index].read_frames[i];
+
+			if (f->state != V4L2_FRAME_READY)
+				continue;
+			if (v4l2_frame_too_old(f->time, now)) {
+				V4L2_LOG("dropping frame older than %d seconds\n",
+					 V4L2_MAX_FRAME_AGE);
+				f->state = V4L2_FRAME_FREE;
+				pthread_cond_broadcast(&devices[index].read_cond);
+				continue;
+			}
+			if (!frame || f->time < frame->time)
+				frame = f;
+		}
+		if (frame)
+			break;
+
+		if (!devices[index].read_thread_active) {
+			int saved_err = devices[index].read_thread_error;
+
+			/* Let the next read() start a new thread */
+			v4l2_stop_read_thread(index);
+			errno = saved_err;
+			return -1;
+		}
+		if (fcntl(devices[index].fd, F_GETFL) & O_NONBLOCK) {
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&devices[index].read_cond,
+				  &devices[index].stream_lock);
+	}
+
+	frame->state = V4L2_FRAME_READING;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	size = MIN(n, frame->size);
+	memcpy(dest, frame->data, size);
+	pthread_mutex_lock(&devices[index].stream_lock);
+	frame->state = V4L2_FRAME_FREE;
+	pthread_cond_broadcast(&devices[index].read_cond);
+
+	return size;
+}
+
 static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
@@ -528,6 +903,8 @@ static int v4l2_deactivate_read_stream(int index)
 {
 	int result;
 
+	v4l2_stop_read_thread(index);
+
 	result = v4l2_streamoff(index);
 	if (result)
 		return result;
@@ -545,13 +922,23 @@ static int v4l2_deactivate_read_stream(int index)
 
 static int v4l2_needs_conversion(int index)
 {
-	if (devices[index].convert == NULL || devices[index].has_dmabuf_memory)
+	/* When the app's own buffers are handed to the driver, it captures
+	   into them directly */
+	if (devices[index].convert == NULL ||
+	    devices[index].driver_memory != V4L2_MEMORY_MMAP)
 		return 0;
 
 	return v4lconvert_needs_conversion(devices[index].convert,
 			&devices[index].src_fmt, &devices[index].dest_fmt);
 }
 
+/* Are we converting into the app's USERPTR or DMABUF buffers? */
+static int v4l2_converts_to_app_buffers(int index)
+{
+	return devices[index].memory != V4L2_MEMORY_MMAP &&
+	       v4l2_needs_conversion(index);
+}
+
 static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 {
 	if (!v4l2_needs_conversion(index))
@@ -561,6 +948,20 @@ static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 	if (buf->index >= devices[index].no_frames)
 		buf->index = 0;
 
+	if (devices[index].memory != V4L2_MEMORY_MMAP) {
+		struct v4l2_app_buf *app = &devices[index].app_bufs[buf->index];
+
+		buf->memory = devices[index].memory;
+		if (buf->memory == V4L2_MEMORY_USERPTR)
+			buf->m.userptr = (unsigned long)app->start;
+		else
+			buf->m.fd = app->fd;
+		buf->length = app->length ? app->length :
+			devices[index].dest_fmt.fmt.pix.sizeimage;
+		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
+		return;
+	}
+
 	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
 	buf->length = devices[index].convert_mmap_frame_size;
 	if (devices[index].frame_map_count[buf->index])
@@ -728,7 +1129,7 @@ int v4l2_open(const char *file, int oflag, ...)
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
 	int i, index;
-	char *lfname;
+	char *lfname, *s;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
 	struct v4l2_streamparm parm = { 0, };
@@ -792,6 +1193,9 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	if (!getenv("LIBV4L2_ALLOW_CONVERSION"))
 		v4l2_flags |= V4L2_DISABLE_CONVERSION;
 
+	if (getenv("LIBV4L2_READ_AHEAD"))
+		v4l2_flags |= V4L2_ENABLE_READ_AHEAD;
+
 	/* init libv4lconvert */
 	if (!(v4l2_flags & V4L2_DISABLE_CONVERSION)) {
 		convert = v4lconvert_create_with_dev_ops(fd, dev_ops_priv, dev_ops);
@@ -802,6 +1206,13 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			errno = saved_err;
 			return -1;
 		}
+
+		/* Allow converting with multiple threads through the
+		   environment, 0 means one thread per cpu */
+		s = getenv("LIBV4L2_THREADS");
+		if (s && v4lconvert_set_threads(convert, atoi(s)))
+			V4L2_LOG_WARN("could not use %s conversion threads: %s\n",
+				      s, v4lconvert_get_error_message(convert));
 	}
 
 no_capture:
@@ -846,6 +1257,7 @@ no_capture:
 				     &devices[index].dest_fmt);
 
 	pthread_mutex_init(&devices[index].stream_lock, NULL);
+	pthread_cond_init(&devices[index].read_cond, NULL);
 
 	devices[index].no_frames = 0;
 	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
@@ -856,9 +1268,14 @@ no_capture:
 		devices[index].frame_pointers[i] = MAP_FAILED;
 		devices[index].frame_map_count[i] = 0;
 	}
+	devices[index].memory = V4L2_MEMORY_MMAP;
+	devices[index].driver_memory = V4L2_MEMORY_MMAP;
+	v4l2_release_app_buffers(index);
 	devices[index].frame_queued = 0;
 	devices[index].readbuf = NULL;
 	devices[index].readbuf_size = 0;
+	devices[index].read_frames[0].data = NULL;
+	devices[index].read_frame_size = 0;
 
 	if (index >= devices_used)
 		devices_used = index + 1;
@@ -870,6 +1287,9 @@ no_capture:
 		v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
 	v4l2_update_fps(index, &parm);
 
+	/* Start intercepting calls on the fd now that the device is ready */
+	v4l2_set_fd_table(fd, index + 1);
+
 	V4L2_LOG("open: %d\n", fd);
 
 	return fd;
@@ -884,6 +1304,9 @@ static int v4l2_get_index(int fd)
 	if (fd == -1)
 		return -1;
 
+	if ((unsigned int)fd < V4L2_FD_TABLE_SIZE)
+		return __atomic_load_n(&fd_table[fd], __ATOMIC_ACQUIRE) - 1;
+
 	for (index = 0; index < devices_used; index++)
 		if (devices[index].fd == fd)
 			break;
@@ -908,6 +1331,8 @@ int v4l2_close(int fd)
 	pthread_mutex_lock(&devices[index].stream_lock);
 	devices[index].open_count--;
 	result = devices[index].open_count != 0;
+	if (!result)
+		v4l2_stop_read_thread(index);
 	pthread_mutex_unlock(&devices[index].stream_lock);
 
 	if (result)
@@ -918,6 +1343,9 @@ int v4l2_close(int fd)
 			devices[index].dev_ops);
 
 	/* Free resources */
+	free(devices[index].read_frames[0].data);
+	devices[index].read_frames[0].data = NULL;
+	devices[index].read_frame_size = 0;
 	v4l2_unmap_buffers(index);
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
 		if (v4l2_buffers_mapped(index)) {
@@ -930,6 +1358,7 @@ int v4l2_close(int fd)
 		devices[index].convert_mmap_buf = MAP_FAILED;
 		devices[index].convert_mmap_buf_size = 0;
 	}
+	v4l2_release_app_buffers(index);
 	v4lconvert_destroy(devices[index].convert);
 	free(devices[index].readbuf);
 	devices[index].readbuf = NULL;
@@ -938,6 +1367,7 @@ int v4l2_close(int fd)
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
+	v4l2_set_fd_table(fd, 0);
 	devices[index].fd = -1;
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
@@ -958,7 +1388,10 @@ int v4l2_dup(int fd)
 	if (index == -1)
 		return syscall(SYS_dup, fd);
 
+	/* Protects open_count against racing with v4l2_close() */
+	pthread_mutex_lock(&devices[index].stream_lock);
 	devices[index].open_count++;
+	pthread_mutex_unlock(&devices[index].stream_lock);
 
 	return fd;
 }
@@ -985,6 +1418,7 @@ static int v4l2_check_buffer_change_ok(int index)
 			devices[index].convert_mmap_buf_size);
 	devices[index].convert_mmap_buf = MAP_FAILED;
 	devices[index].convert_mmap_buf_size = 0;
+	v4l2_release_app_buffers(index);
 
 	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
@@ -1202,6 +1636,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 			stream_needs_locking = 1;
 		}
 		break;
+	case VIDIOC_EXPBUF:
+		if (((struct v4l2_exportbuffer *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (*((enum v4l2_buf_type *)arg) ==
@@ -1240,6 +1681,8 @@ no_capture_request:
 
 	if (stream_needs_locking) {
 		pthread_mutex_lock(&devices[index].stream_lock);
+		/* The read thread must not run while the stream changes */
+		v4l2_stop_read_thread(index);
 		/* If this is the first stream-related ioctl, and we should only allow
 		   libv4lconvert supported destination formats (so that it can do flipping,
 		   processing, etc.) and the current destination format is not supported,
@@ -1379,33 +1822,47 @@ no_capture_request:
 
 	case VIDIOC_REQBUFS: {
 		struct v4l2_requestbuffers *req = arg;
+		unsigned int memory = req->memory;
 
-		/* IMPROVEME (maybe?) add support for userptr's? */
-		if (req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_DMABUF) {
+		if (memory != V4L2_MEMORY_MMAP &&
+		    memory != V4L2_MEMORY_USERPTR &&
+		    memory != V4L2_MEMORY_DMABUF) {
 			errno = EINVAL;
 			result = -1;
 			break;
 		}
 
-		if (req->memory == V4L2_MEMORY_DMABUF) {
-			devices[index].has_dmabuf_memory = 1;
-			V4L2_LOG("memory type is V4L2_MEMORY_DMABUF, "
-			         "buf conversion and mmap emulation are disabled\n");
-		}
-
 		result = v4l2_check_buffer_change_ok(index);
 		if (result)
 			break;
 
+		/* When converting the frames get converted straight into the
+		   app's USERPTR or DMABUF buffers, and the driver captures into
+		   mmap buffers. Otherwise the app's buffers go to the driver. */
+		devices[index].memory = memory;
+		devices[index].driver_memory = V4L2_MEMORY_MMAP;
+		if (memory != V4L2_MEMORY_MMAP && !v4l2_needs_conversion(index)) {
+			devices[index].driver_memory = memory;
+			V4L2_LOG("memory type is %s, buf conversion and mmap "
+				 "emulation are disabled\n",
+				 memory == V4L2_MEMORY_USERPTR ?
+				 "V4L2_MEMORY_USERPTR" : "V4L2_MEMORY_DMABUF");
+		}
+
 		/* No more buffers than we can manage please */
 		if (req->count > V4L2_MAX_NO_FRAMES)
 			req->count = V4L2_MAX_NO_FRAMES;
 
+		req->memory = devices[index].driver_memory;
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
-		if (result < 0)
+		req->memory = memory;
+		if (result < 0) {
+			devices[index].memory = V4L2_MEMORY_MMAP;
+			devices[index].driver_memory = V4L2_MEMORY_MMAP;
 			break;
+		}
 		result = 0; /* some drivers return the number of buffers on success */
 
 		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
@@ -1424,6 +1881,8 @@ no_capture_request:
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
+		if (v4l2_converts_to_app_buffers(index))
+			buf->memory = V4L2_MEMORY_MMAP;
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
@@ -1448,6 +1907,13 @@ no_capture_request:
 				break;
 		}
 
+		if (v4l2_converts_to_app_buffers(index)) {
+			result = v4l2_set_app_buffer(index, buf);
+			if (result)
+				break;
+			buf->memory = V4L2_MEMORY_MMAP;
+		}
+
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_QBUF, arg);
@@ -1479,12 +1945,16 @@ no_capture_request:
 			break;
 		}
 
-		/* An application can do a DQBUF before mmap-ing in the buffer,
-		   but we need the buffer _now_ to write our converted data
-		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
-		if (result)
-			break;
+		if (v4l2_converts_to_app_buffers(index)) {
+			buf->memory = V4L2_MEMORY_MMAP;
+		} else {
+			/* An application can do a DQBUF before mmap-ing in the
+			   buffer, but we need the buffer _now_ to write our
+			   converted data to it! */
+			result = v4l2_ensure_convert_mmap_buf(index);
+			if (result)
+				break;
+		}
 
 		result = v4l2_dequeue_and_convert(index, buf, 0,
 				devices[index].convert_mmap_frame_size);
@@ -1497,6 +1967,23 @@ no_capture_request:
 		break;
 	}
 
+	case VIDIOC_EXPBUF:
+		/* Exporting the driver's buffers is only useful when not
+		   converting, otherwise they hold the unconverted frames and
+		   the app should convert into its own DMABUF buffers instead */
+		if (v4l2_needs_conversion(index)) {
+			V4L2_LOG("EXPBUF not possible while converting, use "
+				 "V4L2_MEMORY_DMABUF buffers instead\n");
+			errno = EINVAL;
+			result = -1;
+			break;
+		}
+
+		result = devices[index].dev_ops->ioctl(
+				devices[index].dev_ops_priv,
+				fd, VIDIOC_EXPBUF, arg);
+		break;
+
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
@@ -1646,11 +2133,12 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	}
 
 	if (!(devices[index].flags & V4L2_USE_READ_FOR_READ) &&
-	    devices[index].has_dmabuf_memory) {
-		V4L2_PERROR("memory type is V4L2_MEMORY_DMABUF, "
-		            "no support v4l2 read\n");
+	    devices[index].memory != V4L2_MEMORY_MMAP) {
+		V4L2_LOG_ERR("memory type is not V4L2_MEMORY_MMAP, "
+			     "no support v4l2 read\n");
 		errno = EINVAL;
-		return -1;
+		result = -1;
+		goto leave;
 	}
 
 	/* Since we need to do conversion try to use mmap (streaming) mode under
@@ -1674,15 +2162,24 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 
 	if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
 		result = v4l2_read_and_convert(index, dest, n);
+	} else if (devices[index].flags & V4L2_ENABLE_READ_AHEAD) {
+		result = v4l2_read_ahead(index, dest, n);
 	} else {
 		struct v4l2_buffer buf;
+		unsigned int tries = devices[index].no_frames;
 
-		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		result = v4l2_dequeue_and_convert(index, &buf, dest, n);
+		/* Skip frames which sat in the driver's queue for too long,
+		   at most one queue full */
+		do {
+			buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			result = v4l2_dequeue_and_convert(index, &buf, dest, n);
+			if (result < 0)
+				break;
 
-		if (result >= 0)
 			v4l2_queue_read_buffer(index, buf.index);
+		} while (tries-- &&
+			 v4l2_frame_too_old(v4l2_frame_time(&buf), v4l2_now()));
 	}
 
 leave:
@@ -1728,7 +2225,8 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		return result;
 	}
 
-        if (index != -1 && devices[index].has_dmabuf_memory) {
+        if (index != -1 &&
+	    devices[index].driver_memory == V4L2_MEMORY_DMABUF) {
                 return (void *)SYS_MMAP(start, length, prot, flags, fd, offset);
         }
 
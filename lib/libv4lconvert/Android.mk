@@ -7,6 +7,7 @@ LOCAL_SRC_FILES := \
     cpia1.c \
     crop.c \
     flip.c \
+    fused.c \
     helper.c \
     hm12.c \
     jidctflt.c \
@@ -18,6 +19,7 @@ LOCAL_SRC_FILES := \
     mr97310a.c \
     pac207.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -26,6 +28,7 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
@@ -29,6 +29,7 @@
  * see bayer.c from libdc1394 for all supported algorithms
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
@@ -162,174 +163,255 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
-		int start_with_green, int blue_line)
+
+/* Lines are rendered in blocks of this many lines when the source needs to
+   be reduced to 8 bit first, so that the reduced lines are still in the
+   cache when demosaicing them */
+#define BAYER_BLOCK_LINES 32
+
+typedef void (*bayer_unpack_func)(const unsigned char *src,
+		unsigned char *bayer8, int width, int height);
+
+struct bayer_slice;
+
+/* Renders lines [first, last), bayer points to line first - 1, or to line 0
+   when first is 0, and holds the lines up to and including line last */
+typedef void (*bayer_render_func)(const struct bayer_slice *s,
+		const unsigned char *bayer, unsigned int stride,
+		int first, int last, unsigned char *line);
+
+struct bayer_slice {
+	struct v4lconvert_data *data;
+	const unsigned char *bayer;
+	unsigned char *dest;
+	int width;
+	int height;
+	unsigned int stride;
+	unsigned int pixfmt;	/* 8 bit equivalent of the source format */
+	/* Pattern of the first line */
+	int start_with_green;
+	int blue_line;
+	int yvu;
+	int edge;		/* Use edge directed green interpolation */
+	bayer_unpack_func unpack; /* NULL for 8 bit sources */
+	bayer_render_func render;
+	unsigned char *scratch;
+	int scratch_size;	/* Per slice */
+};
+
+/* Pairs of pixels in the middle of a line, the first pixel of a pair is
+   not green, the second one is */
+void v4lconvert_bayer_to_rgb24_pairs(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, int stride, int blue_line)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
-
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-
-			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-			/* Write first pixel */
-			t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride];
-			} else {
-				*bgr++ = bayer[stride];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+	int t0, t1;
 
-			/* Write second pixel */
-			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-			} else {
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t0;
-			}
-			bayer++;
-		} else {
-			/* Write first pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride];
-				*bgr++ = t0;
-			}
-		}
+	if (blue_line) {
+		for (; pairs > 0; pairs--, bayer += 2) {
+			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+				bayer[stride * 2 + 2] + 2) >> 2;
+			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+				bayer[stride * 2 + 1] + 2) >> 2;
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
 
-		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
-		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t1;
 		}
-
-		if (bayer < bayer_end) {
-			/* write second to last pixel */
+	} else {
+		for (; pairs > 0; pairs--, bayer += 2) {
 			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
 				bayer[stride * 2 + 2] + 2) >> 2;
 			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
 				bayer[stride * 2 + 1] + 2) >> 2;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-			/* write last pixel */
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+
 			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+	}
+}
 
-			bayer++;
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders one line from the line above it (bayer) and the line below it */
+static void bayer_line_to_rgbbgr24(const struct bayer_slice *s,
+		const unsigned char *bayer, const unsigned int stride,
+		unsigned char *bgr, int start_with_green, int blue_line)
+{
+	int t0, t1, pairs;
+	/* (width - 2) because of the border */
+	const unsigned char *bayer_end = bayer + (s->width - 2);
 
-		} else {
-			/* write last pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+	if (start_with_green) {
 
+		t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride];
+		} else {
+			*bgr++ = bayer[stride];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+		/* Write second pixel */
+		t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+		} else {
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t0;
+		}
+		bayer++;
+	} else {
+		/* Write first pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride];
+			*bgr++ = t0;
+		}
+	}
 
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+	pairs = (bayer_end - bayer) / 2;
+	if (pairs > 0) {
+		s->data->cpu_ops->bayer_to_rgb24_pairs(bayer, bgr, pairs,
+						       stride, blue_line);
+		bayer += 2 * pairs;
+		bgr += 6 * pairs;
 	}
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+	if (bayer < bayer_end) {
+		/* write second to last pixel */
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+			bayer[stride * 2 + 1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+		/* write last pixel */
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+	} else {
+		/* write last pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+	}
 }
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+/* Edge directed mode: re-interpolate green at the red and blue pixels of a
+   line rendered by bayer_line_to_rgbbgr24() along the direction in which it
+   changes least, instead of averaging all 4 neighbours, which blurs edges
+   and gives zipper artefacts on them. Red and blue are left as is. */
+static void bayer_line_edge_green(const unsigned char *bayer,
+		const unsigned int stride, unsigned char *bgr, int width,
+		int start_with_green)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+	const unsigned char *line = bayer + stride;
+	int x, dh, dv, g;
+
+	for (x = start_with_green ? 2 : 1; x < width - 1; x += 2) {
+		dh = abs(line[x - 1] - line[x + 1]);
+		dv = abs(bayer[x] - line[stride + x]);
+		if (dh < dv)
+			g = (line[x - 1] + line[x + 1] + 1) >> 1;
+		else if (dv < dh)
+			g = (bayer[x] + line[stride + x] + 1) >> 1;
+		else
+			g = (line[x - 1] + line[x + 1] + bayer[x] +
+			     line[stride + x] + 2) >> 2;
+		bgr[3 * x + 1] = g;
+	}
 }
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+static void bayer_to_rgbbgr24_lines(const struct bayer_slice *s,
+		const unsigned char *bayer, const unsigned int stride,
+		int first, int last, unsigned char *line)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
-}
+	unsigned char *bgr = s->dest + first * s->width * 3;
+	int width = s->width, height = s->height;
+	int start_with_green = s->start_with_green, blue_line = s->blue_line;
+	int y;
+
+	if (first == 0) {
+		/* render the first line */
+		v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride,
+				bgr, width, start_with_green, blue_line);
+		bgr += width * 3;
+		first = 1;
+	}
+
+	if ((first - 1) & 1) {
+		start_with_green = !start_with_green;
+		blue_line = !blue_line;
+	}
+
+	/* skip the special case bottom line */
+	for (y = first; y < last && y < height - 1; y++) {
+		bayer_line_to_rgbbgr24(s, bayer, stride, bgr,
+				       start_with_green, blue_line);
+		if (s->edge)
+			bayer_line_edge_green(bayer, stride, bgr, width,
+					      start_with_green);
+		bayer += stride;
+		bgr += width * 3;
+
+		blue_line = !blue_line;
+		start_with_green = !start_with_green;
+	}
 
+	if (last == height) {
+		/* render the last line, bayer is at line height - 2 now */
+		bgr = s->dest + (height - 1) * width * 3;
+		start_with_green = s->start_with_green ^ (height & 1);
+		blue_line = s->blue_line ^ (height & 1);
+		v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
+				!start_with_green, !blue_line);
+	}
+}
 static void v4lconvert_border_bayer_line_to_y(
 		const unsigned char *bayer, const unsigned char *adjacent_bayer,
 		unsigned char *y, int width, int start_with_green, int blue_line)
@@ -429,220 +511,469 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+
+/* The luminance of pairs of pixels in the middle of a line, see
+   v4lconvert_bayer_to_rgb24_pairs() */
+void v4lconvert_bayer_to_y_pairs(const unsigned char *bayer,
+		unsigned char *ydst, int pairs, int stride, int blue_line)
+{
+	int t0, t1;
+
+	if (blue_line) {
+		for (; pairs > 0; pairs--, bayer += 2) {
+			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+			t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
+			*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
+
+			t0 = bayer[2] + bayer[stride * 2 + 2];
+			t1 = bayer[stride + 1] + bayer[stride + 3];
+			*ydst++ = (4226 * t1 + 16594 * bayer[stride + 2] +
+					1611 * t0 + 524288) >> 15;
+		}
+	} else {
+		for (; pairs > 0; pairs--, bayer += 2) {
+			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+			t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+
+			t0 = bayer[2] + bayer[stride * 2 + 2];
+			t1 = bayer[stride + 1] + bayer[stride + 3];
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
+					1611 * t1 + 524288) >> 15;
+		}
+	}
+}
+
+/* Renders the luminance of one line from the line above it (bayer) and the
+   line below it */
+static void bayer_line_to_y(const struct bayer_slice *s,
+		const unsigned char *bayer, const unsigned int stride,
+		unsigned char *ydst, int start_with_green, int blue_line)
 {
-	int blue_line = 0, start_with_green = 0, x, y;
-	unsigned char *ydst = yuv;
+	int t0, t1, pairs;
+	/* (width - 2) because of the border */
+	const unsigned char *bayer_end = bayer + (s->width - 2);
+
+	if (start_with_green) {
+		t0 = bayer[1] + bayer[stride * 2 + 1];
+		/* Write first pixel */
+		t1 = bayer[0] + bayer[stride * 2] + bayer[stride + 1];
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * bayer[stride] + 524288) >> 15;
+
+		/* Write second pixel */
+		t1 = bayer[stride] + bayer[stride + 2];
+		if (blue_line)
+			*ydst++ = (4226 * t1 + 16594 * bayer[stride + 1] +
+					1611 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 1] +
+					1611 * t1 + 524288) >> 15;
+		bayer++;
+	} else {
+		/* Write first pixel */
+		t0 = bayer[0] + bayer[stride * 2];
+		if (blue_line) {
+			*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride] +
+					1661 * t0 + 524288) >> 15;
+		} else {
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride] +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+		}
+	}
+
+	pairs = (bayer_end - bayer) / 2;
+	if (pairs > 0) {
+		s->data->cpu_ops->bayer_to_y_pairs(bayer, ydst, pairs,
+						   stride, blue_line);
+		bayer += 2 * pairs;
+		ydst += 2 * pairs;
+	}
+
+	if (bayer < bayer_end) {
+		/* Write second to last pixel */
+		t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+		t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+
+		/* write last pixel */
+		t0 = bayer[2] + bayer[stride * 2 + 2];
+		if (blue_line) {
+			*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride + 2] +
+					1661 * t0 + 524288) >> 15;
+		} else {
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+		}
+	} else {
+		/* write last pixel */
+		t0 = bayer[0] + bayer[stride * 2];
+		t1 = bayer[1] + bayer[stride * 2 + 1] + bayer[stride];
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride + 1] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+	}
+}
+
+/* Edge directed mode, the luminance is calculated from the rgb values of
+   the line, rendered into line as bgr24 */
+static void bayer_line_to_y_edge(const struct bayer_slice *s,
+		const unsigned char *bayer, const unsigned int stride,
+		unsigned char *ydst, int start_with_green, int blue_line,
+		unsigned char *line)
+{
+	int x;
+
+	bayer_line_to_rgbbgr24(s, bayer, stride, line, start_with_green,
+			       blue_line);
+	bayer_line_edge_green(bayer, stride, line, s->width, start_with_green);
+
+	for (x = 0; x < s->width; x++, line += 3)
+		ydst[x] = (3223 * line[0] + 16594 * line[1] + 8453 * line[2] +
+			   524288) >> 15;
+}
+
+/* first is even and so is last, unless it is the height */
+static void bayer_to_yuv420_lines(const struct bayer_slice *s,
+		const unsigned char *bayer, const unsigned int stride,
+		int first, int last, unsigned char *line)
+{
+	int width = s->width, height = s->height;
+	int start_with_green = s->start_with_green, blue_line = s->blue_line;
+	unsigned char *ydst = s->dest + first * width;
 	unsigned char *udst, *vdst;
+	const unsigned char *uv = first ? bayer + stride : bayer;
+	int x, y;
 
-	if (yvu) {
-		vdst = yuv + width * height;
+	if (s->yvu) {
+		vdst = s->dest + width * height;
 		udst = vdst + width * height / 4;
 	} else {
-		udst = yuv + width * height;
+		udst = s->dest + width * height;
 		vdst = udst + width * height / 4;
 	}
+	udst += first / 2 * ((width + 1) / 2);
+	vdst += first / 2 * ((width + 1) / 2);
 
 	/* First calculate the u and v planes 2x2 pixels at a time */
-	switch (src_pixfmt) {
+	switch (s->pixfmt) {
 	case V4L2_PIX_FMT_SBGGR8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
-				b  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				r  = bayer[x + stride + 1];
+				b  = uv[x];
+				g  = uv[x + 1];
+				g += uv[x + stride];
+				r  = uv[x + stride + 1];
 				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
-			bayer += 2 * stride;
+			uv += 2 * stride;
 		}
-		blue_line = 1;
 		break;
 
 	case V4L2_PIX_FMT_SRGGB8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
-				r  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				b  = bayer[x + stride + 1];
+				r  = uv[x];
+				g  = uv[x + 1];
+				g += uv[x + stride];
+				b  = uv[x + stride + 1];
 				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
-			bayer += 2 * stride;
+			uv += 2 * stride;
 		}
 		break;
 
 	case V4L2_PIX_FMT_SGBRG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
-				g  = bayer[x];
-				b  = bayer[x + 1];
-				r  = bayer[x + stride];
-				g += bayer[x + stride + 1];
+				g  = uv[x];
+				b  = uv[x + 1];
+				r  = uv[x + stride];
+				g += uv[x + stride + 1];
 				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
-			bayer += 2 * stride;
+			uv += 2 * stride;
 		}
-		blue_line = 1;
-		start_with_green = 1;
 		break;
 
 	case V4L2_PIX_FMT_SGRBG8:
-		for (y = 0; y < height; y += 2) {
+		for (y = first; y < last; y += 2) {
 			for (x = 0; x < width; x += 2) {
 				int b, g, r;
 
-				g  = bayer[x];
-				r  = bayer[x + 1];
-				b  = bayer[x + stride];
-				g += bayer[x + stride + 1];
+				g  = uv[x];
+				r  = uv[x + 1];
+				b  = uv[x + stride];
+				g += uv[x + stride + 1];
 				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
 				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 			}
-			bayer += 2 * stride;
+			uv += 2 * stride;
 		}
-		start_with_green = 1;
 		break;
 	}
 
-	/* Point bayer back to start of frame */
-	bayer -= stride * height;
-
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst, width,
-			start_with_green, blue_line);
-	ydst += width;
-
-	/* reduce height by 2 because of the border */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-			t0 = bayer[1] + bayer[stride * 2 + 1];
-			/* Write first pixel */
-			t1 = bayer[0] + bayer[stride * 2] + bayer[stride + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride] + 524288) >> 15;
-
-			/* Write second pixel */
-			t1 = bayer[stride] + bayer[stride + 2];
-			if (blue_line)
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 1] +
-						1611 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 1] +
-						1611 * t1 + 524288) >> 15;
-			bayer++;
-		} else {
-			/* Write first pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-		}
-
-		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 2] +
-						1611 * t0 + 524288) >> 15;
-			}
-		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						1611 * t1 + 524288) >> 15;
-			}
-		}
+	if (first == 0) {
+		/* render the first line */
+		v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst,
+				width, start_with_green, blue_line);
+		ydst += width;
+		first = 1;
+	}
 
-		if (bayer < bayer_end) {
-			/* Write second to last pixel */
-			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-			t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-			/* write last pixel */
-			t0 = bayer[2] + bayer[stride * 2 + 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride + 2] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-			bayer++;
-		} else {
-			/* write last pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			t1 = bayer[1] + bayer[stride * 2 + 1] + bayer[stride];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-		}
+	if ((first - 1) & 1) {
+		start_with_green = !start_with_green;
+		blue_line = !blue_line;
+	}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+	/* skip the special case bottom line */
+	for (y = first; y < last && y < height - 1; y++) {
+		if (s->edge)
+			bayer_line_to_y_edge(s, bayer, stride, ydst,
+					     start_with_green, blue_line, line);
+		else
+			bayer_line_to_y(s, bayer, stride, ydst,
+					start_with_green, blue_line);
+		bayer += stride;
+		ydst += width;
 
 		blue_line = !blue_line;
 		start_with_green = !start_with_green;
 	}
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
-			!start_with_green, !blue_line);
+	if (last == height) {
+		/* render the last line, bayer is at line height - 2 now */
+		ydst = s->dest + (height - 1) * width;
+		start_with_green = s->start_with_green ^ (height & 1);
+		blue_line = s->blue_line ^ (height & 1);
+		v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
+				!start_with_green, !blue_line);
+	}
+}
+
+static void bayer_slice_lines(void *priv, int slice, int first, int last)
+{
+	const struct bayer_slice *s = priv;
+	unsigned char *scratch = s->scratch + slice * s->scratch_size;
+	unsigned char *line = scratch;
+	int i, y, top, bottom, end;
+
+	if (!s->unpack) {
+		top = first ? first - 1 : 0;
+		s->render(s, s->bayer + top * s->stride, s->stride, first, last,
+			  line);
+		return;
+	}
+
+	/* Reduce blocks of lines to 8 bit into scratch and demosaic these
+	   straight away, so that no 8 bit copy of the whole frame is needed */
+	line += (BAYER_BLOCK_LINES + 2) * s->width;
+	for (y = first; y < last; y = end) {
+		end = y + BAYER_BLOCK_LINES;
+		if (end > last)
+			end = last;
+		top = y ? y - 1 : 0;
+		bottom = end < s->height ? end + 1 : s->height;
+
+		for (i = top; i < bottom; i++)
+			s->unpack(s->bayer + i * s->stride,
+				  scratch + (i - top) * s->width, s->width, 1);
+		s->render(s, scratch, s->width, y, end, line);
+	}
+}
+
+/* Returns the 8 bit bayer format with the same pattern as pixfmt, and sets
+   unpack to the function for reducing lines to 8 bit, if necessary */
+static unsigned int bayer_pattern(unsigned int pixfmt,
+		bayer_unpack_func *unpack, int *line_size, int width)
+{
+	*unpack = NULL;
+	*line_size = width;
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		*unpack = v4lconvert_bayer10p_to_bayer8;
+		*line_size = (width + 3) / 4 * 5;
+		break;
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+		*unpack = v4lconvert_bayer10_to_bayer8;
+		*line_size = width * 2;
+		break;
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		*unpack = v4lconvert_bayer16_to_bayer8;
+		*line_size = width * 2;
+		break;
+	}
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SBGGR16:
+		return V4L2_PIX_FMT_SBGGR8;
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGBRG16:
+		return V4L2_PIX_FMT_SGBRG8;
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SGRBG16:
+		return V4L2_PIX_FMT_SGRBG8;
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SRGGB16:
+		return V4L2_PIX_FMT_SRGGB8;
+	}
+	return pixfmt;
+}
+
+/* The size of a raw bayer frame, bytesperline is only used when it is
+   large enough, as drivers for the 10 / 16 bit formats tend to not fill it
+   in correctly */
+int v4lconvert_bayer_frame_size(unsigned int pixfmt, int width, int height,
+		unsigned int bytesperline)
+{
+	bayer_unpack_func unpack;
+	int line_size;
+
+	bayer_pattern(pixfmt, &unpack, &line_size, width);
+	if ((int)bytesperline < line_size)
+		bytesperline = line_size;
+	return bytesperline * height;
+}
+
+/* bgr selects the order of the rgb values, for yuv420 the luminance is
+   calculated from bgr */
+static int bayer_convert(struct v4lconvert_data *data, struct bayer_slice *s,
+		unsigned int pixfmt, int bgr, int align)
+{
+	int line_size, slices = v4lconvert_threads_count(data->threads);
+
+	s->data = data;
+	s->pixfmt = bayer_pattern(pixfmt, &s->unpack, &line_size, s->width);
+	if ((int)s->stride < line_size)
+		s->stride = line_size;
+	s->start_with_green = s->pixfmt == V4L2_PIX_FMT_SGBRG8 ||
+			      s->pixfmt == V4L2_PIX_FMT_SGRBG8;
+	s->blue_line = s->pixfmt == V4L2_PIX_FMT_SBGGR8 ||
+		       s->pixfmt == V4L2_PIX_FMT_SGBRG8;
+	if (!bgr)
+		s->blue_line = !s->blue_line;
+	s->edge = v4lcontrol_get_ctrl(data->control, V4LCONTROL_DEMOSAIC_EDGE);
+
+	/* Per slice: a block of lines reduced to 8 bit, plus room for the
+	   unpack functions writing upto 3 bytes past the end of a line, and a
+	   rgb line for calculating the luminance in edge directed mode */
+	s->scratch_size = 0;
+	if (s->unpack)
+		s->scratch_size += (BAYER_BLOCK_LINES + 2) * s->width + 4;
+	if (s->edge && s->render == bayer_to_yuv420_lines)
+		s->scratch_size += s->width * 3;
+
+	s->scratch = NULL;
+	if (s->scratch_size) {
+		s->scratch = v4lconvert_alloc_buffer(s->scratch_size * slices,
+				&data->bayer_buf, &data->bayer_buf_size);
+		if (!s->scratch)
+			return v4lconvert_oom_error(data);
+	}
+
+	v4lconvert_run_slices(data->threads, bayer_slice_lines, s,
+			      s->height, align);
+	return 0;
+}
+
+static int bayer_to_rgbbgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width, int height,
+		const unsigned int stride, unsigned int pixfmt, int bgr24)
+{
+	struct bayer_slice s = {
+		.bayer = bayer,
+		.dest = bgr,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.render = bayer_to_rgbbgr24_lines,
+	};
+
+	return bayer_convert(data, &s, pixfmt, bgr24, 1);
+}
+
+int v4lconvert_bayer_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width, int height,
+		const unsigned int stride, unsigned int pixfmt)
+{
+	return bayer_to_rgbbgr24(data, bayer, bgr, width, height, stride,
+				 pixfmt, 0);
+}
+
+int v4lconvert_bayer_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr, int width, int height,
+		const unsigned int stride, unsigned int pixfmt)
+{
+	return bayer_to_rgbbgr24(data, bayer, bgr, width, height, stride,
+				 pixfmt, 1);
+}
+
+int v4lconvert_bayer_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *yuv, int width, int height,
+		const unsigned int stride, unsigned int src_pixfmt, int yvu)
+{
+	struct bayer_slice s = {
+		.bayer = bayer,
+		.dest = yuv,
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.yvu = yvu,
+		.render = bayer_to_yuv420_lines,
+	};
+
+	return bayer_convert(data, &s, src_pixfmt, 1, 2);
 }
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
+void v4lconvert_bayer10_to_bayer8(const unsigned char *bayer10,
 		unsigned char *bayer8, int width, int height)
 {
 	int i;
-	uint16_t *src = bayer10;
+	const uint16_t *src = (const uint16_t *)bayer10;
 
 	for (i = 0; i < width * height; i++)
 		bayer8[i] = src[i] >> 2;
 }
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
+void v4lconvert_bayer10p_to_bayer8(const unsigned char *bayer10p,
 		unsigned char *bayer8, int width, int height)
 {
 	unsigned long i;
@@ -663,7 +994,7 @@ void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
 	}
 }
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
+void v4lconvert_bayer16_to_bayer8(const unsigned char *bayer16,
 		unsigned char *bayer8, int width, int height)
 {
 	int i;
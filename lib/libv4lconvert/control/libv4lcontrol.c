@@ -566,6 +566,55 @@ static void v4lcontrol_get_flags_from_db(struct v4lcontrol_data *data,
 		}
 }
 
+/* Check if the device delivers frames which need demosaicing. Devices which
+   also offer formats we can convert to are left out, as any fake control
+   makes us go through the conversion path for those formats. */
+static int v4lcontrol_needs_demosaic(struct v4lcontrol_data *data)
+{
+	struct v4l2_fmtdesc fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	int bayer = 0;
+
+	for (fmt.index = 0; data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+					VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++) {
+		switch (fmt.pixelformat) {
+		case V4L2_PIX_FMT_SBGGR8:
+		case V4L2_PIX_FMT_SGBRG8:
+		case V4L2_PIX_FMT_SGRBG8:
+		case V4L2_PIX_FMT_SRGGB8:
+		case V4L2_PIX_FMT_SBGGR10:
+		case V4L2_PIX_FMT_SGBRG10:
+		case V4L2_PIX_FMT_SGRBG10:
+		case V4L2_PIX_FMT_SRGGB10:
+		case V4L2_PIX_FMT_SBGGR10P:
+		case V4L2_PIX_FMT_SGBRG10P:
+		case V4L2_PIX_FMT_SGRBG10P:
+		case V4L2_PIX_FMT_SRGGB10P:
+		case V4L2_PIX_FMT_SBGGR16:
+		case V4L2_PIX_FMT_SGBRG16:
+		case V4L2_PIX_FMT_SGRBG16:
+		case V4L2_PIX_FMT_SRGGB16:
+		/* compressed bayer */
+		case V4L2_PIX_FMT_SPCA561:
+		case V4L2_PIX_FMT_SN9C10X:
+		case V4L2_PIX_FMT_PAC207:
+		case V4L2_PIX_FMT_MR97310A:
+		case V4L2_PIX_FMT_JL2005BCD:
+		case V4L2_PIX_FMT_SN9C2028:
+		case V4L2_PIX_FMT_SQ905C:
+		case V4L2_PIX_FMT_STV0680:
+			bayer = 1;
+			break;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			return 0;
+		}
+	}
+
+	return bayer;
+}
+
 struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 	const struct libv4l_dev_ops *dev_ops, int always_needs_conversion)
 {
@@ -650,6 +699,11 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 		}
 	}
 
+	/* Offer the choice between the fast and the edge directed demosaicing
+	   for raw bayer sensors */
+	if (v4lcontrol_needs_demosaic(data))
+		data->controls |= 1 << V4LCONTROL_DEMOSAIC_EDGE;
+
 	/* Check if a camera does not have hardware autogain and has the necessary
 	   controls, before enabling sw autogain, even if this is requested by flags.
 	   This is necessary because some cameras share a USB-ID, but can have
@@ -841,6 +895,15 @@ static const struct v4l2_queryctrl fake_controls[V4LCONTROL_COUNT] = {
 		.step = 1,
 		.default_value = 100,
 		.flags = V4L2_CTRL_FLAG_SLIDER
+	}, {
+		.id = V4L2_CTRL_CLASS_USER + 0x2001, /* FIXME */
+		.type = V4L2_CTRL_TYPE_BOOLEAN,
+		.name =  "Demosaic, Edge Directed",
+		.minimum = 0,
+		.maximum = 1,
+		.step = 1,
+		.default_value = 0,
+		.flags = 0
 	},
 };
 
@@ -45,6 +45,7 @@ enum {
 	V4LCONTROL_AUTO_ENABLE_COUNT,
 	V4LCONTROL_AUTOGAIN,
 	V4LCONTROL_AUTOGAIN_TARGET,
+	V4LCONTROL_DEMOSAIC_EDGE,
 	V4LCONTROL_COUNT
 };
 
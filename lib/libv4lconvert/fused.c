@@ -0,0 +1,330 @@
+/*
+
+# Conversion routines which fold flipping and cropping into the conversion
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * Instead of converting the whole frame into a temporary buffer, then
+ * flipping it into another one and then cropping it into dest, the routines
+ * in here convert only the part of each source line which ends up in dest,
+ * into a single line buffer, and copy that to its final place in dest.
+ * The result is identical to the one of v4lconvert_flip() + v4lconvert_crop().
+ *
+ * All of this works on independent lines, so frames get split into bands
+ * which are handled in parallel when there are worker threads.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+/* The source line from which dest line y comes */
+int v4lconvert_geometry_src_line(const struct v4lconvert_geometry *geom,
+		int src_height, int y)
+{
+	y += geom->starty;
+	return geom->vflip ? src_height - 1 - y : y;
+}
+
+/* The dest line to which source line src_y goes, or -1 if it is cropped */
+int v4lconvert_geometry_dest_line(const struct v4lconvert_geometry *geom,
+		int src_height, int src_y)
+{
+	int y = geom->vflip ? src_height - 1 - src_y : src_y;
+
+	y -= geom->starty;
+	return (y >= 0 && y < geom->height) ? y : -1;
+}
+
+/* The first source column of the part of a line which ends up in dest */
+int v4lconvert_geometry_src_col(const struct v4lconvert_geometry *geom,
+		int src_width)
+{
+	return geom->hflip ? src_width - geom->startx - geom->width :
+			     geom->startx;
+}
+
+void v4lconvert_geometry_copy_line(unsigned char *dest,
+		const unsigned char *src, int width, int bpp, int hflip)
+{
+	int x;
+
+	if (!hflip) {
+		memcpy(dest, src, width * bpp);
+		return;
+	}
+
+	src += (width - 1) * bpp;
+	if (bpp == 1) {
+		for (x = 0; x < width; x++)
+			*dest++ = *src--;
+		return;
+	}
+	for (x = 0; x < width; x++) {
+		dest[0] = src[0];
+		dest[1] = src[1];
+		dest[2] = src[2];
+		dest += 3;
+		src -= 3;
+	}
+}
+
+struct fused_slice {
+	const unsigned char *src;
+	unsigned char *dest;
+	const struct v4l2_format *src_fmt;
+	const struct v4lconvert_geometry *geom;
+	unsigned char *lines;	/* line buffers, line_size bytes per slice */
+	int line_size;
+	int yvu;
+	void (*to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*to_yuv420)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int yvu);
+};
+
+static void packed422_to_rgb24_lines(void *priv, int slice, int first,
+		int last)
+{
+	const struct fused_slice *s = priv;
+	const struct v4lconvert_geometry *geom = s->geom;
+	int stride = s->src_fmt->fmt.pix.bytesperline;
+	unsigned char *line = s->lines + slice * s->line_size;
+	unsigned char *dest = s->dest + first * geom->bytesperline;
+	int x, x0, y;
+
+	/* Convert whole pixel pairs, as they share their chroma samples */
+	x = v4lconvert_geometry_src_col(geom, s->src_fmt->fmt.pix.width);
+	x0 = x & ~1;
+
+	for (y = first; y < last; y++) {
+		int sy = v4lconvert_geometry_src_line(geom,
+				s->src_fmt->fmt.pix.height, y);
+
+		s->to_rgb24(s->src + sy * stride + 2 * x0, line,
+			    s->line_size / 3, 1, stride);
+		v4lconvert_geometry_copy_line(dest, line + 3 * (x - x0),
+					      geom->width, 3, geom->hflip);
+		dest += geom->bytesperline;
+	}
+}
+
+int v4lconvert_packed422_to_rgb24_fused(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, unsigned int dest_pix_fmt,
+		const struct v4lconvert_geometry *geom)
+{
+	struct fused_slice s = {
+		.src = src,
+		.dest = dest,
+		.src_fmt = src_fmt,
+		.geom = geom,
+	};
+	int bgr = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+	int x;
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+		s.to_rgb24 = bgr ? data->cpu_ops->yuyv_to_bgr24 :
+				   data->cpu_ops->yuyv_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		s.to_rgb24 = bgr ? data->cpu_ops->yvyu_to_bgr24 :
+				   data->cpu_ops->yvyu_to_rgb24;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		s.to_rgb24 = bgr ? data->cpu_ops->uyvy_to_bgr24 :
+				   data->cpu_ops->uyvy_to_rgb24;
+		break;
+	}
+
+	x = v4lconvert_geometry_src_col(geom, src_fmt->fmt.pix.width);
+	s.line_size = (((x + geom->width + 1) & ~1) - (x & ~1)) * 3;
+	s.lines = v4lconvert_alloc_buffer(
+			s.line_size * v4lconvert_threads_count(data->threads),
+			&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+	if (!s.lines)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_run_slices(data->threads, packed422_to_rgb24_lines, &s,
+			      geom->height, 1);
+	return 0;
+}
+
+static void packed422_to_yuv420_lines(void *priv, int slice, int first,
+		int last)
+{
+	const struct fused_slice *s = priv;
+	const struct v4lconvert_geometry *geom = s->geom;
+	int stride = s->src_fmt->fmt.pix.bytesperline;
+	int width = geom->width;
+	int chroma_bpl = geom->bytesperline / 2;
+	/* 2 lines of Y, followed by 1 line of U and 1 line of V */
+	unsigned char *lines = s->lines + slice * s->line_size;
+	unsigned char *dest = s->dest + first * geom->bytesperline;
+	unsigned char *udest, *vdest;
+	int x, y;
+
+	udest = s->dest + geom->height * geom->bytesperline;
+	vdest = udest + geom->height / 2 * chroma_bpl;
+	if (s->yvu) {
+		unsigned char *tmp = udest;
+
+		udest = vdest;
+		vdest = tmp;
+	}
+	udest += first / 2 * chroma_bpl;
+	vdest += first / 2 * chroma_bpl;
+
+	x = v4lconvert_geometry_src_col(geom, s->src_fmt->fmt.pix.width);
+	for (y = first; y < last; y += 2) {
+		int sy = v4lconvert_geometry_src_line(geom,
+				s->src_fmt->fmt.pix.height, y);
+		/* With vflip dest line y comes from the 2nd line of the pair */
+		int pair = geom->vflip ? sy - 1 : sy;
+
+		s->to_yuv420(s->src + pair * stride + 2 * x, lines, width, 2,
+			     stride, 0);
+		v4lconvert_geometry_copy_line(dest,
+				lines + (geom->vflip ? width : 0),
+				width, 1, geom->hflip);
+		v4lconvert_geometry_copy_line(dest + geom->bytesperline,
+				lines + (geom->vflip ? 0 : width),
+				width, 1, geom->hflip);
+		v4lconvert_geometry_copy_line(udest, lines + 2 * width,
+				width / 2, 1, geom->hflip);
+		v4lconvert_geometry_copy_line(vdest, lines + 2 * width + width / 2,
+				width / 2, 1, geom->hflip);
+		dest += 2 * geom->bytesperline;
+		udest += chroma_bpl;
+		vdest += chroma_bpl;
+	}
+}
+
+int v4lconvert_packed422_to_yuv420_fused(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, unsigned int dest_pix_fmt,
+		const struct v4lconvert_geometry *geom)
+{
+	struct fused_slice s = {
+		.src = src,
+		.dest = dest,
+		.src_fmt = src_fmt,
+		.geom = geom,
+		.line_size = geom->width * 3,
+		.yvu = dest_pix_fmt == V4L2_PIX_FMT_YVU420,
+	};
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_UYVY:
+		s.to_yuv420 = data->cpu_ops->uyvy_to_yuv420;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		/* yvyu is yuyv with the chroma planes swapped */
+		s.yvu = !s.yvu;
+		/* fall through */
+	default:
+		s.to_yuv420 = data->cpu_ops->yuyv_to_yuv420;
+		break;
+	}
+
+	s.lines = v4lconvert_alloc_buffer(
+			s.line_size * v4lconvert_threads_count(data->threads),
+			&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+	if (!s.lines)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_run_slices(data->threads, packed422_to_yuv420_lines, &s,
+			      geom->height, 2);
+	return 0;
+}
+
+struct geometry_slice {
+	const unsigned char *src;
+	unsigned char *dest;
+	const struct v4l2_format *fmt;
+	const struct v4lconvert_geometry *geom;
+};
+
+static void geometry_copy_lines(void *priv, int slice, int first, int last)
+{
+	const struct geometry_slice *s = priv;
+	const struct v4lconvert_geometry *geom = s->geom;
+	int width = s->fmt->fmt.pix.width;
+	int height = s->fmt->fmt.pix.height;
+	int bpl = s->fmt->fmt.pix.bytesperline;
+	int x = v4lconvert_geometry_src_col(geom, width);
+	int y, sy;
+
+	switch (s->fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		for (y = first; y < last; y++) {
+			sy = v4lconvert_geometry_src_line(geom, height, y);
+			v4lconvert_geometry_copy_line(
+				s->dest + y * geom->bytesperline,
+				s->src + sy * bpl + 3 * x,
+				geom->width, 3, geom->hflip);
+		}
+		break;
+
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420: {
+		const unsigned char *usrc = s->src + height * bpl;
+		const unsigned char *vsrc = usrc + height / 2 * bpl / 2;
+		unsigned char *udest = s->dest + geom->height * geom->bytesperline;
+		unsigned char *vdest = udest +
+			geom->height / 2 * geom->bytesperline / 2;
+
+		for (y = first; y < last; y++) {
+			sy = v4lconvert_geometry_src_line(geom, height, y);
+			v4lconvert_geometry_copy_line(
+				s->dest + y * geom->bytesperline,
+				s->src + sy * bpl + x, geom->width, 1, geom->hflip);
+			if (y & 1)
+				continue;
+
+			/* The chroma line of this pair of lines */
+			sy = geom->starty / 2 + y / 2;
+			if (geom->vflip)
+				sy = height / 2 - 1 - sy;
+			v4lconvert_geometry_copy_line(
+				udest + y / 2 * geom->bytesperline / 2,
+				usrc + sy * bpl / 2 + x / 2,
+				geom->width / 2, 1, geom->hflip);
+			v4lconvert_geometry_copy_line(
+				vdest + y / 2 * geom->bytesperline / 2,
+				vsrc + sy * bpl / 2 + x / 2,
+				geom->width / 2, 1, geom->hflip);
+		}
+		break;
+	}
+	}
+}
+
+/* Flip and / or crop an already converted rgb24 / bgr24 / yuv420 / yvu420
+   frame into dest in a single pass, in place of v4lconvert_flip() followed
+   by v4lconvert_crop() */
+void v4lconvert_geometry_copy(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *fmt, const struct v4lconvert_geometry *geom)
+{
+	struct geometry_slice s = { src, dest, fmt, geom };
+
+	v4lconvert_run_slices(data->threads, geometry_copy_lines, &s,
+			      geom->height, 2);
+}
@@ -72,11 +72,16 @@
 */
 
 #include <stdint.h>
-#include "tinyjpeg-internal.h"
+#include "libv4lconvert-priv.h"
 
 #define FAST_FLOAT float
+/* These are also defined by jpeglib.h when building with libjpeg */
+#ifndef DCTSIZE
 #define DCTSIZE	   8
+#endif
+#ifndef DCTSIZE2
 #define DCTSIZE2   (DCTSIZE * DCTSIZE)
+#endif
 
 #define DEQUANTIZE(coef, quantval)  (((FAST_FLOAT) (coef)) * (quantval))
 
@@ -115,16 +120,19 @@ static inline unsigned char descale_and_clamp(int x, int shift)
 #endif
 
 /*
- * Perform dequantization and inverse DCT on one block of coefficients.
+ * Perform dequantization and inverse DCT on one block of coefficients,
+ * both coef and qtable are in natural (not zigzag) order.
  */
 
-void tinyjpeg_idct_float(struct component *compptr, uint8_t *output_buf, int stride)
+void tinyjpeg_idct_float(const int16_t *coef,
+		const struct tinyjpeg_qtable *qtable, uint8_t *output_buf,
+		int stride)
 {
 	FAST_FLOAT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
 	FAST_FLOAT tmp10, tmp11, tmp12, tmp13;
 	FAST_FLOAT z5, z10, z11, z12, z13;
-	int16_t *inptr;
-	FAST_FLOAT *quantptr;
+	const int16_t *inptr;
+	const FAST_FLOAT *quantptr;
 	FAST_FLOAT *wsptr;
 	uint8_t *outptr;
 	int ctr;
@@ -132,8 +140,8 @@ void tinyjpeg_idct_float(struct component *compptr, uint8_t *output_buf, int str
 
 	/* Pass 1: process columns from input, store into work array. */
 
-	inptr = compptr->DCT;
-	quantptr = compptr->Q_table;
+	inptr = coef;
+	quantptr = qtable->aan;
 	wsptr = workspace;
 	for (ctr = DCTSIZE; ctr > 0; ctr--) {
 		/* Due to quantization, we will usually find that many of the input
@@ -45,6 +45,7 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
+	tinyjpeg_set_threads(data->tinyjpeg, data->threads);
 	if (tinyjpeg_parse_header(data->tinyjpeg, src, src_size)) {
 		V4LCONVERT_ERR("parsing JPEG header: %s",
 				tinyjpeg_get_errorstring(data->tinyjpeg));
@@ -280,10 +281,12 @@ static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt,
+	const struct v4lconvert_geometry *geom)
 {
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
+	unsigned char *line = NULL;
 	int result = 0;
 
 	/* libjpeg errors before decoding the first line should signal EAGAIN */
@@ -326,17 +329,44 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			data->cinfo.out_color_space = JCS_EXT_BGR;
 #endif
-		row_pointer[0] = dest;
+		/* When flipping / cropping, decode each line into a line buffer
+		   and copy the part we want to its place in dest */
+		if (geom) {
+			line = v4lconvert_alloc_buffer(width * 3,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!line)
+				return v4lconvert_oom_error(data);
+		}
+		row_pointer[0] = line ? line : dest;
 		jpeg_start_decompress(&data->cinfo);
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		while (data->cinfo.output_scanline < height) {
+			int y = data->cinfo.output_scanline;
+
 			jpeg_read_scanlines(&data->cinfo, row_pointer, 1);
-			row_pointer[0] += 3 * width;
+			if (!line) {
+				row_pointer[0] += 3 * width;
+				continue;
+			}
+			y = v4lconvert_geometry_dest_line(geom, height, y);
+			if (y == -1)
+				continue;
+			v4lconvert_geometry_copy_line(
+				dest + y * geom->bytesperline,
+				line + 3 * v4lconvert_geometry_src_col(geom, width),
+				geom->width, 3, geom->hflip);
+#ifndef JCS_EXTENSIONS
+			if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
+				v4lconvert_swap_rgb(dest + y * geom->bytesperline,
+						    dest + y * geom->bytesperline,
+						    geom->width, 1);
+#endif
 		}
 		jpeg_finish_decompress(&data->cinfo);
 #ifndef JCS_EXTENSIONS
-		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
+		if (!line && dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			v4lconvert_swap_rgb(dest, dest, width, height);
 #endif
 	} else {
@@ -47,6 +47,9 @@
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
 			"v4l-convert: error " __VA_ARGS__)
 
+/* Upper limit for v4lconvert_set_threads() */
+#define V4LCONVERT_MAX_THREADS           64
+
 /* Card flags */
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
@@ -77,11 +80,13 @@ struct v4lconvert_data {
 	int rotate90_buf_size;
 	int flip_buf_size;
 	int convert_pixfmt_buf_size;
+	int bayer_buf_size;
 	unsigned char *convert1_buf;
 	unsigned char *convert2_buf;
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
 	unsigned char *convert_pixfmt_buf;
+	unsigned char *bayer_buf;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
 	void *dev_ops_priv;
@@ -97,6 +102,84 @@ struct v4lconvert_data {
 
 	/* For cpia1 decoder */
 	unsigned char *previous_frame;
+
+	/* Plain C or SIMD versions of the rgb / yuv converters */
+	const struct v4lconvert_cpu_ops *cpu_ops;
+
+	/* Worker threads, NULL when converting in the calling thread only */
+	struct v4lconvert_threads *threads;
+};
+
+/* Called by v4lconvert_run_slices() for each band of lines [first, last) of
+   a frame, from multiple threads at once. slice is the index of the band, for
+   picking per thread scratch buffers, and is < v4lconvert_threads_count(). */
+typedef void (*v4lconvert_slice_func)(void *priv, int slice,
+		int first, int last);
+
+/* A tinyjpeg quantization table in natural (not zigzag) order, scaled for
+   the AA&N float IDCT */
+struct tinyjpeg_qtable {
+	float aan[64];
+};
+
+/* The rgb / yuv conversion routines which have an optimized version for the
+   CPU we are running on, see rgbyuv-simd.c */
+struct v4lconvert_cpu_ops {
+	void (*yuyv_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuyv_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yvyu_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yvyu_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*uyvy_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	void (*yuyv_to_yuv420)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int yvu);
+	void (*uyvy_to_yuv420)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride, int yvu);
+	void (*yuv420_to_rgb24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int yvu);
+	void (*yuv420_to_bgr24)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int yvu);
+	void (*nv12_to_rgb24)(const unsigned char *src, unsigned char *dest,
+			int width, int height, int bgr);
+	void (*rgb24_to_yuv420)(const unsigned char *src, unsigned char *dest,
+			const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
+	/* Bilinear demosaicing of pairs of pixels in the middle of a bayer
+	   line, see bayer.c */
+	void (*bayer_to_rgb24_pairs)(const unsigned char *bayer,
+			unsigned char *bgr, int pairs, int stride, int blue_line);
+	void (*bayer_to_y_pairs)(const unsigned char *bayer,
+			unsigned char *ydst, int pairs, int stride, int blue_line);
+	/* Dequantization plus inverse DCT of a block, and colour conversion
+	   of lines with horizontally subsampled chroma for tinyjpeg */
+	void (*jpeg_idct)(const int16_t *coef,
+			const struct tinyjpeg_qtable *qtable,
+			uint8_t *dest, int stride);
+	void (*jpeg_ycbcr_h2_to_rgb24)(const unsigned char *y,
+			const unsigned char *cb, const unsigned char *cr,
+			unsigned char *dest, int width, int bgr);
+	/* Sums of each of the comps interleaved components of n groups of
+	   bytes, for the statistics of v4lprocessing */
+	void (*component_sums)(const unsigned char *buf, int n, int comps,
+			unsigned int *sums);
+};
+
+/* Flipping and cropping to apply while converting, for converters which write
+   straight into the final destination, see fused.c. startx / starty are the
+   top left corner of the dest window in the flipped frame. */
+struct v4lconvert_geometry {
+	int hflip;
+	int vflip;
+	int startx;
+	int starty;
+	int width;
+	int height;
+	int bytesperline;
 };
 
 struct v4lconvert_pixfmt {
@@ -109,6 +192,19 @@ struct v4lconvert_pixfmt {
 
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
+const struct v4lconvert_cpu_ops *v4lconvert_get_cpu_ops(void);
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count);
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads);
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads);
+
+/* Split lines into bands, which are a multiple of align lines, and call func
+   for each band, spreading them over the threads. threads may be NULL. */
+void v4lconvert_run_slices(struct v4lconvert_threads *threads,
+		v4lconvert_slice_func func, void *priv, int lines, int align);
+
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size);
 
@@ -222,9 +318,17 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags);
 
+void tinyjpeg_idct_float(const int16_t *coef,
+		const struct tinyjpeg_qtable *qtable, uint8_t *dest, int stride);
+
+void tinyjpeg_ycbcr_h2_to_rgb24(const unsigned char *y,
+		const unsigned char *cb, const unsigned char *cr,
+		unsigned char *dest, int width, int bgr);
+
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
-	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt,
+	const struct v4lconvert_geometry *geom);
 
 int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 	unsigned int dest_pix_fmt, unsigned char *dest, int width, int height);
@@ -256,22 +360,34 @@ void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+int v4lconvert_bayer_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb, int width, int height,
+		const unsigned int stride, unsigned int pixfmt);
+
+int v4lconvert_bayer_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb, int width, int height,
+		const unsigned int stride, unsigned int pixfmt);
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+int v4lconvert_bayer_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *yuv, int width, int height,
+		const unsigned int stride, unsigned int src_pixfmt, int yvu);
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
+int v4lconvert_bayer_frame_size(unsigned int pixfmt, int width, int height,
+		unsigned int bytesperline);
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
+void v4lconvert_bayer_to_rgb24_pairs(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, int stride, int blue_line);
+
+void v4lconvert_bayer_to_y_pairs(const unsigned char *bayer,
+		unsigned char *ydst, int pairs, int stride, int blue_line);
+
+void v4lconvert_bayer10_to_bayer8(const unsigned char *bayer10,
 		unsigned char *bayer8, int width, int height);
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
+void v4lconvert_bayer10p_to_bayer8(const unsigned char *bayer10p,
 		unsigned char *bayer8, int width, int height);
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
+void v4lconvert_bayer16_to_bayer8(const unsigned char *bayer16,
 		unsigned char *bayer8, int width, int height);
 
 void v4lconvert_hm12_to_rgb24(const unsigned char *src,
@@ -301,10 +417,39 @@ void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 void v4lconvert_crop(unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
 
+int v4lconvert_geometry_src_line(const struct v4lconvert_geometry *geom,
+		int src_height, int y);
+
+int v4lconvert_geometry_src_col(const struct v4lconvert_geometry *geom,
+		int src_width);
+
+int v4lconvert_geometry_dest_line(const struct v4lconvert_geometry *geom,
+		int src_height, int src_y);
+
+void v4lconvert_geometry_copy_line(unsigned char *dest,
+		const unsigned char *src, int width, int bpp, int hflip);
+
+int v4lconvert_packed422_to_rgb24_fused(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, unsigned int dest_pix_fmt,
+		const struct v4lconvert_geometry *geom);
+
+int v4lconvert_packed422_to_yuv420_fused(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, unsigned int dest_pix_fmt,
+		const struct v4lconvert_geometry *geom);
+
+void v4lconvert_geometry_copy(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *fmt, const struct v4lconvert_geometry *geom);
+
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int command);
 
 void v4lconvert_helper_cleanup(struct v4lconvert_data *data);
 
+void v4lprocessing_component_sums(const unsigned char *buf, int n,
+		int comps, unsigned int *sums);
+
 #endif
@@ -239,6 +239,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
 	data->fps = 30;
+	data->cpu_ops = v4lconvert_get_cpu_ops();
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -303,6 +304,7 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	if (!data)
 		return;
 
+	v4lconvert_threads_destroy(data->threads);
 	v4lprocessing_destroy(data->processing);
 	v4lcontrol_destroy(data->control);
 	if (data->tinyjpeg) {
@@ -323,6 +325,7 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 	free(data->rotate90_buf);
 	free(data->flip_buf);
 	free(data->convert_pixfmt_buf);
+	free(data->bayer_buf);
 	free(data->previous_frame);
 	free(data);
 }
@@ -747,6 +750,8 @@ static int v4lconvert_processing_needs_double_conversion(
 	switch (dest_pix_fmt) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
 		return 0;
 	}
 
@@ -775,6 +780,37 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+struct v4lconvert_packed_slice {
+	void (*convert)(const unsigned char *src, unsigned char *dst,
+			int width, int height, int stride);
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int stride;
+};
+
+static void v4lconvert_packed422_to_rgb_lines(void *priv, int slice,
+		int first, int last)
+{
+	const struct v4lconvert_packed_slice *s = priv;
+
+	s->convert(s->src + first * s->stride, s->dest + first * s->width * 3,
+		   s->width, last - first, s->stride);
+}
+
+/* Run one of the yuyv / yvyu / uyvy -> rgb24 / bgr24 cpu_ops in parallel */
+static void v4lconvert_packed422_to_rgb(struct v4lconvert_data *data,
+		void (*convert)(const unsigned char *src, unsigned char *dst,
+				int width, int height, int stride),
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	struct v4lconvert_packed_slice s = { convert, src, dest, width, stride };
+
+	v4lconvert_run_slices(data->threads, v4lconvert_packed422_to_rgb_lines,
+			      &s, height, 1);
+}
+
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
@@ -799,7 +835,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		} else {
 			result = v4lconvert_decode_jpeg_libjpeg(data,
 							src, src_size, dest,
-							fmt, dest_pix_fmt);
+							fmt, dest_pix_fmt, NULL);
 			if (result == -1 && errno == EOPNOTSUPP) {
 				/* Fall back to tinyjpeg */
 				jpeg_destroy_decompress(&data->cinfo);
@@ -904,11 +940,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
+			data->cpu_ops->yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
 					height, yvu);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
+			data->cpu_ops->yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
 					height, yvu);
 			break;
 		}
@@ -937,10 +973,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV12:
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 0);
+			data->cpu_ops->nv12_to_rgb24(src, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, 1);
+			data->cpu_ops->nv12_to_rgb24(src, dest, width, height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_nv12_to_yuv420(src, dest, width, height, 0);
@@ -1031,143 +1067,47 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		src_pix_fmt = tmpfmt.fmt.pix.pixelformat;
 		src = tmpbuf;
 		src_size = width * height;
+		bytesperline = width;
 		/* fall through */
 	}
 
-		/* Raw bayer formats */
+		/* Raw bayer formats, the 10 and 16 bit ones are reduced to 8 bit
+		   while demosaicing */
 	case V4L2_PIX_FMT_SBGGR10P:
 	case V4L2_PIX_FMT_SGBRG10P:
 	case V4L2_PIX_FMT_SGRBG10P:
-	case V4L2_PIX_FMT_SRGGB10P: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10P:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10P:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < ((width * height * 10)/8)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10p_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
+	case V4L2_PIX_FMT_SRGGB10P:
 	case V4L2_PIX_FMT_SBGGR10:
 	case V4L2_PIX_FMT_SGBRG10:
 	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < (width * height * 2)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
+	case V4L2_PIX_FMT_SRGGB10:
 	case V4L2_PIX_FMT_SBGGR16:
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
-	case V4L2_PIX_FMT_SRGGB16: {
-		int b16format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR16:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB16:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b16format = 0;
-			break;
-		}
-
-		if (b16format) {
-			if (src_size < ((width * height * 2))) {
-				V4LCONVERT_ERR
-					("short raw bayer16 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer16_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
-	/* Fall-through*/
+	case V4L2_PIX_FMT_SRGGB16:
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
-		if (src_size < (width * height)) {
+		if (src_size < v4lconvert_bayer_frame_size(src_pix_fmt, width,
+						height, bytesperline)) {
 			V4LCONVERT_ERR("short raw bayer data frame\n");
 			errno = EPIPE;
 			result = -1;
+			break;
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
+			result = v4lconvert_bayer_to_rgb24(data, src, dest, width, height, bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
+			result = v4lconvert_bayer_to_bgr24(data, src, dest, width, height, bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
+			result = v4lconvert_bayer_to_yuv420(data, src, dest, width, height, bytesperline, src_pix_fmt, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
+			result = v4lconvert_bayer_to_yuv420(data, src, dest, width, height, bytesperline, src_pix_fmt, 1);
 			break;
 		}
 		break;
@@ -1204,10 +1144,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			v4lconvert_swap_rgb(d, dest, width, height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(d, dest, fmt, 0, 0, 3);
+			data->cpu_ops->rgb24_to_yuv420(d, dest, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(d, dest, fmt, 0, 1, 3);
+			data->cpu_ops->rgb24_to_yuv420(d, dest, fmt, 0, 1, 3);
 			break;
 		}
 		break;
@@ -1310,10 +1250,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			v4lconvert_swap_rgb(src, dest, width, height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
 			break;
 		}
 		break;
@@ -1332,10 +1272,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			memcpy(dest, src, width * height * 3);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 0, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 1, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 1, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 1, 1, 3);
 			break;
 		}
 		break;
@@ -1357,10 +1297,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 4);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 0, 4);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 4);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 1, 4);
 			break;
 		}
 		break;
@@ -1381,10 +1321,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 0, 4);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 1, 0, 4);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 1, 1, 4);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 1, 1, 4);
 			break;
 		}
 		break;
@@ -1397,11 +1337,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
+			data->cpu_ops->yuv420_to_rgb24(src, dest, width,
 					height, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
+			data->cpu_ops->yuv420_to_bgr24(src, dest, width,
 					height, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
@@ -1421,11 +1361,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(src, dest, width,
+			data->cpu_ops->yuv420_to_rgb24(src, dest, width,
 					height, 1);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(src, dest, width,
+			data->cpu_ops->yuv420_to_bgr24(src, dest, width,
 					height, 1);
 			break;
 		case V4L2_PIX_FMT_YUV420:
@@ -1459,16 +1399,18 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->yuyv_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->yuyv_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->cpu_ops->yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->cpu_ops->yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1496,18 +1438,20 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->yvyu_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->yvyu_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
 			   with the last argument reversed to make it have as we want */
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->cpu_ops->yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->cpu_ops->yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		}
 		break;
@@ -1520,16 +1464,18 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->uyvy_to_rgb24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed422_to_rgb(data, data->cpu_ops->uyvy_to_bgr24,
+					src, dest, width, height, bytesperline);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
+			data->cpu_ops->uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
+			data->cpu_ops->uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
 		}
 		break;
@@ -1551,12 +1497,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
 						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
 						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
 			break;
 		}
 
@@ -1580,12 +1526,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
 						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
 			break;
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
 						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			data->cpu_ops->rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
 			break;
 		}
 
@@ -1605,13 +1551,123 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
+/* Check if flipping and cropping a width x height frame into dest_fmt can be
+   done line by line, see fused.c. If so fill in geom and return 1. */
+static int v4lconvert_get_geometry(int width, int height,
+		const struct v4l2_format *dest_fmt, int hflip, int vflip, int crop,
+		struct v4lconvert_geometry *geom)
+{
+	int dest_width = dest_fmt->fmt.pix.width;
+	int dest_height = dest_fmt->fmt.pix.height;
+	int yuv = dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YUV420 ||
+		  dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420;
+
+	if (yuv && ((width | height | dest_width | dest_height) & 1))
+		return 0;
+
+	geom->hflip = hflip;
+	geom->vflip = vflip;
+	geom->width = dest_width;
+	geom->height = dest_height;
+	if (!crop) {
+		geom->startx = 0;
+		geom->starty = 0;
+		geom->bytesperline = yuv ? dest_width : dest_width * 3;
+		return 1;
+	}
+
+	/* Only plain cropping, not adding borders or reduce and crop, see
+	   v4lconvert_crop() */
+	if (dest_width > width || dest_height > height ||
+	    (width >= 2 * dest_width && height >= 2 * dest_height))
+		return 0;
+
+	geom->startx = (width - dest_width) / 2;
+	geom->starty = (height - dest_height) / 2;
+	geom->bytesperline = dest_fmt->fmt.pix.bytesperline;
+	if (yuv) {
+		geom->startx &= ~1;
+		geom->starty &= ~1;
+		return geom->bytesperline >= dest_width;
+	}
+	return geom->bytesperline >= dest_width * 3;
+}
+
+/* Check if flipping and cropping can be done by the converter itself, writing
+   straight into dest, see fused.c. If so fill in geom and return 1. */
+static int v4lconvert_can_fuse(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int hflip, int vflip, int crop, struct v4lconvert_geometry *geom)
+{
+	int yuv = dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YUV420 ||
+		  dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420;
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		if (src_fmt->fmt.pix.width & 1)
+			return 0;
+		break;
+#ifdef HAVE_JPEG
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_JPEG:
+		/* libjpeg decodes yuv420 in blocks of lines, and tinyjpeg
+		   the entire frame at once */
+		if (yuv || (data->flags & V4LCONVERT_USE_TINYJPEG))
+			return 0;
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	return v4lconvert_get_geometry(src_fmt->fmt.pix.width,
+				       src_fmt->fmt.pix.height, dest_fmt,
+				       hflip, vflip, crop, geom);
+}
+
+static int v4lconvert_convert_fused(struct v4lconvert_data *data,
+		unsigned char *src, int src_size, unsigned char *dest,
+		struct v4l2_format *src_fmt, unsigned int dest_pix_fmt,
+		const struct v4lconvert_geometry *geom)
+{
+	int width = src_fmt->fmt.pix.width;
+	int height = src_fmt->fmt.pix.height;
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+#ifdef HAVE_JPEG
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_JPEG:
+		return v4lconvert_decode_jpeg_libjpeg(data, src, src_size, dest,
+						      src_fmt, dest_pix_fmt, geom);
+#endif
+	}
+
+	if (src_size < (width * height * 2)) {
+		V4LCONVERT_ERR("short yuyv data frame\n");
+		errno = EPIPE;
+		return -1;
+	}
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		return v4lconvert_packed422_to_rgb24_fused(data, src, dest,
+						src_fmt, dest_pix_fmt, geom);
+	default:
+		return v4lconvert_packed422_to_yuv420_fused(data, src, dest,
+						src_fmt, dest_pix_fmt, geom);
+	}
+}
+
 int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
 {
 	int res, dest_needed, temp_needed, processing, convert = 0;
-	int rotate90, vflip, hflip, crop;
+	int rotate90, vflip, hflip, crop, geometry = 0;
 	unsigned char *convert1_dest = dest;
 	int convert1_dest_size = dest_size;
 	unsigned char *convert2_src = src, *convert2_dest = dest;
@@ -1621,6 +1677,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	unsigned char *crop_src = src;
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
+	struct v4lconvert_geometry geom;
 
 	processing = v4lprocessing_pre_processing(data->processing);
 	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
@@ -1669,7 +1726,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 
 
 	/* Sometimes we need foo -> rgb -> bar as video processing (whitebalance,
-	   etc.) can only be done on rgb data */
+	   etc.) can only be done on bayer, rgb and yuv420 data */
 	if (processing && v4lconvert_processing_needs_double_conversion(
 				my_src_fmt.fmt.pix.pixelformat,
 				my_dest_fmt.fmt.pix.pixelformat))
@@ -1683,6 +1740,34 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		 (!rotate90 && !hflip && !vflip && !crop))
 		convert = 1;
 
+	/* For the common cases convert, flip and crop in a single pass, without
+	   going through any intermediate buffers */
+	if (convert == 1 && !processing && !rotate90 && (hflip || vflip || crop) &&
+	    v4lconvert_can_fuse(data, &my_src_fmt, &my_dest_fmt,
+				hflip, vflip, crop, &geom)) {
+		res = v4lconvert_convert_fused(data, src, src_size, dest,
+				&my_src_fmt, my_dest_fmt.fmt.pix.pixelformat, &geom);
+		if (res)
+			return res;
+
+		return dest_needed;
+	}
+
+	/* Otherwise see if we can at least flip and crop in a single pass, note
+	   that rotate90 swaps width and height */
+	if (hflip || vflip || crop) {
+		if (rotate90)
+			geometry = v4lconvert_get_geometry(
+					my_src_fmt.fmt.pix.height,
+					my_src_fmt.fmt.pix.width, &my_dest_fmt,
+					hflip, vflip, crop, &geom);
+		else
+			geometry = v4lconvert_get_geometry(
+					my_src_fmt.fmt.pix.width,
+					my_src_fmt.fmt.pix.height, &my_dest_fmt,
+					hflip, vflip, crop, &geom);
+	}
+
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
@@ -1716,7 +1801,7 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		flip_src = crop_src = rotate90_dest;
 	}
 
-	if ((vflip || hflip) && crop) {
+	if ((vflip || hflip) && crop && !geometry) {
 		flip_dest = v4lconvert_alloc_buffer(temp_needed, &data->flip_buf,
 				&data->flip_buf_size);
 		if (!flip_dest)
@@ -1752,8 +1837,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 
 		/* We call processing here again in case the source format was not
-		   rgb, but the dest is. v4lprocessing checks it self it only actually
-		   does the processing once per frame. */
+		   rgb / yuv420, but the dest is. v4lprocessing checks it self it only
+		   actually does the processing once per frame. */
 		if (processing)
 			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
 	}
@@ -1761,6 +1846,11 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	if (rotate90)
 		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
 
+	if (geometry) {
+		v4lconvert_geometry_copy(data, flip_src, dest, &my_src_fmt, &geom);
+		return dest_needed;
+	}
+
 	if (hflip || vflip)
 		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
 
@@ -31,7 +31,8 @@ static int gamma_active(struct v4lprocessing_data *data)
 
 static int gamma_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		const struct v4lprocessing_stats *stats,
+		const struct v4l2_format *fmt)
 {
 	int i, x, gamma;
 
@@ -48,6 +49,14 @@ static int gamma_calculate_lookup_tables(
 		data->last_gamma = gamma;
 	}
 
+	/* For yuv420 only the y plane, which uses the green table */
+	if (fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YUV420 ||
+	    fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420) {
+		for (i = 0; i < 256; i++)
+			data->green[i] = data->gamma_table[data->green[i]];
+		return 1;
+	}
+
 	for (i = 0; i < 256; i++) {
 		data->comp1[i] = data->gamma_table[data->comp1[i]];
 		data->green[i] = data->gamma_table[data->green[i]];
@@ -23,11 +23,27 @@
 
 #include "../control/libv4lcontrol.h"
 #include "../libv4lsyscall-priv.h"
+#include "../libv4lconvert-priv.h"
 
 #define V4L2PROCESSING_UPDATE_RATE 10
 
+/* Statistics of the raw (before applying the lookup tables) frame, gathered
+   while processing it, on which the filters base the lookup tables for the
+   next frames */
+struct v4lprocessing_stats {
+	/* Sums of the components, for bayer of the 4 pixels of each 2x2 block,
+	   for rgb24 of r, g and b (or b, g and r) and for yuv420 of the y, u and
+	   v (or y, v and u) planes */
+	uint64_t sum[4];
+	/* Sum of all bytes of the center quarter of the frame, for yuv420 of
+	   the y plane only */
+	uint64_t center_sum;
+};
+
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
+	struct v4lconvert_threads *threads;
+	const struct v4lconvert_cpu_ops *cpu_ops;
 	int fd;
 	int do_process;
 	int controls_changed;
@@ -37,10 +53,13 @@ struct v4lprocessing_data {
 	/* Counts the number of processed frames until a
 	   V4L2PROCESSING_UPDATE_RATE overflow happens */
 	int lookup_table_update_counter;
-	/* RGB/BGR lookup tables */
+	/* RGB/BGR lookup tables, for yuv420 green is used for the y plane
+	   and comp1 / comp2 for the chroma planes */
 	unsigned char comp1[256];
 	unsigned char green[256];
 	unsigned char comp2[256];
+	/* Statistics gathered by each slice of the last processed frame */
+	struct v4lprocessing_stats slice_stats[V4LCONVERT_MAX_THREADS];
 	/* Filter private data for filters which need it */
 	/* whitebalance.c data */
 	int green_avg;
@@ -58,7 +77,8 @@ struct v4lprocessing_filter {
 	int (*active)(struct v4lprocessing_data *data);
 	/* Returns 1 if any of the lookup tables was changed */
 	int (*calculate_lookup_tables)(struct v4lprocessing_data *data,
-			unsigned char *buf, const struct v4l2_format *fmt);
+			const struct v4lprocessing_stats *stats,
+			const struct v4l2_format *fmt);
 };
 
 extern const struct v4lprocessing_filter whitebalance_filter;
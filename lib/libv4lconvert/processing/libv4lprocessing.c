@@ -45,6 +45,7 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 
 	data->fd = fd;
 	data->control = control;
+	data->cpu_ops = v4lconvert_get_cpu_ops();
 
 	return data;
 }
@@ -54,6 +55,12 @@ void v4lprocessing_destroy(struct v4lprocessing_data *data)
 	free(data);
 }
 
+void v4lprocessing_set_threads(struct v4lprocessing_data *data,
+		struct v4lconvert_threads *threads)
+{
+	data->threads = threads;
+}
+
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 {
 	int i;
@@ -70,7 +77,8 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 }
 
 static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		const struct v4lprocessing_stats *stats,
+		const struct v4l2_format *fmt)
 {
 	int i;
 
@@ -83,78 +91,210 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 	data->lookup_table_active = 0;
 	for (i = 0; i < ARRAY_SIZE(filters); i++) {
 		if (filters[i]->active(data)) {
-			if (filters[i]->calculate_lookup_tables(data, buf, fmt))
+			if (filters[i]->calculate_lookup_tables(data, stats, fmt))
 				data->lookup_table_active = 1;
 		}
 	}
 }
 
-static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+void v4lprocessing_component_sums(const unsigned char *buf, int n,
+		int comps, unsigned int *sums)
 {
-	int x, y;
+	int i, c;
 
-	switch (fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp1[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp2[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+	for (c = 0; c < comps; c++)
+		sums[c] = 0;
+
+	for (i = 0; i < n; i++)
+		for (c = 0; c < comps; c++)
+			sums[c] += *buf++;
+}
+
+static void apply_lut(unsigned char *buf, int n, const unsigned char *lut)
+{
+	for (; n >= 4; n -= 4, buf += 4) {
+		unsigned char a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+		buf[0] = lut[a];
+		buf[1] = lut[b];
+		buf[2] = lut[c];
+		buf[3] = lut[d];
+	}
+	for (; n; n--, buf++)
+		*buf = lut[*buf];
+}
+
+static void apply_lut2(unsigned char *buf, int pairs,
+		const unsigned char *lut0, const unsigned char *lut1)
+{
+	for (; pairs >= 2; pairs -= 2, buf += 4) {
+		unsigned char a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+		buf[0] = lut0[a];
+		buf[1] = lut1[b];
+		buf[2] = lut0[c];
+		buf[3] = lut1[d];
+	}
+	if (pairs) {
+		buf[0] = lut0[buf[0]];
+		buf[1] = lut1[buf[1]];
+	}
+}
+
+static void apply_lut3(unsigned char *buf, int pixels,
+		const unsigned char *lut0, const unsigned char *lut1,
+		const unsigned char *lut2)
+{
+	for (; pixels; pixels--, buf += 3) {
+		unsigned char a = buf[0], b = buf[1], c = buf[2];
+
+		buf[0] = lut0[a];
+		buf[1] = lut1[b];
+		buf[2] = lut2[c];
+	}
+}
+
+struct v4lprocessing_slice {
+	struct v4lprocessing_data *data;
+	unsigned char *buf;
+	const struct v4l2_format *fmt;
+	int apply;	/* Apply the lookup tables */
+	int gather;	/* Gather statistics for the next lookup tables update */
+};
+
+/* Gather the statistics of a line of n groups of comps bytes, adding the
+   sums of the components to sums, and for lines in the center of the frame
+   the sum of bytes [center_start, center_end) to *center_sum. Then apply
+   the lookup tables while the line is still in the cache. */
+static void v4lprocessing_line(struct v4lprocessing_slice *s,
+		unsigned char *buf, int n, int comps,
+		const unsigned char *const *lut, uint64_t *sums,
+		uint64_t *center_sum, int center_start, int center_end)
+{
+	const struct v4lconvert_cpu_ops *ops = s->data->cpu_ops;
+	unsigned int line_sums[3];
+	int c;
+
+	if (s->gather) {
+		ops->component_sums(buf, n, comps, line_sums);
+		for (c = 0; c < comps; c++)
+			sums[c] += line_sums[c];
+
+		if (center_sum) {
+			ops->component_sums(buf + center_start,
+					center_end - center_start, 1, line_sums);
+			*center_sum += line_sums[0];
 		}
+	}
+
+	if (!s->apply)
+		return;
+
+	switch (comps) {
+	case 1:
+		apply_lut(buf, n, lut[0]);
 		break;
+	case 2:
+		apply_lut2(buf, n, lut[0], lut[1]);
+		break;
+	case 3:
+		apply_lut3(buf, n, lut[0], lut[1], lut[2]);
+		break;
+	}
+}
 
+/* Is line y within the center half of the lines of the frame? */
+#define IN_CENTER(y, height) \
+	((y) >= (height) / 4 && (y) < (height) / 4 + (height) / 2)
+
+/* Process lines [first, last), for bayer and yuv420 these are even */
+static void v4lprocessing_do_processing(void *priv, int slice,
+		int first, int last)
+{
+	struct v4lprocessing_slice *s = priv;
+	struct v4lprocessing_data *data = s->data;
+	struct v4lprocessing_stats *stats = &data->slice_stats[slice];
+	const unsigned int width = s->fmt->fmt.pix.width;
+	const unsigned int height = s->fmt->fmt.pix.height;
+	const unsigned int bpl = s->fmt->fmt.pix.bytesperline;
+	const unsigned char *luts[2][2];
+	unsigned char *buf = s->buf;
+	uint64_t *center;
+	int y;
+
+	switch (s->fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+	case V4L2_PIX_FMT_SRGGB8:
+		if (s->fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_SGBRG8 ||
+		    s->fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_SGRBG8) {
+			/* Bayer patterns starting with green */
+			luts[0][0] = data->green;
+			luts[0][1] = data->comp1;
+			luts[1][0] = data->comp2;
+			luts[1][1] = data->green;
+		} else {
+			luts[0][0] = data->comp1;
+			luts[0][1] = data->green;
+			luts[1][0] = data->green;
+			luts[1][1] = data->comp2;
+		}
+		for (y = first; y < last; y++) {
+			center = IN_CENTER(y, height) ? &stats->center_sum : NULL;
+			v4lprocessing_line(s, buf + y * bpl, width / 2, 2,
+					luts[y & 1], stats->sum + 2 * (y & 1),
+					center, width / 4, width / 4 + width / 2);
 		}
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
+	case V4L2_PIX_FMT_BGR24: {
+		const unsigned char *rgb_luts[3] = {
+			data->comp1, data->green, data->comp2
+		};
+
+		for (y = first; y < last; y++) {
+			center = IN_CENTER(y, height) ? &stats->center_sum : NULL;
+			v4lprocessing_line(s, buf + y * bpl, width, 3, rgb_luts,
+					stats->sum, center, width * 3 / 4,
+					width * 3 / 4 + width * 3 / 2);
+		}
+		break;
+	}
+
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420: {
+		const unsigned char *y_lut = data->green;
+		const unsigned char *u_lut = data->comp1;
+		const unsigned char *v_lut = data->comp2;
+		unsigned char *ubuf = buf + bpl * height;
+		unsigned char *vbuf = ubuf + (bpl / 2) * (height / 2);
+
+		for (y = first; y < last; y++) {
+			center = IN_CENTER(y, height) ? &stats->center_sum : NULL;
+			v4lprocessing_line(s, buf + y * bpl, width, 1, &y_lut,
+					&stats->sum[0], center, width / 4,
+					width / 4 + width / 2);
+		}
+		for (y = first / 2; y < last / 2; y++) {
+			v4lprocessing_line(s, ubuf + y * (bpl / 2), width / 2, 1,
+					&u_lut, &stats->sum[1], NULL, 0, 0);
+			v4lprocessing_line(s, vbuf + y * (bpl / 2), width / 2, 1,
+					&v_lut, &stats->sum[2], NULL, 0, 0);
 		}
 		break;
 	}
+	}
 }
 
 void v4lprocessing_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
+	struct v4lprocessing_slice slice = { data, buf, fmt };
+	struct v4lprocessing_stats stats;
+	int i, j, update, lines = fmt->fmt.pix.height, align = 1;
+
 	if (!data->do_process)
 		return;
 
@@ -164,6 +304,13 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8:
+		lines &= ~1;
+		align = 2;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		align = 2;
+		break;
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 		break;
@@ -171,18 +318,37 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 		return; /* Non supported pix format */
 	}
 
-	if (data->controls_changed ||
-			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
+	update = data->controls_changed ||
+		 data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE;
+	if (update) {
 		data->controls_changed = 0;
 		data->lookup_table_update_counter = 0;
-		/* Do this after resetting lookup_table_update_counter so that filters can
-		   force the next update to be sooner when they changed camera settings */
-		v4lprocessing_update_lookup_tables(data, buf, fmt);
 	} else
 		data->lookup_table_update_counter++;
 
-	if (data->lookup_table_active)
-		v4lprocessing_do_processing(data, buf, fmt);
+	/* The statistics for the new lookup tables are gathered in the same
+	   pass which applies the current ones, so the new tables take effect
+	   from the next frame on */
+	slice.apply = data->lookup_table_active;
+	slice.gather = update;
+	if (slice.gather)
+		memset(data->slice_stats, 0, sizeof(data->slice_stats));
+	if (slice.apply || slice.gather)
+		v4lconvert_run_slices(data->threads,
+				v4lprocessing_do_processing, &slice, lines, align);
+
+	if (update) {
+		memset(&stats, 0, sizeof(stats));
+		for (i = 0; i < v4lconvert_threads_count(data->threads); i++) {
+			for (j = 0; j < 4; j++)
+				stats.sum[j] += data->slice_stats[i].sum[j];
+			stats.center_sum += data->slice_stats[i].center_sum;
+		}
+		/* Do this after resetting lookup_table_update_counter so that
+		   filters can force the next update to be sooner when they
+		   changed camera settings */
+		v4lprocessing_update_lookup_tables(data, &stats, fmt);
+	}
 
 	data->do_process = 0;
 }
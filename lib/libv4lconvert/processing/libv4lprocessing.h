@@ -30,10 +30,15 @@
 
 struct v4lprocessing_data;
 struct v4lcontrol_data;
+struct v4lconvert_threads;
 
 struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *data);
 void v4lprocessing_destroy(struct v4lprocessing_data *data);
 
+/* Use the worker threads of libv4lconvert for processing, NULL to stop */
+void v4lprocessing_set_threads(struct v4lprocessing_data *data,
+  struct v4lconvert_threads *threads);
+
 /* Prepare to process 1 frame, returns 1 if processing is necesary,
    return 0 if no processing will be done */
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
@@ -43,54 +43,38 @@ static int whitebalance_active(struct v4lprocessing_data *data)
 	return wb;
 }
 
-static int whitebalance_calculate_lookup_tables_generic(
-		struct v4lprocessing_data *data, int green_avg, int comp1_avg, int comp2_avg)
+/* Slowly adjust the average used for the correction, so that we do not get
+   a sudden change in colors, returns 1 if still converging */
+static int whitebalance_converge(int *cur_avg, int avg)
 {
-	int i, avg_avg;
-	const int threshold = 64;
 	const int max_step = 128;
 
-	/* Clip averages (restricts maximum white balance correction) */
-	green_avg = CLIP(green_avg, 512, 3072);
-	comp1_avg = CLIP(comp1_avg, 512, 3072);
-	comp2_avg = CLIP(comp2_avg, 512, 3072);
+	if (abs(*cur_avg - avg) > max_step) {
+		if (*cur_avg < avg)
+			*cur_avg += max_step;
+		else
+			*cur_avg -= max_step;
+		return 1;
+	}
+
+	*cur_avg = avg;
+	return 0;
+}
 
+static void whitebalance_update_averages(struct v4lprocessing_data *data,
+		int green_avg, int comp1_avg, int comp2_avg)
+{
 	/* First frame ? */
 	if (data->green_avg == 0) {
 		data->green_avg = green_avg;
 		data->comp1_avg = comp1_avg;
 		data->comp2_avg = comp2_avg;
 	} else {
-		/* Slowly adjust the averages used for the correction, so that
-		   we do not get a sudden change in colors */
 		int throttling = 0;
 
-		if (abs(data->green_avg - green_avg) > max_step) {
-			if (data->green_avg < green_avg)
-				data->green_avg += max_step;
-			else
-				data->green_avg -= max_step;
-			throttling = 1;
-		} else
-			data->green_avg = green_avg;
-
-		if (abs(data->comp1_avg - comp1_avg) > max_step) {
-			if (data->comp1_avg < comp1_avg)
-				data->comp1_avg += max_step;
-			else
-				data->comp1_avg -= max_step;
-			throttling = 1;
-		} else
-			data->comp1_avg = comp1_avg;
-
-		if (abs(data->comp2_avg - comp2_avg) > max_step) {
-			if (data->comp2_avg < comp2_avg)
-				data->comp2_avg += max_step;
-			else
-				data->comp2_avg -= max_step;
-			throttling = 1;
-		} else
-			data->comp2_avg = comp2_avg;
+		throttling |= whitebalance_converge(&data->green_avg, green_avg);
+		throttling |= whitebalance_converge(&data->comp1_avg, comp1_avg);
+		throttling |= whitebalance_converge(&data->comp2_avg, comp2_avg);
 
 		/*
 		 * If we are still converging to a stable update situation,
@@ -103,6 +87,20 @@ static int whitebalance_calculate_lookup_tables_generic(
 			data->lookup_table_update_counter =
 						V4L2PROCESSING_UPDATE_RATE;
 	}
+}
+
+static int whitebalance_calculate_lookup_tables_generic(
+		struct v4lprocessing_data *data, int green_avg, int comp1_avg, int comp2_avg)
+{
+	int i, avg_avg;
+	const int threshold = 64;
+
+	/* Clip averages (restricts maximum white balance correction) */
+	green_avg = CLIP(green_avg, 512, 3072);
+	comp1_avg = CLIP(comp1_avg, 512, 3072);
+	comp2_avg = CLIP(comp2_avg, 512, 3072);
+
+	whitebalance_update_averages(data, green_avg, comp1_avg, comp2_avg);
 
 	if (abs(data->green_avg - data->comp1_avg) < threshold &&
 			abs(data->green_avg - data->comp2_avg) < threshold &&
@@ -121,24 +119,14 @@ static int whitebalance_calculate_lookup_tables_generic(
 }
 
 static int whitebalance_calculate_lookup_tables_bayer(
-		struct v4lprocessing_data *data, unsigned char *buf,
+		struct v4lprocessing_data *data,
+		const struct v4lprocessing_stats *stats,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
-	int green_avg, comp1_avg, comp2_avg;
-
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-	}
+	uint64_t a1 = stats->sum[0], a2 = stats->sum[1];
+	uint64_t b1 = stats->sum[2], b2 = stats->sum[3];
+	uint64_t green_avg, comp1_avg, comp2_avg;
+	int norm = fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
 
 	if (starts_with_green) {
 		green_avg = a1 / 2 + b2 / 2;
@@ -151,55 +139,84 @@ static int whitebalance_calculate_lookup_tables_bayer(
 	}
 
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-
-	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
-			comp1_avg, comp2_avg);
+	return whitebalance_calculate_lookup_tables_generic(data,
+			green_avg / norm, comp1_avg / norm, comp2_avg / norm);
 }
 
 static int whitebalance_calculate_lookup_tables_rgb(
-		struct v4lprocessing_data *data, unsigned char *buf,
+		struct v4lprocessing_data *data,
+		const struct v4lprocessing_stats *stats,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
-	}
+	int norm = fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
 
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-
-	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
-			comp1_avg, comp2_avg);
+	return whitebalance_calculate_lookup_tables_generic(data,
+			stats->sum[1] / norm, stats->sum[0] / norm,
+			stats->sum[2] / norm);
 }
 
+/* For yuv420 the chroma planes get shifted, so that their averages become
+   neutral (128), the y plane is left alone */
+static int whitebalance_calculate_lookup_tables_yuv420(
+		struct v4lprocessing_data *data,
+		const struct v4lprocessing_stats *stats,
+		const struct v4l2_format *fmt)
+{
+	int i, comp1_shift, comp2_shift;
+	int norm = fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
+	const int threshold = 64;
+
+	/* Norm avg to ~ 0 - 4095, clip the chroma averages (restricts maximum
+	   white balance correction), the y average only marks that we have
+	   seen the first frame */
+	whitebalance_update_averages(data,
+			CLIP((int)(stats->sum[0] / (norm * 4)), 512, 3072),
+			CLIP((int)(stats->sum[1] / norm), 1536, 2560),
+			CLIP((int)(stats->sum[2] / norm), 1536, 2560));
+
+	if (abs(data->comp1_avg - 2048) < threshold &&
+			abs(data->comp2_avg - 2048) < threshold)
+		return 0;
+
+	comp1_shift = (2048 - data->comp1_avg) / 16;
+	comp2_shift = (2048 - data->comp2_avg) / 16;
+
+	for (i = 0; i < 256; i++) {
+		data->comp1[i] = CLIP256(data->comp1[i] + comp1_shift);
+		data->comp2[i] = CLIP256(data->comp2[i] + comp2_shift);
+	}
+
+	return 1;
+}
 
 static int whitebalance_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		const struct v4lprocessing_stats *stats,
+		const struct v4l2_format *fmt)
 {
+	if (fmt->fmt.pix.width * fmt->fmt.pix.height < 64)
+		return 0;
+
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		return whitebalance_calculate_lookup_tables_bayer(data, buf, fmt, 1);
+		return whitebalance_calculate_lookup_tables_bayer(data, stats,
+				fmt, 1);
 
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		return whitebalance_calculate_lookup_tables_bayer(data, buf, fmt, 0);
+		return whitebalance_calculate_lookup_tables_bayer(data, stats,
+				fmt, 0);
 
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		return whitebalance_calculate_lookup_tables_rgb(data, buf, fmt);
+		return whitebalance_calculate_lookup_tables_rgb(data, stats, fmt);
+
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		return whitebalance_calculate_lookup_tables_yuv420(data, stats,
+				fmt);
 	}
 
 	return 0; /* Should never happen */
@@ -0,0 +1,1136 @@
+/*
+
+# SIMD versions of the RGB <-> YUV conversion routines from rgbyuv.c and of
+# the bilinear demosaicing from bayer.c
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All routines in here work on blocks of 16 pixels and produce exactly the
+ * same output as the plain C versions in rgbyuv.c and bayer.c, which remain
+ * the reference. The bayer routines only do the middle of a line, leaving
+ * the remaining pixels to the C versions. Row remainders are handled by running a block on a zero padded
+ * copy of the last pixels. Odd widths (and for the yuv420 destinations odd
+ * heights) are left to the C versions, as those have their own peculiar
+ * handling of the last column / line.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+static const struct v4lconvert_cpu_ops v4lconvert_c_ops = {
+	.yuyv_to_rgb24 = v4lconvert_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = v4lconvert_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = v4lconvert_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = v4lconvert_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = v4lconvert_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = v4lconvert_uyvy_to_bgr24,
+	.yuyv_to_yuv420 = v4lconvert_yuyv_to_yuv420,
+	.uyvy_to_yuv420 = v4lconvert_uyvy_to_yuv420,
+	.yuv420_to_rgb24 = v4lconvert_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = v4lconvert_yuv420_to_bgr24,
+	.nv12_to_rgb24 = v4lconvert_nv12_to_rgb24,
+	.rgb24_to_yuv420 = v4lconvert_rgb24_to_yuv420,
+	.bayer_to_rgb24_pairs = v4lconvert_bayer_to_rgb24_pairs,
+	.bayer_to_y_pairs = v4lconvert_bayer_to_y_pairs,
+	.jpeg_idct = tinyjpeg_idct_float,
+	.jpeg_ycbcr_h2_to_rgb24 = tinyjpeg_ycbcr_h2_to_rgb24,
+	.component_sums = v4lprocessing_component_sums,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_SIMD_OPS 1
+#define SIMD_FN __attribute__((target("ssse3")))
+#include <tmmintrin.h>
+
+/* pshufb masks to interleave 3 registers of 16 bytes into 48 bytes rgb24 */
+static const int8_t rgb24_interleave[3][3][16] = {
+	{
+		{ 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+		{ -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+		{ -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 },
+	}, {
+		{ -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+		{ 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+		{ -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 },
+	}, {
+		{ -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+		{ -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+		{ 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 },
+	},
+};
+
+/* pshufb masks to gather one component out of 48 bytes rgb24 */
+static const int8_t rgb24_deinterleave[3][3][16] = {
+	{
+		{ 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 },
+	}, {
+		{ 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 },
+	}, {
+		{ 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 },
+	},
+};
+
+/* pshufb mask to group the components of 4 rgb32 pixels */
+static const int8_t rgb32_deinterleave[16] = {
+	0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+};
+
+#define LOAD_MASK(m) _mm_loadu_si128((const __m128i *)(m))
+
+/* Two 16 bit coefficients, applied to the low / high half of each 32 bit
+   lane by _mm_madd_epi16 */
+#define COEF_PAIR(lo, hi) _mm_set_epi16(hi, lo, hi, lo, hi, lo, hi, lo)
+
+static inline SIMD_FN void store_rgb24(unsigned char *dest,
+		__m128i c0, __m128i c1, __m128i c2)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		__m128i out = _mm_or_si128(
+			_mm_or_si128(
+				_mm_shuffle_epi8(c0, LOAD_MASK(rgb24_interleave[i][0])),
+				_mm_shuffle_epi8(c1, LOAD_MASK(rgb24_interleave[i][1]))),
+			_mm_shuffle_epi8(c2, LOAD_MASK(rgb24_interleave[i][2])));
+		_mm_storeu_si128((__m128i *)(dest + 16 * i), out);
+	}
+}
+
+static inline SIMD_FN void load_rgb(const unsigned char *src, int bpp,
+		__m128i *c0, __m128i *c1, __m128i *c2)
+{
+	__m128i in[4];
+	int i;
+
+	if (bpp == 3) {
+		__m128i *c[3] = { c0, c1, c2 };
+
+		for (i = 0; i < 3; i++)
+			in[i] = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+		for (i = 0; i < 3; i++)
+			*c[i] = _mm_or_si128(
+				_mm_or_si128(
+					_mm_shuffle_epi8(in[0], LOAD_MASK(rgb24_deinterleave[i][0])),
+					_mm_shuffle_epi8(in[1], LOAD_MASK(rgb24_deinterleave[i][1]))),
+				_mm_shuffle_epi8(in[2], LOAD_MASK(rgb24_deinterleave[i][2])));
+	} else {
+		__m128i a, b;
+
+		for (i = 0; i < 4; i++)
+			in[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(src + 16 * i)),
+				LOAD_MASK(rgb32_deinterleave));
+		a = _mm_unpacklo_epi32(in[0], in[1]);
+		b = _mm_unpacklo_epi32(in[2], in[3]);
+		*c0 = _mm_unpacklo_epi64(a, b);
+		*c1 = _mm_unpackhi_epi64(a, b);
+		a = _mm_unpackhi_epi32(in[0], in[1]);
+		b = _mm_unpackhi_epi32(in[2], in[3]);
+		*c2 = _mm_unpacklo_epi64(a, b);
+	}
+}
+
+/* r = y + roff, g = y - goff, b = y + boff, with one offset per 2 pixels */
+static inline SIMD_FN void store_yuv_offsets(unsigned char *dest, __m128i y,
+		__m128i roff, __m128i goff, __m128i boff, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i ylo = _mm_unpacklo_epi8(y, zero);
+	__m128i yhi = _mm_unpackhi_epi8(y, zero);
+	__m128i r, g, b;
+
+	r = _mm_packus_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(roff, roff)),
+			     _mm_add_epi16(yhi, _mm_unpackhi_epi16(roff, roff)));
+	g = _mm_packus_epi16(_mm_sub_epi16(ylo, _mm_unpacklo_epi16(goff, goff)),
+			     _mm_sub_epi16(yhi, _mm_unpackhi_epi16(goff, goff)));
+	b = _mm_packus_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(boff, boff)),
+			     _mm_add_epi16(yhi, _mm_unpackhi_epi16(boff, boff)));
+	if (bgr)
+		store_rgb24(dest, b, g, r);
+	else
+		store_rgb24(dest, r, g, b);
+}
+
+/* The "fast slightly less accurate multiplication free" formula, u and v
+   are 8 chroma samples minus 128 */
+static inline SIMD_FN void store_yuv_fast(unsigned char *dest, __m128i y,
+		__m128i u, __m128i v, int bgr)
+{
+	__m128i u1 = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(u, 7), u), 6);
+	__m128i rg = _mm_srai_epi16(_mm_add_epi16(
+				_mm_add_epi16(_mm_slli_epi16(u, 1), u),
+				_mm_add_epi16(_mm_slli_epi16(v, 2),
+					      _mm_slli_epi16(v, 1))), 3);
+	__m128i v1 = _mm_srai_epi16(_mm_add_epi16(_mm_slli_epi16(v, 1), v), 1);
+
+	store_yuv_offsets(dest, y, v1, rg, u1, bgr);
+}
+
+static inline SIMD_FN void blk_packed422_rgb(const unsigned char *src,
+		unsigned char *dest, int y_odd, int v_first, int bgr)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+	__m128i y, c, c0, c1;
+
+	if (y_odd) {
+		y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		c = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	} else {
+		y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+		c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+	}
+	c0 = _mm_sub_epi16(_mm_and_si128(c, mask), c128);
+	c1 = _mm_sub_epi16(_mm_srli_epi16(c, 8), c128);
+
+	if (v_first)
+		store_yuv_fast(dest, y, c1, c0, bgr);
+	else
+		store_yuv_fast(dest, y, c0, c1, bgr);
+}
+
+static inline SIMD_FN void blk_planar_rgb(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+	__m128i u = _mm_loadl_epi64((const __m128i *)usrc);
+	__m128i v = _mm_loadl_epi64((const __m128i *)vsrc);
+
+	u = _mm_sub_epi16(_mm_unpacklo_epi8(u, zero), c128);
+	v = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), c128);
+	store_yuv_fast(dest, y, u, v, bgr);
+}
+
+/* ((x * coef) >> 10) for 8 16 bit values, with 32 bit intermediates */
+static inline SIMD_FN __m128i mul_shr10(__m128i lo_pairs, __m128i hi_pairs,
+		__m128i coefs)
+{
+	return _mm_packs_epi32(
+		_mm_srai_epi32(_mm_madd_epi16(lo_pairs, coefs), 10),
+		_mm_srai_epi32(_mm_madd_epi16(hi_pairs, coefs), 10));
+}
+
+static inline SIMD_FN void blk_nv12_rgb(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+	__m128i uv = _mm_loadu_si128((const __m128i *)uvsrc);
+	__m128i u = _mm_sub_epi16(_mm_and_si128(uv, mask), c128);
+	__m128i v = _mm_sub_epi16(_mm_srli_epi16(uv, 8), c128);
+	__m128i roff, goff, boff;
+
+	roff = mul_shr10(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero),
+			 COEF_PAIR(1436, 0));
+	goff = mul_shr10(_mm_unpacklo_epi16(u, v), _mm_unpackhi_epi16(u, v),
+			 COEF_PAIR(352, 731));
+	boff = mul_shr10(_mm_unpacklo_epi16(u, zero), _mm_unpackhi_epi16(u, zero),
+			 COEF_PAIR(1814, 0));
+	store_yuv_offsets(dest, y, roff, goff, boff, bgr);
+}
+
+static inline SIMD_FN void blk_packed422_y(const unsigned char *src,
+		unsigned char *dest, int y_odd)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+	__m128i y;
+
+	if (y_odd)
+		y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+	else
+		y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	_mm_storeu_si128((__m128i *)dest, y);
+}
+
+static inline SIMD_FN __m128i packed422_chroma(const unsigned char *src,
+		int y_odd)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+	if (y_odd)
+		return _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static inline SIMD_FN void blk_packed422_uv(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int y_odd)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i c0 = packed422_chroma(src0, y_odd);
+	__m128i c1 = packed422_chroma(src1, y_odd);
+	__m128i lo, hi, avg;
+
+	lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi8(c0, zero),
+					  _mm_unpacklo_epi8(c1, zero)), 1);
+	hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpackhi_epi8(c0, zero),
+					  _mm_unpackhi_epi8(c1, zero)), 1);
+	avg = _mm_packus_epi16(lo, hi);
+	_mm_storel_epi64((__m128i *)udest,
+			 _mm_packus_epi16(_mm_and_si128(avg, mask), zero));
+	_mm_storel_epi64((__m128i *)vdest,
+			 _mm_packus_epi16(_mm_srli_epi16(avg, 8), zero));
+}
+
+/* (c_r * r + c_g * g + c_b * b + 16384 * k) >> 15 for 8 16 bit values */
+static inline SIMD_FN __m128i rgb_dot(__m128i r, __m128i g, __m128i b,
+		__m128i c_rg, __m128i c_bk, __m128i k)
+{
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), c_rg),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(b, k), c_bk));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), c_rg),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(b, k), c_bk));
+	return _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+}
+
+static inline SIMD_FN void blk_rgb_y(const unsigned char *src,
+		unsigned char *dest, int bpp, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c_rg = COEF_PAIR(8453, 16594);
+	const __m128i c_bk = COEF_PAIR(3223, 16384);
+	const __m128i k = _mm_set1_epi16(32); /* 32 * 16384 == 524288 */
+	__m128i r, g, b, lo, hi;
+
+	if (bgr)
+		load_rgb(src, bpp, &b, &g, &r);
+	else
+		load_rgb(src, bpp, &r, &g, &b);
+
+	lo = rgb_dot(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero),
+		     _mm_unpacklo_epi8(b, zero), c_rg, c_bk, k);
+	hi = rgb_dot(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+		     _mm_unpackhi_epi8(b, zero), c_rg, c_bk, k);
+	_mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(lo, hi));
+}
+
+/* Sum of horizontally adjacent pixel pairs as 8 16 bit values */
+static inline SIMD_FN __m128i pair_sum(__m128i c)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+
+	return _mm_add_epi16(_mm_and_si128(c, mask), _mm_srli_epi16(c, 8));
+}
+
+static inline SIMD_FN void blk_rgb_uv(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int bpp, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k = _mm_set1_epi16(257); /* 257 * 16384 == 4210688 */
+	__m128i r0, g0, b0, r1, g1, b1, r, g, b;
+
+	if (bgr) {
+		load_rgb(src0, bpp, &b0, &g0, &r0);
+		load_rgb(src1, bpp, &b1, &g1, &r1);
+	} else {
+		load_rgb(src0, bpp, &r0, &g0, &b0);
+		load_rgb(src1, bpp, &r1, &g1, &b1);
+	}
+	r = _mm_srli_epi16(_mm_add_epi16(pair_sum(r0), pair_sum(r1)), 2);
+	g = _mm_srli_epi16(_mm_add_epi16(pair_sum(g0), pair_sum(g1)), 2);
+	b = _mm_srli_epi16(_mm_add_epi16(pair_sum(b0), pair_sum(b1)), 2);
+
+	_mm_storel_epi64((__m128i *)udest, _mm_packus_epi16(
+		rgb_dot(r, g, b, COEF_PAIR(-4878, -9578), COEF_PAIR(14456, 16384), k),
+		zero));
+	_mm_storel_epi64((__m128i *)vdest, _mm_packus_epi16(
+		rgb_dot(r, g, b, COEF_PAIR(14456, -12105), COEF_PAIR(-2351, 16384), k),
+		zero));
+}
+
+/* The neighbours of 8 pairs of pixels in the middle of a bayer line, see
+   v4lconvert_bayer_to_rgb24_pairs(), summed as 16 bit values. Pixel a of a
+   pair is red or blue, pixel b is green. */
+struct bayer_sums {
+	__m128i a_diag, a_cross, a_center;
+	__m128i b_vert, b_horiz, b_center;
+};
+
+static inline SIMD_FN void load_bayer_sums(const unsigned char *bayer,
+		int stride, struct bayer_sums *s)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i e[3], o[3], en[3], on1;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(bayer + i * stride));
+		__m128i xn = _mm_loadu_si128((const __m128i *)(bayer + i * stride + 2));
+
+		e[i] = _mm_and_si128(x, mask);
+		o[i] = _mm_srli_epi16(x, 8);
+		en[i] = _mm_and_si128(xn, mask);
+	}
+	on1 = _mm_srli_epi16(
+		_mm_loadu_si128((const __m128i *)(bayer + stride + 2)), 8);
+
+	s->a_diag = _mm_add_epi16(_mm_add_epi16(e[0], en[0]),
+				  _mm_add_epi16(e[2], en[2]));
+	s->a_cross = _mm_add_epi16(_mm_add_epi16(o[0], e[1]),
+				   _mm_add_epi16(en[1], o[2]));
+	s->a_center = o[1];
+	s->b_vert = _mm_add_epi16(en[0], en[2]);
+	s->b_horiz = _mm_add_epi16(o[1], on1);
+	s->b_center = en[1];
+}
+
+/* The bytes of 16 pixels from 8 16 bit values for the a and b pixels */
+static inline SIMD_FN __m128i bayer_pixels(__m128i a, __m128i b)
+{
+	return _mm_or_si128(a, _mm_slli_epi16(b, 8));
+}
+
+static inline SIMD_FN void blk_bayer_rgb(const unsigned char *bayer,
+		unsigned char *dest, int stride, int blue_line)
+{
+	const __m128i two = _mm_set1_epi16(2), one = _mm_set1_epi16(1);
+	struct bayer_sums s;
+	__m128i a_t0, a_t1, b_t0, b_t1, c0, c1, c2;
+
+	load_bayer_sums(bayer, stride, &s);
+	a_t0 = _mm_srli_epi16(_mm_add_epi16(s.a_diag, two), 2);
+	a_t1 = _mm_srli_epi16(_mm_add_epi16(s.a_cross, two), 2);
+	b_t0 = _mm_srli_epi16(_mm_add_epi16(s.b_vert, one), 1);
+	b_t1 = _mm_srli_epi16(_mm_add_epi16(s.b_horiz, one), 1);
+
+	c0 = bayer_pixels(a_t0, b_t0);
+	c1 = bayer_pixels(a_t1, s.b_center);
+	c2 = bayer_pixels(s.a_center, b_t1);
+	if (blue_line)
+		store_rgb24(dest, c0, c1, c2);
+	else
+		store_rgb24(dest, c2, c1, c0);
+}
+
+static inline SIMD_FN void blk_bayer_y(const unsigned char *bayer,
+		unsigned char *dest, int stride, int blue_line)
+{
+	const __m128i k = _mm_set1_epi16(32); /* 32 * 16384 == 524288 */
+	struct bayer_sums s;
+	__m128i a, b;
+
+	load_bayer_sums(bayer, stride, &s);
+	if (blue_line) {
+		a = rgb_dot(s.a_center, s.a_cross, s.a_diag,
+			    COEF_PAIR(8453, 4148), COEF_PAIR(806, 16384), k);
+		b = rgb_dot(s.b_horiz, s.b_center, s.b_vert,
+			    COEF_PAIR(4226, 16594), COEF_PAIR(1611, 16384), k);
+	} else {
+		a = rgb_dot(s.a_diag, s.a_cross, s.a_center,
+			    COEF_PAIR(2113, 4148), COEF_PAIR(3223, 16384), k);
+		b = rgb_dot(s.b_vert, s.b_center, s.b_horiz,
+			    COEF_PAIR(4226, 16594), COEF_PAIR(1611, 16384), k);
+	}
+	_mm_storeu_si128((__m128i *)dest, bayer_pixels(a, b));
+}
+
+/* ((x * coef + 512) >> 10) for 8 16 bit values, with the rounding of
+   tinyjpeg's colour conversion */
+static inline SIMD_FN __m128i mul_round_shr10(__m128i lo_pairs,
+		__m128i hi_pairs, __m128i coefs)
+{
+	const __m128i round = _mm_set1_epi32(512);
+
+	return _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo_pairs, coefs),
+					     round), 10),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi_pairs, coefs),
+					     round), 10));
+}
+
+static inline SIMD_FN void blk_jpeg_ycbcr_rgb(const unsigned char *ysrc,
+		const unsigned char *cbsrc, const unsigned char *crsrc,
+		unsigned char *dest, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+	__m128i cb = _mm_loadl_epi64((const __m128i *)cbsrc);
+	__m128i cr = _mm_loadl_epi64((const __m128i *)crsrc);
+	__m128i roff, goff, boff;
+
+	cb = _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), c128);
+	cr = _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), c128);
+	roff = mul_round_shr10(_mm_unpacklo_epi16(cr, zero),
+			       _mm_unpackhi_epi16(cr, zero), COEF_PAIR(1436, 0));
+	goff = mul_round_shr10(_mm_unpacklo_epi16(cb, cr),
+			       _mm_unpackhi_epi16(cb, cr), COEF_PAIR(-352, -731));
+	boff = mul_round_shr10(_mm_unpacklo_epi16(cb, zero),
+			       _mm_unpackhi_epi16(cb, zero), COEF_PAIR(1815, 0));
+	store_yuv_offsets(dest, y, roff, _mm_sub_epi16(zero, goff), boff, bgr);
+}
+
+#if __FLT_EVAL_METHOD__ == 0
+
+/*
+ * One pass of the float AA&N IDCT of jidctflt.c on 4 columns or rows at
+ * once, v[i] holds coefficient i of each of them. The operations are the
+ * same and in the same order as in the C version, so the result is bit for
+ * bit the same.
+ */
+static inline SIMD_FN void idct_float_1d(__m128 *v)
+{
+	const __m128 c1_414 = _mm_set1_ps(1.414213562f);
+	const __m128 c1_847 = _mm_set1_ps(1.847759065f);
+	const __m128 c1_082 = _mm_set1_ps(1.082392200f);
+	const __m128 c2_613 = _mm_set1_ps(-2.613125930f);
+	__m128 tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	__m128 tmp10, tmp11, tmp12, tmp13;
+	__m128 z5, z10, z11, z12, z13;
+
+	/* Even part */
+	tmp10 = _mm_add_ps(v[0], v[4]);
+	tmp11 = _mm_sub_ps(v[0], v[4]);
+
+	tmp13 = _mm_add_ps(v[2], v[6]);
+	tmp12 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(v[2], v[6]), c1_414), tmp13);
+
+	tmp0 = _mm_add_ps(tmp10, tmp13);
+	tmp3 = _mm_sub_ps(tmp10, tmp13);
+	tmp1 = _mm_add_ps(tmp11, tmp12);
+	tmp2 = _mm_sub_ps(tmp11, tmp12);
+
+	/* Odd part */
+	z13 = _mm_add_ps(v[5], v[3]);
+	z10 = _mm_sub_ps(v[5], v[3]);
+	z11 = _mm_add_ps(v[1], v[7]);
+	z12 = _mm_sub_ps(v[1], v[7]);
+
+	tmp7 = _mm_add_ps(z11, z13);
+	tmp11 = _mm_mul_ps(_mm_sub_ps(z11, z13), c1_414);
+
+	z5 = _mm_mul_ps(_mm_add_ps(z10, z12), c1_847);
+	tmp10 = _mm_sub_ps(_mm_mul_ps(c1_082, z12), z5);
+	tmp12 = _mm_add_ps(_mm_mul_ps(c2_613, z10), z5);
+
+	tmp6 = _mm_sub_ps(tmp12, tmp7);
+	tmp5 = _mm_sub_ps(tmp11, tmp6);
+	tmp4 = _mm_add_ps(tmp10, tmp5);
+
+	v[0] = _mm_add_ps(tmp0, tmp7);
+	v[7] = _mm_sub_ps(tmp0, tmp7);
+	v[1] = _mm_add_ps(tmp1, tmp6);
+	v[6] = _mm_sub_ps(tmp1, tmp6);
+	v[2] = _mm_add_ps(tmp2, tmp5);
+	v[5] = _mm_sub_ps(tmp2, tmp5);
+	v[4] = _mm_add_ps(tmp3, tmp4);
+	v[3] = _mm_sub_ps(tmp3, tmp4);
+}
+
+/* Transposes an 8x8 block held as its left (a) and right (b) half, which
+   then hold its top and bottom half */
+static inline SIMD_FN void transpose_8x8_ps(__m128 *a, __m128 *b)
+{
+	__m128 t[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		t[i] = a[i + 4];
+	for (i = 0; i < 4; i++)
+		a[i + 4] = b[i];
+	_MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+	_MM_TRANSPOSE4_PS(a[4], a[5], a[6], a[7]);
+	_MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+	_MM_TRANSPOSE4_PS(b[4], b[5], b[6], b[7]);
+	for (i = 0; i < 4; i++)
+		b[i] = t[i];
+}
+
+static inline SIMD_FN void transpose_8x8_16(__m128i *v)
+{
+	__m128i a[8], b[8];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		a[i] = _mm_unpacklo_epi16(v[2 * i], v[2 * i + 1]);
+		a[i + 4] = _mm_unpackhi_epi16(v[2 * i], v[2 * i + 1]);
+	}
+	for (i = 0; i < 2; i++) {
+		b[i] = _mm_unpacklo_epi32(a[2 * i], a[2 * i + 1]);
+		b[i + 2] = _mm_unpackhi_epi32(a[2 * i], a[2 * i + 1]);
+		b[i + 4] = _mm_unpacklo_epi32(a[2 * i + 4], a[2 * i + 5]);
+		b[i + 6] = _mm_unpackhi_epi32(a[2 * i + 4], a[2 * i + 5]);
+	}
+	for (i = 0; i < 4; i++) {
+		v[2 * i] = _mm_unpacklo_epi64(b[2 * i], b[2 * i + 1]);
+		v[2 * i + 1] = _mm_unpackhi_epi64(b[2 * i], b[2 * i + 1]);
+	}
+}
+
+/* descale_and_clamp((int)x, 3) of jidctflt.c for 4 values */
+static inline SIMD_FN __m128i idct_float_descale(__m128 x)
+{
+	return _mm_srai_epi32(_mm_add_epi32(_mm_cvttps_epi32(x),
+					    _mm_set1_epi32(4)), 3);
+}
+
+/*
+ * The column and the row pass of jidctflt.c, on the left and right 4
+ * columns (then top and bottom 4 rows) at once. Columns with only a DC
+ * coefficient need no shortcut: adding and multiplying zeroes gives the same
+ * result as the one of the C version.
+ */
+static SIMD_FN void simd_jpeg_idct(const int16_t *coef,
+		const struct tinyjpeg_qtable *qt, uint8_t *dest, int stride)
+{
+	const __m128i ac_mask = _mm_set_epi16(-1, -1, -1, -1, -1, -1, -1, 0);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128 l[8], r[8];
+	__m128i v[8], ac;
+	int i;
+
+	/* Blocks with only a DC coefficient are common, and are a single
+	   colour */
+	ac = _mm_and_si128(_mm_loadu_si128((const __m128i *)coef), ac_mask);
+	for (i = 1; i < 8; i++)
+		ac = _mm_or_si128(ac,
+			_mm_loadu_si128((const __m128i *)(coef + 8 * i)));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(ac, _mm_setzero_si128())) ==
+	    0xffff) {
+		int dc = ((int)(coef[0] * qt->aan[0]) + 4) >> 3;
+
+		dc = dc < -128 ? 0 : dc > 127 ? 255 : dc + 128;
+		for (i = 0; i < 8; i++, dest += stride)
+			memset(dest, dc, 8);
+		return;
+	}
+
+	for (i = 0; i < 8; i++) {
+		__m128i row = _mm_loadu_si128((const __m128i *)(coef + 8 * i));
+
+		l[i] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+					_mm_unpacklo_epi16(row, row), 16)),
+				  _mm_loadu_ps(qt->aan + 8 * i));
+		r[i] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+					_mm_unpackhi_epi16(row, row), 16)),
+				  _mm_loadu_ps(qt->aan + 8 * i + 4));
+	}
+
+	idct_float_1d(l);
+	idct_float_1d(r);
+	transpose_8x8_ps(l, r);
+	idct_float_1d(l);
+	idct_float_1d(r);
+
+	/* v[i] gets output column i of the 8 rows */
+	for (i = 0; i < 8; i++)
+		v[i] = _mm_packs_epi32(idct_float_descale(l[i]),
+				       idct_float_descale(r[i]));
+	transpose_8x8_16(v);
+
+	for (i = 0; i < 8; i += 2) {
+		__m128i out = _mm_packus_epi16(_mm_adds_epi16(v[i], c128),
+					       _mm_adds_epi16(v[i + 1], c128));
+
+		_mm_storel_epi64((__m128i *)dest, out);
+		_mm_storel_epi64((__m128i *)(dest + stride),
+				 _mm_unpackhi_epi64(out, out));
+		dest += 2 * stride;
+	}
+}
+
+#endif
+
+/* pand masks selecting the first and the second component out of 48 bytes
+   of rgb24 */
+static const int8_t rgb24_component_mask[2][3][16] = {
+	{
+		{ -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1 },
+		{ 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0 },
+		{ 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0 },
+	}, {
+		{ 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0 },
+		{ -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1 },
+		{ 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0 },
+	},
+};
+
+static inline SIMD_FN __m128i sad_add(__m128i acc, __m128i v)
+{
+	return _mm_add_epi32(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+}
+
+static inline SIMD_FN unsigned int sad_total(__m128i acc)
+{
+	return _mm_cvtsi128_si32(acc) +
+	       _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+}
+
+/* psadbw sums 8 bytes at once, acc[2] gets the total of all components,
+   the last component is that minus the masked other components */
+static SIMD_FN void simd_component_sums(const unsigned char *buf, int n,
+		int comps, unsigned int *sums)
+{
+	const __m128i even = _mm_set1_epi16(0x00ff);
+	__m128i acc[3], v;
+	unsigned int tail[3], total;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		acc[i] = _mm_setzero_si128();
+
+	switch (comps) {
+	case 1:
+		for (; n >= 16; n -= 16, buf += 16)
+			acc[2] = sad_add(acc[2],
+					 _mm_loadu_si128((const __m128i *)buf));
+		break;
+	case 2:
+		for (; n >= 8; n -= 8, buf += 16) {
+			v = _mm_loadu_si128((const __m128i *)buf);
+			acc[0] = sad_add(acc[0], _mm_and_si128(v, even));
+			acc[2] = sad_add(acc[2], v);
+		}
+		break;
+	case 3:
+		for (; n >= 16; n -= 16, buf += 48) {
+			for (i = 0; i < 3; i++) {
+				v = _mm_loadu_si128((const __m128i *)(buf + 16 * i));
+				acc[0] = sad_add(acc[0], _mm_and_si128(v,
+					LOAD_MASK(rgb24_component_mask[0][i])));
+				acc[1] = sad_add(acc[1], _mm_and_si128(v,
+					LOAD_MASK(rgb24_component_mask[1][i])));
+				acc[2] = sad_add(acc[2], v);
+			}
+		}
+		break;
+	}
+
+	v4lprocessing_component_sums(buf, n, comps, tail);
+	total = sad_total(acc[2]);
+	for (i = 0; i < comps - 1; i++) {
+		sums[i] = sad_total(acc[i]);
+		total -= sums[i];
+		sums[i] += tail[i];
+	}
+	sums[comps - 1] = total + tail[comps - 1];
+}
+
+static int simd_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+#endif
+
+#ifdef HAVE_SIMD_OPS
+
+static SIMD_FN void simd_packed422_to_rgb24(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int y_odd, int v_first, int bgr)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16)
+			blk_packed422_rgb(src + 2 * j, dest + 3 * j,
+					  y_odd, v_first, bgr);
+		if (j < width) {
+			unsigned char in[32] = { 0 }, out[48];
+
+			memcpy(in, src + 2 * j, 2 * (width - j));
+			blk_packed422_rgb(in, out, y_odd, v_first, bgr);
+			memcpy(dest + 3 * j, out, 3 * (width - j));
+		}
+		src += stride;
+		dest += 3 * width;
+	}
+}
+
+static void simd_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_yuyv_to_rgb24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 0, 0, 0);
+}
+
+static void simd_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_yuyv_to_bgr24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 0, 0, 1);
+}
+
+static void simd_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_yvyu_to_rgb24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 0, 1, 0);
+}
+
+static void simd_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_yvyu_to_bgr24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 0, 1, 1);
+}
+
+static void simd_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_uyvy_to_rgb24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 1, 0, 0);
+}
+
+static void simd_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	if (width & 1)
+		v4lconvert_uyvy_to_bgr24(src, dest, width, height, stride);
+	else
+		simd_packed422_to_rgb24(src, dest, width, height, stride, 1, 0, 1);
+}
+
+static SIMD_FN void simd_packed422_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int yvu, int y_odd)
+{
+	int i, j;
+	unsigned char *udest, *vdest;
+
+	/* Y */
+	for (i = 0; i < height; i++) {
+		const unsigned char *s = src + i * stride;
+
+		for (j = 0; j + 16 <= width; j += 16)
+			blk_packed422_y(s + 2 * j, dest + j, y_odd);
+		if (j < width) {
+			unsigned char in[32] = { 0 }, out[16];
+
+			memcpy(in, s + 2 * j, 2 * (width - j));
+			blk_packed422_y(in, out, y_odd);
+			memcpy(dest + j, out, width - j);
+		}
+		dest += width;
+	}
+
+	/* U + V */
+	if (yvu) {
+		vdest = dest;
+		udest = dest + width * height / 4;
+	} else {
+		udest = dest;
+		vdest = dest + width * height / 4;
+	}
+	for (i = 0; i < height; i += 2) {
+		const unsigned char *s0 = src + i * stride;
+		const unsigned char *s1 = s0 + stride;
+
+		for (j = 0; j + 16 <= width; j += 16)
+			blk_packed422_uv(s0 + 2 * j, s1 + 2 * j,
+					 udest + j / 2, vdest + j / 2, y_odd);
+		if (j < width) {
+			unsigned char in0[32] = { 0 }, in1[32] = { 0 };
+			unsigned char u[8], v[8];
+
+			memcpy(in0, s0 + 2 * j, 2 * (width - j));
+			memcpy(in1, s1 + 2 * j, 2 * (width - j));
+			blk_packed422_uv(in0, in1, u, v, y_odd);
+			memcpy(udest + j / 2, u, (width - j) / 2);
+			memcpy(vdest + j / 2, v, (width - j) / 2);
+		}
+		udest += width / 2;
+		vdest += width / 2;
+	}
+}
+
+static void simd_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	if ((width & 1) || (height & 1))
+		v4lconvert_yuyv_to_yuv420(src, dest, width, height, stride, yvu);
+	else
+		simd_packed422_to_yuv420(src, dest, width, height, stride, yvu, 0);
+}
+
+static void simd_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	if ((width & 1) || (height & 1))
+		v4lconvert_uyvy_to_yuv420(src, dest, width, height, stride, yvu);
+	else
+		simd_packed422_to_yuv420(src, dest, width, height, stride, yvu, 1);
+}
+
+static SIMD_FN void simd_yuv420_to_rgb(const unsigned char *src,
+		unsigned char *dest, int width, int height, int yvu, int bgr)
+{
+	int i, j;
+	const unsigned char *ysrc = src;
+	const unsigned char *usrc, *vsrc;
+
+	if (yvu) {
+		vsrc = src + width * height;
+		usrc = vsrc + (width * height) / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + (width * height) / 4;
+	}
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *u = usrc + (i / 2) * (width / 2);
+		const unsigned char *v = vsrc + (i / 2) * (width / 2);
+
+		for (j = 0; j + 16 <= width; j += 16)
+			blk_planar_rgb(ysrc + j, u + j / 2, v + j / 2,
+				       dest + 3 * j, bgr);
+		if (j < width) {
+			unsigned char yin[16] = { 0 }, uin[8] = { 0 };
+			unsigned char vin[8] = { 0 }, out[48];
+
+			memcpy(yin, ysrc + j, width - j);
+			memcpy(uin, u + j / 2, (width - j) / 2);
+			memcpy(vin, v + j / 2, (width - j) / 2);
+			blk_planar_rgb(yin, uin, vin, out, bgr);
+			memcpy(dest + 3 * j, out, 3 * (width - j));
+		}
+		ysrc += width;
+		dest += 3 * width;
+	}
+}
+
+static void simd_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	if (width & 1)
+		v4lconvert_yuv420_to_rgb24(src, dest, width, height, yvu);
+	else
+		simd_yuv420_to_rgb(src, dest, width, height, yvu, 0);
+}
+
+static void simd_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	if (width & 1)
+		v4lconvert_yuv420_to_bgr24(src, dest, width, height, yvu);
+	else
+		simd_yuv420_to_rgb(src, dest, width, height, yvu, 1);
+}
+
+static SIMD_FN void simd_nv12_to_rgb(const unsigned char *src,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	int i, j;
+	const unsigned char *ysrc = src;
+	const unsigned char *uvsrc = src + width * height;
+
+	for (i = 0; i < height; i++) {
+		const unsigned char *uv = uvsrc + (i / 2) * width;
+
+		for (j = 0; j + 16 <= width; j += 16)
+			blk_nv12_rgb(ysrc + j, uv + j, dest + 3 * j, bgr);
+		if (j < width) {
+			unsigned char yin[16] = { 0 }, uvin[16] = { 0 }, out[48];
+
+			memcpy(yin, ysrc + j, width - j);
+			memcpy(uvin, uv + j, width - j);
+			blk_nv12_rgb(yin, uvin, out, bgr);
+			memcpy(dest + 3 * j, out, 3 * (width - j));
+		}
+		ysrc += width;
+		dest += 3 * width;
+	}
+}
+
+static void simd_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bgr)
+{
+	if (width & 1)
+		v4lconvert_nv12_to_rgb24(src, dest, width, height, bgr);
+	else
+		simd_nv12_to_rgb(src, dest, width, height, bgr);
+}
+
+static SIMD_FN void simd_rgb_to_yuv420(const unsigned char *src,
+		unsigned char *dest, const struct v4l2_format *src_fmt,
+		int bgr, int yvu, int bpp)
+{
+	int i, j;
+	int width = src_fmt->fmt.pix.width;
+	int height = src_fmt->fmt.pix.height;
+	int bytesperline = src_fmt->fmt.pix.bytesperline;
+	/* For rgb32 our caller may have skipped the alpha byte, so a block
+	   load of the last pixel would go 1 byte past the end of the line */
+	int simd_width = (bpp == 4) ? width - 1 : width;
+	unsigned char *udest, *vdest;
+
+	/* Y */
+	for (i = 0; i < height; i++) {
+		const unsigned char *s = src + i * bytesperline;
+
+		for (j = 0; j + 16 <= simd_width; j += 16)
+			blk_rgb_y(s + bpp * j, dest + j, bpp, bgr);
+		if (j < width) {
+			unsigned char in[64] = { 0 }, out[16];
+
+			memcpy(in, s + bpp * j, bpp * (width - j - 1) + 3);
+			blk_rgb_y(in, out, bpp, bgr);
+			memcpy(dest + j, out, width - j);
+		}
+		dest += width;
+	}
+
+	/* U + V */
+	if (yvu) {
+		vdest = dest;
+		udest = dest + width * height / 4;
+	} else {
+		udest = dest;
+		vdest = dest + width * height / 4;
+	}
+	for (i = 0; i < height / 2; i++) {
+		const unsigned char *s0 = src + 2 * i * bytesperline;
+		const unsigned char *s1 = s0 + bytesperline;
+
+		for (j = 0; j + 16 <= simd_width; j += 16)
+			blk_rgb_uv(s0 + bpp * j, s1 + bpp * j,
+				   udest + j / 2, vdest + j / 2, bpp, bgr);
+		if (j < width) {
+			unsigned char in0[64] = { 0 }, in1[64] = { 0 };
+			unsigned char u[8], v[8];
+
+			memcpy(in0, s0 + bpp * j, bpp * (width - j - 1) + 3);
+			memcpy(in1, s1 + bpp * j, bpp * (width - j - 1) + 3);
+			blk_rgb_uv(in0, in1, u, v, bpp, bgr);
+			memcpy(udest + j / 2, u, (width - j) / 2);
+			memcpy(vdest + j / 2, v, (width - j) / 2);
+		}
+		udest += width / 2;
+		vdest += width / 2;
+	}
+}
+
+static void simd_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp)
+{
+	if (src_fmt->fmt.pix.width & 1)
+		v4lconvert_rgb24_to_yuv420(src, dest, src_fmt, bgr, yvu, bpp);
+	else
+		simd_rgb_to_yuv420(src, dest, src_fmt, bgr, yvu, bpp);
+}
+
+static SIMD_FN void simd_bayer_to_rgb24_pairs(const unsigned char *bayer,
+		unsigned char *bgr, int pairs, int stride, int blue_line)
+{
+	for (; pairs >= 8; pairs -= 8) {
+		blk_bayer_rgb(bayer, bgr, stride, blue_line);
+		bayer += 16;
+		bgr += 48;
+	}
+	v4lconvert_bayer_to_rgb24_pairs(bayer, bgr, pairs, stride, blue_line);
+}
+
+static SIMD_FN void simd_bayer_to_y_pairs(const unsigned char *bayer,
+		unsigned char *ydst, int pairs, int stride, int blue_line)
+{
+	for (; pairs >= 8; pairs -= 8) {
+		blk_bayer_y(bayer, ydst, stride, blue_line);
+		bayer += 16;
+		ydst += 16;
+	}
+	v4lconvert_bayer_to_y_pairs(bayer, ydst, pairs, stride, blue_line);
+}
+
+static SIMD_FN void simd_jpeg_ycbcr_h2_to_rgb24(const unsigned char *y,
+		const unsigned char *cb, const unsigned char *cr,
+		unsigned char *dest, int width, int bgr)
+{
+	for (; width >= 16; width -= 16) {
+		blk_jpeg_ycbcr_rgb(y, cb, cr, dest, bgr);
+		y += 16;
+		cb += 8;
+		cr += 8;
+		dest += 48;
+	}
+	tinyjpeg_ycbcr_h2_to_rgb24(y, cb, cr, dest, width, bgr);
+}
+
+static const struct v4lconvert_cpu_ops v4lconvert_simd_ops = {
+	.yuyv_to_rgb24 = simd_yuyv_to_rgb24,
+	.yuyv_to_bgr24 = simd_yuyv_to_bgr24,
+	.yvyu_to_rgb24 = simd_yvyu_to_rgb24,
+	.yvyu_to_bgr24 = simd_yvyu_to_bgr24,
+	.uyvy_to_rgb24 = simd_uyvy_to_rgb24,
+	.uyvy_to_bgr24 = simd_uyvy_to_bgr24,
+	.yuyv_to_yuv420 = simd_yuyv_to_yuv420,
+	.uyvy_to_yuv420 = simd_uyvy_to_yuv420,
+	.yuv420_to_rgb24 = simd_yuv420_to_rgb24,
+	.yuv420_to_bgr24 = simd_yuv420_to_bgr24,
+	.nv12_to_rgb24 = simd_nv12_to_rgb24,
+	.rgb24_to_yuv420 = simd_rgb24_to_yuv420,
+	.bayer_to_rgb24_pairs = simd_bayer_to_rgb24_pairs,
+	.bayer_to_y_pairs = simd_bayer_to_y_pairs,
+#if __FLT_EVAL_METHOD__ == 0
+	.jpeg_idct = simd_jpeg_idct,
+#else
+	/* The C version computes with x87 precision, which differs */
+	.jpeg_idct = tinyjpeg_idct_float,
+#endif
+	.jpeg_ycbcr_h2_to_rgb24 = simd_jpeg_ycbcr_h2_to_rgb24,
+	.component_sums = simd_component_sums,
+};
+
+#endif
+
+const struct v4lconvert_cpu_ops *v4lconvert_get_cpu_ops(void)
+{
+	/* Setting LIBV4LCONVERT_NO_SIMD forces the plain C routines, this is
+	   useful for checking the SIMD routines against them */
+	if (getenv("LIBV4LCONVERT_NO_SIMD"))
+		return &v4lconvert_c_ops;
+
+#ifdef HAVE_SIMD_OPS
+	if (simd_supported())
+		return &v4lconvert_simd_ops;
+#endif
+
+	return &v4lconvert_c_ops;
+}
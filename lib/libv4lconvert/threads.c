@@ -0,0 +1,234 @@
+/*
+
+# Worker threads for converting frames as a number of horizontal bands
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "libv4lconvert-priv.h"
+
+/* Don't bother waking up other threads for less lines than this */
+#define V4LCONVERT_MIN_SLICE_LINES 16
+
+struct v4lconvert_threads {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int count;		/* No threads, including the calling thread */
+	int started;		/* No worker threads actually started */
+	int stop;
+	unsigned int generation;/* Incremented for each new job */
+	/* The current job */
+	v4lconvert_slice_func func;
+	void *priv;
+	int lines;
+	int align;
+	int slices;
+	int next_slice;		/* Next slice to be claimed by a thread */
+	int pending;		/* Slices not finished yet */
+};
+
+static void run_slice(struct v4lconvert_threads *threads, int slice)
+{
+	int units = threads->lines / threads->align;
+	int first = units * slice / threads->slices * threads->align;
+	int last = units * (slice + 1) / threads->slices * threads->align;
+
+	/* The last slice also gets the remaining lines */
+	if (slice == threads->slices - 1)
+		last = threads->lines;
+
+	threads->func(threads->priv, slice, first, last);
+}
+
+/* Claim and run slices until there are none left, called with lock held */
+static void run_slices_locked(struct v4lconvert_threads *threads)
+{
+	while (threads->next_slice < threads->slices) {
+		int slice = threads->next_slice++;
+
+		pthread_mutex_unlock(&threads->lock);
+		run_slice(threads, slice);
+		pthread_mutex_lock(&threads->lock);
+
+		if (--threads->pending == 0)
+			pthread_cond_signal(&threads->done_cond);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct v4lconvert_threads *threads = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&threads->lock);
+	while (1) {
+		while (!threads->stop && threads->generation == generation)
+			pthread_cond_wait(&threads->work_cond, &threads->lock);
+		if (threads->stop)
+			break;
+
+		generation = threads->generation;
+		run_slices_locked(threads);
+	}
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count)
+{
+	struct v4lconvert_threads *threads;
+	sigset_t all, old;
+	int i;
+
+	threads = calloc(1, sizeof(*threads));
+	if (!threads)
+		return NULL;
+
+	threads->threads = calloc(count - 1, sizeof(pthread_t));
+	if (!threads->threads) {
+		free(threads);
+		return NULL;
+	}
+	threads->count = count;
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->work_cond, NULL);
+	pthread_cond_init(&threads->done_cond, NULL);
+
+	/* Signals should be delivered to the application's own threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < count - 1; i++) {
+		errno = pthread_create(&threads->threads[i], NULL,
+				       worker_thread, threads);
+		if (errno)
+			break;
+		threads->started++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (threads->started != count - 1) {
+		int saved_errno = errno;
+
+		v4lconvert_threads_destroy(threads);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return threads;
+}
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->stop = 1;
+	pthread_cond_broadcast(&threads->work_cond);
+	pthread_mutex_unlock(&threads->lock);
+
+	for (i = 0; i < threads->started; i++)
+		pthread_join(threads->threads[i], NULL);
+
+	pthread_cond_destroy(&threads->done_cond);
+	pthread_cond_destroy(&threads->work_cond);
+	pthread_mutex_destroy(&threads->lock);
+	free(threads->threads);
+	free(threads);
+}
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads)
+{
+	return threads ? threads->count : 1;
+}
+
+void v4lconvert_run_slices(struct v4lconvert_threads *threads,
+		v4lconvert_slice_func func, void *priv, int lines, int align)
+{
+	int slices = 1;
+
+	if (threads) {
+		slices = lines / (align * V4LCONVERT_MIN_SLICE_LINES);
+		if (slices > threads->count)
+			slices = threads->count;
+	}
+
+	if (slices <= 1) {
+		func(priv, 0, 0, lines);
+		return;
+	}
+
+	pthread_mutex_lock(&threads->lock);
+	threads->func = func;
+	threads->priv = priv;
+	threads->lines = lines;
+	threads->align = align;
+	threads->slices = slices;
+	threads->next_slice = 0;
+	threads->pending = slices;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->work_cond);
+
+	/* Do our share of the work, and then wait for the others to finish */
+	run_slices_locked(threads);
+	while (threads->pending)
+		pthread_cond_wait(&threads->done_cond, &threads->lock);
+	pthread_mutex_unlock(&threads->lock);
+}
+
+int v4lconvert_get_threads(struct v4lconvert_data *data)
+{
+	return v4lconvert_threads_count(data->threads);
+}
+
+int v4lconvert_set_threads(struct v4lconvert_data *data, int threads)
+{
+	struct v4lconvert_threads *new_threads = NULL;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > V4LCONVERT_MAX_THREADS)
+		threads = V4LCONVERT_MAX_THREADS;
+
+	if (threads == v4lconvert_get_threads(data))
+		return 0;
+
+	if (threads > 1) {
+		new_threads = v4lconvert_threads_create(threads);
+		if (!new_threads) {
+			V4LCONVERT_ERR("could not start %d threads\n", threads);
+			if (!errno)
+				errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	v4lconvert_threads_destroy(data->threads);
+	data->threads = new_threads;
+	v4lprocessing_set_threads(data->processing, new_threads);
+
+	return 0;
+}
@@ -65,7 +65,7 @@ struct huffman_table {
 struct component {
 	unsigned int Hfactor;
 	unsigned int Vfactor;
-	float *Q_table;		/* Pointer to the quantisation table to use */
+	struct tinyjpeg_qtable *Q_table;	/* Pointer to the quantisation table to use */
 	struct huffman_table *AC_table;
 	struct huffman_table *DC_table;
 	short int previous_DC;	/* Previous DC coefficient */
@@ -93,7 +93,7 @@ struct jdec_private {
 	unsigned int reservoir, nbits_in_reservoir;
 
 	struct component component_infos[COMPONENTS];
-	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	struct tinyjpeg_qtable Q_tables[COMPONENTS];	/* quantization tables */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
 	int default_huffman_table_initialized;
@@ -118,10 +118,21 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* Plain C or SIMD versions of the IDCT and colour conversion */
+	const struct v4lconvert_cpu_ops *cpu_ops;
+
+	/* For decoding restart intervals in parallel, NULL threads when not */
+	struct v4lconvert_threads *threads;
+	unsigned char *restart_buf;	/* Start of each restart interval */
+	int restart_buf_size;
+	unsigned char *worker_buf;	/* Per thread copies of this struct */
+	int worker_buf_size;
 };
 
-#define IDCT tinyjpeg_idct_float
-void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
+#define IDCT(priv, compptr, output_buf, stride) \
+	(priv)->cpu_ops->jpeg_idct((compptr)->DCT, (compptr)->Q_table, \
+				   output_buf, stride)
 
 #endif
 
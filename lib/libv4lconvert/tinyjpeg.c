@@ -38,8 +38,8 @@
 #include <errno.h>
 
 #include "tinyjpeg.h"
-#include "tinyjpeg-internal.h"
 #include "libv4lconvert-priv.h"
+#include "tinyjpeg-internal.h"
 
 enum std_markers {
 	DQT  = 0xDB, /* Define Quantization Table */
@@ -134,6 +134,19 @@ static const unsigned char zigzag[64] = {
 	35, 36, 48, 49, 57, 58, 62, 63
 };
 
+/* The inverse of zigzag: the position in the block of the n-th coefficient
+   in the stream */
+static const unsigned char dezigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
 /* Set up the standard Huffman tables (cf. JPEG standard section K.3) */
 /* IMPORTANT: these are only valid for 8-bit data precision! */
 static const unsigned char bits_dc_luminance[17] = {
@@ -366,10 +379,10 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	unsigned char size_val, count_0;
 
 	struct component *c = &priv->component_infos[component];
-	short int DCT[64];
+	short int *DCT = c->DCT;
 
 	/* Initialize the DCT coef table */
-	memset(DCT, 0, sizeof(DCT));
+	memset(DCT, 0, sizeof(c->DCT));
 
 	/* DC coefficient decoding */
 	huff_code = get_next_huffman_code(priv, c->DC_table);
@@ -382,7 +395,8 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	}
 
 
-	/* AC coefficient decoding */
+	/* AC coefficient decoding, the coefficients are stored straight at
+	   their dezigzaged position */
 	j = 1;
 	while (j < 64) {
 		huff_code = get_next_huffman_code(priv, c->AC_table);
@@ -398,7 +412,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 		} else {
 			j += count_0;	/* skip count_0 zeroes */
 			if (j < 64) {
-				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
+				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[dezigzag[j]]);
 				j++;
 			}
 		}
@@ -409,9 +423,6 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 				"error: more than 63 AC components (%d) in huffman unit\n", (int)j);
 		longjmp(priv->jump_state, -EIO);
 	}
-
-	for (j = 0; j < 64; j++)
-		c->DCT[j] = DCT[zigzag[j]];
 }
 
 /*
@@ -811,58 +822,48 @@ static void YCrCB_to_BGR24_1x1(struct jdec_private *priv)
 
 
 /**
- *  YCrCb -> RGB24 (2x1)
- *  .-------.
- *  | 1 | 2 |
- *  `-------'
+ * Colour conversion of a line of pixels with one Cb and Cr value per 2
+ * pixels, the plain C version of cpu_ops->jpeg_ycbcr_h2_to_rgb24
  */
-static void YCrCB_to_RGB24_2x1(struct jdec_private *priv)
+void tinyjpeg_ycbcr_h2_to_rgb24(const unsigned char *Y,
+		const unsigned char *Cb, const unsigned char *Cr,
+		unsigned char *p, int width, int bgr)
 {
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p;
-	int i, j;
-	int offset_to_next_row;
+	int i;
+	/* Offsets of r and b in a pixel */
+	int ro = bgr ? 2 : 0, bo = 2 - ro;
 
 #define SCALEBITS       10
 #define ONE_HALF        (1UL << (SCALEBITS - 1))
 #define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
 
-	p = priv->plane[0];
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = priv->width * 3 - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			y  = (*Y++) << SCALEBITS;
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-		}
-
-		p += offset_to_next_row;
+	for (i = 0; i < width; i += 2) {
+		int y, cb, cr;
+		int add_r, add_g, add_b;
+		int r, g , b;
+
+		y  = (*Y++) << SCALEBITS;
+		cb = *Cb++ - 128;
+		cr = *Cr++ - 128;
+		add_r = FIX(1.40200) * cr + ONE_HALF;
+		add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
+		add_b = FIX(1.77200) * cb + ONE_HALF;
+
+		r = (y + add_r) >> SCALEBITS;
+		p[ro] = clamp(r);
+		g = (y + add_g) >> SCALEBITS;
+		p[1] = clamp(g);
+		b = (y + add_b) >> SCALEBITS;
+		p[bo] = clamp(b);
+
+		y  = (*Y++) << SCALEBITS;
+		r = (y + add_r) >> SCALEBITS;
+		p[3 + ro] = clamp(r);
+		g = (y + add_g) >> SCALEBITS;
+		p[4] = clamp(g);
+		b = (y + add_b) >> SCALEBITS;
+		p[3 + bo] = clamp(b);
+		p += 6;
 	}
 
 #undef SCALEBITS
@@ -870,6 +871,32 @@ static void YCrCB_to_RGB24_2x1(struct jdec_private *priv)
 #undef FIX
 }
 
+/* The 2x1 and 2x2 MCUs are 16 pixels wide, with 8 Cb and Cr values per
+   line, the 2x2 ones use each line of Cb and Cr for 2 lines */
+static void YCrCB_h2_to_RGB24(struct jdec_private *priv, int lines, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i, vshift = lines / 16;
+
+	for (i = 0; i < lines; i++) {
+		priv->cpu_ops->jpeg_ycbcr_h2_to_rgb24(priv->Y + 16 * i,
+				priv->Cb + 8 * (i >> vshift),
+				priv->Cr + 8 * (i >> vshift), p, 16, bgr);
+		p += priv->width * 3;
+	}
+}
+
+/**
+ *  YCrCb -> RGB24 (2x1)
+ *  .-------.
+ *  | 1 | 2 |
+ *  `-------'
+ */
+static void YCrCB_to_RGB24_2x1(struct jdec_private *priv)
+{
+	YCrCB_h2_to_RGB24(priv, 8, 0);
+}
+
 /*
  *  YCrCb -> BGR24 (2x1)
  *  .-------.
@@ -878,56 +905,7 @@ static void YCrCB_to_RGB24_2x1(struct jdec_private *priv)
  */
 static void YCrCB_to_BGR24_2x1(struct jdec_private *priv)
 {
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = priv->width * 3 - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-		}
-
-		p += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
+	YCrCB_h2_to_RGB24(priv, 8, 1);
 }
 
 /**
@@ -1071,74 +1049,7 @@ static void YCrCB_to_BGR24_1x2(struct jdec_private *priv)
  */
 static void YCrCB_to_RGB24_2x2(struct jdec_private *priv)
 {
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p, *p2;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	p2 = priv->plane[0] + priv->width * 3;
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = (priv->width * 3 * 2) - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (Y[16-2]) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-
-			y  = (Y[16-1]) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-		}
-		Y  += 16;
-		p  += offset_to_next_row;
-		p2 += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
+	YCrCB_h2_to_RGB24(priv, 16, 0);
 }
 
 
@@ -1152,74 +1063,7 @@ static void YCrCB_to_RGB24_2x2(struct jdec_private *priv)
  */
 static void YCrCB_to_BGR24_2x2(struct jdec_private *priv)
 {
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p, *p2;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	p2 = priv->plane[0] + priv->width * 3;
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = (priv->width * 3 * 2) - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (Y[16-2]) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-
-			y  = (Y[16-1]) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-		}
-		Y  += 16;
-		p  += offset_to_next_row;
-		p2 += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
+	YCrCB_h2_to_RGB24(priv, 16, 1);
 }
 
 
@@ -1327,15 +1171,15 @@ static void decode_MCU_1x1_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1345,15 +1189,15 @@ static void decode_MCU_1x1_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
 
@@ -1367,20 +1211,21 @@ static void decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table);
+static void build_quantization_table(struct tinyjpeg_qtable *qtable,
+		const unsigned char *ref_table);
 
 static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
@@ -1465,7 +1310,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 			j = (pixart_q[lumi][i] * comp + 50) / 100;
 			qt[i] = (j < 255) ? j : 255;
 		}
-		build_quantization_table(priv->Q_tables[0], qt);
+		build_quantization_table(&priv->Q_tables[0], qt);
 
 		/* If bit 7 of the marker is set chrominance uses the
 		   luminance quantization table */
@@ -1476,7 +1321,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 				qt[i] = (j < 255) ? j : 255;
 			}
 		}
-		build_quantization_table(priv->Q_tables[1], qt);
+		build_quantization_table(&priv->Q_tables[1], qt);
 
 		priv->marker = marker;
 	}
@@ -1484,17 +1329,17 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1507,9 +1352,9 @@ static void decode_MCU_2x1_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1531,21 +1376,21 @@ static void decode_MCU_2x2_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 8, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64 * 2, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1560,13 +1405,13 @@ static void decode_MCU_2x2_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 8, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64 * 2, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1587,17 +1432,17 @@ static void decode_MCU_1x2_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 8);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	IDCT(priv, &priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	IDCT(priv, &priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1612,9 +1457,9 @@ static void decode_MCU_1x2_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y, 8);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64, 8);
+	IDCT(priv, &priv->component_infos[cY], priv->Y + 64, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1657,7 +1502,8 @@ static void print_SOF(const unsigned char *stream)
  *
  ******************************************************************************/
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table)
+static void build_quantization_table(struct tinyjpeg_qtable *qtable,
+		const unsigned char *ref_table)
 {
 	/* Taken from libjpeg. Copyright Independent JPEG Group's LLM idct.
 	 * For float AA&N IDCT method, divisors are equal to quantization
@@ -1676,15 +1522,15 @@ static void build_quantization_table(float *qtable, const unsigned char *ref_tab
 	const unsigned char *zz = zigzag;
 
 	for (i = 0; i < 8; i++)
-		for (j = 0; j < 8; j++)
-			*qtable++ = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
-
+		for (j = 0; j < 8; j++, zz++)
+			qtable->aan[i * 8 + j] = ref_table[*zz] *
+				aanscalefactor[i] * aanscalefactor[j];
 }
 
 static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 {
 	int qi;
-	float *table;
+	struct tinyjpeg_qtable *table;
 	const unsigned char *dqt_block_end;
 
 	trace("> DQT marker\n");
@@ -1700,7 +1546,7 @@ static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 			error("No more than %d quantization tables supported (got %d)\n",
 					COMPONENTS, qi + 1);
 #endif
-		table = priv->Q_tables[qi];
+		table = &priv->Q_tables[qi];
 		build_quantization_table(table, stream);
 		stream += 64;
 	}
@@ -1743,7 +1589,7 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 #endif
 		c->Vfactor = sampling_factor & 0xf;
 		c->Hfactor = sampling_factor >> 4;
-		c->Q_table = priv->Q_tables[Q_table];
+		c->Q_table = &priv->Q_tables[Q_table];
 		trace("Component:%d  factor:%dx%d  Quantization table:%d\n",
 				cid, c->Hfactor, c->Hfactor, Q_table);
 
@@ -1980,6 +1826,10 @@ static int parse_JFIF(struct jdec_private *priv, const unsigned char *stream)
 	int dht_marker_found = 0;
 	const unsigned char *next_chunck;
 
+	/* Without a DRI marker this frame has no restart intervals, even if
+	   the previous one had */
+	priv->restart_interval = 0;
+
 	/* Parse marker */
 	while (!sos_marker_found) {
 		if (*stream++ != 0xff)
@@ -2081,6 +1931,7 @@ struct jdec_private *tinyjpeg_init(void)
 	priv = (struct jdec_private *)calloc(1, sizeof(struct jdec_private));
 	if (priv == NULL)
 		return NULL;
+	priv->cpu_ops = v4lconvert_get_cpu_ops();
 	return priv;
 }
 
@@ -2101,6 +1952,8 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	free(priv->restart_buf);
+	free(priv->worker_buf);
 	free(priv);
 }
 
@@ -2231,6 +2084,142 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
 	error("Short Pixart JPEG frame\n");
 }
 
+/* Where the MCUs of a scan go in the output planes, and how to decode and
+   convert them */
+struct mcu_layout {
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	unsigned int mcus_per_row;
+	unsigned int mcus;
+	unsigned int bytes_per_blocklines[3];
+	unsigned int bytes_per_mcu[3];
+};
+
+struct restart_slices {
+	const struct jdec_private *priv;
+	const struct mcu_layout *layout;
+	const unsigned char **starts;	/* Start of each restart interval */
+	struct jdec_private *workers;	/* Decoder state per slice */
+};
+
+/*
+ * Find the start of the entropy coded data of each restart interval of the
+ * scan, without decoding it. Returns the number of intervals found, which
+ * is less than intervals when a RST marker is missing or out of order.
+ */
+static unsigned int find_restart_intervals(struct jdec_private *priv,
+		const unsigned char **starts, unsigned int intervals)
+{
+	const unsigned char *stream = priv->stream;
+	int rst = priv->last_rst_marker_seen;
+	unsigned int found = 0;
+
+	starts[found++] = stream;
+	while (found < intervals) {
+		stream = memchr(stream, 0xff, priv->stream_end - stream);
+		if (!stream)
+			break;
+		/* Skip any padding ff byte (this is normal) */
+		do {
+			stream++;
+		} while (stream < priv->stream_end && *stream == 0xff);
+		if (stream >= priv->stream_end)
+			break;
+
+		if (*stream == 0x00)
+			continue;	/* Stuffed 0xff data byte */
+		if (*stream != RST + rst)
+			break;
+		rst = (rst + 1) & 7;
+		starts[found++] = ++stream;
+	}
+
+	return found;
+}
+
+static void decode_restart_slice(void *opaque, int slice, int first, int last)
+{
+	const struct restart_slices *r = opaque;
+	const struct mcu_layout *layout = r->layout;
+	struct jdec_private *priv = &r->workers[slice];
+	unsigned int mcu, end, x, y;
+	int i, c;
+
+	/* Each slice decodes with its own copy of the decoder state, the
+	   huffman and quantization tables it points to are only read */
+	memcpy(priv, r->priv, sizeof(*priv));
+	priv->error_string[0] = 0;
+	if (setjmp(priv->jump_state))
+		return;
+
+	for (i = first; i < last; i++) {
+		priv->stream = r->starts[i];
+		resync(priv);
+
+		mcu = i * priv->restart_interval;
+		end = mcu + priv->restart_interval;
+		if (end > layout->mcus)
+			end = layout->mcus;
+		for (; mcu < end; mcu++) {
+			x = mcu % layout->mcus_per_row;
+			y = mcu / layout->mcus_per_row;
+			for (c = 0; c < COMPONENTS; c++)
+				priv->plane[c] = priv->components[c] +
+					y * layout->bytes_per_blocklines[c] +
+					x * layout->bytes_per_mcu[c];
+			layout->decode_MCU(priv);
+			layout->convert_to_pixfmt(priv);
+		}
+	}
+}
+
+/*
+ * Restart intervals can be decoded independently of each other, so when
+ * there are worker threads, decode them in parallel. Returns 1 when this
+ * is not possible, e.g. because of missing RST markers, in which case the
+ * scan should be decoded serially, which also takes care of reporting
+ * errors in the stream.
+ */
+static int decode_restart_intervals(struct jdec_private *priv,
+		const struct mcu_layout *layout)
+{
+	struct restart_slices r = { .priv = priv, .layout = layout };
+	int i, threads = v4lconvert_threads_count(priv->threads);
+	unsigned int intervals;
+
+	intervals = (layout->mcus + priv->restart_interval - 1) /
+		    priv->restart_interval;
+	if (intervals < 2)
+		return 1;
+
+	r.starts = (const unsigned char **)v4lconvert_alloc_buffer(
+			intervals * sizeof(*r.starts),
+			&priv->restart_buf, &priv->restart_buf_size);
+	r.workers = (struct jdec_private *)v4lconvert_alloc_buffer(
+			threads * sizeof(*r.workers),
+			&priv->worker_buf, &priv->worker_buf_size);
+	if (!r.starts || !r.workers)
+		return 1;
+
+	if (find_restart_intervals(priv, r.starts, intervals) != intervals)
+		return 1;
+
+	for (i = 0; i < threads; i++)
+		r.workers[i].error_string[0] = 0;
+
+	v4lconvert_run_slices(priv->threads, decode_restart_slice, &r,
+			      intervals, 1);
+
+	for (i = 0; i < threads; i++) {
+		if (r.workers[i].error_string[0]) {
+			memcpy(priv->error_string, r.workers[i].error_string,
+			       sizeof(priv->error_string));
+			return -1;
+		}
+	}
+	return 0;
+}
+
 /**
  * Decode and convert the jpeg image into @pixfmt@ image
  *
@@ -2364,6 +2353,24 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	if (priv->threads && priv->restart_interval > 0 &&
+			!(priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)) {
+		struct mcu_layout layout = {
+			.decode_MCU = decode_MCU,
+			.convert_to_pixfmt = convert_to_pixfmt,
+			.mcus_per_row = (priv->width + xstride_by_mcu - 1) / xstride_by_mcu,
+		};
+		int result;
+
+		layout.mcus = layout.mcus_per_row * (priv->height / ystride_by_mcu);
+		memcpy(layout.bytes_per_blocklines, bytes_per_blocklines,
+		       sizeof(bytes_per_blocklines));
+		memcpy(layout.bytes_per_mcu, bytes_per_mcu, sizeof(bytes_per_mcu));
+		result = decode_restart_intervals(priv, &layout);
+		if (result <= 0)
+			return result;
+	}
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2444,7 +2451,7 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 	for (y = 0; y < priv->height / 8; y++) {
 		for (x = 0; x < priv->width / 8; x++) {
 			process_Huffman_data_unit(priv, cY);
-			IDCT(&priv->component_infos[cY], y_buf, priv->width);
+			IDCT(priv, &priv->component_infos[cY], y_buf, priv->width);
 			y_buf += 8;
 		}
 		y_buf += 7 * priv->width;
@@ -2466,7 +2473,7 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 	for (y = 0; y < priv->height / 16; y++) {
 		for (x = 0; x < priv->width / 16; x++) {
 			process_Huffman_data_unit(priv, cCb);
-			IDCT(&priv->component_infos[cCb], u_buf, priv->width / 2);
+			IDCT(priv, &priv->component_infos[cCb], u_buf, priv->width / 2);
 			u_buf += 8;
 		}
 		u_buf += 7 * (priv->width / 2);
@@ -2488,7 +2495,7 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 	for (y = 0; y < priv->height / 16; y++) {
 		for (x = 0; x < priv->width / 16; x++) {
 			process_Huffman_data_unit(priv, cCr);
-			IDCT(&priv->component_infos[cCr], v_buf, priv->width / 2);
+			IDCT(priv, &priv->component_infos[cCr], v_buf, priv->width / 2);
 			v_buf += 8;
 		}
 		v_buf += 7 * (priv->width / 2);
@@ -2668,3 +2675,12 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/**
+ * Use threads for decoding the restart intervals of a JPEG in parallel,
+ * threads may be NULL for decoding in the calling thread only.
+ */
+void tinyjpeg_set_threads(struct jdec_private *priv,
+		struct v4lconvert_threads *threads)
+{
+	priv->threads = threads;
+}
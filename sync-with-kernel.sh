@@ -12,6 +12,7 @@ if [ -z "${KERNEL_DIR}" -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/v4l2-subdev.h -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/v4l2-mediabus.h -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/ivtv.h -o \
+     ! -f ${KERNEL_DIR}/usr/include/linux/dma-buf.h -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/dvb/frontend.h -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/dvb/dmx.h -o \
      ! -f ${KERNEL_DIR}/usr/include/linux/lirc.h -o \
@@ -36,6 +37,7 @@ cp -a ${KERNEL_DIR}/usr/include/linux/v4l2-mediabus.h ${TOPSRCDIR}/include/linux
 cp -a ${KERNEL_DIR}/usr/include/linux/media-bus-format.h ${TOPSRCDIR}/include/linux
 cp -a ${KERNEL_DIR}/usr/include/linux/media.h ${TOPSRCDIR}/include/linux
 cp -a ${KERNEL_DIR}/usr/include/linux/ivtv.h ${TOPSRCDIR}/include/linux
+cp -a ${KERNEL_DIR}/usr/include/linux/dma-buf.h ${TOPSRCDIR}/include/linux
 cp -a ${KERNEL_DIR}/usr/include/linux/dvb/frontend.h ${TOPSRCDIR}/include/linux/dvb
 cp ${TOPSRCDIR}/include/linux/dvb/frontend.h ${TOPSRCDIR}/lib/include/libdvbv5/dvb-frontend.h
 cp -a ${KERNEL_DIR}/usr/include/linux/dvb/dmx.h ${TOPSRCDIR}/include/linux/dvb
@@ -64,6 +64,28 @@ typedef __u8 u8;
  * with this driver. His project report can be found here:
  *
  * https://hverkuil.home.xs4all.nl/fwht.pdf
+ *
+ * When encoded by several threads, the macroblocks of a plane aren't
+ * repeated across macroblock rows, and the compressed data may be followed
+ * by a row index: the size in bytes of each macroblock row of each
+ * compressed plane, in plane order, then the number of rows and
+ * FWHT_ROW_INDEX_MAGIC, all as 32 bit values. Decoders find it from the
+ * end of the compressed data, and use it to decode the rows in parallel.
+ * No header flag is used, so decoders that don't know about it, like the
+ * vicodec driver, just ignore the index, as it comes after all planes.
+ * Since the top byte of each of these values is 0, the magic header can't
+ * occur there either.
+ *
+ * P-coded macroblocks may also be predicted from another block of the
+ * previous frame, if the encoder searched for motion. Bit 13 of their header
+ * is then set, and it is followed by a 16 bit motion vector: the vertical
+ * displacement in the top 8 bits and twice the horizontal one in the bottom
+ * 8 bits, as signed values. The displaced block is within the visible part
+ * of the plane. Older encoders never set bit 13, so the decoder reads the
+ * motion vector whenever it is set, and no header flag is used. Older
+ * decoders, like the vicodec driver, can't decode such frames though, so
+ * the encoder only searches for motion when asked to, and the application
+ * must first make sure that the decoder knows about it.
  */
 
 /*
@@ -76,6 +98,12 @@ typedef __u8 u8;
 #define FWHT_MAGIC1 0x4f4f4f4f
 #define FWHT_MAGIC2 0xffffffff
 
+/* Last value of the row index at the end of the compressed data */
+#define FWHT_ROW_INDEX_MAGIC	0x00524f57
+
+/* Maximum distance searched for the motion vectors, in pixels */
+#define FWHT_MAX_MOTION_RANGE	16
+
 /*
  * A macro to calculate the needed padding in order to make sure
  * both luma and chroma components resolutions are rounded up to
@@ -96,14 +124,18 @@ struct fwht_cframe_hdr {
 	__be32 size;
 };
 
+/* A pool of threads sharing the work on the rows of the frames */
+struct fwht_pool;
+
 struct fwht_cframe {
 	u16 i_frame_qp;
 	u16 p_frame_qp;
 	__be16 *rlc_data;
-	s16 coeffs[8 * 8];
-	s16 de_coeffs[8 * 8];
-	s16 de_fwht[8 * 8];
 	u32 size;
+	/* If set, the threads of the pool encode or decode the frame */
+	struct fwht_pool *pool;
+	/* If not 0, the encoder searches for motion that many pixels away */
+	unsigned int motion_range;
 };
 
 struct fwht_raw_frame {
@@ -122,6 +154,10 @@ struct fwht_raw_frame {
 #define FWHT_CB_UNENCODED	BIT(3)
 #define FWHT_CR_UNENCODED	BIT(4)
 #define FWHT_ALPHA_UNENCODED	BIT(5)
+#define FWHT_FRAME_MOTION	BIT(7)
+
+struct fwht_pool *fwht_pool_create(unsigned int threads);
+void fwht_pool_free(struct fwht_pool *pool);
 
 u32 fwht_encode_frame(struct fwht_raw_frame *frm,
 		      struct fwht_raw_frame *ref_frm,
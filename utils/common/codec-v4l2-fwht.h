@@ -35,6 +35,10 @@ struct v4l2_fwht_state {
 	unsigned int gop_cnt;
 	u16 i_frame_qp;
 	u16 p_frame_qp;
+	/* If set, encode and decode the frames with the threads of the pool */
+	struct fwht_pool *pool;
+	/* If not 0, search for motion that many pixels away when encoding */
+	unsigned int motion_range;
 
 	enum v4l2_colorspace colorspace;
 	enum v4l2_ycbcr_encoding ycbcr_enc;
@@ -9,6 +9,8 @@
 #define _V4L_STREAM_H_
 
 #include <linux/videodev2.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -136,12 +138,137 @@ extern "C" {
  */
 #define V4L_STREAM_PACKET_END				v4l2_fourcc('e', 'n', 'd', ' ')
 
+/*
+ * Receivers that accept a connection send this packet back to the sender,
+ * followed by its size and a uint32_t with the V4L_STREAM_CAP_* flags of
+ * the extensions they understand. Older receivers send nothing, so a sender
+ * must not use an extension unless it got this packet with the matching
+ * flag within V4L_STREAM_CAPS_TIMEOUT milliseconds.
+ */
+#define V4L_STREAM_PACKET_CAPS				v4l2_fourcc('c', 'a', 'p', 's')
+#define V4L_STREAM_PACKET_CAPS_SIZE			4
+#define V4L_STREAM_CAPS_TIMEOUT				2000
+
+/* FWHT frames with motion vectors (see codec-fwht.h) */
+#define V4L_STREAM_CAP_FWHT_MOTION			(1 << 0)
+/* The extensions understood by this version */
+#define V4L_STREAM_CAPS					V4L_STREAM_CAP_FWHT_MOTION
+
+/*
+ * UDP transport:
+ *
+ * Instead of over a TCP connection, the stream can be sent as UDP datagrams,
+ * to a single receiver or to a multicast group, so that any number of
+ * receivers can watch the same stream. There is no stream ID and version at
+ * the start: the FMT_VIDEO, FRAME_VIDEO and END packets described above are
+ * cut into fragments which fit in a datagram, each preceded by:
+ *
+ * uint32_t id;		// V4L_STREAM_UDP_ID
+ * uint32_t version;	// V4L_STREAM_VERSION
+ * uint32_t seq;	// datagram sequence number
+ * uint32_t packet;	// packet sequence number
+ * uint32_t offset;	// offset of the fragment in the packet
+ * uint32_t size;	// size of the packet
+ * uint8_t data[];	// the fragment
+ *
+ * The fragments of a packet are sent in order, the packets with missing
+ * fragments are dropped by the receivers. Since receivers can join at any
+ * time, the FMT_VIDEO packet is sent again every V4L_STREAM_UDP_FMT_INTERVAL
+ * milliseconds, and the receivers drop the frames until they have it.
+ *
+ * Receivers send their statistics back to the address the datagrams come
+ * from every V4L_STREAM_UDP_REPORT_INTERVAL milliseconds, or every
+ * V4L_STREAM_UDP_REQ_INTERVAL milliseconds while they request something:
+ *
+ * uint32_t id;		// V4L_STREAM_UDP_REPORT
+ * uint32_t flags;	// V4L_STREAM_UDP_REQ_* flags
+ * uint32_t received;	// number of datagrams received
+ * uint32_t lost;	// number of datagrams lost
+ *
+ * A FWHT P-frame can't be decoded if a previous frame was lost: receivers
+ * drop the P-frames until the next I-frame, and request it with the
+ * V4L_STREAM_UDP_REQ_I_FRAME flag rather than waiting for the end of the GOP.
+ */
+#define V4L_STREAM_UDP_ID				v4l2_fourcc('V', '4', 'L', 'u')
+#define V4L_STREAM_UDP_REPORT				v4l2_fourcc('V', '4', 'L', 'r')
+#define V4L_STREAM_UDP_HDR_SIZE				(6 * 4)
+#define V4L_STREAM_UDP_REPORT_SIZE			(4 * 4)
+
+#define V4L_STREAM_UDP_REQ_FMT				(1 << 0)
+#define V4L_STREAM_UDP_REQ_I_FRAME			(1 << 1)
+
+#define V4L_STREAM_UDP_FMT_INTERVAL			1000
+#define V4L_STREAM_UDP_REPORT_INTERVAL			1000
+#define V4L_STREAM_UDP_REQ_INTERVAL			100
+
+/* Default MTU, the datagrams are this size minus the IP and UDP headers */
+#define V4L_STREAM_UDP_MTU				1500
+#define V4L_STREAM_UDP_MIN_MTU				576
+#define V4L_STREAM_UDP_MAX_MTU				65535
+
+/* Max number of buffers in a packet given to udp_stream_send() */
+#define V4L_STREAM_UDP_MAX_IOV				(1 + 2 * VIDEO_MAX_PLANES)
+
+/* Max number of receivers a sender keeps the statistics of */
+#define V4L_STREAM_UDP_MAX_PEERS			16
+
+struct udp_stream_peer {
+	struct sockaddr_in	addr;
+	__u32			received;
+	__u32			lost;
+};
+
+struct udp_stream {
+	int			fd;
+	bool			sender;
+	unsigned int		mtu;
+	/* Sender: where to send to. Receiver: where the datagrams come from */
+	struct sockaddr_in	addr;
+	bool			has_addr;
+	__u32			seq;
+	__u32			packet;
+	/* Sender: the last FMT_VIDEO packet, sent again now and then */
+	__u8			*fmt;
+	unsigned int		fmt_size;
+	__u64			fmt_time;
+	/* Sender: the requests of the receivers not handled yet */
+	__u32			req_flags;
+	/* Receiver: the packet being put together, and the last datagram */
+	__u8			*buf;
+	unsigned int		buf_size;
+	unsigned int		size;
+	unsigned int		offset;
+	__u8			*dgram;
+	bool			has_seq;
+	bool			has_packet;
+	bool			has_fmt;
+	bool			need_i_frame;
+	/* Receiver: the largest packet the current format can lead to */
+	unsigned int		max_size;
+	__u32			last_packet;
+	__u64			report_time;
+	/* Statistics */
+	__u32			datagrams;
+	__u32			lost;
+	__u32			packets;
+	__u32			dropped;
+	__u32			i_frame_reqs;
+	__u32			fmt_reqs;
+	unsigned int		num_peers;
+	struct udp_stream_peer	peers[V4L_STREAM_UDP_MAX_PEERS];
+};
+
 struct codec_ctx {
 	struct v4l2_fwht_state	state;
 	unsigned int		flags;
 	unsigned int		size;
 	u32			field;
 	u32			comp_max_size;
+	/* Rate control: target size of the frames, 0 to use a fixed qp */
+	unsigned int		frame_bytes;
+	unsigned int		qp;
+	__s64			rc_avg;
+	__s64			rc_fill;
 };
 
 unsigned rle_compress(__u8 *buf, unsigned size, unsigned bytesperline);
@@ -151,10 +278,21 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 			     unsigned colorspace, unsigned xfer_func, unsigned ycbcr_enc,
 			     unsigned quantization);
 void fwht_free(struct codec_ctx *ctx);
+void fwht_set_threads(struct codec_ctx *ctx, unsigned threads);
 __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned size, unsigned *comp_size);
 bool fwht_decompress(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
 		     __u8 *buf, unsigned size);
 unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat);
+int v4l_stream_send_caps(int fd, __u32 caps);
+int v4l_stream_read_caps(int fd, unsigned timeout, __u32 *caps);
+
+int udp_stream_open(struct udp_stream *s, const char *host, unsigned port,
+		    const char *if_addr, unsigned mtu, bool sender);
+void udp_stream_close(struct udp_stream *s);
+int udp_stream_send_fmt(struct udp_stream *s, const void *fmt, unsigned size);
+int udp_stream_send(struct udp_stream *s, const struct iovec *iov, unsigned iovcnt);
+bool udp_stream_i_frame_requested(struct udp_stream *s);
+int udp_stream_recv(struct udp_stream *s);
 
 #ifdef __cplusplus
 }
@@ -33,8 +33,9 @@
 #include <argp.h>
 #include <config.h>
 #include <endian.h>
+#include <inttypes.h>
+#include <fcntl.h>
 #include <netinet/in.h>
-#include <poll.h>
 #include <pthread.h>
 #include <search.h>
 #include <signal.h>
@@ -43,8 +44,14 @@
 #include <stdio.h>
 #include <signal.h>
 #include <syslog.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <linux/sockios.h>
 
 #include <netdb.h>
 #include <netinet/in.h>
@@ -67,8 +74,8 @@
 
 # define N_(string) string
 
-/* Max number of open files */
-#define NUM_FOPEN	1024
+/* Max number of events handled per epoll_wait() call */
+#define NUM_EVENTS	64
 
 /*
  * Argument processing data and logic
@@ -199,19 +206,67 @@ void local_log(int level, const char *fmt, ...)
 
 static pthread_mutex_t msg_mutex;
 static pthread_mutex_t dvb_read_mutex;
+static pthread_cond_t queue_cond;
 static pthread_t read_id = 0;
 
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
+
+	/* Control connection of the client that opened the device */
+	int client_fd;
+
+	/* Binary data channel, if the client attached one */
+	int data_fd;
+	int pipefd[2];
+
+	/* Given to the client at dev_open, needed to attach the channel */
+	char token[REMOTE_TOKEN_LEN + 1];
+
+	/* Not read while its socket has data waiting to be sent */
+	int paused;
+
+	/* Per-device counters, shown on SIGUSR1 */
+	struct timespec start;
+	uint64_t bytes, reads, errors;
+	int backlog, max_backlog;
+
+	struct dvb_descriptors *next;
+};
+
+/*
+ * Data that a client socket couldn't take without blocking. It is sent
+ * by the read_data() thread when the socket becomes writable again.
+ */
+struct out_queue {
+	int fd;
+	char *buf;
+	size_t len, size;
+
+	struct out_queue *next;
 };
 
+/*
+ * Commands from a client are only read while less than MAX_CMD_QUEUED
+ * bytes are queued for it, and the devices feeding a socket are paused
+ * while it has queued data. So, MAX_QUEUED is only reached by a client
+ * that stopped reading, which then gets disconnected.
+ */
+#define MAX_CMD_QUEUED		(REMOTE_BUF_SIZE * 4)
+#define MAX_QUEUED		(REMOTE_BUF_SIZE * 64)
+
 static struct dvb_device *dvb = NULL;
+static struct out_queue *queue_list = NULL;
 static void *desc_root = NULL;
+static struct dvb_descriptors *desc_list = NULL;
 static int dvb_fd = -1;
 
-static struct pollfd fds[NUM_FOPEN];
-static nfds_t numfds = 0;
+/*
+ * Demux/DVR devices, client sockets with queued data and the SIGUSR1
+ * signalfd are monitored via epoll
+ */
+static int epoll_fd = -1;
+static int signal_fd = -1;
 
 static char output_charset[256] = "utf-8";
 static char default_charset[256] = "iso-8859-1";
@@ -248,7 +303,7 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+static struct dvb_descriptors *__get_desc(int uid)
 {
 	struct dvb_descriptors desc, **p;
 
@@ -257,43 +312,389 @@ static struct dvb_open_descriptor *get_open_dev(int uid)
 
 	desc.uid = uid;
 	p = tfind(&desc, &desc_root, dvb_desc_compare);
+	if (!p)
+		return NULL;
 
-	if (!p) {
+	return *p;
+}
+
+static struct dvb_descriptors *get_desc(int uid)
+{
+	struct dvb_descriptors *desc;
+
+	pthread_mutex_lock(&dvb_read_mutex);
+	desc = __get_desc(uid);
+	pthread_mutex_unlock(&dvb_read_mutex);
+
+	if (!desc)
 		err("open element not retrieved!");
+
+	return desc;
+}
+
+static struct dvb_open_descriptor *get_open_dev(int uid)
+{
+	struct dvb_descriptors *desc = get_desc(uid);
+
+	if (!desc)
 		return NULL;
+
+	return desc->open_dev;
+}
+
+/* Should be called with dvb_read_mutex hold */
+static int resume_reading(struct dvb_descriptors *desc)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.fd = desc->uid;
+
+	desc->paused = 0;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, desc->uid, &ev) < 0) {
+		local_perror("epoll_ctl");
+		return -errno;
 	}
+	return 0;
+}
 
-	return (*p)->open_dev;
+/* Should be called with dvb_read_mutex hold */
+static int start_reading(struct dvb_descriptors *desc)
+{
+	clock_gettime(CLOCK_MONOTONIC, &desc->start);
+
+	return resume_reading(desc);
 }
 
-static void destroy_open_dev(int uid)
+/* Should be called with dvb_read_mutex hold */
+static void stop_reading(struct dvb_descriptors *desc)
 {
-	struct dvb_descriptors desc, **p;
+	/* Fails if it was not being read, which is fine */
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, desc->uid, NULL);
+}
 
-	desc.uid = uid;
-	p = tdelete(&desc, &desc_root, dvb_desc_compare);
-	if (!p)
-		err("can't destroy opened element");
+/* Should be called with dvb_read_mutex hold */
+static void pause_reading(struct dvb_descriptors *desc)
+{
+	stop_reading(desc);
+	desc->paused = 1;
+}
+
+/* Socket where the data of a descriptor is sent to */
+static int desc_sock(struct dvb_descriptors *desc)
+{
+	return desc->data_fd >= 0 ? desc->data_fd : desc->client_fd;
+}
+
+/*
+ * Client output queues
+ */
+
+/* Should be called with msg_mutex hold */
+static struct out_queue *__get_queue(int fd)
+{
+	struct out_queue *q;
+
+	for (q = queue_list; q; q = q->next)
+		if (q->fd == fd)
+			return q;
+
+	return NULL;
+}
+
+/* Should be called with msg_mutex hold */
+static size_t __queued(int fd)
+{
+	struct out_queue *q = __get_queue(fd);
+
+	return q ? q->len : 0;
+}
+
+static size_t queued(int fd)
+{
+	size_t len;
+
+	pthread_mutex_lock(&msg_mutex);
+	len = __queued(fd);
+	pthread_mutex_unlock(&msg_mutex);
+
+	return len;
 }
 
-static void free_opendevs(void *node)
+/*
+ * Sends data to a client socket without blocking. Whatever the socket
+ * can't take is queued, and sent later by the read_data() thread.
+ *
+ * Should be called with msg_mutex hold.
+ */
+static int __queue_send(int fd, struct iovec *iov, int iovcnt, int flags)
 {
-	struct dvb_descriptors *desc = node;
+	struct out_queue *q = __get_queue(fd);
+	struct epoll_event ev;
+	struct msghdr msg;
+	size_t len, was_queued = q ? q->len : 0;
+	ssize_t ret = 0;
+	char *buf;
+	int i;
+
+	if (q && q->len >= MAX_QUEUED) {
+		err("too much data queued for socket %d. Dropping it", fd);
+		shutdown(fd, SHUT_RDWR);
+		return -ENOBUFS;
+	}
+
+	if (!was_queued) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		do {
+			ret = sendmsg(fd, &msg,
+				      flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -errno;
+			ret = 0;
+		}
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (ret >= iov[i].iov_len) {
+			ret -= iov[i].iov_len;
+			continue;
+		}
+		len = iov[i].iov_len - ret;
+
+		if (!q) {
+			q = calloc(1, sizeof(*q));
+			if (!q)
+				return -ENOMEM;
+			q->fd = fd;
+			q->next = queue_list;
+			queue_list = q;
+		}
+		if (q->len + len > q->size) {
+			buf = realloc(q->buf, q->len + len);
+			if (!buf)
+				return -ENOMEM;
+			q->buf = buf;
+			q->size = q->len + len;
+		}
+		memcpy(q->buf + q->len, (char *)iov[i].iov_base + ret, len);
+		q->len += len;
+		ret = 0;
+	}
+
+	if (!was_queued && q && q->len) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLOUT;
+		ev.data.fd = fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			local_perror("epoll_ctl");
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Sends as much of the queued data as the socket takes. Returns the
+ * amount of data still queued, or a negative error code, in which case
+ * the queued data is discarded.
+ *
+ * Should be called with msg_mutex hold.
+ */
+static ssize_t __flush_queue(int fd)
+{
+	struct out_queue *q = __get_queue(fd);
+	ssize_t ret;
+
+	if (!q)
+		return 0;
+
+	while (q->len) {
+		ret = send(fd, q->buf, q->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return q->len;
+			ret = -errno;
+			q->len = 0;
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			pthread_cond_broadcast(&queue_cond);
+			return ret;
+		}
+		q->len -= ret;
+		memmove(q->buf, q->buf + ret, q->len);
+		if (q->len < MAX_CMD_QUEUED)
+			pthread_cond_broadcast(&queue_cond);
+	}
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	return 0;
+}
+
+/* Discards the queue of a socket that is about to be closed */
+static void drop_queue(int fd)
+{
+	struct out_queue **p, *q;
+
+	pthread_mutex_lock(&msg_mutex);
+	for (p = &queue_list; *p; p = &(*p)->next) {
+		q = *p;
+		if (q->fd == fd) {
+			if (q->len)
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			*p = q->next;
+			free(q->buf);
+			free(q);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&msg_mutex);
+}
+
+static void close_data_channel(struct dvb_descriptors *desc)
+{
+	if (desc->pipefd[0] >= 0) {
+		close(desc->pipefd[0]);
+		close(desc->pipefd[1]);
+		desc->pipefd[0] = desc->pipefd[1] = -1;
+	}
+	if (desc->data_fd >= 0) {
+		drop_queue(desc->data_fd);
+		close(desc->data_fd);
+		desc->data_fd = -1;
+	}
+}
+
+/*
+ * Called when a client socket can take more data. Once all queued data
+ * is sent, resumes reading the descriptors that feed the socket.
+ *
+ * Should be called with dvb_read_mutex hold.
+ */
+static void flush_queue(int fd)
+{
+	struct dvb_descriptors *desc, *next;
+	ssize_t ret;
+
+	pthread_mutex_lock(&msg_mutex);
+	ret = __flush_queue(fd);
+	pthread_mutex_unlock(&msg_mutex);
+
+	if (ret > 0)
+		return;
+
+	for (desc = desc_list; desc; desc = next) {
+		next = desc->next;
+		if (desc_sock(desc) != fd)
+			continue;
+
+		if (ret < 0 && desc->data_fd == fd) {
+			/* Client went away. Stop sending data */
+			err("Error %zd sending data for #%d", ret, desc->uid);
+			stop_reading(desc);
+			close_data_channel(desc);
+		} else if (!ret && desc->paused) {
+			resume_reading(desc);
+		}
+	}
+}
+
+/* Should be called with dvb_read_mutex hold */
+static void free_desc(struct dvb_descriptors *desc)
+{
+	struct dvb_descriptors **p;
 
 	if (verbose)
-		dbg("closing dev %p", desc, desc->open_dev);
+		dbg("closing dev %p", desc->open_dev);
 
+	stop_reading(desc);
 	dvb_dev_close(desc->open_dev);
-	free (desc);
+	close_data_channel(desc);
+
+	if (!tdelete(desc, &desc_root, dvb_desc_compare))
+		err("can't destroy opened element");
+
+	for (p = &desc_list; *p; p = &(*p)->next) {
+		if (*p == desc) {
+			*p = desc->next;
+			break;
+		}
+	}
+
+	free(desc);
+}
+
+/* Releases the devices opened by a client, or all of them if fd < 0 */
+static void close_client_devs(int fd)
+{
+	struct dvb_descriptors *desc, *next;
+
+	pthread_mutex_lock(&dvb_read_mutex);
+	for (desc = desc_list; desc; desc = next) {
+		next = desc->next;
+		if (fd < 0 || desc->client_fd == fd)
+			free_desc(desc);
+	}
+	pthread_mutex_unlock(&dvb_read_mutex);
 }
 
 static void close_all_devs(void)
 {
 	dvb_fd = -1;
-	numfds = 0;
-	tdestroy(desc_root, free_opendevs);
+	close_client_devs(-1);
+}
+
+/* Should be called with dvb_read_mutex hold */
+static void show_stats(void)
+{
+	struct dvb_descriptors *desc;
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	desc_root = NULL;
+	for (desc = desc_list; desc; desc = desc->next) {
+		if (!desc->reads)
+			continue;
+
+		elapsed = now.tv_sec - desc->start.tv_sec +
+			  (now.tv_nsec - desc->start.tv_nsec) / 1E9;
+
+		info("#%d (client %d, %s): %" PRIu64 " bytes in %" PRIu64 " reads, %.2f Mbps, %" PRIu64 " errors, backlog %d bytes (max %d)",
+		     desc->uid, desc->client_fd,
+		     desc->data_fd >= 0 ? "data channel" : "data_read",
+		     desc->bytes, desc->reads,
+		     elapsed > 0 ? desc->bytes * 8 / elapsed / 1E6 : 0.,
+		     desc->errors, desc->backlog, desc->max_backlog);
+	}
+}
+
+/* Should be called with dvb_read_mutex hold */
+static void account_read(struct dvb_descriptors *desc, ssize_t read_ret,
+			 int sock)
+{
+	int backlog;
+
+	desc->reads++;
+	if (read_ret > 0)
+		desc->bytes += read_ret;
+	else if (read_ret < 0)
+		desc->errors++;
+
+	/* Data still queued at the socket, waiting for the client */
+	if (!ioctl(sock, SIOCOUTQ, &backlog)) {
+		desc->backlog = backlog;
+		if (backlog > desc->max_backlog)
+			desc->max_backlog = backlog;
+	}
 }
 
 /*
@@ -434,27 +835,29 @@ static ssize_t prepare_data(char *buf, const size_t size,
 
 static int send_buf(int fd, const char *buf, size_t size)
 {
+	struct iovec iov[2];
 	int ret;
 	int32_t i32;
 
 	if (fd < 0)
-		return ECONNRESET;
+		return -ECONNRESET;
 
-	pthread_mutex_lock(&msg_mutex);
 	i32 = htobe32(size);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
-	if (ret >= 0)
-		ret = send(fd, buf, size, 0);
+	iov[0].iov_base = &i32;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = size;
+
+	pthread_mutex_lock(&msg_mutex);
+	ret = __queue_send(fd, iov, 2, 0);
 	pthread_mutex_unlock(&msg_mutex);
 	if (ret < 0) {
+		errno = -ret;
 		local_perror("write");
-		if (ret == ECONNRESET)
-			close_all_devs();
-
-		return errno;
+		return ret;
 	}
 
-	return ret;
+	return size;
 }
 
 static ssize_t send_data(int fd, const char *fmt, ...)
@@ -595,9 +998,16 @@ static int dev_change_monitor(char *sysname,
 static int daemon_get_version(uint32_t seq, char *cmd, int fd,
 			      char *buf, ssize_t size)
 {
-	int ret = 0;
+	int ret = 0, features = 0;
+
+	/* Older clients don't ask for any protocol extension */
+	if (size >= 4 && scan_data(buf, size, "%i", &features) < 0)
+		features = 0;
 
-	return send_data(fd, "%i%s%i%s", seq, cmd, ret, argp_program_version);
+	features &= REMOTE_FEAT_DATA_CHANNEL;
+
+	return send_data(fd, "%i%s%i%s%i", seq, cmd, ret, argp_program_version,
+			 features);
 }
 
 static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
@@ -671,103 +1081,230 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
-static void *read_data(void *privdata)
+/*
+ * Sends the data available on a descriptor through its data channel.
+ *
+ * When possible, the data is moved from the DVR to the socket with
+ * splice(), via a pipe, without ever being copied to userspace.
+ * Otherwise, it is read into a buffer and sent together with its header
+ * with a single sendmsg().
+ *
+ * The socket is non-blocking: if the client doesn't keep up, what is left
+ * is queued, and the descriptor is paused until the queue drains.
+ */
+static int send_data_channel(struct dvb_descriptors *desc)
 {
-	struct dvb_open_descriptor *open_dev;
-	int timeout;
-	int ret, read_ret = -1, fd, i;
+	struct dvb_remote_data_hdr hdr;
 	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
-	size_t count;
-	struct pollfd __fds[NUM_FOPEN];
-	nfds_t __numfds;
+	struct iovec iov[2];
+	ssize_t read_ret, left, ret;
+	int iovcnt = 1;
 
-	timeout = 10; /* ms */
-	while (1) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		if (!numfds) {
-			pthread_mutex_unlock(&dvb_read_mutex);
-			break;
-		}
-		__numfds = numfds;
-		memcpy(__fds, fds, sizeof(fds));
-		pthread_mutex_unlock(&dvb_read_mutex);
+	hdr.uid = htobe32(desc->uid);
 
-		ret = poll(__fds, __numfds, timeout);
-		if (!ret)
-			continue;
-		if (ret < 0) {
-			err("poll");
-			continue;
-		}
+	if (desc->pipefd[0] >= 0) {
+		read_ret = splice(desc->uid, NULL, desc->pipefd[1], NULL,
+				  REMOTE_BUF_SIZE, SPLICE_F_MOVE);
+		if (read_ret < 0 && errno == EINVAL) {
+			/* The device doesn't support splice. Don't try again */
+			if (verbose)
+				dbg("#%d: can't splice, using read()", desc->uid);
+			close(desc->pipefd[0]);
+			close(desc->pipefd[1]);
+			desc->pipefd[0] = desc->pipefd[1] = -1;
+		} else {
+			if (read_ret < 0)
+				read_ret = -errno;
+			hdr.retval = htobe32(read_ret);
+			iov[0].iov_base = &hdr;
+			iov[0].iov_len = sizeof(hdr);
+
+			pthread_mutex_lock(&msg_mutex);
+			ret = __queue_send(desc->data_fd, iov, 1,
+					   read_ret > 0 ? MSG_MORE : 0);
+			for (left = read_ret; !ret && left > 0; ) {
+				if (!__queued(desc->data_fd)) {
+					ret = splice(desc->pipefd[0], NULL,
+						     desc->data_fd, NULL, left,
+						     SPLICE_F_MOVE | SPLICE_F_MORE |
+						     SPLICE_F_NONBLOCK);
+					if (ret > 0) {
+						left -= ret;
+						ret = 0;
+						continue;
+					}
+					if (ret < 0 && errno == EINTR) {
+						ret = 0;
+						continue;
+					}
+					if (ret < 0 && errno != EAGAIN) {
+						ret = -errno;
+						break;
+					}
+				}
 
-		for (i = 0; i < __numfds; i++) {
-			if (__fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
-				continue;
-			if (__fds[i].revents)
-				break;
+				/* The socket is full: queue the pipe contents */
+				ret = read(desc->pipefd[0], databuf, left);
+				if (ret < 0) {
+					ret = (errno == EINTR) ? 0 : -errno;
+					continue;
+				}
+				iov[1].iov_base = databuf;
+				iov[1].iov_len = ret;
+				left -= ret;
+				ret = __queue_send(desc->data_fd, &iov[1], 1, 0);
+			}
+			pthread_mutex_unlock(&msg_mutex);
+
+			if (!ret)
+				account_read(desc, read_ret, desc->data_fd);
+			return ret;
 		}
+	}
 
-		/*
-		 * it means that one error condition happened.
-		 * Likely the file was closed.
-		 */
-		if (i == __numfds)
-			continue;
+	read_ret = dvb_dev_read(desc->open_dev, databuf, sizeof(databuf));
+	if (verbose && read_ret < 0)
+		dbg("#%d: read error: %zd on %p", desc->uid, read_ret,
+		    desc->open_dev);
+
+	hdr.retval = htobe32(read_ret);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	if (read_ret > 0) {
+		iov[1].iov_base = databuf;
+		iov[1].iov_len = read_ret;
+		iovcnt++;
+	}
 
-		fd = __fds[i].fd;
+	pthread_mutex_lock(&msg_mutex);
+	ret = __queue_send(desc->data_fd, iov, iovcnt, 0);
+	pthread_mutex_unlock(&msg_mutex);
+	if (!ret)
+		account_read(desc, read_ret, desc->data_fd);
 
-		if (!desc_root)
-			break;
+	return ret;
+}
 
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
-			err("Couldn't find opened file %d", fd);
-			continue;
-		}
+/*
+ * Sends the data available on a descriptor to the client that opened
+ * it, as a "data_read" message at its control connection.
+ */
+static int send_data_read(struct dvb_descriptors *desc)
+{
+	struct dvb_open_descriptor *open_dev = desc->open_dev;
+	char databuf[REMOTE_BUF_SIZE];
+	char buf[REMOTE_BUF_SIZE + 32], *p;
+	ssize_t read_ret;
+	size_t size;
+	int ret, fd = desc->uid;
+
+	read_ret = dvb_dev_read(open_dev, databuf, sizeof(databuf));
+	if (verbose) {
+		if (read_ret < 0)
+			dbg("#%d: read error: %zd on %p", fd, read_ret, open_dev);
+		else
+			dbg("#%d: read %zd bytes", fd, read_ret);
+	}
 
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %ul bytes (count %d)", fd, read_ret, count);
+	/* Initialize to the start of the buffer */
+	p = buf;
+	size = sizeof(buf);
+
+	ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
+			   (int)read_ret, fd);
+	if (ret < 0) {
+		err("Failed to prepare answer to dvb_read()");
+		return ret;
+	}
+
+	p += ret;
+	size -= ret;
+
+	if (read_ret > 0) {
+		if (read_ret > size) {
+			dbg("buffer to short to store read data!");
+			read_ret = -EOVERFLOW;
+		} else {
+			memcpy(p, databuf, read_ret);
+			p += read_ret;
 		}
+	}
 
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
+	ret = send_buf(desc->client_fd, buf, p - buf);
+	if (ret < 0)
+		return ret;
 
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
+	account_read(desc, read_ret, desc->client_fd);
+
+	return 0;
+}
+
+/*
+ * Event loop that forwards the data of all demux/DVR devices being read.
+ *
+ * Every descriptor that is ready gets one read per wakeup, so a busy
+ * multiplex can't starve the other ones.
+ *
+ * Data is never sent with a blocking call. When a client is slow, its
+ * descriptors are paused until its socket signals that it can take the
+ * queued data, so it doesn't delay the other clients.
+ */
+static void *read_data(void *privdata)
+{
+	struct epoll_event events[NUM_EVENTS];
+	struct signalfd_siginfo si;
+	struct dvb_descriptors *desc;
+	int ret, fd, i, n;
+
+	while (1) {
+		n = epoll_wait(epoll_fd, events, NUM_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			local_perror("epoll_wait");
 			break;
 		}
 
-		p += ret;
-		size -= ret;
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
 
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
+			pthread_mutex_lock(&dvb_read_mutex);
+			if (fd == signal_fd) {
+				if (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+					show_stats();
+				pthread_mutex_unlock(&dvb_read_mutex);
+				continue;
 			}
-		}
 
-		ret = send_buf(dvb_fd, buf, p - buf);
-		if (ret < 0) {
-			err("Error %d sending buffer\n", ret);
-			if (ret == ECONNRESET) {
-				close_all_devs();
-				break;
+			/*
+			 * Either a client socket with queued data, or a
+			 * device that was closed meanwhile.
+			 */
+			desc = __get_desc(fd);
+			if (!desc) {
+				flush_queue(fd);
+				pthread_mutex_unlock(&dvb_read_mutex);
+				continue;
 			}
-			continue;
+
+			/*
+			 * Even on EPOLLERR, read from the device, in order to
+			 * report the error (like EOVERFLOW) to the client.
+			 */
+			if (desc->data_fd >= 0)
+				ret = send_data_channel(desc);
+			else
+				ret = send_data_read(desc);
+
+			if (ret < 0) {
+				/* Client went away. Stop sending data */
+				err("Error %d sending data for #%d", ret, fd);
+				stop_reading(desc);
+				close_data_channel(desc);
+			} else if (queued(desc_sock(desc))) {
+				pause_reading(desc);
+			}
+			pthread_mutex_unlock(&dvb_read_mutex);
 		}
 	}
 
@@ -776,13 +1313,47 @@ static void *read_data(void *privdata)
 	return NULL;
 }
 
+/*
+ * Fills a descriptor token with random hex digits. Only the client that
+ * got it from dev_open can attach a data channel to the descriptor.
+ */
+static int new_token(struct dvb_descriptors *desc)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char rnd[REMOTE_TOKEN_LEN / 2];
+	ssize_t ret;
+	int fd, i;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		local_perror("open /dev/urandom");
+		return -errno;
+	}
+	do {
+		ret = read(fd, rnd, sizeof(rnd));
+	} while (ret < 0 && errno == EINTR);
+	close(fd);
+	if (ret != sizeof(rnd)) {
+		err("can't get random data");
+		return -EIO;
+	}
+
+	for (i = 0; i < sizeof(rnd); i++) {
+		desc->token[2 * i] = hex[rnd[i] >> 4];
+		desc->token[2 * i + 1] = hex[rnd[i] & 0x0f];
+	}
+	desc->token[REMOTE_TOKEN_LEN] = '\0';
+
+	return 0;
+}
+
 static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	struct dvb_dev_list *dev;
 	struct dvb_descriptors *desc, **p;
-	int ret, flags, uid;
-	char sysname[REMOTE_BUF_SIZE];
+	int ret, flags, uid, remote_flags = 0;
+	char sysname[REMOTE_BUF_SIZE], token[REMOTE_TOKEN_LEN + 1] = "";
 
 	desc = calloc(1, sizeof(*desc));
 	if (!desc) {
@@ -790,6 +1361,8 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		ret = -ENOMEM;
 		goto error;
 	}
+	desc->data_fd = -1;
+	desc->pipefd[0] = desc->pipefd[1] = -1;
 
 	ret = scan_data(buf, size, "%s%i", sysname, &flags);
 	if (ret < 0) {
@@ -797,6 +1370,18 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		goto error;
 	}
 
+	/* Newer clients also pass the protocol extensions they'll use */
+	if (size - ret >= 4)
+		scan_data(buf + ret, size - ret, "%i", &remote_flags);
+
+	if (remote_flags & REMOTE_FEAT_DATA_CHANNEL) {
+		ret = new_token(desc);
+		if (ret < 0) {
+			free(desc);
+			goto error;
+		}
+	}
+
 	/*
 	 * Discard requests for O_NONBLOCK, as the daemon will use threads
 	 * to handle unblocked reads.
@@ -814,31 +1399,13 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (verbose)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
-	dev = open_dev->dev;
-	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
-	    dev->dvb_type == DVB_DEVICE_DVR) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		fds[numfds].fd = open_dev->fd;
-		fds[numfds].events = POLLIN | POLLPRI;
-		numfds++;
-		pthread_mutex_unlock(&dvb_read_mutex);
-	}
-
-	if (!read_id) {
-		ret = pthread_create(&read_id, NULL, read_data, NULL);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			pthread_mutex_unlock(&msg_mutex);
-			free(desc);
-			return -1;
-		}
-	}
-
-	pthread_mutex_unlock(&msg_mutex);
 	uid = open_dev->fd;
 
 	desc->uid = uid;
 	desc->open_dev = open_dev;
+	desc->client_fd = fd;
+
+	pthread_mutex_lock(&dvb_read_mutex);
 
 	/* Add element to the desc_root tree */
 	p = tsearch(desc, &desc_root, dvb_desc_compare);
@@ -847,9 +1414,26 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		uid = 0;
 	} else if (*p != desc) {
 		err("uid %d was already opened!", uid);
+	} else {
+		desc->next = desc_list;
+		desc_list = desc;
+		strcpy(token, desc->token);
+
+		/*
+		 * When the client uses a data channel, the device will only
+		 * be read after it gets attached.
+		 */
+		dev = open_dev->dev;
+		if (!(remote_flags & REMOTE_FEAT_DATA_CHANNEL) &&
+		    (dev->dvb_type == DVB_DEVICE_DEMUX ||
+		     dev->dvb_type == DVB_DEVICE_DVR))
+			start_reading(desc);
 	}
 
-	pthread_mutex_unlock(&msg_mutex);
+	pthread_mutex_unlock(&dvb_read_mutex);
+
+	if (*token)
+		return send_data(fd, "%i%s%i%s", seq, cmd, uid, token);
 
 	ret = uid;
 error:
@@ -858,42 +1442,117 @@ error:
 
 static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 {
-	struct dvb_open_descriptor *open_dev;
-	int uid, ret, i;
+	struct dvb_descriptors *desc;
+	int uid, ret;
 
 	ret = scan_data(buf, size, "%i",  &uid);
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
-	if (!open_dev) {
+	pthread_mutex_lock(&dvb_read_mutex);
+	desc = __get_desc(uid);
+	if (!desc || desc->client_fd != fd) {
+		pthread_mutex_unlock(&dvb_read_mutex);
 		err("Can't find uid to close");
 		ret = -1;
 		goto error;
 	}
+	free_desc(desc);
+	pthread_mutex_unlock(&dvb_read_mutex);
+
+error:
+	return send_data(fd, "%i%s%i", seq, cmd, ret);
+}
+
+/*
+ * Called on a new connection, turning it into the data channel for an
+ * already opened demux/DVR. On success, the connection is owned by the
+ * descriptor, and no more commands are read from it.
+ */
+static int dev_attach_data(uint32_t seq, char *cmd, int fd,
+			   char *buf, ssize_t size)
+{
+	struct dvb_descriptors *desc;
+	struct dvb_dev_list *dev;
+	int uid, ret, bufsize;
+	char token[REMOTE_BUF_SIZE];
+
+	ret = scan_data(buf, size, "%i%s",  &uid, token);
+	if (ret < 0)
+		goto error;
 
-	/* Delete fd from the opened array */
+	/*
+	 * Keep the lock until the channel is set, as the descriptor may
+	 * be closed meanwhile, or attached by another connection.
+	 */
 	pthread_mutex_lock(&dvb_read_mutex);
-	for (i = 0; i < numfds; i++) {
-		if (fds[i].fd != open_dev->fd)
-		    continue;
-		if (i < numfds - 1)
-			memmove(&fds[i], &fds[i + 1],
-				sizeof(*fds)*(numfds - i - 1));
-		numfds--;
-		break;
+
+	desc = __get_desc(uid);
+	if (!desc) {
+		ret = -1;
+		err("Can't find uid to attach data");
+		goto error_unlock;
 	}
-	pthread_mutex_unlock(&dvb_read_mutex);
-	if (read_id && !numfds) {
-		pthread_cancel(read_id);
-		read_id = 0;
+
+	/* Only the client that opened the descriptor knows its token */
+	if (!desc->token[0] || strcmp(desc->token, token)) {
+		ret = -EPERM;
+		err("Wrong token to attach data to #%d", uid);
+		goto error_unlock;
+	}
+
+	dev = desc->open_dev->dev;
+	if (dev->dvb_type != DVB_DEVICE_DEMUX &&
+	    dev->dvb_type != DVB_DEVICE_DVR) {
+		ret = -EINVAL;
+		goto error_unlock;
+	}
+	if (desc->data_fd >= 0) {
+		ret = -EBUSY;
+		goto error_unlock;
+	}
+
+	/*
+	 * The reply should arrive before any data. Sending doesn't block,
+	 * so it can be done with the lock hold.
+	 */
+	ret = send_data(fd, "%i%s%i", seq, cmd, 0);
+	if (ret < 0) {
+		pthread_mutex_unlock(&dvb_read_mutex);
+		return ret;
+	}
+
+	/* The socket should hold a few reads, as the client may be slow */
+	bufsize = REMOTE_BUF_SIZE * 8;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+		       (void *)&bufsize, (int)sizeof(bufsize)))
+		dbg("Failed to set a large buffer size");
+
+	/* Data is sent from the read_data() thread, which can't block */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+		local_perror("fcntl");
+
+	if (pipe2(desc->pipefd, O_CLOEXEC) < 0) {
+		desc->pipefd[0] = desc->pipefd[1] = -1;
+		if (verbose)
+			dbg("#%d: can't create pipe, splice disabled", uid);
 	}
 
-	dvb_dev_close(open_dev);
-	destroy_open_dev(uid);
+	desc->data_fd = fd;
+	desc->token[0] = '\0';
+	start_reading(desc);
+	pthread_mutex_unlock(&dvb_read_mutex);
+
+	if (verbose)
+		dbg("#%d: data channel on socket %d", uid, fd);
+
+	return ret;
 
+error_unlock:
+	pthread_mutex_unlock(&dvb_read_mutex);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	send_data(fd, "%i%s%i", seq, cmd, ret);
+	return -1;
 }
 
 static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
@@ -1312,6 +1971,7 @@ struct method_types {
 	char *name;
 	method_handler handler;
 	int locks_dvb;
+	int takes_fd;
 };
 
 static const struct method_types methods[] = {
@@ -1322,6 +1982,7 @@ static const struct method_types methods[] = {
 	{"dev_get_dev_info", &dev_get_dev_info, 0},
 	{"dev_open", &dev_open, 0},
 	{"dev_close", &dev_close, 0},
+	{"dev_attach_data", &dev_attach_data, 0, 1},
 	{"dev_dmx_stop", &dev_dmx_stop, 0},
 	{"dev_set_bufsize", &dev_set_bufsize, 0},
 	{"dev_dmx_set_pesfilter", &dev_dmx_set_pesfilter, 0},
@@ -1341,7 +2002,7 @@ static const struct method_types methods[] = {
 static void *start_server(void *fd_pointer)
 {
 	const struct method_types *method;
-	int fd = *(int *)fd_pointer, ret, flag = 1;
+	int fd = (intptr_t)fd_pointer, ret, flag = 1;
 	char buf[REMOTE_BUF_SIZE + 8], cmd[CMD_SIZE], *p;
 	ssize_t size;
 	uint32_t seq;
@@ -1364,6 +2025,12 @@ static void *start_server(void *fd_pointer)
 
 	/* Command dispatcher */
 	do {
+		/* Don't take new commands while the replies aren't read */
+		pthread_mutex_lock(&msg_mutex);
+		while (__queued(fd) >= MAX_CMD_QUEUED)
+			pthread_cond_wait(&queue_cond, &msg_mutex);
+		pthread_mutex_unlock(&msg_mutex);
+
 		size = recv(fd, buf, 4, MSG_WAITALL);
 		if (size <= 0)
 			break;
@@ -1406,6 +2073,9 @@ static void *start_server(void *fd_pointer)
 						break;
 					if (method->locks_dvb)
 						dvb_fd = fd;
+					/* The socket now belongs to someone else */
+					if (method->takes_fd)
+						return NULL;
 					break;
 				}
 				send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
@@ -1425,13 +2095,13 @@ static void *start_server(void *fd_pointer)
 	if (verbose)
 		dbg("Closing socket %d", fd);
 
+	/* Release the devices opened by this client, before fd gets reused */
+	close_client_devs(fd);
+	if (fd == dvb_fd)
+		dvb_fd = -1;
+
+	drop_queue(fd);
 	close(fd);
-	if (read_id) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
-	if (dvb_fd > 0)
-		close_all_devs();
 
 	return NULL;
 }
@@ -1446,6 +2116,7 @@ int main(int argc, char *argv[])
 	int sockfd;
 	socklen_t addrlen;
 	struct sockaddr_in serv_addr, cli_addr;
+	sigset_t sigmask;
 
 #ifdef ENABLE_NLS
 	setlocale (LC_ALL, "");
@@ -1502,6 +2173,39 @@ int main(int argc, char *argv[])
 	start_signal_handler();
 	pthread_mutex_init(&msg_mutex, NULL);
 	pthread_mutex_init(&dvb_read_mutex, NULL);
+	pthread_cond_init(&queue_cond, NULL);
+
+	/*
+	 * Start the event loop that reads from the devices. SIGUSR1 is
+	 * blocked on all threads, and handled there, to show statistics.
+	 */
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		local_perror("epoll_create1");
+		goto error;
+	}
+
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+	signal_fd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+	if (signal_fd >= 0) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = signal_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0)
+			local_perror("epoll_ctl");
+	} else {
+		local_perror("signalfd");
+	}
+
+	ret = pthread_create(&read_id, NULL, read_data, NULL);
+	if (ret) {
+		local_perror("pthread_create");
+		goto error;
+	}
 
 	/* Accept actual connection from the client */
 
@@ -1529,7 +2233,7 @@ int main(int argc, char *argv[])
 
 		if (verbose)
 			dbg("accepted connection %d", fd);
-		ret = pthread_create(&id, NULL, start_server, (void *)&fd);
+		ret = pthread_create(&id, NULL, start_server, (void *)(intptr_t)fd);
 		if (ret < 0) {
 			local_perror("pthread_create");
 			break;
@@ -27,17 +27,21 @@
 /*
  * Use a buffer big enough at least 1 second of data. It is interesting
  * To have it multiple of a page. So, define it as a multiply of
- * 4096.
+ * 4096. Can be changed with --buffer-size.
  */
 #define DVB_BUF_SIZE	(4096 * 8 * 188)
 
 /*
  * Size of the buffer on read operations. The better is if it is
  * smaller than DVB_BUF_SIZE, as we want to give more time for
- * write() syscalls to be able to flush data.
+ * write() syscalls to be able to flush data. Can be changed, when
+ * recording, with --chunk-size.
  */
 #define BUFLEN (188 * 512)
 
+/* Alignment of the buffer and of the writes, with O_DIRECT */
+#define DIRECT_IO_ALIGN	4096
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,6 +50,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <argp.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -97,6 +102,8 @@ struct arguments {
 	unsigned traffic_monitor, low_traffic, non_human, port;
 	char *search, *server;
 	const char *cc;
+	unsigned buf_size, chunk_size, zero_copy, direct_io;
+	unsigned dvr_buf_size;	/* 0 keeps the Kernel default */
 
 	/* Used by status print */
 	unsigned n_status_lines;
@@ -131,6 +138,10 @@ static const struct argp_option options[] = {
 	{"server",	'H', N_("SERVER"),		0, N_("dvbv5-daemon host IP address"), 0},
 	{"tcp-port",	'T', N_("PORT"),		0, N_("dvbv5-daemon host tcp port"), 0},
 	{"dvr-pipe",	'D', N_("PIPE"),		0, N_("Named pipe for DVR output, when using remote access (by default: /tmp/dvr-pipe)"), 0},
+	{"buffer-size",	'B', N_("bytes"),		0, N_("size of the demux buffers (default 6160384 bytes)"), 0},
+	{"chunk-size",	'k', N_("bytes"),		0, N_("amount of data moved at once when recording (default 96256 bytes)"), 0},
+	{"zero-copy",	'Z', NULL,			0, N_("record using splice(), without copying the data to user space"), 0},
+	{"direct-io",	'O', NULL,			0, N_("record using O_DIRECT writes, bypassing the page cache"), 0},
 	{"help",        '?', 0,				0, N_("Give this help list"), -1},
 	{"usage",	-3,  0,				0, N_("Give a short usage message")},
 	{"version",	-4,  0,				0, N_("Print program version"), -1},
@@ -554,64 +565,240 @@ static struct timespec *elapsed_time(struct timespec *start)
 	return &elapsed;
 }
 
+struct rec_stats {
+	long long int bytes;
+	unsigned overruns;
+	struct timespec start;
+	int started;
+};
+
+static void rec_overrun(struct rec_stats *st)
+{
+	struct timespec *elapsed;
+
+	st->overruns++;
+	elapsed = elapsed_time(&st->start);
+	if (!elapsed)
+		fprintf(stderr, _("buffer overrun at %lld\n"), st->bytes);
+	else
+		fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+			(long long)elapsed->tv_sec,
+			elapsed->tv_nsec / 10000000);
+}
+
+/*
+ * It takes a while for a DVB device to start streaming, as the
+ * hardware may be waiting for some locks. The safest way to
+ * ensure that a program record will have the start amount of
+ * time specified by the user is to restart the timeout alarm
+ * here, after the first succeded read.
+ *
+ * So, let's reset the start time here.
+ */
+static void rec_start(struct rec_stats *st, int timeout)
+{
+	if (st->started)
+		return;
+
+	if (timeout > 0)
+		alarm(timeout);
+
+	clock_gettime(CLOCK_MONOTONIC, &st->start);
+	st->started = 1;
+}
+
+/*
+ * Moves the data from the DVR to the file inside the Kernel, through a
+ * pipe, or directly, if the output is a pipe. Returns -EINVAL if the DVR
+ * device doesn't support splice(), before moving any data.
+ */
+static int splice_to_file(int in_fd, int out_fd, struct arguments *args,
+			  struct rec_stats *st)
+{
+	int pipe_fd[2] = { -1, -1 }, to_fd = out_fd;
+	unsigned flags = SPLICE_F_MOVE | SPLICE_F_MORE;
+	struct stat sb;
+	ssize_t r, w;
+	int ret = 0;
+
+	if (fstat(out_fd, &sb) < 0 || !S_ISFIFO(sb.st_mode)) {
+		if (pipe2(pipe_fd, O_CLOEXEC) < 0) {
+			PERROR(_("pipe creation failed"));
+			return -errno;
+		}
+		fcntl(pipe_fd[1], F_SETPIPE_SZ, args->chunk_size);
+		to_fd = pipe_fd[1];
+	}
+
+	while (timeout_flag == 0) {
+		r = splice(in_fd, NULL, to_fd, NULL, args->chunk_size, flags);
+		if (r < 0) {
+			if (errno == EOVERFLOW) {
+				rec_overrun(st);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if ((errno == EINVAL || errno == ENOSYS) && !st->started) {
+				ret = -EINVAL;
+				break;
+			}
+			PERROR(_("Read failed"));
+			ret = -errno;
+			break;
+		}
+		if (!r)
+			break;
+
+		rec_start(st, args->timeout);
+
+		if (to_fd == out_fd) {
+			st->bytes += r;
+			continue;
+		}
+		while (r > 0) {
+			w = splice(pipe_fd[0], NULL, out_fd, NULL, r, flags);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				PERROR(_("Write failed"));
+				ret = -errno;
+				goto out;
+			}
+			r -= w;
+			st->bytes += w;
+		}
+	}
+
+out:
+	if (pipe_fd[0] >= 0) {
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+	}
+	return ret;
+}
+
+/*
+ * With O_DIRECT (direct != 0), a short write may leave the rest of the
+ * buffer, and the file offset, unaligned, which write() refuses with
+ * EINVAL. The rest is then written with O_DIRECT cleared. As buf holds
+ * whole blocks, the offset is aligned again at the end, so O_DIRECT is
+ * restored afterwards.
+ */
+static int write_all(int fd, const char *buf, size_t len, int direct)
+{
+	int ret = 0, flags = -1;
+	ssize_t w;
+
+	while (len) {
+		w = write(fd, buf, len);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+		buf += w;
+		len -= w;
+
+		if (direct && len && flags < 0 && (w & (DIRECT_IO_ALIGN - 1))) {
+			flags = fcntl(fd, F_GETFL);
+			if (flags >= 0)
+				fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+		}
+	}
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags);
+	return ret;
+}
+
 static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
-			 int timeout, int silent)
+			 struct arguments *args)
 {
-	char buf[BUFLEN];
-	int r, first = 1;
-	long long int rc = 0LL;
-	struct timespec start, *elapsed;
+	struct rec_stats st = {};
+	struct timespec *elapsed;
+	size_t size = args->chunk_size, fill = 0;
+	char *buf;
+	int r, fd;
+
+	/* Initialize start time, due to -EOVERFLOW before the first read */
+	clock_gettime(CLOCK_MONOTONIC, &st.start);
+
+	if (args->zero_copy) {
+		fd = dvb_dev_get_fd(in_fd);
+		if (fd < 0) {
+			fprintf(stderr, _("zero copy is only available for local devices\n"));
+		} else {
+			if (splice_to_file(fd, out_fd, args, &st) != -EINVAL)
+				goto done;
+			fprintf(stderr, _("the DVR device doesn't support splice(), using read()\n"));
+		}
+	}
 
-	/* Initialize start time, due to -EOVERFLOW with first == 1 */
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	/*
+	 * With O_DIRECT, only full blocks are written, from an aligned
+	 * buffer: the data is accumulated there, until it is full.
+	 */
+	if (args->direct_io)
+		size = (size + DIRECT_IO_ALIGN - 1) & ~(DIRECT_IO_ALIGN - 1);
+	if (posix_memalign((void **)&buf, DIRECT_IO_ALIGN, size)) {
+		ERROR("Can't allocate a %zu bytes buffer", size);
+		return;
+	}
 
 	while (timeout_flag == 0) {
-		r = dvb_dev_read(in_fd, buf, sizeof(buf));
+		r = dvb_dev_read(in_fd, buf + fill, size - fill);
 		if (r < 0) {
 			if (r == -EOVERFLOW) {
-				elapsed = elapsed_time(&start);
-				if (!elapsed)
-					fprintf(stderr, _("buffer overrun at %lld\n"), rc);
-				else
-					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
-						(long long)elapsed->tv_sec,
-						elapsed->tv_nsec / 10000000);
+				rec_overrun(&st);
 				continue;
 			}
 			ERROR("Read failed");
 			break;
 		}
 
-		/*
-		 * It takes a while for a DVB device to start streaming, as the
-		 * hardware may be waiting for some locks. The safest way to
-		 * ensure that a program record will have the start amount of
-		 * time specified by the user is to restart the timeout alarm
-		 * here, after the first succeded read.
-		 *
-		 * So, let's reset the start time here.
-		 */
-		if (first) {
-			if (timeout > 0)
-				alarm(timeout);
+		rec_start(&st, args->timeout);
 
-			clock_gettime(CLOCK_MONOTONIC, &start);
-			first = 0;
+		if (args->direct_io) {
+			fill += r;
+			if (fill < size)
+				continue;
+			r = fill;
+			fill = 0;
 		}
 
-		if (write(out_fd, buf, r) < 0) {
+		if (write_all(out_fd, buf, r, args->direct_io) < 0) {
 			PERROR(_("Write failed"));
 			break;
 		}
 
-		rc += r;
+		st.bytes += r;
 	}
-	if (silent < 2) {
-		if (timeout)
-			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
-				rc / (1024 * timeout));
+
+	/* What's left isn't a full block: write it without O_DIRECT */
+	if (fill) {
+		fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) & ~O_DIRECT);
+		if (write_all(out_fd, buf, fill, 0) < 0)
+			PERROR(_("Write failed"));
 		else
-			fprintf(stderr, _("received %lld bytes\n"), rc);
+			st.bytes += fill;
+	}
+	free(buf);
+
+done:
+	if (args->silent < 2) {
+		elapsed = st.started ? elapsed_time(&st.start) : NULL;
+		if (elapsed && (elapsed->tv_sec || elapsed->tv_nsec)) {
+			double secs = elapsed->tv_sec +
+				      elapsed->tv_nsec * 1. / NANO_SECONDS_IN_SEC;
+
+			fprintf(stderr, _("received %lld bytes in %.2f seconds (%.0f Kbytes/sec)\n"),
+				st.bytes, secs, st.bytes / (1024 * secs));
+		} else {
+			fprintf(stderr, _("received %lld bytes\n"), st.bytes);
+		}
+		if (st.overruns)
+			fprintf(stderr, _("%u buffer overruns\n"), st.overruns);
 	}
 }
 
@@ -718,6 +905,19 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'D':
 		args->dvr_pipe = strdup(optarg);
 		break;
+	case 'B':
+		args->buf_size = strtoul(optarg, NULL, 0);
+		args->dvr_buf_size = args->buf_size;
+		break;
+	case 'k':
+		args->chunk_size = strtoul(optarg, NULL, 0);
+		break;
+	case 'Z':
+		args->zero_copy = 1;
+		break;
+	case 'O':
+		args->direct_io = 1;
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -784,8 +984,8 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	if (!dvr_fd)
 		return -1;
 
-	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), DVB_BUF_SIZE);
-	dvb_dev_set_bufsize(dvr_fd, DVB_BUF_SIZE);
+	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), args->buf_size);
+	dvb_dev_set_bufsize(dvr_fd, args->buf_size);
 
 	fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
 	if (!fd) {
@@ -1062,12 +1262,19 @@ int main(int argc, char **argv)
 	args.input_format = FILE_DVBV5;
 	args.dvr_pipe = default_dvr_pipe;
 	args.low_traffic = 1;
+	args.buf_size = DVB_BUF_SIZE;
+	args.chunk_size = BUFLEN;
 
 	if (argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, &idx, &args)) {
 		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
 		return -1;
 	}
 
+	if (args.buf_size < 188 || args.chunk_size < 188) {
+		ERROR("buffer and chunk sizes should be at least one TS packet (188 bytes)");
+		return -1;
+	}
+
 	if (idx < argc)
 		channel = argv[idx];
 
@@ -1271,8 +1478,8 @@ int main(int argc, char **argv)
 		if (args.silent < 2)
 			fprintf(stderr, _("  dvb_set_pesfilter %d\n"), vpid);
 
-		fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), DVB_BUF_SIZE);
-		dvb_dev_set_bufsize(video_fd, DVB_BUF_SIZE);
+		fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), args.buf_size);
+		dvb_dev_set_bufsize(video_fd, args.buf_size);
 
 		if (vpid == 0x2000) {
 			if (dvb_dev_dmx_set_pesfilter(video_fd, vpid, DMX_PES_OTHER,
@@ -1321,15 +1528,27 @@ int main(int argc, char **argv)
 			file_fd = STDOUT_FILENO;
 
 			if (strcmp(args.filename, "-") != 0) {
-				file_fd = open(args.filename,
-					 O_LARGEFILE |
-					 O_WRONLY | O_CREAT | O_TRUNC,
-					 0644);
+				int flags = O_LARGEFILE | O_WRONLY | O_CREAT | O_TRUNC;
+
+				file_fd = -1;
+				if (args.direct_io) {
+					file_fd = open(args.filename,
+						       flags | O_DIRECT, 0644);
+					if (file_fd < 0 && errno == EINVAL)
+						fprintf(stderr, _("'%s' doesn't support O_DIRECT\n"),
+							args.filename);
+				}
+				if (file_fd < 0) {
+					args.direct_io = 0;
+					file_fd = open(args.filename, flags, 0644);
+				}
 				if (file_fd < 0) {
 					PERROR(_("open of '%s' failed"),
 					       args.filename);
 					return -1;
 				}
+			} else {
+				args.direct_io = 0;
 			}
 		}
 
@@ -1342,9 +1561,11 @@ int main(int argc, char **argv)
 				ERROR("failed opening '%s'", args.dvr_dev);
 				goto err;
 			}
+			if (args.dvr_buf_size)
+				dvb_dev_set_bufsize(dvr_fd, args.dvr_buf_size);
 			if (!timeout_flag)
 				fprintf(stderr, _("Record to file '%s' started\n"), args.filename);
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			copy_to_file(dvr_fd, file_fd, &args);
 		} else if (args.server && args.port) {
 			struct stat st;
 			if (stat(args.dvr_pipe, &st) == -1) {
@@ -1383,7 +1604,7 @@ int main(int argc, char **argv)
 				err = -1;
 				goto err;
 			}
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			copy_to_file(dvr_fd, file_fd, &args);
 		} else {
 			if (!timeout_flag)
 				fprintf(stderr, _("DVR interface '%s' can now be opened\n"), args.dvr_fname);
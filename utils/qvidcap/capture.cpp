@@ -20,6 +20,7 @@
 #include <QtCore/QSocketNotifier>
 #include <QtMath>
 #include <QTimer>
+#include <QThread>
 #include <QApplication>
 
 #include <netinet/in.h>
@@ -799,11 +800,13 @@ void CaptureWin::setModeSocket(int socket, int port)
 	m_sock = socket;
 	m_port = port;
 	if (m_ctx)
-		free(m_ctx);
+		fwht_free(m_ctx);
 	m_ctx = fwht_alloc(m_v4l_fmt.g_pixelformat(), m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			   m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			   m_v4l_fmt.g_field(), m_v4l_fmt.g_colorspace(), m_v4l_fmt.g_xfer_func(),
 			   m_v4l_fmt.g_ycbcr_enc(), m_v4l_fmt.g_quantization());
+	if (m_ctx)
+		fwht_set_threads(m_ctx, QThread::idealThreadCount());
 
 	QSocketNotifier *readSock = new QSocketNotifier(m_sock,
 		QSocketNotifier::Read, this);
@@ -1187,7 +1190,7 @@ void CaptureWin::listenForNewConnection()
 		::close(sock_fd);
 	}
 	if (m_ctx)
-		free(m_ctx);
+		fwht_free(m_ctx);
 	m_ctx = fwht_alloc(fmt.g_pixelformat(), fmt.g_width(), fmt.g_height(),
 			   fmt.g_width(), fmt.g_height(),
 			   fmt.g_field(), fmt.g_colorspace(), fmt.g_xfer_func(),
@@ -355,6 +355,10 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 		fprintf(stderr, "could not accept\n");
 		std::exit(EXIT_FAILURE);
 	}
+	if (v4l_stream_send_caps(sock_fd, V4L_STREAM_CAPS)) {
+		fprintf(stderr, "could not send the capabilities\n");
+		std::exit(EXIT_FAILURE);
+	}
 	if (read_u32(sock_fd) != V4L_STREAM_ID) {
 		fprintf(stderr, "unknown protocol ID\n");
 		std::exit(EXIT_FAILURE);
@@ -31,6 +31,6 @@ SOURCES += ../common/v4l2-tpg-colors.c
 LIBS += -L$$PWD/../../lib/libv4l2/.libs -lv4l2
 LIBS += -L$$PWD/../../lib/libv4lconvert/.libs -lv4lconvert
 LIBS += -L$$PWD/../libv4l2util/.libs -lv4l2util
-LIBS += -lrt -ldl -ljpeg
+LIBS += -lrt -ldl -ljpeg -lpthread
 
 RESOURCES += qvidcap.qrc
@@ -12,6 +12,8 @@
 #include <linux/string.h>
 #include <linux/kernel.h>
 #include <linux/videodev2.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "codec-fwht.h"
 
 #define OVERFLOW_BIT BIT(14)
@@ -22,6 +24,7 @@
  * never occur in the rlc output.
  */
 #define PFRAME_BIT BIT(15)
+#define MOTION_BIT BIT(13)
 #define DUPS_MASK 0x1ffe
 
 #define PBLOCK 0
@@ -29,6 +32,35 @@
 
 #define ALL_ZEROS 15
 
+/*
+ * The transforms and the quantization work on FWHT_LANES blocks at once,
+ * each block in its own vector lane: blk[i] holds the coefficient i of all
+ * the blocks. All the arithmetic is done modulo 2^16, which gives the same
+ * result as the 32 bit workspace of the scalar version truncated to the
+ * 16 bits of the coefficients.
+ *
+ * The functions working on a single block of a group get a pointer to its
+ * first coefficient, the next ones are FWHT_LANES values apart.
+ */
+#define FWHT_LANES 8
+
+typedef u16 fwht_u16v __attribute__((vector_size(2 * FWHT_LANES)));
+typedef s16 fwht_s16v __attribute__((vector_size(2 * FWHT_LANES)));
+
+#define LANE(blk, lane) ((u16 *)(blk) + (lane))
+
+/*
+ * Motion vectors are stored as a 16 bit value: dy in the high byte, dx
+ * times 2 in the low byte, so that bit 0 stays 0. A zero vector is never
+ * stored.
+ */
+#define MV(dx, dy) ((u16)((u8)(dy) << 8 | (u8)((dx) * 2)))
+#define MV_DX(mv) ((int8_t)((mv) & 0xff) / 2)
+#define MV_DY(mv) ((int8_t)((mv) >> 8))
+
+/* Below that SAD, a P-block isn't worth a motion search */
+#define MOTION_MIN_SAD 64
+
 static const uint8_t zigzag[64] = {
 	0,
 	1,  8,
@@ -47,46 +79,50 @@ static const uint8_t zigzag[64] = {
 	63,
 };
 
+/* Number of trailing zeros of each block, in zigzag order */
+static fwht_s16v trailing_zeros(const fwht_u16v *blk)
+{
+	fwht_s16v last = { 0 };
+	int i;
+
+	/* Index of the last non-zero coefficient, plus one */
+	for (i = 0; i < 8 * 8; i++) {
+		fwht_s16v nonzero = (fwht_s16v)(blk[zigzag[i]] != 0);
+
+		last = (last & ~nonzero) | (nonzero & (s16)(i + 1));
+	}
+	return 8 * 8 - last;
+}
+
 /*
  * noinline_for_stack to work around
  * https://bugs.llvm.org/show_bug.cgi?id=38809
  */
 static int noinline_for_stack
-rlc(const s16 *in, __be16 *output, int blocktype)
+rlc(const u16 *in, __be16 *output, int blocktype, int lastzero_run, u16 mv)
 {
-	s16 block[8 * 8];
-	s16 *wp = block;
 	int i = 0;
-	int x, y;
 	int ret = 0;
-
-	/* read in block from framebuffer */
-	int lastzero_run = 0;
 	int to_encode;
 
-	for (y = 0; y < 8; y++) {
-		for (x = 0; x < 8; x++) {
-			*wp = in[x + y * 8];
-			wp++;
-		}
+	if (blocktype == PBLOCK && mv) {
+		*output++ = htons(PFRAME_BIT | MOTION_BIT);
+		*output++ = htons(mv);
+		ret += 2;
+	} else {
+		*output++ = (blocktype == PBLOCK ? htons(PFRAME_BIT) : 0);
+		ret++;
 	}
 
-	/* keep track of amount of trailing zeros */
-	for (i = 63; i >= 0 && !block[zigzag[i]]; i--)
-		lastzero_run++;
-
-	*output++ = (blocktype == PBLOCK ? htons(PFRAME_BIT) : 0);
-	ret++;
-
 	to_encode = 8 * 8 - (lastzero_run > 14 ? lastzero_run : 0);
 
 	i = 0;
 	while (i < to_encode) {
 		int cnt = 0;
-		int tmp;
+		u16 tmp;
 
 		/* count leading zeros */
-		while ((tmp = block[zigzag[i]]) == 0 && cnt < 14) {
+		while ((tmp = in[zigzag[i] * FWHT_LANES]) == 0 && cnt < 14) {
 			cnt++;
 			i++;
 			if (i == to_encode) {
@@ -108,11 +144,14 @@ rlc(const s16 *in, __be16 *output, int blocktype)
 }
 
 /*
- * This function will worst-case increase rlc_in by 65*2 bytes:
- * one s16 value for the header and 8 * 8 coefficients of type s16.
+ * This function will worst-case increase rlc_in by 66*2 bytes:
+ * one s16 value for the header, one for the motion vector and
+ * 8 * 8 coefficients of type s16. The motion vector is 0 if there
+ * is none.
  */
 static noinline_for_stack u16
-derlc(const __be16 **rlc_in, s16 *dwht_out, const __be16 *end_of_input)
+derlc(const __be16 **rlc_in, u16 *dwht_out, const __be16 *end_of_input,
+      u16 *mv)
 {
 	/* header */
 	const __be16 *input = *rlc_in;
@@ -125,6 +164,12 @@ derlc(const __be16 **rlc_in, s16 *dwht_out, const __be16 *end_of_input)
 	if (input > end_of_input)
 		return OVERFLOW_BIT;
 	stat = ntohs(*input++);
+	*mv = 0;
+	if (stat & MOTION_BIT) {
+		if (input > end_of_input)
+			return OVERFLOW_BIT;
+		*mv = ntohs(*input++);
+	}
 
 	/*
 	 * Now de-compress, it expands one byte to up to 15 bytes
@@ -165,7 +210,7 @@ derlc(const __be16 **rlc_in, s16 *dwht_out, const __be16 *end_of_input)
 		int y = pos / 8;
 		int x = pos % 8;
 
-		dwht_out[x + y * 8] = *wp++;
+		dwht_out[(x + y * 8) * FWHT_LANES] = *wp++;
 	}
 	*rlc_in = input;
 	return stat;
@@ -193,385 +238,120 @@ static const int quant_table_p[] = {
 	3, 3, 3, 6, 6, 9,  9,  10,
 };
 
-static void quantize_intra(s16 *coeff, s16 *de_coeff, u16 qp)
+static inline void fwht_butterfly(fwht_u16v *p, unsigned int s)
 {
-	const int *quant = quant_table;
-	int i, j;
+	fwht_u16v workspace1[8], workspace2[8];
 
-	for (j = 0; j < 8; j++) {
-		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
-			*coeff >>= *quant;
-			if (*coeff >= -qp && *coeff <= qp)
-				*coeff = *de_coeff = 0;
-			else
-				*de_coeff = *coeff << *quant;
-		}
-	}
+	/* stage 1 */
+	workspace1[0]  = p[0] + p[1 * s];
+	workspace1[1]  = p[0] - p[1 * s];
+
+	workspace1[2]  = p[2 * s] + p[3 * s];
+	workspace1[3]  = p[2 * s] - p[3 * s];
+
+	workspace1[4]  = p[4 * s] + p[5 * s];
+	workspace1[5]  = p[4 * s] - p[5 * s];
+
+	workspace1[6]  = p[6 * s] + p[7 * s];
+	workspace1[7]  = p[6 * s] - p[7 * s];
+
+	/* stage 2 */
+	workspace2[0] = workspace1[0] + workspace1[2];
+	workspace2[1] = workspace1[0] - workspace1[2];
+	workspace2[2] = workspace1[1] - workspace1[3];
+	workspace2[3] = workspace1[1] + workspace1[3];
+
+	workspace2[4] = workspace1[4] + workspace1[6];
+	workspace2[5] = workspace1[4] - workspace1[6];
+	workspace2[6] = workspace1[5] - workspace1[7];
+	workspace2[7] = workspace1[5] + workspace1[7];
+
+	/* stage 3 */
+	p[0 * s] = workspace2[0] + workspace2[4];
+	p[1 * s] = workspace2[0] - workspace2[4];
+	p[2 * s] = workspace2[1] - workspace2[5];
+	p[3 * s] = workspace2[1] + workspace2[5];
+	p[4 * s] = workspace2[2] + workspace2[6];
+	p[5 * s] = workspace2[2] - workspace2[6];
+	p[6 * s] = workspace2[3] - workspace2[7];
+	p[7 * s] = workspace2[3] + workspace2[7];
 }
 
-static void dequantize_intra(s16 *coeff)
+/*
+ * 8x8 Walsh Hadamard transform, in place. The transform is its own inverse,
+ * up to a 1/64 scale factor, applied by ifwht_finish().
+ *
+ * Intra blocks are loaded with 128 subtracted from each pixel, P-blocks
+ * with their deltas against the reference.
+ */
+static void fwht(fwht_u16v *blk)
 {
-	const int *quant = quant_table;
-	int i, j;
+	unsigned int i;
 
-	for (j = 0; j < 8; j++)
-		for (i = 0; i < 8; i++, quant++, coeff++)
-			*coeff <<= *quant;
+	for (i = 0; i < 8; i++)
+		fwht_butterfly(blk + 8 * i, 1);
+	for (i = 0; i < 8; i++)
+		fwht_butterfly(blk + i, 8);
 }
 
-static void quantize_inter(s16 *coeff, s16 *de_coeff, u16 qp)
+/* Scaling of the inverse transform: lanes of P-blocks are set at pmask */
+static void ifwht_finish(fwht_u16v *blk, fwht_s16v pmask)
 {
-	const int *quant = quant_table_p;
-	int i, j;
+	fwht_u16v add = (fwht_u16v)(~pmask & 128);
+	unsigned int i;
 
-	for (j = 0; j < 8; j++) {
-		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
-			*coeff >>= *quant;
-			if (*coeff >= -qp && *coeff <= qp)
-				*coeff = *de_coeff = 0;
-			else
-				*de_coeff = *coeff << *quant;
-		}
-	}
+	for (i = 0; i < 8 * 8; i++)
+		blk[i] = (fwht_u16v)((fwht_s16v)blk[i] >> 6) + add;
 }
 
-static void dequantize_inter(s16 *coeff)
+static void quantize(fwht_u16v *coeff, fwht_u16v *de_coeff, fwht_s16v pmask,
+		     u16 i_frame_qp, u16 p_frame_qp)
 {
-	const int *quant = quant_table_p;
-	int i, j;
+	fwht_s16v qp;
+	unsigned int i;
 
-	for (j = 0; j < 8; j++)
-		for (i = 0; i < 8; i++, quant++, coeff++)
-			*coeff <<= *quant;
+	if (i_frame_qp > 0x7fff)
+		i_frame_qp = 0x7fff;
+	if (p_frame_qp > 0x7fff)
+		p_frame_qp = 0x7fff;
+	qp = (pmask & (s16)p_frame_qp) | (~pmask & (s16)i_frame_qp);
+
+	for (i = 0; i < 8 * 8; i++) {
+		fwht_s16v c = (fwht_s16v)coeff[i];
+		fwht_s16v zero;
+
+		c = ((c >> quant_table[i]) & ~pmask) |
+		    ((c >> quant_table_p[i]) & pmask);
+		zero = (c >= -qp) & (c <= qp);
+		coeff[i] = (fwht_u16v)(c & ~zero);
+		de_coeff[i] = ((coeff[i] << quant_table[i]) & (fwht_u16v)~pmask) |
+			      ((coeff[i] << quant_table_p[i]) & (fwht_u16v)pmask);
+	}
 }
 
-static void noinline_for_stack fwht(const u8 *block, s16 *output_block,
-				    unsigned int stride,
-				    unsigned int input_step, bool intra)
+static void dequantize(fwht_u16v *coeff, fwht_s16v pmask)
 {
-	/* we'll need more than 8 bits for the transformed coefficients */
-	s32 workspace1[8], workspace2[8];
-	const u8 *tmp = block;
-	s16 *out = output_block;
-	int add = intra ? 256 : 0;
 	unsigned int i;
 
-	/* stage 1 */
-	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
-		switch (input_step) {
-		case 1:
-			workspace1[0]  = tmp[0] + tmp[1] - add;
-			workspace1[1]  = tmp[0] - tmp[1];
-
-			workspace1[2]  = tmp[2] + tmp[3] - add;
-			workspace1[3]  = tmp[2] - tmp[3];
-
-			workspace1[4]  = tmp[4] + tmp[5] - add;
-			workspace1[5]  = tmp[4] - tmp[5];
-
-			workspace1[6]  = tmp[6] + tmp[7] - add;
-			workspace1[7]  = tmp[6] - tmp[7];
-			break;
-		case 2:
-			workspace1[0]  = tmp[0] + tmp[2] - add;
-			workspace1[1]  = tmp[0] - tmp[2];
-
-			workspace1[2]  = tmp[4] + tmp[6] - add;
-			workspace1[3]  = tmp[4] - tmp[6];
-
-			workspace1[4]  = tmp[8] + tmp[10] - add;
-			workspace1[5]  = tmp[8] - tmp[10];
-
-			workspace1[6]  = tmp[12] + tmp[14] - add;
-			workspace1[7]  = tmp[12] - tmp[14];
-			break;
-		case 3:
-			workspace1[0]  = tmp[0] + tmp[3] - add;
-			workspace1[1]  = tmp[0] - tmp[3];
-
-			workspace1[2]  = tmp[6] + tmp[9] - add;
-			workspace1[3]  = tmp[6] - tmp[9];
-
-			workspace1[4]  = tmp[12] + tmp[15] - add;
-			workspace1[5]  = tmp[12] - tmp[15];
-
-			workspace1[6]  = tmp[18] + tmp[21] - add;
-			workspace1[7]  = tmp[18] - tmp[21];
-			break;
-		default:
-			workspace1[0]  = tmp[0] + tmp[4] - add;
-			workspace1[1]  = tmp[0] - tmp[4];
-
-			workspace1[2]  = tmp[8] + tmp[12] - add;
-			workspace1[3]  = tmp[8] - tmp[12];
-
-			workspace1[4]  = tmp[16] + tmp[20] - add;
-			workspace1[5]  = tmp[16] - tmp[20];
-
-			workspace1[6]  = tmp[24] + tmp[28] - add;
-			workspace1[7]  = tmp[24] - tmp[28];
-			break;
-		}
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
-
-		/* stage 3 */
-		out[0] = workspace2[0] + workspace2[4];
-		out[1] = workspace2[0] - workspace2[4];
-		out[2] = workspace2[1] - workspace2[5];
-		out[3] = workspace2[1] + workspace2[5];
-		out[4] = workspace2[2] + workspace2[6];
-		out[5] = workspace2[2] - workspace2[6];
-		out[6] = workspace2[3] - workspace2[7];
-		out[7] = workspace2[3] + workspace2[7];
-	}
-
-	out = output_block;
-
-	for (i = 0; i < 8; i++, out++) {
-		/* stage 1 */
-		workspace1[0]  = out[0] + out[1 * 8];
-		workspace1[1]  = out[0] - out[1 * 8];
-
-		workspace1[2]  = out[2 * 8] + out[3 * 8];
-		workspace1[3]  = out[2 * 8] - out[3 * 8];
-
-		workspace1[4]  = out[4 * 8] + out[5 * 8];
-		workspace1[5]  = out[4 * 8] - out[5 * 8];
-
-		workspace1[6]  = out[6 * 8] + out[7 * 8];
-		workspace1[7]  = out[6 * 8] - out[7 * 8];
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
-		/* stage 3 */
-		out[0 * 8] = workspace2[0] + workspace2[4];
-		out[1 * 8] = workspace2[0] - workspace2[4];
-		out[2 * 8] = workspace2[1] - workspace2[5];
-		out[3 * 8] = workspace2[1] + workspace2[5];
-		out[4 * 8] = workspace2[2] + workspace2[6];
-		out[5 * 8] = workspace2[2] - workspace2[6];
-		out[6 * 8] = workspace2[3] - workspace2[7];
-		out[7 * 8] = workspace2[3] + workspace2[7];
-	}
+	for (i = 0; i < 8 * 8; i++)
+		coeff[i] = ((coeff[i] << quant_table[i]) & (fwht_u16v)~pmask) |
+			   ((coeff[i] << quant_table_p[i]) & (fwht_u16v)pmask);
 }
 
-/*
- * Not the nicest way of doing it, but P-blocks get twice the range of
- * that of the I-blocks. Therefore we need a type bigger than 8 bits.
- * Furthermore values can be negative... This is just a version that
- * works with 16 signed data
- */
-static void noinline_for_stack
-fwht16(const s16 *block, s16 *output_block, int stride, int intra)
+static void lane_load(u16 *lane, const s16 *block)
 {
-	/* we'll need more than 8 bits for the transformed coefficients */
-	s32 workspace1[8], workspace2[8];
-	const s16 *tmp = block;
-	s16 *out = output_block;
-	int i;
-
-	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
-		/* stage 1 */
-		workspace1[0]  = tmp[0] + tmp[1];
-		workspace1[1]  = tmp[0] - tmp[1];
-
-		workspace1[2]  = tmp[2] + tmp[3];
-		workspace1[3]  = tmp[2] - tmp[3];
-
-		workspace1[4]  = tmp[4] + tmp[5];
-		workspace1[5]  = tmp[4] - tmp[5];
-
-		workspace1[6]  = tmp[6] + tmp[7];
-		workspace1[7]  = tmp[6] - tmp[7];
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
-
-		/* stage 3 */
-		out[0] = workspace2[0] + workspace2[4];
-		out[1] = workspace2[0] - workspace2[4];
-		out[2] = workspace2[1] - workspace2[5];
-		out[3] = workspace2[1] + workspace2[5];
-		out[4] = workspace2[2] + workspace2[6];
-		out[5] = workspace2[2] - workspace2[6];
-		out[6] = workspace2[3] - workspace2[7];
-		out[7] = workspace2[3] + workspace2[7];
-	}
-
-	out = output_block;
-
-	for (i = 0; i < 8; i++, out++) {
-		/* stage 1 */
-		workspace1[0]  = out[0] + out[1*8];
-		workspace1[1]  = out[0] - out[1*8];
-
-		workspace1[2]  = out[2*8] + out[3*8];
-		workspace1[3]  = out[2*8] - out[3*8];
-
-		workspace1[4]  = out[4*8] + out[5*8];
-		workspace1[5]  = out[4*8] - out[5*8];
-
-		workspace1[6]  = out[6*8] + out[7*8];
-		workspace1[7]  = out[6*8] - out[7*8];
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
+	unsigned int i;
 
-		/* stage 3 */
-		out[0*8] = workspace2[0] + workspace2[4];
-		out[1*8] = workspace2[0] - workspace2[4];
-		out[2*8] = workspace2[1] - workspace2[5];
-		out[3*8] = workspace2[1] + workspace2[5];
-		out[4*8] = workspace2[2] + workspace2[6];
-		out[5*8] = workspace2[2] - workspace2[6];
-		out[6*8] = workspace2[3] - workspace2[7];
-		out[7*8] = workspace2[3] + workspace2[7];
-	}
+	for (i = 0; i < 8 * 8; i++)
+		lane[i * FWHT_LANES] = block[i];
 }
 
-static noinline_for_stack void
-ifwht(const s16 *block, s16 *output_block, int intra)
+static void lane_store(const u16 *lane, s16 *block)
 {
-	/*
-	 * we'll need more than 8 bits for the transformed coefficients
-	 * use native unit of cpu
-	 */
-	int workspace1[8], workspace2[8];
-	int inter = intra ? 0 : 1;
-	const s16 *tmp = block;
-	s16 *out = output_block;
-	int i;
+	unsigned int i;
 
-	for (i = 0; i < 8; i++, tmp += 8, out += 8) {
-		/* stage 1 */
-		workspace1[0]  = tmp[0] + tmp[1];
-		workspace1[1]  = tmp[0] - tmp[1];
-
-		workspace1[2]  = tmp[2] + tmp[3];
-		workspace1[3]  = tmp[2] - tmp[3];
-
-		workspace1[4]  = tmp[4] + tmp[5];
-		workspace1[5]  = tmp[4] - tmp[5];
-
-		workspace1[6]  = tmp[6] + tmp[7];
-		workspace1[7]  = tmp[6] - tmp[7];
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
-
-		/* stage 3 */
-		out[0] = workspace2[0] + workspace2[4];
-		out[1] = workspace2[0] - workspace2[4];
-		out[2] = workspace2[1] - workspace2[5];
-		out[3] = workspace2[1] + workspace2[5];
-		out[4] = workspace2[2] + workspace2[6];
-		out[5] = workspace2[2] - workspace2[6];
-		out[6] = workspace2[3] - workspace2[7];
-		out[7] = workspace2[3] + workspace2[7];
-	}
-
-	out = output_block;
-
-	for (i = 0; i < 8; i++, out++) {
-		/* stage 1 */
-		workspace1[0]  = out[0] + out[1 * 8];
-		workspace1[1]  = out[0] - out[1 * 8];
-
-		workspace1[2]  = out[2 * 8] + out[3 * 8];
-		workspace1[3]  = out[2 * 8] - out[3 * 8];
-
-		workspace1[4]  = out[4 * 8] + out[5 * 8];
-		workspace1[5]  = out[4 * 8] - out[5 * 8];
-
-		workspace1[6]  = out[6 * 8] + out[7 * 8];
-		workspace1[7]  = out[6 * 8] - out[7 * 8];
-
-		/* stage 2 */
-		workspace2[0] = workspace1[0] + workspace1[2];
-		workspace2[1] = workspace1[0] - workspace1[2];
-		workspace2[2] = workspace1[1] - workspace1[3];
-		workspace2[3] = workspace1[1] + workspace1[3];
-
-		workspace2[4] = workspace1[4] + workspace1[6];
-		workspace2[5] = workspace1[4] - workspace1[6];
-		workspace2[6] = workspace1[5] - workspace1[7];
-		workspace2[7] = workspace1[5] + workspace1[7];
-
-		/* stage 3 */
-		if (inter) {
-			int d;
-
-			out[0 * 8] = workspace2[0] + workspace2[4];
-			out[1 * 8] = workspace2[0] - workspace2[4];
-			out[2 * 8] = workspace2[1] - workspace2[5];
-			out[3 * 8] = workspace2[1] + workspace2[5];
-			out[4 * 8] = workspace2[2] + workspace2[6];
-			out[5 * 8] = workspace2[2] - workspace2[6];
-			out[6 * 8] = workspace2[3] - workspace2[7];
-			out[7 * 8] = workspace2[3] + workspace2[7];
-
-			for (d = 0; d < 8; d++)
-				out[8 * d] >>= 6;
-		} else {
-			int d;
-
-			out[0 * 8] = workspace2[0] + workspace2[4];
-			out[1 * 8] = workspace2[0] - workspace2[4];
-			out[2 * 8] = workspace2[1] - workspace2[5];
-			out[3 * 8] = workspace2[1] + workspace2[5];
-			out[4 * 8] = workspace2[2] + workspace2[6];
-			out[5 * 8] = workspace2[2] - workspace2[6];
-			out[6 * 8] = workspace2[3] - workspace2[7];
-			out[7 * 8] = workspace2[3] + workspace2[7];
-
-			for (d = 0; d < 8; d++) {
-				out[8 * d] >>= 6;
-				out[8 * d] += 128;
-			}
-		}
-	}
+	for (i = 0; i < 8 * 8; i++)
+		block[i] = lane[i * FWHT_LANES];
 }
 
 static void fill_encoder_block(const u8 *input, s16 *dst,
@@ -640,140 +420,709 @@ decide_blocktype(const u8 *cur, const u8 *reference, s16 *deltablock,
 	return vari <= vard ? IBLOCK : PBLOCK;
 }
 
-static void fill_decoder_block(u8 *dst, const s16 *input, int stride,
+static void fill_decoder_block(u8 *dst, const u16 *input, int stride,
 			       unsigned int dst_step)
 {
 	int i, j;
 
 	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++, input++, dst += dst_step) {
-			if (*input < 0)
+		for (j = 0; j < 8; j++, input += FWHT_LANES, dst += dst_step) {
+			s16 v = *input;
+
+			if (v < 0)
 				*dst = 0;
-			else if (*input > 255)
+			else if (v > 255)
 				*dst = 255;
 			else
-				*dst = *input;
+				*dst = v;
 		}
 		dst += stride - (8 * dst_step);
 	}
 }
 
-static void add_deltas(s16 *deltas, const u8 *ref, int stride,
+static void add_deltas(u16 *deltas, const u8 *ref, int stride,
 		       unsigned int ref_step)
 {
 	int k, l;
 
 	for (k = 0; k < 8; k++) {
 		for (l = 0; l < 8; l++) {
-			*deltas += *ref;
+			s16 v = *deltas + *ref;
+
 			ref += ref_step;
 			/*
 			 * Due to quantizing, it might possible that the
 			 * decoded coefficients are slightly out of range
 			 */
-			if (*deltas < 0)
-				*deltas = 0;
-			else if (*deltas > 255)
-				*deltas = 255;
-			deltas++;
+			if (v < 0)
+				v = 0;
+			else if (v > 255)
+				v = 255;
+			*deltas = v;
+			deltas += FWHT_LANES;
 		}
 		ref += stride - (8 * ref_step);
 	}
 }
 
-static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
-			struct fwht_cframe *cf, u32 height, u32 width,
-			u32 stride, unsigned int input_step,
-			bool is_intra, bool next_is_intra)
+/*
+ * A plane of the frame. The encoder reads it from src and keeps its
+ * reconstruction at refp, one 8x8 block after the other. The decoder
+ * writes it to dst, adding the deltas of the P-blocks to ref.
+ *
+ * For the motion search, the encoder also has a copy of refp at mref,
+ * row after row, width bytes per row. The motion vectors only point to
+ * blocks within the visible part of the plane, which is all the decoder
+ * has in its reference.
+ */
+struct fwht_plane {
+	u8 *src;
+	u8 *refp;
+	const u8 *mref;
+	const u8 *ref;
+	u8 *dst;
+	unsigned int width, height;
+	unsigned int visible_width, visible_height;
+	unsigned int size;
+	unsigned int stride, step;
+	unsigned int ref_stride, ref_step;
+	bool uncompressed;
+	u32 *row_sizes;
+	const __be16 **row_start;
+};
+
+/* Sum of the absolute differences of the rows of a block with cur */
+static int block_sad(const fwht_s16v *cur, const u8 *ref, unsigned int stride)
 {
-	u8 *input_start = input;
-	__be16 *rlco_start = *rlco;
-	s16 deltablock[64];
-	__be16 pframe_bit = htons(PFRAME_BIT);
-	u32 encoding = 0;
-	unsigned int last_size = 0;
-	unsigned int i, j;
+	fwht_s16v sum = { 0 };
+	int ret = 0;
+	unsigned int k;
 
-	width = round_up(width, 8);
-	height = round_up(height, 8);
-
-	for (j = 0; j < height / 8; j++) {
-		input = input_start + j * 8 * stride;
-		for (i = 0; i < width / 8; i++) {
-			/* intra code, first frame is always intra coded. */
-			int blocktype = IBLOCK;
-			unsigned int size;
-
-			if (!is_intra)
-				blocktype = decide_blocktype(input, refp,
-					deltablock, stride, input_step);
-			if (blocktype == IBLOCK) {
-				fwht(input, cf->coeffs, stride, input_step, 1);
-				quantize_intra(cf->coeffs, cf->de_coeffs,
-					       cf->i_frame_qp);
-			} else {
-				/* inter code */
-				encoding |= FWHT_FRAME_PCODED;
-				fwht16(deltablock, cf->coeffs, 8, 0);
-				quantize_inter(cf->coeffs, cf->de_coeffs,
-					       cf->p_frame_qp);
-			}
-			if (!next_is_intra) {
-				ifwht(cf->de_coeffs, cf->de_fwht, blocktype);
+	for (k = 0; k < 8; k++, ref += stride) {
+		fwht_s16v r = {
+			ref[0], ref[1], ref[2], ref[3],
+			ref[4], ref[5], ref[6], ref[7]
+		};
+		fwht_s16v d = cur[k] - r;
+		fwht_s16v sign = d >> 15;
+
+		sum += (d ^ sign) - sign;
+	}
+	for (k = 0; k < 8; k++)
+		ret += sum[k];
+	return ret;
+}
 
-				if (blocktype == PBLOCK)
-					add_deltas(cf->de_fwht, refp, 8, 1);
-				fill_decoder_block(refp, cf->de_fwht, 8, 1);
+/*
+ * Looks for the block of the reference closest to cur, the block at (x, y),
+ * within range pixels. sad is the SAD of the block at the same position.
+ * Returns the SAD of the best match, and sets mv if it isn't that block.
+ */
+static int motion_search(const struct fwht_plane *p, int range,
+			 int x, int y, const s16 *cur, int sad, u16 *mv)
+{
+	int x0 = x - range, x1 = x + range;
+	int y0 = y - range, y1 = y + range;
+	fwht_s16v rows[8];
+	int dx, dy;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 > (int)p->visible_width - 8)
+		x1 = p->visible_width - 8;
+	if (y1 > (int)p->visible_height - 8)
+		y1 = p->visible_height - 8;
+
+	memcpy(rows, cur, sizeof(rows));
+	for (dy = y0; dy <= y1; dy++) {
+		for (dx = x0; dx <= x1; dx++) {
+			int s;
+
+			if (dx == x && dy == y)
+				continue;
+			s = block_sad(rows, p->mref + dy * p->width + dx,
+				      p->width);
+			if (s < sad) {
+				sad = s;
+				*mv = MV(dx - x, dy - y);
 			}
+		}
+	}
+	return sad;
+}
 
-			input += 8 * input_step;
-			refp += 8 * 8;
+/* decide_blocktype(), with a motion search for the P-blocks */
+static noinline_for_stack int
+decide_blocktype_motion(const struct fwht_plane *p, int range, int x, int y,
+			const u8 *refp, s16 *deltablock, u16 *mv)
+{
+	s16 tmp[64];
+	s16 old[64];
+	const u8 *ref = refp;
+	unsigned int ref_stride = 8;
+	unsigned int k, l;
+	int vari;
+	int vard;
+
+	fill_encoder_block(p->src + y * p->stride + x * p->step, tmp,
+			   p->stride, p->step);
+	fill_encoder_block(refp, old, 8, 1);
+	vari = var_intra(tmp);
+	vard = var_inter(old, tmp);
+	*mv = 0;
+	if (vard >= MOTION_MIN_SAD && vari > MOTION_MIN_SAD)
+		vard = motion_search(p, range, x, y, tmp, vard, mv);
+	if (vari <= vard) {
+		*mv = 0;
+		return IBLOCK;
+	}
 
-			size = rlc(cf->coeffs, *rlco, blocktype);
-			if (last_size == size &&
-			    !memcmp(*rlco + 1, *rlco - size + 1, 2 * size - 2)) {
-				__be16 *last_rlco = *rlco - size;
-				s16 hdr = ntohs(*last_rlco);
+	if (*mv) {
+		ref = p->mref + (y + MV_DY(*mv)) * (int)p->width +
+		      x + MV_DX(*mv);
+		ref_stride = p->width;
+	}
+	for (k = 0; k < 8; k++, ref += ref_stride)
+		for (l = 0; l < 8; l++)
+			*deltablock++ = tmp[k * 8 + l] - ref[l];
+	return PBLOCK;
+}
+
+/*
+ * Encodes the n blocks of a row of blocks of a plane starting at block
+ * (i, j), into the lanes of coeffs, and updates their reference.
+ */
+static void encode_block_group(const struct fwht_cframe *cf,
+			       const struct fwht_plane *p,
+			       unsigned int i, unsigned int j, unsigned int n,
+			       bool is_intra, bool next_is_intra,
+			       fwht_u16v *coeffs, int *blocktype, u16 *mv)
+{
+	unsigned int stride = p->stride, input_step = p->step;
+	const u8 *input = p->src + j * 8 * stride + i * 8 * input_step;
+	u8 *refp = p->refp + (j * p->width / 8 + i) * 8 * 8;
+	fwht_u16v de_coeffs[8 * 8];
+	fwht_s16v pmask = { 0 };
+	s16 block[8 * 8];
+	unsigned int l, k;
+
+	for (l = 0; l < n; l++, input += 8 * input_step, refp += 8 * 8) {
+		/* intra code, first frame is always intra coded. */
+		blocktype[l] = IBLOCK;
+		mv[l] = 0;
+		if (!is_intra && p->mref)
+			blocktype[l] = decide_blocktype_motion(p, cf->motion_range,
+							       (i + l) * 8, j * 8,
+							       refp, block,
+							       &mv[l]);
+		else if (!is_intra)
+			blocktype[l] = decide_blocktype(input, refp, block,
+							stride, input_step);
+		if (blocktype[l] == IBLOCK) {
+			fill_encoder_block(input, block, stride, input_step);
+			for (k = 0; k < 8 * 8; k++)
+				block[k] -= 128;
+		} else {
+			pmask[l] = -1;
+		}
+		lane_load(LANE(coeffs, l), block);
+	}
 
-				if (!((*last_rlco ^ **rlco) & pframe_bit) &&
-				    (hdr & DUPS_MASK) < DUPS_MASK)
-					*last_rlco = htons(hdr + 2);
-				else
+	fwht(coeffs);
+	quantize(coeffs, de_coeffs, pmask, cf->i_frame_qp, cf->p_frame_qp);
+	if (next_is_intra)
+		return;
+
+	fwht(de_coeffs);
+	ifwht_finish(de_coeffs, pmask);
+	refp -= n * 8 * 8;
+	for (l = 0; l < n; l++, refp += 8 * 8) {
+		int x = (i + l) * 8 + MV_DX(mv[l]);
+		int y = j * 8 + MV_DY(mv[l]);
+
+		if (blocktype[l] == PBLOCK && mv[l])
+			add_deltas(LANE(de_coeffs, l),
+				   p->mref + y * (int)p->width + x, p->width, 1);
+		else if (blocktype[l] == PBLOCK)
+			add_deltas(LANE(de_coeffs, l), refp, 8, 1);
+		fill_decoder_block(refp, LANE(de_coeffs, l), 8, 1);
+	}
+}
+
+/*
+ * Encodes the macroblock rows [first_row, last_row) of a plane. If row_sizes
+ * is given, the macroblocks are never repeated across rows, so that each
+ * row can be decoded on its own, and the size of each row is stored there.
+ */
+static u32 encode_rows(const struct fwht_cframe *cf,
+		       const struct fwht_plane *p,
+		       unsigned int first_row, unsigned int last_row,
+		       __be16 **rlco, __be16 *rlco_max, u32 *row_sizes,
+		       bool is_intra, bool next_is_intra)
+{
+	unsigned int blocks_per_row = p->width / 8;
+	fwht_u16v coeffs[8 * 8] = { { 0 } };
+	int blocktype[FWHT_LANES];
+	u16 mv[FWHT_LANES];
+	fwht_s16v zeros;
+	__be16 pframe_bit = htons(PFRAME_BIT | MOTION_BIT);
+	u32 encoding = 0;
+	unsigned int last_size = 0;
+	unsigned int i, j, l, n;
+
+	for (j = first_row; j < last_row; j++) {
+		__be16 *row_start = *rlco;
+
+		if (row_sizes)
+			last_size = 0;
+		for (i = 0; i < blocks_per_row; i += n) {
+			n = blocks_per_row - i;
+			if (n > FWHT_LANES)
+				n = FWHT_LANES;
+			encode_block_group(cf, p, i, j, n, is_intra,
+					   next_is_intra, coeffs, blocktype, mv);
+			zeros = trailing_zeros(coeffs);
+
+			for (l = 0; l < n; l++) {
+				unsigned int size;
+
+				if (blocktype[l] == PBLOCK)
+					encoding |= FWHT_FRAME_PCODED;
+				if (mv[l])
+					encoding |= FWHT_FRAME_MOTION;
+				size = rlc(LANE(coeffs, l), *rlco, blocktype[l],
+					   zeros[l], mv[l]);
+				if (last_size == size &&
+				    !memcmp(*rlco + 1, *rlco - size + 1, 2 * size - 2)) {
+					__be16 *last_rlco = *rlco - size;
+					s16 hdr = ntohs(*last_rlco);
+
+					if (!((*last_rlco ^ **rlco) & pframe_bit) &&
+					    (hdr & DUPS_MASK) < DUPS_MASK)
+						*last_rlco = htons(hdr + 2);
+					else
+						*rlco += size;
+				} else {
 					*rlco += size;
-			} else {
-				*rlco += size;
+				}
+				if (*rlco >= rlco_max)
+					return encoding | FWHT_FRAME_UNENCODED;
+				last_size = size;
 			}
-			if (*rlco >= rlco_max) {
-				encoding |= FWHT_FRAME_UNENCODED;
-				goto exit_loop;
-			}
-			last_size = size;
 		}
+		if (row_sizes)
+			row_sizes[j] = (*rlco - row_start) * sizeof(**rlco);
 	}
+	return encoding;
+}
 
-exit_loop:
-	if (encoding & FWHT_FRAME_UNENCODED) {
-		u8 *out = (u8 *)rlco_start;
-		u8 *p;
-
-		input = input_start;
-		/*
-		 * The compressed stream should never contain the magic
-		 * header, so when we copy the YUV data we replace 0xff
-		 * by 0xfe. Since YUV is limited range such values
-		 * shouldn't appear anyway.
-		 */
-		for (j = 0; j < height; j++) {
-			for (i = 0, p = input; i < width; i++, p += input_step)
-				*out++ = (*p == 0xff) ? 0xfe : *p;
-			input += stride;
+/*
+ * Stores a plane uncompressed. The reference then gets the same pixels
+ * as the decoder, so that the next P-frame is coded against them.
+ */
+static __be16 *encode_plane_raw(const struct fwht_plane *p, __be16 *rlco,
+				bool next_is_intra)
+{
+	unsigned int blocks_per_row = p->width / 8;
+	u8 *out = (u8 *)rlco;
+	const u8 *input = p->src;
+	const u8 *s;
+	unsigned int i, j;
+
+	/*
+	 * The compressed stream should never contain the magic
+	 * header, so when we copy the YUV data we replace 0xff
+	 * by 0xfe. Since YUV is limited range such values
+	 * shouldn't appear anyway.
+	 */
+	for (j = 0; j < p->height; j++) {
+		u8 *refp = p->refp + (j / 8) * blocks_per_row * 8 * 8 +
+			   (j % 8) * 8;
+
+		for (i = 0, s = input; i < p->width; i++, s += p->step) {
+			*out = (*s == 0xff) ? 0xfe : *s;
+			if (!next_is_intra)
+				refp[(i / 8) * 8 * 8 + i % 8] = *out;
+			out++;
 		}
-		*rlco = (__be16 *)out;
-		encoding &= ~FWHT_FRAME_PCODED;
+		input += p->stride;
+	}
+	return (__be16 *)out;
+}
+
+static u32 encode_plane(const struct fwht_cframe *cf,
+			const struct fwht_plane *p, __be16 **rlco,
+			bool is_intra, bool next_is_intra)
+{
+	__be16 *rlco_start = *rlco;
+	__be16 *rlco_max = *rlco + p->size / 2 - 256;
+	u32 encoding;
+
+	encoding = encode_rows(cf, p, 0, p->height / 8, rlco, rlco_max, NULL,
+			       is_intra, next_is_intra);
+	if (encoding & FWHT_FRAME_UNENCODED) {
+		*rlco = encode_plane_raw(p, rlco_start, next_is_intra);
+		encoding &= ~(FWHT_FRAME_PCODED | FWHT_FRAME_MOTION);
 	}
 	return encoding;
 }
 
+#define FWHT_MAX_THREADS 16
+
+static const u32 plane_unencoded[] = {
+	FWHT_LUMA_UNENCODED, FWHT_CB_UNENCODED,
+	FWHT_CR_UNENCODED, FWHT_ALPHA_UNENCODED
+};
+
+/*
+ * The macroblock rows of the planes are split in units of work, which the
+ * threads pick in turn.
+ */
+struct fwht_unit {
+	struct fwht_plane *plane;
+	unsigned int first_row, last_row;
+	__be16 *out, *out_end;
+	const __be16 *in, *in_end;
+	u32 encoding;
+	bool ok;
+};
+
+struct fwht_job {
+	void (*work)(struct fwht_job *job, struct fwht_unit *unit);
+	const struct fwht_cframe *cf;
+	bool is_intra, next_is_intra;
+	struct fwht_unit *units;
+	unsigned int num_units;
+	unsigned int next_unit;
+};
+
+static void *fwht_job_thread(void *arg)
+{
+	struct fwht_job *job = arg;
+	unsigned int u;
+
+	while ((u = __atomic_fetch_add(&job->next_unit, 1, __ATOMIC_RELAXED)) <
+	       job->num_units)
+		job->work(job, &job->units[u]);
+	return NULL;
+}
+
+/*
+ * The threads of a pool wait for the jobs of the frames, and each of them
+ * joins every job, so that they are all done with a job when it returns.
+ */
+struct fwht_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct fwht_job *job;
+	unsigned int generation;
+	unsigned int finished;
+	bool stop;
+	/* The calling thread is one of them */
+	unsigned int threads;
+	unsigned int started;
+	pthread_t thread[FWHT_MAX_THREADS];
+};
+
+static void *fwht_pool_thread(void *arg)
+{
+	struct fwht_pool *pool = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct fwht_job *job;
+
+		while (!pool->stop && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->stop)
+			break;
+		generation = pool->generation;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		fwht_job_thread(job);
+
+		pthread_mutex_lock(&pool->lock);
+		if (++pool->finished == pool->started)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct fwht_pool *fwht_pool_create(unsigned int threads)
+{
+	struct fwht_pool *pool = calloc(1, sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+	if (threads > FWHT_MAX_THREADS)
+		threads = FWHT_MAX_THREADS;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	while (pool->started + 1 < threads &&
+	       !pthread_create(&pool->thread[pool->started], NULL,
+			       fwht_pool_thread, pool))
+		pool->started++;
+	pool->threads = pool->started + 1;
+	return pool;
+}
+
+void fwht_pool_free(struct fwht_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->started; i++)
+		pthread_join(pool->thread[i], NULL);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static void fwht_job_run(struct fwht_job *job, struct fwht_pool *pool)
+{
+	job->next_unit = 0;
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->generation++;
+	pool->finished = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* The calling thread does its share of the work */
+	fwht_job_thread(job);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->finished < pool->started)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Splits the rows of the compressed planes in units, a few per thread, so
+ * that the threads end at about the same time. There is at most a unit
+ * per row.
+ */
+static unsigned int fwht_split_rows(struct fwht_plane *planes,
+				    unsigned int num_planes,
+				    unsigned int threads,
+				    struct fwht_unit *units)
+{
+	unsigned int rows = 0, chunk, num_units = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < num_planes; i++)
+		if (!planes[i].uncompressed)
+			rows += planes[i].height / 8;
+	chunk = rows / (threads * 4);
+	if (!chunk)
+		chunk = 1;
+
+	for (i = 0; i < num_planes; i++) {
+		if (planes[i].uncompressed)
+			continue;
+		for (j = 0; j < planes[i].height / 8; j += chunk) {
+			struct fwht_unit *unit = &units[num_units++];
+
+			memset(unit, 0, sizeof(*unit));
+			unit->plane = &planes[i];
+			unit->first_row = j;
+			unit->last_row = j + chunk;
+			if (unit->last_row > planes[i].height / 8)
+				unit->last_row = planes[i].height / 8;
+		}
+	}
+	return num_units;
+}
+
+static void encode_unit(struct fwht_job *job, struct fwht_unit *unit)
+{
+	const struct fwht_plane *p = unit->plane;
+	unsigned int blocks = (unit->last_row - unit->first_row) * p->width / 8;
+	unsigned int max = p->size / 2 - 256;
+	__be16 *rlco = unit->out;
+
+	/* Stop once the plane is known to end up uncompressed */
+	if (max > blocks * 66)
+		max = blocks * 66;
+	unit->encoding = encode_rows(job->cf, p, unit->first_row,
+				     unit->last_row, &rlco, unit->out + max,
+				     p->row_sizes, job->is_intra,
+				     job->next_is_intra);
+	unit->out_end = rlco;
+}
+
+/*
+ * Encodes the rows of the planes in parallel, each unit of rows to its own
+ * buffer, then puts them together, followed by the row index if it fits.
+ * Returns false if there is not enough memory for that.
+ */
+static bool encode_planes_threaded(struct fwht_cframe *cf,
+				   struct fwht_plane *planes,
+				   unsigned int num_planes,
+				   bool is_intra, bool next_is_intra,
+				   u32 *encoding)
+{
+	struct fwht_job job = {
+		.work = encode_unit,
+		.cf = cf,
+		.is_intra = is_intra,
+		.next_is_intra = next_is_intra,
+	};
+	unsigned int rows = 0, index_rows = 0, blocks = 0, raw_size = 0;
+	__be16 *rlco = cf->rlc_data;
+	__be16 *scratch;
+	u32 *row_sizes;
+	unsigned int i, j, u;
+
+	for (i = 0; i < num_planes; i++) {
+		rows += planes[i].height / 8;
+		blocks += planes[i].height / 8 * planes[i].width / 8;
+		raw_size += planes[i].width * planes[i].height;
+	}
+	job.units = malloc(rows * sizeof(*job.units));
+	row_sizes = malloc(rows * sizeof(*row_sizes));
+	/* 66 words per block at most, and the overshoot of a block per unit */
+	scratch = malloc((blocks + rows) * 66 * sizeof(*scratch));
+	if (!job.units || !row_sizes || !scratch) {
+		free(job.units);
+		free(row_sizes);
+		free(scratch);
+		return false;
+	}
+
+	for (i = 0, j = 0; i < num_planes; i++) {
+		planes[i].uncompressed = false;
+		planes[i].row_sizes = row_sizes + j;
+		j += planes[i].height / 8;
+	}
+	job.num_units = fwht_split_rows(planes, num_planes, cf->pool->threads,
+					job.units);
+	for (u = 0, blocks = 0; u < job.num_units; u++) {
+		struct fwht_unit *unit = &job.units[u];
+
+		unit->out = scratch + (blocks + u) * 66;
+		blocks += (unit->last_row - unit->first_row) *
+			  unit->plane->width / 8;
+	}
+	fwht_job_run(&job, cf->pool);
+
+	*encoding = 0;
+	for (i = 0, u = 0; i < num_planes; i++) {
+		struct fwht_plane *p = &planes[i];
+		unsigned int first_unit = u;
+		u32 plane_encoding = 0;
+		unsigned int size = 0;
+
+		for (; u < job.num_units && job.units[u].plane == p; u++) {
+			plane_encoding |= job.units[u].encoding;
+			size += job.units[u].out_end - job.units[u].out;
+		}
+		if (size >= p->size / 2 - 256)
+			plane_encoding |= FWHT_FRAME_UNENCODED;
+
+		if (plane_encoding & FWHT_FRAME_UNENCODED) {
+			rlco = encode_plane_raw(p, rlco, next_is_intra);
+			*encoding |= plane_unencoded[i];
+			p->uncompressed = true;
+			continue;
+		}
+		*encoding |= plane_encoding;
+		index_rows += p->height / 8;
+		for (; first_unit < u; first_unit++) {
+			struct fwht_unit *unit = &job.units[first_unit];
+
+			memcpy(rlco, unit->out,
+			       (unit->out_end - unit->out) * sizeof(*rlco));
+			rlco += unit->out_end - unit->out;
+		}
+	}
+
+	/*
+	 * The row index is only worth sending if some plane is compressed,
+	 * and it must not make the frame bigger than an uncompressed one.
+	 */
+	if (index_rows &&
+	    (rlco - cf->rlc_data) * sizeof(*rlco) + index_rows * 4 + 8 <= raw_size) {
+		u8 *out = (u8 *)rlco;
+		__be32 trailer[2] = {
+			htonl(index_rows), htonl(FWHT_ROW_INDEX_MAGIC)
+		};
+
+		for (i = 0; i < num_planes; i++) {
+			if (planes[i].uncompressed)
+				continue;
+			for (j = 0; j < planes[i].height / 8; j++, out += 4) {
+				__be32 row_size = htonl(planes[i].row_sizes[j]);
+
+				memcpy(out, &row_size, 4);
+			}
+		}
+		memcpy(out, trailer, sizeof(trailer));
+		rlco = (__be16 *)(out + sizeof(trailer));
+	}
+	cf->size = (rlco - cf->rlc_data) * sizeof(*rlco);
+
+	free(scratch);
+	free(job.units);
+	free(row_sizes);
+	return true;
+}
+
+static void fwht_plane_init(struct fwht_plane *p, unsigned int width,
+			    unsigned int height)
+{
+	memset(p, 0, sizeof(*p));
+	p->size = width * height;
+	p->width = round_up(width, 8);
+	p->height = round_up(height, 8);
+	p->visible_width = width;
+	p->visible_height = height;
+}
+
+/*
+ * Copies the reference of the planes row after row, for the motion search.
+ * Returns the buffer holding the copies, or NULL if there is no memory, in
+ * which case the frame is coded without motion vectors.
+ */
+static u8 *motion_ref_alloc(struct fwht_plane *planes, unsigned int num_planes)
+{
+	unsigned int size = 0;
+	u8 *buf, *mref;
+	unsigned int i, j, k, l;
+
+	for (i = 0; i < num_planes; i++)
+		size += planes[i].width * planes[i].height;
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+
+	for (i = 0, mref = buf; i < num_planes; i++) {
+		struct fwht_plane *p = &planes[i];
+		const u8 *refp = p->refp;
+
+		p->mref = mref;
+		for (j = 0; j < p->height; j += 8, mref += 8 * p->width)
+			for (k = 0; k < p->width; k += 8, refp += 8 * 8)
+				for (l = 0; l < 8; l++)
+					memcpy(mref + l * p->width + k,
+					       refp + l * 8, 8);
+	}
+	return buf;
+}
+
 u32 fwht_encode_frame(struct fwht_raw_frame *frm,
 		      struct fwht_raw_frame *ref_frm,
 		      struct fwht_cframe *cf,
@@ -781,130 +1130,276 @@ u32 fwht_encode_frame(struct fwht_raw_frame *frm,
 		      unsigned int width, unsigned int height,
 		      unsigned int stride, unsigned int chroma_stride)
 {
-	unsigned int size = height * width;
+	struct fwht_plane planes[4];
+	unsigned int num_planes = 1;
 	__be16 *rlco = cf->rlc_data;
-	__be16 *rlco_max;
-	u32 encoding;
+	u32 encoding = 0;
+	u8 *mref = NULL;
+	unsigned int i;
 
-	rlco_max = rlco + size / 2 - 256;
-	encoding = encode_plane(frm->luma, ref_frm->luma, &rlco, rlco_max, cf,
-				height, width, stride,
-				frm->luma_alpha_step, is_intra, next_is_intra);
-	if (encoding & FWHT_FRAME_UNENCODED)
-		encoding |= FWHT_LUMA_UNENCODED;
-	encoding &= ~FWHT_FRAME_UNENCODED;
+	fwht_plane_init(&planes[0], width, height);
+	planes[0].src = frm->luma;
+	planes[0].refp = ref_frm->luma;
+	planes[0].stride = stride;
+	planes[0].step = frm->luma_alpha_step;
 
 	if (frm->components_num >= 3) {
 		u32 chroma_h = height / frm->height_div;
 		u32 chroma_w = width / frm->width_div;
-		unsigned int chroma_size = chroma_h * chroma_w;
 
-		rlco_max = rlco + chroma_size / 2 - 256;
-		encoding |= encode_plane(frm->cb, ref_frm->cb, &rlco, rlco_max,
-					 cf, chroma_h, chroma_w,
-					 chroma_stride, frm->chroma_step,
-					 is_intra, next_is_intra);
-		if (encoding & FWHT_FRAME_UNENCODED)
-			encoding |= FWHT_CB_UNENCODED;
-		encoding &= ~FWHT_FRAME_UNENCODED;
-		rlco_max = rlco + chroma_size / 2 - 256;
-		encoding |= encode_plane(frm->cr, ref_frm->cr, &rlco, rlco_max,
-					 cf, chroma_h, chroma_w,
-					 chroma_stride, frm->chroma_step,
-					 is_intra, next_is_intra);
-		if (encoding & FWHT_FRAME_UNENCODED)
-			encoding |= FWHT_CR_UNENCODED;
-		encoding &= ~FWHT_FRAME_UNENCODED;
+		for (i = 1; i < 3; i++) {
+			fwht_plane_init(&planes[i], chroma_w, chroma_h);
+			planes[i].src = i == 1 ? frm->cb : frm->cr;
+			planes[i].refp = i == 1 ? ref_frm->cb : ref_frm->cr;
+			planes[i].stride = chroma_stride;
+			planes[i].step = frm->chroma_step;
+		}
+		num_planes = 3;
 	}
 
 	if (frm->components_num == 4) {
-		rlco_max = rlco + size / 2 - 256;
-		encoding |= encode_plane(frm->alpha, ref_frm->alpha, &rlco,
-					 rlco_max, cf, height, width,
-					 stride, frm->luma_alpha_step,
+		fwht_plane_init(&planes[3], width, height);
+		planes[3].src = frm->alpha;
+		planes[3].refp = ref_frm->alpha;
+		planes[3].stride = stride;
+		planes[3].step = frm->luma_alpha_step;
+		num_planes = 4;
+	}
+
+	if (cf->motion_range > FWHT_MAX_MOTION_RANGE)
+		cf->motion_range = FWHT_MAX_MOTION_RANGE;
+	if (cf->motion_range && !is_intra)
+		mref = motion_ref_alloc(planes, num_planes);
+
+	/*
+	 * Small frames aren't worth the threads: the bound of the compressed
+	 * size of their planes is also too small to be split between them.
+	 */
+	if (cf->pool && cf->pool->threads > 1 && width * height >= 64 * 1024 &&
+	    encode_planes_threaded(cf, planes, num_planes,
+				   is_intra, next_is_intra, &encoding)) {
+		free(mref);
+		return encoding;
+	}
+
+	for (i = 0; i < num_planes; i++) {
+		encoding |= encode_plane(cf, &planes[i], &rlco,
 					 is_intra, next_is_intra);
 		if (encoding & FWHT_FRAME_UNENCODED)
-			encoding |= FWHT_ALPHA_UNENCODED;
+			encoding |= plane_unencoded[i];
 		encoding &= ~FWHT_FRAME_UNENCODED;
 	}
 
 	cf->size = (rlco - cf->rlc_data) * sizeof(*rlco);
+	free(mref);
 	return encoding;
 }
 
-static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
-			 u32 height, u32 width, const u8 *ref, u32 ref_stride,
-			 unsigned int ref_step, u8 *dst,
-			 unsigned int dst_stride, unsigned int dst_step,
-			 bool uncompressed, const __be16 *end_of_rlco_buf)
+static bool decode_rows(const struct fwht_plane *p,
+			unsigned int first_row, unsigned int last_row,
+			const __be16 **rlco, const __be16 *end_of_rlco_buf)
 {
+	unsigned int blocks_per_row = p->width / 8;
+	fwht_u16v coeffs[8 * 8] = { { 0 } };
+	bool pblock[FWHT_LANES];
+	u16 mv[FWHT_LANES] = { 0 };
 	unsigned int copies = 0;
+	bool copy_pblock = false;
+	u16 copy_mv = 0;
 	s16 copy[8 * 8];
-	u16 stat;
-	unsigned int i, j;
-	bool is_intra = !ref;
+	bool is_intra = !p->ref;
+	unsigned int i, j, l, n;
 
-	width = round_up(width, 8);
-	height = round_up(height, 8);
+	/*
+	 * When decoding each macroblock the rlco pointer will be increased
+	 * by 66 * 2 bytes worst-case.
+	 * To avoid overflow the buffer has to be 66/64th of the actual raw
+	 * image size, just in case someone feeds it malicious data.
+	 */
+	for (j = first_row; j < last_row; j++) {
+		for (i = 0; i < blocks_per_row; i += n) {
+			fwht_s16v pmask = { 0 };
+
+			n = blocks_per_row - i;
+			if (n > FWHT_LANES)
+				n = FWHT_LANES;
+
+			for (l = 0; l < n; l++) {
+				u16 stat;
+
+				if (copies) {
+					lane_load(LANE(coeffs, l), copy);
+					pblock[l] = copy_pblock;
+					mv[l] = copy_mv;
+					copies--;
+				} else {
+					stat = derlc(rlco, LANE(coeffs, l),
+						     end_of_rlco_buf, &mv[l]);
+					if (stat & OVERFLOW_BIT)
+						return false;
+					pblock[l] = (stat & PFRAME_BIT) && !is_intra;
+
+					copies = (stat & DUPS_MASK) >> 1;
+					if (copies) {
+						lane_store(LANE(coeffs, l), copy);
+						copy_pblock = pblock[l];
+						copy_mv = mv[l];
+					}
+				}
+				if (pblock[l])
+					pmask[l] = -1;
+			}
 
-	if (uncompressed) {
-		int i;
+			dequantize(coeffs, pmask);
+			fwht(coeffs);
+			ifwht_finish(coeffs, pmask);
+
+			for (l = 0; l < n; l++) {
+				int x = (i + l) * 8 + MV_DX(mv[l]);
+				int y = j * 8 + MV_DY(mv[l]);
+				u8 *dstp = p->dst + j * 8 * p->stride +
+					(i + l) * 8 * p->step;
+
+				/* Only the visible part of ref is valid */
+				if (pblock[l] && mv[l] &&
+				    (x < 0 || y < 0 ||
+				     x + 8 > (int)p->visible_width ||
+				     y + 8 > (int)p->visible_height))
+					return false;
+				if (pblock[l])
+					add_deltas(LANE(coeffs, l),
+						   p->ref + y * (int)p->ref_stride +
+						   x * (int)p->ref_step,
+						   p->ref_stride, p->ref_step);
+				fill_decoder_block(dstp, LANE(coeffs, l),
+						   p->stride, p->step);
+			}
+		}
+	}
+	return true;
+}
 
-		if (end_of_rlco_buf + 1 < *rlco + width * height / 2)
+static bool decode_plane(const struct fwht_plane *p, const __be16 **rlco,
+			 const __be16 *end_of_rlco_buf)
+{
+	unsigned int i;
+
+	if (p->uncompressed) {
+		u8 *dst = p->dst;
+
+		if (end_of_rlco_buf + 1 < *rlco + p->width * p->height / 2)
 			return false;
-		for (i = 0; i < height; i++) {
-			memcpy(dst, *rlco, width);
-			dst += dst_stride;
-			*rlco += width / 2;
+		for (i = 0; i < p->height; i++) {
+			memcpy(dst, *rlco, p->width);
+			dst += p->stride;
+			*rlco += p->width / 2;
 		}
 		return true;
 	}
+	return decode_rows(p, 0, p->height / 8, rlco, end_of_rlco_buf);
+}
 
-	/*
-	 * When decoding each macroblock the rlco pointer will be increased
-	 * by 65 * 2 bytes worst-case.
-	 * To avoid overflow the buffer has to be 65/64th of the actual raw
-	 * image size, just in case someone feeds it malicious data.
-	 */
-	for (j = 0; j < height / 8; j++) {
-		for (i = 0; i < width / 8; i++) {
-			const u8 *refp = ref + j * 8 * ref_stride +
-				i * 8 * ref_step;
-			u8 *dstp = dst + j * 8 * dst_stride + i * 8 * dst_step;
-
-			if (copies) {
-				memcpy(cf->de_fwht, copy, sizeof(copy));
-				if ((stat & PFRAME_BIT) && !is_intra)
-					add_deltas(cf->de_fwht, refp,
-						   ref_stride, ref_step);
-				fill_decoder_block(dstp, cf->de_fwht,
-						   dst_stride, dst_step);
-				copies--;
-				continue;
-			}
+static void decode_unit(struct fwht_job *job, struct fwht_unit *unit)
+{
+	const __be16 *rlco = unit->in;
 
-			stat = derlc(rlco, cf->coeffs, end_of_rlco_buf);
-			if (stat & OVERFLOW_BIT)
-				return false;
-			if ((stat & PFRAME_BIT) && !is_intra)
-				dequantize_inter(cf->coeffs);
-			else
-				dequantize_intra(cf->coeffs);
-
-			ifwht(cf->coeffs, cf->de_fwht,
-			      ((stat & PFRAME_BIT) && !is_intra) ? 0 : 1);
-
-			copies = (stat & DUPS_MASK) >> 1;
-			if (copies)
-				memcpy(copy, cf->de_fwht, sizeof(copy));
-			if ((stat & PFRAME_BIT) && !is_intra)
-				add_deltas(cf->de_fwht, refp,
-					   ref_stride, ref_step);
-			fill_decoder_block(dstp, cf->de_fwht, dst_stride,
-					   dst_step);
+	unit->ok = decode_rows(unit->plane, unit->first_row, unit->last_row,
+			       &rlco, unit->in_end);
+}
+
+/*
+ * Decodes the rows of the compressed planes in parallel, finding where
+ * each unit of rows starts from the row index. Returns false if the
+ * row index doesn't match the frame.
+ */
+static bool decode_planes_threaded(struct fwht_cframe *cf,
+				   struct fwht_plane *planes,
+				   unsigned int num_planes, bool *ok)
+{
+	struct fwht_job job = {
+		.work = decode_unit,
+		.cf = cf,
+	};
+	const __be16 *raw_start[4];
+	const __be16 **row_start;
+	const __be16 *rlco = cf->rlc_data;
+	const u8 *data_end, *index;
+	__be32 trailer[2];
+	unsigned int rows = 0;
+	unsigned int i, j, k, r, u;
+
+	for (i = 0; i < num_planes; i++)
+		if (!planes[i].uncompressed)
+			rows += planes[i].height / 8;
+	if (!rows || cf->size / 4 < rows + 2)
+		return false;
+	/* Frames without a row index don't end with it */
+	memcpy(trailer, (const u8 *)cf->rlc_data + cf->size - 8, 8);
+	if (ntohl(trailer[0]) != rows ||
+	    ntohl(trailer[1]) != FWHT_ROW_INDEX_MAGIC)
+		return false;
+	data_end = (const u8 *)cf->rlc_data + cf->size - 8 - rows * 4;
+	index = data_end;
+
+	/* The start of each row, and the end of each plane */
+	row_start = malloc((rows + num_planes) * sizeof(*row_start));
+	job.units = malloc(rows * sizeof(*job.units));
+	if (!row_start || !job.units)
+		goto fallback;
+
+	/* The rows and the uncompressed planes must fill the frame */
+	for (i = 0, r = 0, k = 0; i < num_planes; i++) {
+		if (planes[i].uncompressed) {
+			raw_start[i] = rlco;
+			if (planes[i].width * planes[i].height > data_end - (const u8 *)rlco)
+				goto fallback;
+			rlco += planes[i].width * planes[i].height / 2;
+			continue;
+		}
+		planes[i].row_start = row_start + k;
+		for (j = 0; j < planes[i].height / 8; j++, r++, k++) {
+			__be32 be_size;
+			u32 size;
+
+			memcpy(&be_size, index + r * 4, 4);
+			size = ntohl(be_size);
+			if (!size || (size & 1) || size > data_end - (const u8 *)rlco)
+				goto fallback;
+			row_start[k] = rlco;
+			rlco += size / 2;
 		}
+		row_start[k++] = rlco;
+	}
+	if ((const u8 *)rlco != data_end)
+		goto fallback;
+
+	*ok = true;
+	for (i = 0; i < num_planes; i++)
+		if (planes[i].uncompressed &&
+		    !decode_plane(&planes[i], &raw_start[i], rlco - 1))
+			*ok = false;
+
+	job.num_units = fwht_split_rows(planes, num_planes, cf->pool->threads,
+					job.units);
+	for (u = 0; u < job.num_units; u++) {
+		struct fwht_unit *unit = &job.units[u];
+
+		unit->in = unit->plane->row_start[unit->first_row];
+		unit->in_end = unit->plane->row_start[unit->last_row] - 1;
 	}
+	fwht_job_run(&job, cf->pool);
+	for (u = 0; u < job.num_units; u++)
+		if (!job.units[u].ok)
+			*ok = false;
+
+	free(row_start);
+	free(job.units);
 	return true;
+
+fallback:
+	free(row_start);
+	free(job.units);
+	return false;
 }
 
 bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
@@ -914,16 +1409,27 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		       struct fwht_raw_frame *dst, unsigned int dst_stride,
 		       unsigned int dst_chroma_stride)
 {
+	static const u32 uncompressed[] = {
+		V4L2_FWHT_FL_LUMA_IS_UNCOMPRESSED,
+		V4L2_FWHT_FL_CB_IS_UNCOMPRESSED,
+		V4L2_FWHT_FL_CR_IS_UNCOMPRESSED,
+		V4L2_FWHT_FL_ALPHA_IS_UNCOMPRESSED
+	};
 	const __be16 *rlco = cf->rlc_data;
 	const __be16 *end_of_rlco_buf = cf->rlc_data +
 			(cf->size / sizeof(*rlco)) - 1;
+	struct fwht_plane planes[4];
+	unsigned int num_planes = 1;
+	unsigned int i;
+	bool ok;
 
-	if (!decode_plane(cf, &rlco, height, width, ref->luma, ref_stride,
-			  ref->luma_alpha_step, dst->luma, dst_stride,
-			  dst->luma_alpha_step,
-			  hdr_flags & V4L2_FWHT_FL_LUMA_IS_UNCOMPRESSED,
-			  end_of_rlco_buf))
-		return false;
+	fwht_plane_init(&planes[0], width, height);
+	planes[0].ref = ref->luma;
+	planes[0].ref_stride = ref_stride;
+	planes[0].ref_step = ref->luma_alpha_step;
+	planes[0].dst = dst->luma;
+	planes[0].stride = dst_stride;
+	planes[0].step = dst->luma_alpha_step;
 
 	if (components_num >= 3) {
 		u32 h = height;
@@ -934,26 +1440,38 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		if (!(hdr_flags & V4L2_FWHT_FL_CHROMA_FULL_WIDTH))
 			w /= 2;
 
-		if (!decode_plane(cf, &rlco, h, w, ref->cb, ref_chroma_stride,
-				  ref->chroma_step, dst->cb, dst_chroma_stride,
-				  dst->chroma_step,
-				  hdr_flags & V4L2_FWHT_FL_CB_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
-			return false;
-		if (!decode_plane(cf, &rlco, h, w, ref->cr, ref_chroma_stride,
-				  ref->chroma_step, dst->cr, dst_chroma_stride,
-				  dst->chroma_step,
-				  hdr_flags & V4L2_FWHT_FL_CR_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
-			return false;
+		for (i = 1; i < 3; i++) {
+			fwht_plane_init(&planes[i], w, h);
+			planes[i].ref = i == 1 ? ref->cb : ref->cr;
+			planes[i].ref_stride = ref_chroma_stride;
+			planes[i].ref_step = ref->chroma_step;
+			planes[i].dst = i == 1 ? dst->cb : dst->cr;
+			planes[i].stride = dst_chroma_stride;
+			planes[i].step = dst->chroma_step;
+		}
+		num_planes = 3;
 	}
 
-	if (components_num == 4)
-		if (!decode_plane(cf, &rlco, height, width, ref->alpha, ref_stride,
-				  ref->luma_alpha_step, dst->alpha, dst_stride,
-				  dst->luma_alpha_step,
-				  hdr_flags & V4L2_FWHT_FL_ALPHA_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
+	if (components_num == 4) {
+		fwht_plane_init(&planes[3], width, height);
+		planes[3].ref = ref->alpha;
+		planes[3].ref_stride = ref_stride;
+		planes[3].ref_step = ref->luma_alpha_step;
+		planes[3].dst = dst->alpha;
+		planes[3].stride = dst_stride;
+		planes[3].step = dst->luma_alpha_step;
+		num_planes = 4;
+	}
+
+	for (i = 0; i < num_planes; i++)
+		planes[i].uncompressed = hdr_flags & uncompressed[i];
+
+	if (cf->pool && cf->pool->threads > 1 &&
+	    decode_planes_threaded(cf, planes, num_planes, &ok))
+		return ok;
+
+	for (i = 0; i < num_planes; i++)
+		if (!decode_plane(&planes[i], &rlco, end_of_rlco_buf))
 			return false;
 	return true;
 }
@@ -5,9 +5,18 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "v4l-stream.h"
 #include "codec-fwht.h"
@@ -60,6 +69,93 @@ unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat)
 	}
 }
 
+/*
+ * The RLE helpers below look for the runs and the magic values 4 words at a
+ * time with SSE2, and leave the remaining words to the plain C loops.
+ */
+#ifdef __SSE2__
+static inline int rle_mask(__m128i v)
+{
+	return _mm_movemask_ps(_mm_castsi128_ps(v));
+}
+
+static inline __m128i rle_load(const __u32 *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+#endif
+
+/*
+ * Returns the number of words from p, at most n - 7, which rle_compress()
+ * copies as they are: up to the first magic value or the first word
+ * followed by 3 identical ones.
+ */
+static unsigned rle_literals(const __u32 *p, unsigned n,
+			     __u32 magic_x, __u32 magic_y)
+{
+	unsigned k = 0;
+#ifdef __SSE2__
+	const __m128i mx = _mm_set1_epi32(magic_x);
+	const __m128i my = _mm_set1_epi32(magic_y);
+
+	for (; k + 8 <= n; k += 4) {
+		__m128i v = rle_load(p + k);
+		__m128i run = _mm_and_si128(_mm_cmpeq_epi32(v, rle_load(p + k + 1)),
+					    _mm_cmpeq_epi32(v, rle_load(p + k + 2)));
+		__m128i magic = _mm_or_si128(_mm_cmpeq_epi32(v, mx),
+					     _mm_cmpeq_epi32(v, my));
+		int mask;
+
+		run = _mm_and_si128(run, _mm_cmpeq_epi32(v, rle_load(p + k + 3)));
+		mask = rle_mask(_mm_or_si128(run, magic));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#endif
+	return k;
+}
+
+/* Returns the length of the run of p[0], knowing it is at least n words */
+static unsigned rle_run(const __u32 *p, unsigned n, unsigned max)
+{
+#ifdef __SSE2__
+	const __m128i v = _mm_set1_epi32(*p);
+
+	for (; n + 4 <= max; n += 4) {
+		int mask = rle_mask(_mm_cmpeq_epi32(v, rle_load(p + n)));
+
+		if (mask != 0xf)
+			return n + __builtin_ctz(~mask);
+	}
+#endif
+	while (n < max && *p == p[n])
+		n++;
+	return n;
+}
+
+/* Returns the number of words from p, at most n, before a magic value */
+static unsigned rle_find_magic(const __u32 *p, unsigned n,
+			       __u32 magic_x, __u32 magic_y)
+{
+	unsigned k = 0;
+#ifdef __SSE2__
+	const __m128i mx = _mm_set1_epi32(magic_x);
+	const __m128i my = _mm_set1_epi32(magic_y);
+
+	for (; k + 4 <= n; k += 4) {
+		__m128i v = rle_load(p + k);
+		int mask = rle_mask(_mm_or_si128(_mm_cmpeq_epi32(v, mx),
+						 _mm_cmpeq_epi32(v, my)));
+
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#endif
+	while (k < n && p[k] != magic_x && p[k] != magic_y)
+		k++;
+	return k;
+}
+
 void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 {
 	__u32 magic_x = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_X_RLE);
@@ -81,22 +177,35 @@ void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 
 	for (i = 0; i < rle_size; i += 4, p++) {
 		__u32 v = *p;
-		__u32 n = 1;
+		__u32 n;
 
-		if (bpl && v == magic_y) {
-			l = ntohl(*++p);
-			i += 4;
-			next_line = dst + bpl / 4;
-			continue;
-		}
-		if (v == magic_x) {
-			v = *++p;
-			n = ntohl(*++p);
-			i += 8;
-		}
+		/* Copy the words up to the next magic value at once */
+		n = (rle_size - i) / 4;
+		if (next_line && n > (unsigned)(next_line - dst))
+			n = next_line - dst;
+		n = rle_find_magic(p, n, magic_x, magic_y);
+		if (n) {
+			memmove(dst, p, n * 4);
+			dst += n;
+			p += n - 1;
+			i += n * 4 - 4;
+		} else {
+			n = 1;
+			if (bpl && v == magic_y) {
+				l = ntohl(*++p);
+				i += 4;
+				next_line = dst + bpl / 4;
+				continue;
+			}
+			if (v == magic_x) {
+				v = *++p;
+				n = ntohl(*++p);
+				i += 8;
+			}
 
-		while (n--)
-			*dst++ = v;
+			while (n--)
+				*dst++ = v;
+		}
 
 		if (dst == next_line) {
 			while (l--) {
@@ -146,11 +255,23 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 				continue;
 			}
 		}
+		max = bpl ? bpl * (i / bpl + 1) : size;
+
+		/* Copy the words up to the next run or magic value at once */
+		n = rle_literals(p, ((max < size ? max : size) - i) / 4,
+				 magic_x, magic_y);
+		if (n) {
+			if (dst != p)
+				memmove(dst, p, n * 4);
+			dst += n;
+			p += n;
+			i += n * 4;
+		}
+
 		if (*p == magic_x || *p == magic_y) {
 			*dst++ = magic_r;
 			continue;
 		}
-		max = bpl ? bpl * (i / bpl + 1) : size;
 		if (i >= max - 16) {
 			*dst++ = *p;
 			continue;
@@ -159,10 +280,7 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 			*dst++ = *p;
 			continue;
 		}
-		n = 4;
-
-		while (i + n * 4 < max && *p == p[n])
-			n++;
+		n = rle_run(p, 4, (max - i) / 4);
 		*dst++ = magic_x;
 		*dst++ = p[1];
 		*dst++ = htonl(n);
@@ -234,20 +352,73 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 		ctx->state.ref_frame.alpha = NULL;
 	ctx->state.gop_size = 10;
 	ctx->state.gop_cnt = 0;
+	ctx->state.pool = NULL;
+	ctx->state.motion_range = 0;
+	ctx->frame_bytes = 0;
+	ctx->qp = 20;
+	ctx->rc_avg = 0;
+	ctx->rc_fill = 0;
 	return ctx;
 }
 
 void fwht_free(struct codec_ctx *ctx)
 {
+	fwht_pool_free(ctx->state.pool);
 	free(ctx->state.ref_frame.luma);
 	free(ctx->state.compressed_frame);
 	free(ctx);
 }
 
+/*
+ * Encodes and decodes the frames with that many threads, which wait for
+ * them in a pool. A single thread is the default.
+ */
+void fwht_set_threads(struct codec_ctx *ctx, unsigned threads)
+{
+	fwht_pool_free(ctx->state.pool);
+	ctx->state.pool = threads > 1 ? fwht_pool_create(threads) : NULL;
+}
+
+/* The range of the qp, as for the vicodec controls */
+#define FWHT_MIN_QP 1
+#define FWHT_MAX_QP 31
+
+/*
+ * Adapts the qp to the target size of the frames. The average size of the
+ * frames of about a GOP is compared to the target, so that the I-frames are
+ * paid for by the P-frames which follow them. The bytes over or under the
+ * target add up, and are made up for over the next GOP. The qp only changes
+ * by one at a time, since the size of the frames changes much more at low
+ * qp values than at high ones.
+ */
+static void fwht_rate_control(struct codec_ctx *ctx, unsigned comp_size)
+{
+	__s64 gop_size = ctx->state.gop_size ? ctx->state.gop_size : 1;
+	__s64 max = ctx->frame_bytes * gop_size;
+	__s64 over;
+
+	if (!ctx->rc_avg)
+		ctx->rc_avg = ctx->frame_bytes;
+	ctx->rc_avg += ((__s64)comp_size - ctx->rc_avg) / gop_size;
+	ctx->rc_fill += (__s64)comp_size - ctx->frame_bytes;
+	if (ctx->rc_fill > max)
+		ctx->rc_fill = max;
+	else if (ctx->rc_fill < -max)
+		ctx->rc_fill = -max;
+
+	over = ctx->rc_avg + ctx->rc_fill / gop_size - ctx->frame_bytes;
+	if (over > ctx->frame_bytes / 8 && ctx->qp < FWHT_MAX_QP)
+		ctx->qp++;
+	else if (over < -(__s64)ctx->frame_bytes / 8 && ctx->qp > FWHT_MIN_QP)
+		ctx->qp--;
+}
+
 __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned uncomp_size, unsigned *comp_size)
 {
-	ctx->state.i_frame_qp = ctx->state.p_frame_qp = 20;
+	ctx->state.i_frame_qp = ctx->state.p_frame_qp = ctx->qp;
 	*comp_size = v4l2_fwht_encode(&ctx->state, buf, ctx->state.compressed_frame);
+	if (ctx->frame_bytes)
+		fwht_rate_control(ctx, *comp_size);
 	return ctx->state.compressed_frame;
 }
 
@@ -298,3 +469,546 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
 	copy_cap_to_ref(p_out, ctx->state.info, &ctx->state);
 	return true;
 }
+
+int v4l_stream_send_caps(int fd, __u32 caps)
+{
+	__u32 packet[3] = {
+		htonl(V4L_STREAM_PACKET_CAPS),
+		htonl(V4L_STREAM_PACKET_CAPS_SIZE),
+		htonl(caps),
+	};
+
+	if (write(fd, packet, sizeof(packet)) != sizeof(packet))
+		return -1;
+	return 0;
+}
+
+/*
+ * Reads the CAPS packet sent by the receiver, returning -1 if there is
+ * none after timeout milliseconds, as older receivers don't send it.
+ */
+int v4l_stream_read_caps(int fd, unsigned timeout, __u32 *caps)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	__u32 packet[3];
+	unsigned got = 0;
+
+	*caps = 0;
+	while (got < sizeof(packet)) {
+		ssize_t ret;
+
+		if (poll(&pfd, 1, timeout) <= 0)
+			return -1;
+		ret = read(fd, (__u8 *)packet + got, sizeof(packet) - got);
+		if (ret <= 0)
+			return -1;
+		got += ret;
+	}
+	if (ntohl(packet[0]) != V4L_STREAM_PACKET_CAPS ||
+	    ntohl(packet[1]) < V4L_STREAM_PACKET_CAPS_SIZE)
+		return -1;
+	*caps = ntohl(packet[2]);
+	return 0;
+}
+
+/* The IPv4 and UDP headers, which are part of the MTU */
+#define UDP_STREAM_IP_HDR_SIZE		28
+/* Number of datagrams given to the kernel at once */
+#define UDP_STREAM_BATCH		32
+/* Larger packets are sure to be bogus */
+#define UDP_STREAM_MAX_PACKET_SIZE	(256 << 20)
+/* Largest FMT_VIDEO packet, the only one used until the format is known */
+#define UDP_STREAM_MAX_FMT_SIZE		(8 + V4L_STREAM_PACKET_FMT_VIDEO_SIZE(VIDEO_MAX_PLANES))
+/* The first plane of a FRAME_VIDEO packet starts after these bytes */
+#define UDP_STREAM_FRAME_DATA		(8 * 4)
+
+static __u64 udp_stream_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int udp_stream_resolve(const char *host, struct in_addr *addr)
+{
+	struct hostent *server = gethostbyname(host);
+
+	if (!server || server->h_addrtype != AF_INET) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+	memcpy(addr, server->h_addr, sizeof(*addr));
+	return 0;
+}
+
+/*
+ * Opens the socket of a sender, which sends to host, or of a receiver, which
+ * receives what is sent to host, usually INADDR_ANY or a multicast group.
+ * For multicast groups, if_addr is the address of the local interface to use,
+ * or NULL to let the routing table decide.
+ */
+int udp_stream_open(struct udp_stream *s, const char *host, unsigned port,
+		    const char *if_addr, unsigned mtu, bool sender)
+{
+	struct in_addr ifa = { htonl(INADDR_ANY) };
+	int sock_buf = 4 << 20;
+	int one = 1;
+	bool multicast;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	s->sender = sender;
+	s->mtu = mtu ? mtu : V4L_STREAM_UDP_MTU;
+	if (s->mtu < V4L_STREAM_UDP_MIN_MTU || s->mtu > V4L_STREAM_UDP_MAX_MTU) {
+		errno = EINVAL;
+		return -1;
+	}
+	s->addr.sin_family = AF_INET;
+	s->addr.sin_port = htons(port);
+	if (udp_stream_resolve(host, &s->addr.sin_addr) ||
+	    (if_addr && udp_stream_resolve(if_addr, &ifa)))
+		return -1;
+	multicast = IN_MULTICAST(ntohl(s->addr.sin_addr.s_addr));
+
+	s->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s->fd < 0)
+		return -1;
+
+	if (sender) {
+		s->has_addr = true;
+		/* A larger buffer absorbs the bursts of datagrams of a frame */
+		setsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &sock_buf, sizeof(sock_buf));
+		if (multicast && if_addr &&
+		    setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_IF, &ifa, sizeof(ifa)))
+			goto err;
+		return 0;
+	}
+
+	s->dgram = malloc(V4L_STREAM_UDP_MAX_MTU);
+	if (!s->dgram)
+		goto err;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &sock_buf, sizeof(sock_buf));
+	/* Several receivers of a multicast group can run on the same host */
+	if (setsockopt(s->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+	    bind(s->fd, (struct sockaddr *)&s->addr, sizeof(s->addr)))
+		goto err;
+	if (multicast) {
+		struct ip_mreq mreq;
+
+		mreq.imr_multiaddr = s->addr.sin_addr;
+		mreq.imr_interface = ifa;
+		if (setsockopt(s->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+			goto err;
+	}
+	/* The address of the sender is the one of the first datagram */
+	memset(&s->addr, 0, sizeof(s->addr));
+	s->need_i_frame = true;
+	return 0;
+
+err:
+	udp_stream_close(s);
+	return -1;
+}
+
+void udp_stream_close(struct udp_stream *s)
+{
+	if (s->fd >= 0) {
+		int err = errno;
+
+		close(s->fd);
+		errno = err;
+	}
+	free(s->fmt);
+	free(s->buf);
+	free(s->dgram);
+	s->fd = -1;
+	s->fmt = s->buf = s->dgram = NULL;
+	s->fmt_size = s->buf_size = 0;
+}
+
+/* Sends a packet, cut in as many datagrams as needed */
+static int udp_stream_send_packet(struct udp_stream *s,
+				  const struct iovec *iov, unsigned iovcnt)
+{
+	unsigned max_data = s->mtu - UDP_STREAM_IP_HDR_SIZE - V4L_STREAM_UDP_HDR_SIZE;
+	__u32 hdrs[UDP_STREAM_BATCH][V4L_STREAM_UDP_HDR_SIZE / 4];
+	struct iovec msg_iov[UDP_STREAM_BATCH][V4L_STREAM_UDP_MAX_IOV + 1];
+	struct mmsghdr msgs[UDP_STREAM_BATCH];
+	unsigned size = 0, offset = 0;
+	unsigned idx = 0, iov_offset = 0;
+	unsigned i, n;
+
+	if (iovcnt > V4L_STREAM_UDP_MAX_IOV) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	while (offset < size) {
+		for (n = 0; n < UDP_STREAM_BATCH && offset < size; n++) {
+			unsigned len = size - offset > max_data ? max_data : size - offset;
+			struct iovec *v = msg_iov[n];
+			__u32 *hdr = hdrs[n];
+			unsigned cnt = 1;
+
+			hdr[0] = htonl(V4L_STREAM_UDP_ID);
+			hdr[1] = htonl(V4L_STREAM_VERSION);
+			hdr[2] = htonl(s->seq++);
+			hdr[3] = htonl(s->packet);
+			hdr[4] = htonl(offset);
+			hdr[5] = htonl(size);
+			v[0].iov_base = hdr;
+			v[0].iov_len = V4L_STREAM_UDP_HDR_SIZE;
+			offset += len;
+
+			/* Point to the data of the fragment, there are no copies */
+			while (len) {
+				unsigned chunk = iov[idx].iov_len - iov_offset;
+
+				if (chunk > len)
+					chunk = len;
+				v[cnt].iov_base = (__u8 *)iov[idx].iov_base + iov_offset;
+				v[cnt++].iov_len = chunk;
+				len -= chunk;
+				iov_offset += chunk;
+				if (iov_offset == iov[idx].iov_len) {
+					idx++;
+					iov_offset = 0;
+				}
+			}
+			memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+			msgs[n].msg_hdr.msg_name = &s->addr;
+			msgs[n].msg_hdr.msg_namelen = sizeof(s->addr);
+			msgs[n].msg_hdr.msg_iov = v;
+			msgs[n].msg_hdr.msg_iovlen = cnt;
+		}
+		for (i = 0; i < n; ) {
+			int ret = sendmmsg(s->fd, msgs + i, n - i, 0);
+
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			i += ret;
+		}
+		s->datagrams += n;
+	}
+	s->packet++;
+	s->packets++;
+	return 0;
+}
+
+/* Reads the reports of the receivers, without waiting for them */
+static void udp_stream_read_reports(struct udp_stream *s)
+{
+	__u32 report[V4L_STREAM_UDP_REPORT_SIZE / 4];
+	struct sockaddr_in from;
+	socklen_t len;
+	unsigned i;
+	__u32 flags;
+	ssize_t ret;
+
+	for (;;) {
+		len = sizeof(from);
+		ret = recvfrom(s->fd, report, sizeof(report), MSG_DONTWAIT,
+			       (struct sockaddr *)&from, &len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (ret != sizeof(report) || ntohl(report[0]) != V4L_STREAM_UDP_REPORT)
+			continue;
+
+		flags = ntohl(report[1]);
+		if (flags & V4L_STREAM_UDP_REQ_FMT)
+			s->fmt_reqs++;
+		if (flags & V4L_STREAM_UDP_REQ_I_FRAME)
+			s->i_frame_reqs++;
+		s->req_flags |= flags;
+
+		for (i = 0; i < s->num_peers; i++)
+			if (s->peers[i].addr.sin_addr.s_addr == from.sin_addr.s_addr &&
+			    s->peers[i].addr.sin_port == from.sin_port)
+				break;
+		if (i == V4L_STREAM_UDP_MAX_PEERS)
+			continue;
+		if (i == s->num_peers) {
+			s->peers[i].addr = from;
+			s->num_peers++;
+		}
+		s->peers[i].received = ntohl(report[2]);
+		s->peers[i].lost = ntohl(report[3]);
+	}
+}
+
+/*
+ * Sends the FMT_VIDEO packet, and keeps it to send it again for the
+ * receivers which join later.
+ */
+int udp_stream_send_fmt(struct udp_stream *s, const void *fmt, unsigned size)
+{
+	struct iovec iov;
+
+	if (size > s->fmt_size) {
+		__u8 *p = realloc(s->fmt, size);
+
+		if (!p)
+			return -1;
+		s->fmt = p;
+	}
+	memcpy(s->fmt, fmt, size);
+	s->fmt_size = size;
+	s->fmt_time = udp_stream_now();
+	s->req_flags &= ~V4L_STREAM_UDP_REQ_FMT;
+	iov.iov_base = s->fmt;
+	iov.iov_len = size;
+	return udp_stream_send_packet(s, &iov, 1);
+}
+
+/*
+ * Sends a FRAME_VIDEO or END packet, made of iovcnt buffers. The FMT_VIDEO
+ * packet is sent first if it is due, or if a receiver requested it.
+ */
+int udp_stream_send(struct udp_stream *s, const struct iovec *iov, unsigned iovcnt)
+{
+	__u64 now = udp_stream_now();
+
+	udp_stream_read_reports(s);
+	if (s->fmt_size && ((s->req_flags & V4L_STREAM_UDP_REQ_FMT) ||
+			    now - s->fmt_time >= V4L_STREAM_UDP_FMT_INTERVAL)) {
+		struct iovec fmt = { s->fmt, s->fmt_size };
+
+		s->fmt_time = now;
+		s->req_flags &= ~V4L_STREAM_UDP_REQ_FMT;
+		if (udp_stream_send_packet(s, &fmt, 1))
+			return -1;
+	}
+	return udp_stream_send_packet(s, iov, iovcnt);
+}
+
+/* Returns true once if a receiver requested an I-frame */
+bool udp_stream_i_frame_requested(struct udp_stream *s)
+{
+	bool req = s->req_flags & V4L_STREAM_UDP_REQ_I_FRAME;
+
+	s->req_flags &= ~V4L_STREAM_UDP_REQ_I_FRAME;
+	return req;
+}
+
+/* Sends the statistics and the requests of a receiver, if they are due */
+static void udp_stream_report(struct udp_stream *s)
+{
+	__u32 report[V4L_STREAM_UDP_REPORT_SIZE / 4];
+	__u64 now = udp_stream_now();
+	__u32 flags = 0;
+
+	if (!s->has_addr)
+		return;
+	if (!s->has_fmt)
+		flags |= V4L_STREAM_UDP_REQ_FMT;
+	if (s->need_i_frame)
+		flags |= V4L_STREAM_UDP_REQ_I_FRAME;
+	if (now - s->report_time < (flags ? V4L_STREAM_UDP_REQ_INTERVAL :
+					    V4L_STREAM_UDP_REPORT_INTERVAL))
+		return;
+	s->report_time = now;
+	if (flags & V4L_STREAM_UDP_REQ_FMT)
+		s->fmt_reqs++;
+	if (flags & V4L_STREAM_UDP_REQ_I_FRAME)
+		s->i_frame_reqs++;
+	report[0] = htonl(V4L_STREAM_UDP_REPORT);
+	report[1] = htonl(flags);
+	report[2] = htonl(s->datagrams);
+	report[3] = htonl(s->lost);
+	/* The reports are best effort, like everything else here */
+	sendto(s->fd, report, sizeof(report), MSG_DONTWAIT,
+	       (struct sockaddr *)&s->addr, sizeof(s->addr));
+}
+
+static bool udp_stream_is_i_frame(const __u8 *p, unsigned size)
+{
+	struct fwht_cframe_hdr hdr;
+
+	if (size < UDP_STREAM_FRAME_DATA + sizeof(hdr))
+		return false;
+	memcpy(&hdr, p + UDP_STREAM_FRAME_DATA, sizeof(hdr));
+	return ntohl(hdr.flags) & V4L2_FWHT_FL_I_FRAME;
+}
+
+/*
+ * Returns the size of the largest packet that can follow the format of a
+ * FMT_VIDEO packet: a frame whose planes are all FWHT compressed in the worst
+ * case, or RLE compressed, which never makes them larger than sizeimage.
+ * Returns 0 if the packet is malformed.
+ */
+static unsigned udp_stream_max_size(const __u8 *p, unsigned size)
+{
+	unsigned offset = 8 + 4 + V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT;
+	__u32 v[3], planes, total = 0;
+	__u64 max;
+
+	if (size < offset)
+		return 0;
+	memcpy(v, p + 8, 2 * sizeof(v[0]));
+	planes = ntohl(v[1]);
+	if (ntohl(v[0]) != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT ||
+	    !planes || planes > VIDEO_MAX_PLANES ||
+	    size < offset + planes * (4 + V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE))
+		return 0;
+
+	for (unsigned i = 0; i < planes; i++, offset += sizeof(v)) {
+		memcpy(v, p + offset, sizeof(v));
+		if (ntohl(v[0]) != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE ||
+		    ntohl(v[1]) > UDP_STREAM_MAX_PACKET_SIZE - total)
+			return 0;
+		total += ntohl(v[1]);
+	}
+
+	/* Each plane is compressed on its own, with the size of the frame */
+	max = 8 + V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(planes) +
+	      (__u64)planes * (total + sizeof(struct fwht_cframe_hdr));
+	return max < UDP_STREAM_MAX_PACKET_SIZE ? max : UDP_STREAM_MAX_PACKET_SIZE;
+}
+
+/*
+ * Checks whether a whole packet can be used: frames are dropped until the
+ * format is known, and FWHT P-frames until an I-frame after a loss.
+ */
+static int udp_stream_accept(struct udp_stream *s, unsigned size)
+{
+	__u32 id;
+
+	memcpy(&id, s->buf, sizeof(id));
+	switch (ntohl(id)) {
+	case V4L_STREAM_PACKET_FMT_VIDEO:
+		s->max_size = udp_stream_max_size(s->buf, size);
+		if (!s->max_size)
+			goto drop;
+		s->has_fmt = true;
+		break;
+	case V4L_STREAM_PACKET_FRAME_VIDEO_RLE:
+		if (!s->has_fmt)
+			goto drop;
+		s->need_i_frame = false;
+		break;
+	case V4L_STREAM_PACKET_FRAME_VIDEO_FWHT:
+		if (!s->has_fmt)
+			goto drop;
+		if (s->need_i_frame) {
+			if (!udp_stream_is_i_frame(s->buf, size))
+				goto drop;
+			s->need_i_frame = false;
+		}
+		break;
+	}
+	udp_stream_report(s);
+	return size;
+
+drop:
+	s->dropped++;
+	udp_stream_report(s);
+	return 0;
+}
+
+/*
+ * Reads a datagram. Returns the size of the packet in s->buf once it is
+ * complete and can be used, 0 if there is none yet, or -1 on errors.
+ */
+int udp_stream_recv(struct udp_stream *s)
+{
+	__u32 hdr[V4L_STREAM_UDP_HDR_SIZE / 4];
+	__u32 seq, packet, offset, size, len;
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	ssize_t ret;
+
+	ret = recvfrom(s->fd, s->dgram, V4L_STREAM_UDP_MAX_MTU, 0,
+		       (struct sockaddr *)&from, &from_len);
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	if (ret < V4L_STREAM_UDP_HDR_SIZE)
+		return 0;
+	memcpy(hdr, s->dgram, sizeof(hdr));
+	if (ntohl(hdr[0]) != V4L_STREAM_UDP_ID ||
+	    ntohl(hdr[1]) != V4L_STREAM_VERSION)
+		return 0;
+	seq = ntohl(hdr[2]);
+	packet = ntohl(hdr[3]);
+	offset = ntohl(hdr[4]);
+	size = ntohl(hdr[5]);
+	len = ret - V4L_STREAM_UDP_HDR_SIZE;
+
+	/* Start from scratch when the sender changes, e.g. if it restarted */
+	if (!s->has_addr || s->addr.sin_addr.s_addr != from.sin_addr.s_addr ||
+	    s->addr.sin_port != from.sin_port) {
+		s->addr = from;
+		s->has_addr = true;
+		s->has_seq = s->has_packet = s->has_fmt = false;
+		s->need_i_frame = true;
+		s->offset = 0;
+	}
+
+	if (s->has_seq && seq != s->seq + 1) {
+		/* Ignore the datagrams which arrive out of order */
+		if ((__s32)(seq - s->seq) <= 0)
+			return 0;
+		s->lost += seq - s->seq - 1;
+	}
+	s->seq = seq;
+	s->has_seq = true;
+	s->datagrams++;
+
+	/*
+	 * Fragments are only added to a packet in order: if one is missing,
+	 * the rest of the packet is skipped.
+	 */
+	/*
+	 * Anyone can send datagrams: don't let one make the receiver allocate
+	 * more than what the format needs.
+	 */
+	if (packet != s->packet || offset != s->offset || size != s->size) {
+		s->packet = packet;
+		s->size = size;
+		s->offset = 0;
+		if (offset || size < 8 ||
+		    size > (s->has_fmt ? s->max_size : UDP_STREAM_MAX_FMT_SIZE)) {
+			s->size = 0;
+			udp_stream_report(s);
+			return 0;
+		}
+	}
+	if (len > size - offset) {
+		s->size = 0;
+		return 0;
+	}
+	if (size > s->buf_size) {
+		__u8 *p = realloc(s->buf, size);
+
+		if (!p)
+			return -1;
+		s->buf = p;
+		s->buf_size = size;
+	}
+	memcpy(s->buf + offset, s->dgram + V4L_STREAM_UDP_HDR_SIZE, len);
+	s->offset += len;
+	if (s->offset < size) {
+		udp_stream_report(s);
+		return 0;
+	}
+
+	/* The packet is complete, any packet missing before it is lost */
+	s->offset = 0;
+	s->size = 0;
+	if (s->has_packet && (__s32)(packet - s->last_packet) > 1) {
+		s->dropped += packet - s->last_packet - 1;
+		s->need_i_frame = true;
+	}
+	s->last_packet = packet;
+	s->has_packet = true;
+	s->packets++;
+	return udp_stream_accept(s, size);
+}
@@ -1,7 +1,11 @@
 #include <cstring>
+#include <vector>
 
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <linux/media.h>
 
@@ -44,16 +48,31 @@ static char *host_to;
 #ifndef NO_STREAM_TO
 static unsigned host_port_to = V4L_STREAM_PORT;
 static unsigned bpl_cap[VIDEO_MAX_PLANES];
+static udp_stream host_udp_to;
+static FILE *host_udp_fout;
+static char *host_udp_buf;
+static size_t host_udp_size;
 #endif
 static bool host_lossless;
+static unsigned host_workers;
+static unsigned host_gop_size;
+static unsigned host_motion_range;
+static unsigned host_bitrate;
 static int host_fd_to = -1;
+static bool host_to_udp;
 static unsigned comp_perc;
 static unsigned comp_perc_count;
+static unsigned host_queue_drops;
 static char *file_from;
 static bool from_with_hdr;
 static char *host_from;
 static unsigned host_port_from = V4L_STREAM_PORT;
+static unsigned host_from_threads;
 static int host_fd_from = -1;
+static bool host_from_udp;
+static udp_stream host_udp_from;
+static char *host_udp_if;
+static unsigned host_udp_mtu = V4L_STREAM_UDP_MTU;
 static struct tpg_data tpg;
 static unsigned output_field = V4L2_FIELD_NONE;
 static bool output_field_alt;
@@ -264,7 +283,31 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-to-host <hostname[:port]>\n"
                "                     stream to this host. The default port is %d.\n"
+	       "  --stream-to-host-udp <hostname[:port]>\n"
+	       "                     stream to this host or multicast group with UDP datagrams.\n"
+	       "                     Receivers can join at any time, and frames which are lost\n"
+	       "                     are not sent again. The default port is %d.\n"
 	       "  --stream-lossless  always use lossless video compression.\n"
+	       "  --stream-to-host-workers <count>\n"
+	       "                     compress the frames streamed with --stream-to-host using\n"
+	       "                     <count> threads, and send them from another one, so that\n"
+	       "                     the capture is not stalled by the compression or by the\n"
+	       "                     network. Frames are dropped if the send queue is full.\n"
+	       "                     FWHT frames depend on the previous one unless gop=1, so\n"
+	       "                     they are compressed in order, each by the <count> threads.\n"
+	       "                     The default is 0 (compress and send from the capture thread).\n"
+	       "  --stream-to-host-fwht gop=<frames>,motion=<pixels>,bitrate=<kbps>\n"
+	       "                     set how the frames streamed with --stream-to-host are compressed:\n"
+	       "                     gop: the number of frames from one I-frame to the next.\n"
+	       "                          The default is 10.\n"
+	       "                     motion: search for motion up to that many pixels away, at most\n"
+	       "                          %d. Only receivers of this version or later understand\n"
+	       "                          it, and they must announce it when accepting the connection,\n"
+	       "                          so it can't be used with --stream-to-host-udp.\n"
+	       "                          The default is 0 (no motion search).\n"
+	       "                     bitrate: adapt the quantization to that bitrate, in kbit/s,\n"
+	       "                          at the frame rate of the device, or 30 fps if unknown.\n"
+	       "                          The default is 0 (fixed quantization).\n"
 #endif
 	       "  --stream-poll      use non-blocking mode and select() to stream.\n"
 	       "  --stream-buf-caps  show capture buffer capabilities\n"
@@ -287,6 +330,20 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-from-host <hostname[:port]>\n"
 	       "                     stream from this host. The default port is %d.\n"
+	       "  --stream-from-host-udp <address[:port]>\n"
+	       "                     stream the UDP datagrams sent with --stream-to-host-udp to this\n"
+	       "                     address or multicast group. Use 0.0.0.0 for any address.\n"
+	       "                     The default port is %d.\n"
+	       "  --stream-from-host-threads <count>\n"
+	       "                     decode the FWHT frames streamed with --stream-from-host or\n"
+	       "                     --stream-from-host-udp using <count> threads. The default is 1.\n"
+	       "  --stream-host-udp if=<address>,mtu=<bytes>\n"
+	       "                     set how --stream-to/from-host-udp use the network:\n"
+	       "                     if: the address of the interface of the multicast group,\n"
+	       "                         e.g. 127.0.0.1 to stay on this host. The default is to\n"
+	       "                         use the routing table.\n"
+	       "                     mtu: the size of the datagrams, including the IP and UDP\n"
+	       "                          headers. The default is %d.\n"
 	       "  --stream-no-query  Do not query and set the DV timings or standard before streaming.\n"
 	       "  --stream-loop      loop when the end of the file we are streaming from is reached.\n"
 	       "                     The default is to stop.\n"
@@ -347,9 +404,9 @@ void streaming_usage()
 	       "  --list-buffers-meta\n"
 	       "                     list all Meta RX buffers [VIDIOC_QUERYBUF]\n",
 #ifndef NO_STREAM_TO
-		V4L_STREAM_PORT,
+		V4L_STREAM_PORT, V4L_STREAM_PORT, FWHT_MAX_MOTION_RANGE,
 #endif
-	       	V4L_STREAM_PORT);
+	       	V4L_STREAM_PORT, V4L_STREAM_PORT, V4L_STREAM_UDP_MTU);
 }
 
 static enum codec_type get_codec_type(cv4l_fd &fd)
@@ -644,6 +701,7 @@ static void list_buffers(cv4l_fd &fd, unsigned buftype)
 
 void streaming_cmd(int ch, char *optarg)
 {
+	char *value, *subs;
 	unsigned i;
 	int speed;
 
@@ -746,9 +804,44 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamToHost:
 		host_to = optarg;
 		break;
+	case OptStreamToHostUdp:
+		host_to = optarg;
+		host_to_udp = true;
+		break;
 	case OptStreamLossless:
 		host_lossless = true;
 		break;
+	case OptStreamToHostWorkers:
+		host_workers = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamToHostFwht:
+		subs = optarg;
+		while (*subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"gop",
+				"motion",
+				"bitrate",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				host_gop_size = strtoul(value, nullptr, 0);
+				break;
+			case 1:
+				host_motion_range = strtoul(value, nullptr, 0);
+				if (host_motion_range > FWHT_MAX_MOTION_RANGE)
+					host_motion_range = FWHT_MAX_MOTION_RANGE;
+				break;
+			case 2:
+				host_bitrate = strtoul(value, nullptr, 0);
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
 	case OptStreamFrom:
 		file_from = optarg;
 		from_with_hdr = false;
@@ -760,6 +853,35 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamFromHost:
 		host_from = optarg;
 		break;
+	case OptStreamFromHostUdp:
+		host_from = optarg;
+		host_from_udp = true;
+		break;
+	case OptStreamFromHostThreads:
+		host_from_threads = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamHostUdp:
+		subs = optarg;
+		while (*subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"if",
+				"mtu",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				host_udp_if = value;
+				break;
+			case 1:
+				host_udp_mtu = strtoul(value, nullptr, 0);
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
 	case OptStreamUser:
 		memory = V4L2_MEMORY_USERPTR;
 		fallthrough;
@@ -1307,6 +1429,47 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 	return 0;
 }
 
+#ifndef NO_STREAM_TO
+/*
+ * With --stream-to-host-udp, the packets are written to a memory stream,
+ * which is sent as datagrams each time a packet is complete.
+ */
+static void host_udp_flush(FILE *fout, bool is_fmt)
+{
+	struct iovec iov;
+	int ret;
+
+	fflush(fout);
+	iov.iov_base = host_udp_buf;
+	iov.iov_len = host_udp_size;
+	if (is_fmt)
+		ret = udp_stream_send_fmt(&host_udp_to, host_udp_buf, host_udp_size);
+	else
+		ret = udp_stream_send(&host_udp_to, &iov, 1);
+	if (ret)
+		fprintf(stderr, "%s: send error: %s\n", __func__, strerror(errno));
+	rewind(fout);
+}
+
+static void host_udp_stats()
+{
+	const udp_stream &s = host_udp_to;
+
+	fprintf(stderr, "stream-to-host-udp: %u datagrams sent in %u packets, "
+		"%u format and %u I-frame requests\n",
+		s.datagrams, s.packets, s.fmt_reqs, s.i_frame_reqs);
+	for (unsigned i = 0; i < s.num_peers; i++) {
+		const udp_stream_peer &peer = s.peers[i];
+		__u64 total = static_cast<__u64>(peer.received) + peer.lost;
+
+		fprintf(stderr, "  receiver %s:%u: %u datagrams received, %u lost (%.2f%%)\n",
+			inet_ntoa(peer.addr.sin_addr), ntohs(peer.addr.sin_port),
+			peer.received, peer.lost,
+			total ? peer.lost * 100.0 / total : 0.0);
+	}
+}
+#endif
+
 static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 				 cv4l_fmt &fmt, FILE *fout)
 {
@@ -1318,6 +1481,8 @@ static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 		unsigned tot_comp_size = 0;
 		unsigned tot_used = 0;
 
+		if (ctx && host_to_udp && udp_stream_i_frame_requested(&host_udp_to))
+			ctx->state.gop_cnt = 0;
 		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
 			__u32 used = buf.g_bytesused(j);
 			unsigned offset = buf.g_data_offset(j);
@@ -1376,11 +1541,421 @@ static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
 		if (sz != used)
 			fprintf(stderr, "%u != %u\n", sz, used);
 	}
-	if (host_fd_to >= 0)
+	if (host_to_udp)
+		host_udp_flush(fout, false);
+	else if (host_fd_to >= 0)
 		fflush(fout);
 #endif
 }
 
+#ifndef NO_STREAM_TO
+static codec_ctx *alloc_host_codec(cv4l_fd &fd, cv4l_fmt &cfmt)
+{
+	unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
+	unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
+	codec_ctx *ctx;
+
+	ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
+			 cfmt.g_width(), cfmt.g_height(),
+			 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
+			 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+	if (!ctx)
+		return ctx;
+	if (host_gop_size)
+		ctx->state.gop_size = host_gop_size;
+	ctx->state.motion_range = host_motion_range;
+	if (host_bitrate) {
+		v4l2_fract interval;
+		double fps = 30;
+
+		if (!fd.get_interval(interval) && interval.numerator &&
+		    interval.denominator)
+			fps = static_cast<double>(interval.denominator) /
+			      interval.numerator;
+		ctx->frame_bytes = host_bitrate * 1000.0 / 8 / fps;
+		if (!ctx->frame_bytes)
+			ctx->frame_bytes = 1;
+	}
+	return ctx;
+}
+
+/*
+ * Pipelined --stream-to-host: the capture thread hands each dequeued buffer
+ * to a pool of compression workers, which requeue it as soon as it is
+ * compressed. A sender thread then writes the compressed frames to the
+ * socket with writev(), in capture order. At most two frames per capture
+ * buffer can be in flight: when the queue is full, new frames are dropped,
+ * instead of stalling the capture.
+ */
+struct host_frame {
+	cv4l_buffer buf;
+	bool requeue;
+	bool compressed;
+	bool fwht;		/* compressed with FWHT, or else with RLE */
+	__u32 field;
+	__u32 flags;
+	unsigned size[VIDEO_MAX_PLANES];
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	__u8 *data[VIDEO_MAX_PLANES];
+};
+
+struct host_pipeline;
+
+struct host_worker {
+	host_pipeline *pipe;
+	pthread_t thread;
+	codec_ctx *ctx;
+};
+
+struct host_pipeline {
+	cv4l_fd *fd;
+	cv4l_queue *q;
+	unsigned num_planes;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t send_cond;
+	pthread_cond_t idle_cond;
+	pthread_t sender;
+	std::vector<host_worker> workers;
+
+	/* Ring of frames, indexed by a sequence number */
+	std::vector<host_frame> frames;
+	unsigned head;		/* next frame to queue */
+	unsigned todo;		/* next frame to compress */
+	unsigned tail;		/* next frame to send */
+	bool stop;
+	bool send_error;
+	bool i_frame_req;
+
+	unsigned comp_perc;
+	unsigned comp_perc_count;
+	unsigned sent;
+	unsigned dropped;
+	unsigned reported_dropped;
+	unsigned max_depth;
+};
+
+static host_pipeline *host_pipe;
+
+static void host_compress_frame(host_pipeline *pipe, codec_ctx *wctx,
+				host_frame &f)
+{
+	unsigned tot_comp_size = 0;
+	unsigned tot_used = 0;
+
+	f.fwht = wctx != nullptr;
+	for (unsigned j = 0; j < pipe->num_planes; j++) {
+		unsigned offset = f.buf.g_data_offset(j);
+		u8 *p = static_cast<u8 *>(pipe->q->g_dataptr(f.buf.g_index(), j)) + offset;
+
+		if (wctx) {
+			__u8 *comp = fwht_compress(wctx, p, f.size[j], &f.comp_size[j]);
+
+			memcpy(f.data[j], comp, f.comp_size[j]);
+		} else {
+			/* rle_compress() works in place: keep the buffer intact */
+			memcpy(f.data[j], p, f.size[j]);
+			f.comp_size[j] = rle_compress(f.data[j], f.size[j], bpl_cap[j]);
+		}
+		tot_comp_size += f.comp_size[j];
+		tot_used += f.size[j];
+	}
+
+	/*
+	 * EINVAL can happen for the last buffer before a dynamic resolution
+	 * change sequence, see do_handle_cap().
+	 */
+	if (f.requeue && pipe->fd->qbuf(f.buf) && errno != EINVAL)
+		fprintf(stderr, "%s: qbuf error\n", __func__);
+
+	pthread_mutex_lock(&pipe->lock);
+	if (tot_used) {
+		pipe->comp_perc += tot_comp_size * 100 / tot_used;
+		pipe->comp_perc_count++;
+	}
+	f.compressed = true;
+	pthread_cond_signal(&pipe->send_cond);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+static void *host_worker_thread(void *arg)
+{
+	host_worker *w = static_cast<host_worker *>(arg);
+	host_pipeline *pipe = w->pipe;
+
+	for (;;) {
+		host_frame *f;
+
+		pthread_mutex_lock(&pipe->lock);
+		while (!pipe->stop && pipe->todo == pipe->head)
+			pthread_cond_wait(&pipe->work_cond, &pipe->lock);
+		if (pipe->todo == pipe->head) {
+			pthread_mutex_unlock(&pipe->lock);
+			break;
+		}
+		f = &pipe->frames[pipe->todo++ % pipe->frames.size()];
+		if (pipe->i_frame_req && w->ctx) {
+			w->ctx->state.gop_cnt = 0;
+			pipe->i_frame_req = false;
+		}
+		pthread_mutex_unlock(&pipe->lock);
+
+		host_compress_frame(pipe, w->ctx, *f);
+	}
+	return nullptr;
+}
+
+static bool writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt) {
+		ssize_t ret = writev(fd, iov, iovcnt);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		while (iovcnt && static_cast<size_t>(ret) >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = static_cast<u8 *>(iov->iov_base) + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return true;
+}
+
+/* Same packet as written by write_buffer_to_file(), without copies */
+static bool host_send_frame(host_pipeline *pipe, host_frame &f)
+{
+	__u32 hdr[5 + 3 * VIDEO_MAX_PLANES];
+	struct iovec iov[1 + 2 * VIDEO_MAX_PLANES];
+	unsigned tot_comp_size = 0;
+	unsigned n = 1;
+
+	for (unsigned j = 0; j < pipe->num_planes; j++)
+		tot_comp_size += f.comp_size[j];
+
+	hdr[0] = htonl(f.fwht ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
+			       V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
+	hdr[1] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(pipe->num_planes) + tot_comp_size);
+	hdr[2] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
+	hdr[3] = htonl(f.field);
+	hdr[4] = htonl(f.flags);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = 5 * sizeof(hdr[0]);
+
+	for (unsigned j = 0; j < pipe->num_planes; j++) {
+		__u32 *plane_hdr = hdr + 5 + 3 * j;
+
+		plane_hdr[0] = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
+		plane_hdr[1] = htonl(f.size[j]);
+		plane_hdr[2] = htonl(f.comp_size[j]);
+		if (j) {
+			iov[n].iov_base = plane_hdr;
+			iov[n++].iov_len = 3 * sizeof(hdr[0]);
+		} else {
+			iov[0].iov_len += 3 * sizeof(hdr[0]);
+		}
+		iov[n].iov_base = f.data[j];
+		iov[n++].iov_len = f.comp_size[j];
+	}
+	if (!host_to_udp)
+		return writev_all(host_fd_to, iov, n);
+
+	if (udp_stream_send(&host_udp_to, iov, n))
+		return false;
+	if (udp_stream_i_frame_requested(&host_udp_to)) {
+		pthread_mutex_lock(&pipe->lock);
+		pipe->i_frame_req = true;
+		pthread_mutex_unlock(&pipe->lock);
+	}
+	return true;
+}
+
+static void *host_sender_thread(void *arg)
+{
+	host_pipeline *pipe = static_cast<host_pipeline *>(arg);
+	unsigned num_frames = pipe->frames.size();
+
+	for (;;) {
+		host_frame *f;
+
+		pthread_mutex_lock(&pipe->lock);
+		while (!pipe->stop && (pipe->tail == pipe->head ||
+		       !pipe->frames[pipe->tail % num_frames].compressed))
+			pthread_cond_wait(&pipe->send_cond, &pipe->lock);
+		if (pipe->tail == pipe->head) {
+			pthread_mutex_unlock(&pipe->lock);
+			break;
+		}
+		f = &pipe->frames[pipe->tail % num_frames];
+		pthread_mutex_unlock(&pipe->lock);
+
+		if (!pipe->send_error && !host_send_frame(pipe, *f)) {
+			fprintf(stderr, "%s: write error: %s\n", __func__,
+				strerror(errno));
+			pipe->send_error = true;
+		}
+
+		pthread_mutex_lock(&pipe->lock);
+		pipe->tail++;
+		pipe->sent++;
+		pthread_cond_signal(&pipe->idle_cond);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+	return nullptr;
+}
+
+/*
+ * Called by the capture thread. Returns false if the frame was dropped,
+ * in which case the caller still owns the buffer.
+ */
+static bool host_pipeline_queue(host_pipeline *pipe, cv4l_buffer &buf,
+				bool requeue)
+{
+	unsigned depth;
+
+	pthread_mutex_lock(&pipe->lock);
+	depth = pipe->head - pipe->tail;
+	if (depth == pipe->frames.size()) {
+		pipe->dropped++;
+		pthread_mutex_unlock(&pipe->lock);
+		return false;
+	}
+
+	host_frame &f = pipe->frames[pipe->head % pipe->frames.size()];
+
+	f.buf.init(buf);
+	f.requeue = requeue;
+	f.compressed = false;
+	f.field = buf.g_field();
+	f.flags = buf.g_flags();
+	for (unsigned j = 0; j < pipe->num_planes; j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+
+		f.size[j] = offset > used ? used : used - offset;
+	}
+	pipe->head++;
+	if (depth + 1 > pipe->max_depth)
+		pipe->max_depth = depth + 1;
+	pthread_cond_signal(&pipe->work_cond);
+	pthread_mutex_unlock(&pipe->lock);
+	return true;
+}
+
+/* Moves the statistics to the globals printed by do_handle_cap() */
+static void host_pipeline_stats(host_pipeline *pipe)
+{
+	pthread_mutex_lock(&pipe->lock);
+	comp_perc += pipe->comp_perc;
+	comp_perc_count += pipe->comp_perc_count;
+	pipe->comp_perc = pipe->comp_perc_count = 0;
+	host_queue_drops += pipe->dropped - pipe->reported_dropped;
+	pipe->reported_dropped = pipe->dropped;
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+static host_pipeline *host_pipeline_start(cv4l_fd &fd, cv4l_queue &q)
+{
+	host_pipeline *pipe = new host_pipeline();
+	unsigned num_workers = host_workers;
+	unsigned threads = 1;
+	cv4l_fmt cfmt;
+
+	fd.g_fmt(cfmt);
+	pipe->fd = &fd;
+	pipe->q = &q;
+	pipe->num_planes = q.g_num_planes();
+	pthread_mutex_init(&pipe->lock, nullptr);
+	pthread_cond_init(&pipe->work_cond, nullptr);
+	pthread_cond_init(&pipe->send_cond, nullptr);
+	pthread_cond_init(&pipe->idle_cond, nullptr);
+
+	pipe->frames.resize(2 * q.g_buffers());
+	for (auto &f : pipe->frames) {
+		for (unsigned j = 0; j < pipe->num_planes; j++) {
+			unsigned size = q.g_length(j);
+
+			if (ctx && ctx->comp_max_size > size)
+				size = ctx->comp_max_size;
+			f.data[j] = static_cast<__u8 *>(malloc(size));
+			if (!f.data[j]) {
+				fprintf(stderr, "%s: out of memory\n", __func__);
+				std::exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	/*
+	 * FWHT P-frames are encoded against the previous frame, so a single
+	 * worker has to see all of them: it shares the work on each frame with
+	 * the other threads instead.
+	 */
+	if (ctx && ctx->state.gop_size != 1) {
+		threads = host_workers;
+		num_workers = 1;
+	}
+	pipe->workers.resize(num_workers);
+	for (auto &w : pipe->workers) {
+		w.pipe = pipe;
+		w.ctx = nullptr;
+		if (ctx) {
+			w.ctx = alloc_host_codec(fd, cfmt);
+			if (w.ctx)
+				fwht_set_threads(w.ctx, threads);
+		}
+		if (pthread_create(&w.thread, nullptr, host_worker_thread, &w)) {
+			fprintf(stderr, "%s: can't create a thread\n", __func__);
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	if (pthread_create(&pipe->sender, nullptr, host_sender_thread, pipe)) {
+		fprintf(stderr, "%s: can't create a thread\n", __func__);
+		std::exit(EXIT_FAILURE);
+	}
+	return pipe;
+}
+
+/* Waits until all queued frames are sent. Must be called before STREAMOFF */
+static void host_pipeline_stop(host_pipeline *pipe)
+{
+	pthread_mutex_lock(&pipe->lock);
+	while (pipe->tail != pipe->head)
+		pthread_cond_wait(&pipe->idle_cond, &pipe->lock);
+	pipe->stop = true;
+	pthread_cond_broadcast(&pipe->work_cond);
+	pthread_cond_signal(&pipe->send_cond);
+	pthread_mutex_unlock(&pipe->lock);
+
+	for (auto &w : pipe->workers) {
+		pthread_join(w.thread, nullptr);
+		if (w.ctx)
+			fwht_free(w.ctx);
+	}
+	pthread_join(pipe->sender, nullptr);
+
+	if (!verbose)
+		fprintf(stderr, "\n");
+	fprintf(stderr, "stream-to-host: %u frames sent, %u dropped (send queue full), "
+		"max queue depth %u/%zu\n", pipe->sent, pipe->dropped,
+		pipe->max_depth, pipe->frames.size());
+
+	for (auto &f : pipe->frames)
+		for (unsigned j = 0; j < pipe->num_planes; j++)
+			free(f.data[j]);
+	pthread_cond_destroy(&pipe->idle_cond);
+	pthread_cond_destroy(&pipe->send_cond);
+	pthread_cond_destroy(&pipe->work_cond);
+	pthread_mutex_destroy(&pipe->lock);
+	delete pipe;
+}
+#endif
+
 static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
 			 bool ignore_count_skip)
@@ -1388,6 +1963,7 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 	char ch = '<';
 	int ret;
 	cv4l_buffer buf(q);
+	bool queued = false;
 
 	for (;;) {
 		ret = fd.dqbuf(buf);
@@ -1418,8 +1994,19 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
 
 	if (fout && (!stream_skip || ignore_count_skip) &&
-	    !is_empty_frame && !is_error_frame)
-		write_buffer_to_file(fd, q, buf, fmt, fout);
+	    !is_empty_frame && !is_error_frame) {
+#ifndef NO_STREAM_TO
+		if (host_pipe)
+			queued = host_pipeline_queue(host_pipe, buf,
+						     !last_buffer && index == nullptr);
+		else
+#endif
+			write_buffer_to_file(fd, q, buf, fmt, fout);
+	}
+#ifndef NO_STREAM_TO
+	if (host_pipe)
+		host_pipeline_stats(host_pipe);
+#endif
 
 	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
 		ch = 'K';
@@ -1429,10 +2016,11 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 		ch = 'B';
 	if (verbose) {
 		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
-				     host_fd_to >= 0 ? 100 - comp_perc / comp_perc_count : -1);
+				     host_fd_to >= 0 && comp_perc_count ?
+				     100 - comp_perc / comp_perc_count : -1);
 		comp_perc_count = comp_perc = 0;
 	}
-	if (!last_buffer && index == nullptr) {
+	if (!last_buffer && index == nullptr && !queued) {
 		/*
 		 * EINVAL in qbuf can happen if this is the last buffer before
 		 * a dynamic resolution change sequence. In this case the buffer
@@ -1457,9 +2045,12 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			fprintf(stderr, " %.02f fps", fps_ts.fps());
 			if (dropped)
 				fprintf(stderr, ", dropped buffers: %u", dropped);
-			if (host_fd_to >= 0)
+			if (host_fd_to >= 0 && comp_perc_count)
 				fprintf(stderr, " %d%% compression", 100 - comp_perc / comp_perc_count);
 			comp_perc_count = comp_perc = 0;
+			if (host_queue_drops)
+				fprintf(stderr, ", send queue full: %u", host_queue_drops);
+			host_queue_drops = 0;
 			fprintf(stderr, "\n");
 		}
 	}
@@ -1690,6 +2281,30 @@ static FILE *open_output_file(cv4l_fd &fd)
 		host_port_to = strtoul(p + 1, nullptr, 0);
 		*p = '\0';
 	}
+	if (host_to_udp) {
+		/* Receivers can't announce what they understand */
+		if (host_motion_range && !host_lossless) {
+			fprintf(stderr, "motion= can't be used with --stream-to-host-udp\n");
+			std::exit(EXIT_FAILURE);
+		}
+		/* After a source change, only the new format is sent */
+		if (host_fd_to < 0) {
+			if (udp_stream_open(&host_udp_to, host_to, host_port_to,
+					    host_udp_if, host_udp_mtu, true)) {
+				fprintf(stderr, "could not open UDP socket to %s: %s\n",
+					host_to, strerror(errno));
+				std::exit(EXIT_FAILURE);
+			}
+			host_fd_to = host_udp_to.fd;
+			host_udp_fout = open_memstream(&host_udp_buf, &host_udp_size);
+			if (!host_udp_fout) {
+				fprintf(stderr, "%s: out of memory\n", __func__);
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		fout = host_udp_fout;
+		goto fmt;
+	}
 	host_fd_to = socket(AF_INET, SOCK_STREAM, 0);
 	if (host_fd_to < 0) {
 		fprintf(stderr, "cannot open socket");
@@ -1710,9 +2325,20 @@ static FILE *open_output_file(cv4l_fd &fd)
 		fprintf(stderr, "could not connect\n");
 		std::exit(EXIT_SUCCESS);
 	}
+	if (host_motion_range && !host_lossless) {
+		__u32 caps;
+
+		if (v4l_stream_read_caps(host_fd_to, V4L_STREAM_CAPS_TIMEOUT, &caps) ||
+		    !(caps & V4L_STREAM_CAP_FWHT_MOTION)) {
+			fprintf(stderr, "%s can't decode motion vectors, drop motion= from --stream-to-host-fwht\n",
+				host_to);
+			std::exit(EXIT_FAILURE);
+		}
+	}
 	fout = fdopen(host_fd_to, "a");
 	write_u32(fout, V4L_STREAM_ID);
 	write_u32(fout, V4L_STREAM_VERSION);
+fmt:
 	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
 	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
 	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
@@ -1734,16 +2360,12 @@ static FILE *open_output_file(cv4l_fd &fd)
 		write_u32(fout, cfmt.g_bytesperline(i));
 		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
 	}
-	if (!host_lossless) {
-		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
-		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
-
-		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
-				 cfmt.g_width(), cfmt.g_height(),
-				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
-	}
-	fflush(fout);
+	if (!host_lossless)
+		ctx = alloc_host_codec(fd, cfmt);
+	if (host_to_udp)
+		host_udp_flush(fout, true);
+	else
+		fflush(fout);
 #endif
 	return fout;
 }
@@ -1853,6 +2475,11 @@ recover:
 	if (use_poll)
 		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
 
+#ifndef NO_STREAM_TO
+	if (host_fd_to >= 0 && host_workers)
+		host_pipe = host_pipeline_start(fd, q);
+#endif
+
 	while (!eos && !source_change) {
 		fd_set read_fds;
 		fd_set exception_fds;
@@ -1907,6 +2534,12 @@ recover:
 		}
 
 	}
+#ifndef NO_STREAM_TO
+	if (host_pipe) {
+		host_pipeline_stop(host_pipe);
+		host_pipe = nullptr;
+	}
+#endif
 	fd.streamoff();
 	fcntl(fd.g_fd(), F_SETFL, fd_flags);
 	fprintf(stderr, "\n");
@@ -1917,15 +2550,117 @@ recover:
 		goto recover;
 
 done:
+#ifndef NO_STREAM_TO
+	if (host_pipe) {
+		host_pipeline_stop(host_pipe);
+		host_pipe = nullptr;
+	}
+#endif
 	if (options[OptStreamDmaBuf])
 		exp_q.close_exported_fds();
 	if (fout && fout != stdout) {
 		if (host_fd_to >= 0)
 			write_u32(fout, V4L_STREAM_PACKET_END);
+#ifndef NO_STREAM_TO
+		if (host_to_udp) {
+			host_udp_flush(fout, false);
+			host_udp_stats();
+		}
+#endif
 		fclose(fout);
+#ifndef NO_STREAM_TO
+		if (host_to_udp) {
+			free(host_udp_buf);
+			udp_stream_close(&host_udp_to);
+			host_fd_to = -1;
+		}
+#endif
 	}
 }
 
+/*
+ * With --stream-from-host-udp, a thread puts the packets back together and
+ * writes those which can be used to a pipe, as if they were read from a TCP
+ * connection.
+ */
+static void *host_udp_recv_thread(void *arg)
+{
+	FILE *f = static_cast<FILE *>(arg);
+	std::vector<__u8> fmt;
+	sigset_t set;
+
+	/* Stop with EPIPE once the reader is done, rather than be killed */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+	write_u32(f, V4L_STREAM_ID);
+	write_u32(f, V4L_STREAM_VERSION);
+	for (;;) {
+		int size = udp_stream_recv(&host_udp_from);
+		__u32 packet;
+
+		if (size < 0) {
+			fprintf(stderr, "%s: read error: %s\n", __func__,
+				strerror(errno));
+			break;
+		}
+		if (!size)
+			continue;
+
+		memcpy(&packet, host_udp_from.buf, sizeof(packet));
+		packet = ntohl(packet);
+		/* The format is sent again and again, only pass on changes */
+		if (packet == V4L_STREAM_PACKET_FMT_VIDEO) {
+			if (fmt.size() == static_cast<unsigned>(size) &&
+			    !memcmp(fmt.data(), host_udp_from.buf, size))
+				continue;
+			fmt.assign(host_udp_from.buf, host_udp_from.buf + size);
+		}
+		if (fwrite(host_udp_from.buf, 1, size, f) != static_cast<unsigned>(size) ||
+		    fflush(f) || packet == V4L_STREAM_PACKET_END)
+			break;
+	}
+	fclose(f);
+	return nullptr;
+}
+
+static FILE *open_host_udp_input()
+{
+	pthread_t thread;
+	int fds[2];
+	FILE *f;
+
+	if (udp_stream_open(&host_udp_from, host_from, host_port_from,
+			    host_udp_if, host_udp_mtu, false)) {
+		fprintf(stderr, "could not open UDP socket on %s: %s\n",
+			host_from, strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	if (pipe(fds) || !(f = fdopen(fds[1], "w"))) {
+		fprintf(stderr, "could not create pipe\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (pthread_create(&thread, nullptr, host_udp_recv_thread, f)) {
+		fprintf(stderr, "%s: can't create a thread\n", __func__);
+		std::exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+	host_fd_from = fds[0];
+	return fdopen(host_fd_from, "r");
+}
+
+static void host_udp_from_stats()
+{
+	const udp_stream &s = host_udp_from;
+	__u64 total = static_cast<__u64>(s.datagrams) + s.lost;
+
+	fprintf(stderr, "stream-from-host-udp: %u datagrams received, %u lost (%.2f%%), "
+		"%u packets, %u dropped, %u format and %u I-frame requests\n",
+		s.datagrams, s.lost, total ? s.lost * 100.0 / total : 0.0,
+		s.packets, s.dropped, s.fmt_reqs, s.i_frame_reqs);
+}
+
 static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 {
 	FILE *fin = nullptr;
@@ -1950,6 +2685,10 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		host_port_from = strtoul(p + 1, nullptr, 0);
 		*p = '\0';
 	}
+	if (host_from_udp) {
+		fin = open_host_udp_input();
+		goto read_fmt;
+	}
 	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (listen_fd < 0) {
 		fprintf(stderr, "could not opening socket\n");
@@ -1969,7 +2708,12 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 		fprintf(stderr, "could not accept\n");
 		std::exit(EXIT_FAILURE);
 	}
+	if (v4l_stream_send_caps(host_fd_from, V4L_STREAM_CAPS)) {
+		fprintf(stderr, "could not send the capabilities\n");
+		std::exit(EXIT_FAILURE);
+	}
 	fin = fdopen(host_fd_from, "r");
+read_fmt:
 	if (read_u32(fin) != V4L_STREAM_ID) {
 		fprintf(stderr, "unknown protocol ID\n");
 		std::exit(EXIT_FAILURE);
@@ -2030,6 +2774,8 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 			 cfmt.g_width(), cfmt.g_height(),
 			 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
 			 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+	if (ctx)
+		fwht_set_threads(ctx, host_from_threads);
 
 	read_u32(fin); // pixelaspect.numerator
 	read_u32(fin); // pixelaspect.denominator
@@ -2181,6 +2927,8 @@ static void streaming_set_out(cv4l_fd &fd, cv4l_fd &exp_fd)
 done:
 	if (options[OptStreamOutDmaBuf])
 		exp_q.close_exported_fds();
+	if (host_from_udp)
+		host_udp_from_stats();
 	if (fin && fin != stdin)
 		fclose(fin);
 }
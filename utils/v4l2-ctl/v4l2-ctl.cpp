@@ -241,6 +241,9 @@ static struct option long_options[] = {
 	{"stream-to-hdr", required_argument, nullptr, OptStreamToHdr},
 	{"stream-lossless", no_argument, nullptr, OptStreamLossless},
 	{"stream-to-host", required_argument, nullptr, OptStreamToHost},
+	{"stream-to-host-workers", required_argument, nullptr, OptStreamToHostWorkers},
+	{"stream-to-host-fwht", required_argument, nullptr, OptStreamToHostFwht},
+	{"stream-to-host-udp", required_argument, nullptr, OptStreamToHostUdp},
 #endif
 	{"stream-buf-caps", no_argument, nullptr, OptStreamBufCaps},
 	{"stream-show-delta-now", no_argument, nullptr, OptStreamShowDeltaNow},
@@ -250,6 +253,9 @@ static struct option long_options[] = {
 	{"stream-from", required_argument, nullptr, OptStreamFrom},
 	{"stream-from-hdr", required_argument, nullptr, OptStreamFromHdr},
 	{"stream-from-host", required_argument, nullptr, OptStreamFromHost},
+	{"stream-from-host-udp", required_argument, nullptr, OptStreamFromHostUdp},
+	{"stream-from-host-threads", required_argument, nullptr, OptStreamFromHostThreads},
+	{"stream-host-udp", required_argument, nullptr, OptStreamHostUdp},
 	{"stream-out-pattern", required_argument, nullptr, OptStreamOutPattern},
 	{"stream-out-square", no_argument, nullptr, OptStreamOutSquare},
 	{"stream-out-border", no_argument, nullptr, OptStreamOutBorder},
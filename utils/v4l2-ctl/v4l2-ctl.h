@@ -222,6 +222,9 @@ enum Option {
 	OptStreamToHdr,
 	OptStreamToHost,
 	OptStreamLossless,
+	OptStreamToHostWorkers,
+	OptStreamToHostFwht,
+	OptStreamToHostUdp,
 	OptStreamShowDeltaNow,
 	OptStreamBufCaps,
 	OptStreamMmap,
@@ -230,6 +233,9 @@ enum Option {
 	OptStreamFrom,
 	OptStreamFromHdr,
 	OptStreamFromHost,
+	OptStreamFromHostUdp,
+	OptStreamFromHostThreads,
+	OptStreamHostUdp,
 	OptStreamOutPattern,
 	OptStreamOutSquare,
 	OptStreamOutBorder,